@@ -0,0 +1,490 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/allocation_planner.h"
+
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+namespace tensorflow {
+
+namespace {
+
+// Every slot starts at a multiple of this, which is what the BFC allocator
+// guarantees as well.
+const size_t kSlotAlignment = 256;
+
+size_t RoundUpToSlot(size_t bytes)
+{
+    return (bytes + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+}
+
+} // namespace
+
+class AllocationPlanner::NodeAllocator : public Allocator {
+ public:
+  NodeAllocator(AllocationPlanner* planner, int id) : planner_(planner), id_(id) {}
+
+  string Name() override { return planner_->base_->Name(); }
+
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override
+  {
+      return planner_->Allocate(id_, alignment, num_bytes, AllocationAttributes());
+  }
+
+  void* AllocateRaw(size_t alignment, size_t num_bytes,
+                    const AllocationAttributes& allocation_attr) override
+  {
+      return planner_->Allocate(id_, alignment, num_bytes, allocation_attr);
+  }
+
+  void DeallocateRaw(void* ptr) override { planner_->Deallocate(ptr); }
+
+  void GetStats(AllocatorStats* stats) override { planner_->base_->GetStats(stats); }
+
+ private:
+  AllocationPlanner* const planner_;
+  const int id_;
+};
+
+int AllocationPlanner::Plan::SlotOf(int node, int index, size_t num_bytes) const
+{
+    const auto& indices = node_slots[node];
+    if (index >= static_cast<int>(indices.size())) {
+        return -1;
+    }
+    const int slot = indices[index];
+    if (slot < 0 || slots[slot].bytes != RoundUpToSlot(num_bytes)) {
+        return -1;
+    }
+    return slot;
+}
+
+AllocationPlanner::Arena::Arena(std::shared_ptr<const Plan> plan, char* base, size_t bytes)
+    : plan(std::move(plan))
+    , base(base)
+    , bytes(bytes)
+    , occupied(new std::atomic<bool>[this->plan->slots.size()])
+    , owner(new std::atomic<int>[this->plan->offsets.size()])
+{
+    for (size_t i = 0; i < this->plan->slots.size(); ++i) {
+        occupied[i].store(false, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < this->plan->offsets.size(); ++i) {
+        owner[i].store(-1, std::memory_order_relaxed);
+    }
+}
+
+void* AllocationPlanner::Arena::Claim(int slot)
+{
+    // Two steps claiming overlapping slots at once may both give up, which
+    // only costs a fallback to the base allocator.
+    bool expected = false;
+    if (!occupied[slot].compare_exchange_strong(expected, true)) {
+        return nullptr;
+    }
+    const Slot& s = plan->slots[slot];
+    for (int other : s.overlaps) {
+        if (occupied[other].load()) {
+            occupied[slot].store(false);
+            return nullptr;
+        }
+    }
+    owner[s.offset_index].store(slot, std::memory_order_relaxed);
+    num_live.fetch_add(1, std::memory_order_relaxed);
+    return base + s.offset;
+}
+
+bool AllocationPlanner::Arena::Release(void* ptr)
+{
+    auto p = static_cast<char*>(ptr);
+    // A released arena's memory may have been handed out again by the base
+    // allocator.
+    if (p < base || p >= base + bytes || released.load(std::memory_order_acquire)) {
+        return false;
+    }
+    const size_t offset = p - base;
+    const auto& offsets = plan->offsets;
+    const int index = std::lower_bound(offsets.begin(), offsets.end(), offset) - offsets.begin();
+    DCHECK(index < static_cast<int>(offsets.size()) && offsets[index] == offset)
+        << "Freeing unknown pointer " << ptr << " in arena";
+    const int slot = owner[index].exchange(-1, std::memory_order_relaxed);
+    DCHECK_GE(slot, 0) << "Freeing unknown pointer " << ptr << " in arena";
+    occupied[slot].store(false);
+    // Nothing of the arena may be touched after this.
+    num_live.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+AllocationPlanner::AllocationPlanner(Allocator* base, int num_nodes, int trace_steps)
+    : base_(base)
+    , num_nodes_(num_nodes)
+    , trace_steps_(std::max(trace_steps, 1))
+    , node_counts_(new std::atomic<int>[num_nodes])
+{
+    nodes_.reserve(num_nodes);
+    for (int i = 0; i < num_nodes; ++i) {
+        nodes_.emplace_back(new NodeAllocator(this, i));
+        node_counts_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+AllocationPlanner::~AllocationPlanner()
+{
+    // Every allocation holds a reference, so all arenas are empty by now.
+    for (const auto& arena : arenas_) {
+        if (!arena->released.load(std::memory_order_relaxed)) {
+            DCHECK_EQ(0, arena->num_live.load());
+            base_->DeallocateRaw(arena->base);
+        }
+    }
+}
+
+Allocator* AllocationPlanner::ForNode(int id)
+{
+    return nodes_[id].get();
+}
+
+void AllocationPlanner::ReleaseArena(Arena* arena)
+{
+    arena->released.store(true, std::memory_order_release);
+    base_->DeallocateRaw(arena->base);
+}
+
+bool AllocationPlanner::BeginStep()
+{
+    mutex_lock l(mu_);
+    if (in_step_ || state_ == State::kDisabled) {
+        return false;
+    }
+    in_step_ = true;
+    for (int i = 0; i < num_nodes_; ++i) {
+        node_counts_[i].store(0, std::memory_order_relaxed);
+    }
+    ReleaseRetired();
+
+    if (state_ == State::kTracing) {
+        tracing_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    Arena* arena = arena_.load(std::memory_order_relaxed);
+    if (state_ == State::kPlanned && (!arena || arena->plan != plan_ || arena->num_live.load() > 0)) {
+        if (arena) {
+            if (arena->num_live.load() > 0) {
+                // Allocations from an earlier step are still alive.
+                num_retired_.fetch_add(1, std::memory_order_release);
+            } else {
+                ReleaseArena(arena);
+            }
+        }
+        auto base = static_cast<char*>(base_->AllocateRaw(kSlotAlignment, plan_bytes_));
+        if (!base) {
+            LOG(WARNING) << "Failed to allocate arena of " << plan_bytes_
+                         << " bytes for the allocation plan, disabling it";
+            arena_.store(nullptr, std::memory_order_release);
+            plan_.reset();
+            state_ = State::kDisabled;
+            return true;
+        }
+        arenas_.emplace_back(new Arena(plan_, base, plan_bytes_));
+        arena_.store(arenas_.back().get(), std::memory_order_release);
+    }
+    step_arena_.store(arena_.load(std::memory_order_relaxed), std::memory_order_release);
+    return true;
+}
+
+void AllocationPlanner::EndStep()
+{
+    mutex_lock l(mu_);
+    DCHECK(in_step_);
+    in_step_ = false;
+    step_arena_.store(nullptr, std::memory_order_release);
+    tracing_.store(false, std::memory_order_release);
+
+    Arena* arena = arena_.load(std::memory_order_relaxed);
+    if (state_ == State::kTracing) {
+        // Whatever is still in traced_live_ outlives the step, and keeps
+        // end == -1.
+        traced_live_.clear();
+        traces_.push_back(std::move(trace_));
+        trace_.clear();
+        clock_ = 0;
+        if (traces_.size() >= static_cast<size_t>(trace_steps_)) {
+            BuildPlan();
+        }
+    } else if (state_ == State::kPlanned && arena && arena->num_live.load() > 0) {
+        // Don't plan allocations that turned out to outlive the step. The
+        // arena keeps the plan it was laid out for.
+        std::unique_ptr<Plan> plan(new Plan(*plan_));
+        int num_outlived = 0;
+        for (auto& indices : plan->node_slots) {
+            for (auto& slot : indices) {
+                if (slot >= 0 && arena->occupied[slot].load()) {
+                    slot = -1;
+                    --plan->num_planned;
+                    ++num_outlived;
+                }
+            }
+        }
+        VLOG(1) << num_outlived << " planned allocations outlived the step";
+        plan_ = std::move(plan);
+        if (plan_->num_planned == 0) {
+            VLOG(1) << "Allocation plan is empty, disabling it";
+            num_retired_.fetch_add(1, std::memory_order_release);
+            arena_.store(nullptr, std::memory_order_release);
+            plan_.reset();
+            state_ = State::kDisabled;
+        }
+    }
+}
+
+void AllocationPlanner::BuildPlan()
+{
+    // An allocation is planned if it has the same key and slot size in all
+    // traces, and never outlived a step. Its lifetime covers all the traces.
+    struct Interval {
+        uint64 key;
+        size_t bytes;
+        int64 start;
+        int64 end;
+        size_t count;
+    };
+    std::unordered_map<uint64, Interval> intervals;
+    std::unordered_set<uint64> unstable;
+    for (const auto& trace : traces_) {
+        for (const auto& e : trace) {
+            if (unstable.count(e.key)) {
+                continue;
+            }
+            const size_t bytes = RoundUpToSlot(e.bytes);
+            auto it = intervals.find(e.key);
+            if (e.end < 0 || (it != intervals.end() && it->second.bytes != bytes)) {
+                unstable.insert(e.key);
+                intervals.erase(e.key);
+                continue;
+            }
+            if (it == intervals.end()) {
+                intervals.emplace(e.key, Interval{e.key, bytes, e.start, e.end, 1});
+            } else {
+                it->second.start = std::min(it->second.start, e.start);
+                it->second.end = std::max(it->second.end, e.end);
+                ++it->second.count;
+            }
+        }
+    }
+
+    std::vector<Interval> sorted;
+    for (const auto& it : intervals) {
+        if (it.second.count == traces_.size()) {
+            sorted.push_back(it.second);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Interval& a, const Interval& b) {
+        if (a.bytes != b.bytes) {
+            return a.bytes > b.bytes;
+        }
+        return a.start < b.start;
+    });
+
+    // First fit among the already placed intervals alive at the same time.
+    std::unique_ptr<Plan> plan(new Plan);
+    plan->node_slots.resize(num_nodes_);
+    std::vector<int> conflicts;
+    size_t total = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const auto& iv = sorted[i];
+        conflicts.clear();
+        for (size_t j = 0; j < i; ++j) {
+            if (sorted[j].start < iv.end && iv.start < sorted[j].end) {
+                conflicts.push_back(j);
+            }
+        }
+        std::sort(conflicts.begin(), conflicts.end(), [&plan](int a, int b) {
+            return plan->slots[a].offset < plan->slots[b].offset;
+        });
+        size_t offset = 0;
+        for (int c : conflicts) {
+            const Slot& slot = plan->slots[c];
+            if (offset + iv.bytes <= slot.offset) {
+                break;
+            }
+            offset = std::max(offset, slot.offset + slot.bytes);
+        }
+        plan->slots.push_back(Slot{offset, iv.bytes, 0, {}});
+        total = std::max(total, offset + iv.bytes);
+
+        const int node = static_cast<int>(iv.key >> 32);
+        const int index = static_cast<int>(static_cast<uint32>(iv.key));
+        auto& indices = plan->node_slots[node];
+        if (index >= static_cast<int>(indices.size())) {
+            indices.resize(index + 1, -1);
+        }
+        indices[index] = i;
+    }
+    plan->num_planned = plan->slots.size();
+
+    // Slots sharing bytes, which only happens for allocations alive at
+    // different times, must not be taken at once when a step runs in another
+    // order.
+    for (size_t i = 0; i < plan->slots.size(); ++i) {
+        plan->offsets.push_back(plan->slots[i].offset);
+        for (size_t j = i + 1; j < plan->slots.size(); ++j) {
+            auto& a = plan->slots[i];
+            auto& b = plan->slots[j];
+            if (a.offset < b.offset + b.bytes && b.offset < a.offset + a.bytes) {
+                a.overlaps.push_back(j);
+                b.overlaps.push_back(i);
+            }
+        }
+    }
+    std::sort(plan->offsets.begin(), plan->offsets.end());
+    plan->offsets.erase(std::unique(plan->offsets.begin(), plan->offsets.end()),
+                        plan->offsets.end());
+    for (auto& slot : plan->slots) {
+        slot.offset_index = std::lower_bound(plan->offsets.begin(), plan->offsets.end(), slot.offset)
+                            - plan->offsets.begin();
+    }
+
+    size_t traced_bytes = 0;
+    for (const auto& e : traces_.back()) {
+        traced_bytes += e.bytes;
+    }
+    traces_.clear();
+
+    if (plan->slots.empty()) {
+        VLOG(1) << "No stable allocations to plan, disabling allocation plan";
+        state_ = State::kDisabled;
+        return;
+    }
+    VLOG(1) << "Planned " << plan->slots.size() << " allocations in an arena of "
+            << strings::HumanReadableNumBytes(total) << ", last traced step allocated "
+            << strings::HumanReadableNumBytes(traced_bytes) << " in total";
+    plan_ = std::move(plan);
+    plan_bytes_ = total;
+    state_ = State::kPlanned;
+}
+
+void* AllocationPlanner::Allocate(int node, size_t alignment, size_t num_bytes,
+                                  const AllocationAttributes& allocation_attr)
+{
+    const int index = node_counts_[node].fetch_add(1, std::memory_order_relaxed);
+
+    // Every slot is aligned to kSlotAlignment, and so is the arena.
+    Arena* arena = step_arena_.load(std::memory_order_acquire);
+    if (arena && alignment <= kSlotAlignment) {
+        const int slot = arena->plan->SlotOf(node, index, num_bytes);
+        void* ptr = slot >= 0 ? arena->Claim(slot) : nullptr;
+        if (ptr) {
+            num_planned_.fetch_add(1, std::memory_order_relaxed);
+            Ref();
+            return ptr;
+        }
+        num_unplanned_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto ptr = base_->AllocateRaw(alignment, num_bytes, allocation_attr);
+    if (!ptr) {
+        return nullptr;
+    }
+    Ref();
+
+    if (tracing_.load(std::memory_order_acquire)) {
+        mutex_lock l(mu_);
+        if (in_step_ && state_ == State::kTracing) {
+            traced_live_[ptr] = trace_.size();
+            trace_.push_back(TraceEntry{MakeKey(node, index), num_bytes, clock_++, -1});
+        }
+    }
+    return ptr;
+}
+
+void AllocationPlanner::Deallocate(void* ptr)
+{
+    Arena* arena = arena_.load(std::memory_order_acquire);
+    if (arena && arena->Release(ptr)) {
+        // May delete this.
+        Unref();
+        return;
+    }
+
+    bool fromArena = false;
+    if (num_retired_.load(std::memory_order_acquire) > 0 || tracing_.load(std::memory_order_acquire)) {
+        mutex_lock l(mu_);
+        fromArena = DeallocateToArenas(ptr);
+        if (!fromArena) {
+            auto it = traced_live_.find(ptr);
+            if (it != traced_live_.end()) {
+                trace_[it->second].end = clock_++;
+                traced_live_.erase(it);
+            }
+        }
+    }
+    if (!fromArena) {
+        base_->DeallocateRaw(ptr);
+    }
+    // May delete this.
+    Unref();
+}
+
+bool AllocationPlanner::DeallocateToArenas(void* ptr)
+{
+    bool found = false;
+    for (const auto& arena : arenas_) {
+        if (arena->Release(ptr)) {
+            found = true;
+            break;
+        }
+    }
+    ReleaseRetired();
+    return found;
+}
+
+void AllocationPlanner::ReleaseRetired()
+{
+    if (num_retired_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    Arena* current = arena_.load(std::memory_order_relaxed);
+    for (const auto& arena : arenas_) {
+        if (arena.get() != current && !arena->released.load(std::memory_order_relaxed)
+            && arena->num_live.load() == 0) {
+            ReleaseArena(arena.get());
+            num_retired_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+}
+
+size_t AllocationPlanner::plan_bytes() const
+{
+    mutex_lock l(mu_);
+    return plan_bytes_;
+}
+
+int64 AllocationPlanner::num_planned() const
+{
+    return num_planned_.load(std::memory_order_relaxed);
+}
+
+bool AllocationPlanner::disabled() const
+{
+    mutex_lock l(mu_);
+    return state_ == State::kDisabled;
+}
+
+}  // namespace tensorflow
@@ -0,0 +1,193 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMMON_RUNTIME_ALLOCATION_PLANNER_H_
+#define TENSORFLOW_COMMON_RUNTIME_ALLOCATION_PLANNER_H_
+
+#include "tensorflow/core/framework/allocator.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace tensorflow {
+
+// Serves the allocations of a step from a single arena laid out ahead of
+// time, for graphs that allocate the same sizes in the same order every step.
+//
+// The first `trace_steps` steps are traced: each allocation is keyed by the
+// node making it and its index among that node's allocations in the step,
+// and its lifetime recorded. Allocations with the same key and size in all
+// traced steps, and freed before the step ended, are then given fixed offsets
+// in one arena by first-fit interval coloring, largest first. Later steps
+// take matching allocations from the arena and everything else from the base
+// allocator. An allocation whose slot is still occupied, because this step
+// happened to run in a different order, also falls back to the base
+// allocator, so the plan is only ever an optimization.
+//
+// Allocations and deallocations of planned steps take no lock.
+//
+// One step at a time uses the planner; BeginStep returns false for steps
+// that overlap with it, which then should use the base allocator directly.
+//
+// Outstanding allocations hold a reference, so tensors may outlive both the
+// step and the owner of the planner.
+class AllocationPlanner : public core::RefCounted {
+ public:
+  // Does not take ownership of base.
+  AllocationPlanner(Allocator* base, int num_nodes, int trace_steps);
+
+  bool BeginStep();
+  void EndStep();
+
+  // The allocator for node `id` in the step started by BeginStep.
+  Allocator* ForNode(int id);
+
+  // Bytes of the arena, 0 if there is no plan (yet).
+  size_t plan_bytes() const;
+
+  // Number of allocations served from the arena so far.
+  int64 num_planned() const;
+
+  // Whether the planner gave up, because no allocation was stable across
+  // the traced steps or the arena could not be allocated.
+  bool disabled() const;
+
+ private:
+  class NodeAllocator;
+
+  enum class State { kTracing, kPlanned, kDisabled };
+
+  // An allocation seen while tracing. end is -1 if it outlived the step.
+  struct TraceEntry {
+    uint64 key;
+    size_t bytes;
+    int64 start;
+    int64 end;
+  };
+  typedef std::vector<TraceEntry> Trace;
+
+  struct Slot {
+    size_t offset;
+    size_t bytes;
+    // Index of offset in Plan::offsets.
+    int offset_index;
+    // Slots sharing some bytes of the arena with this one.
+    std::vector<int> overlaps;
+  };
+
+  // Never changed once built, so planned steps read it without locking.
+  struct Plan {
+    std::vector<Slot> slots;
+    // Slot of each allocation by node and index, -1 if not planned.
+    std::vector<std::vector<int>> node_slots;
+    // Distinct offsets of the slots, sorted.
+    std::vector<size_t> offsets;
+    int num_planned = 0;
+
+    // -1 if the allocation is not planned with that size.
+    int SlotOf(int node, int index, size_t num_bytes) const;
+  };
+
+  // Planned allocations are taken from the arena without locking. A slot is
+  // claimed by setting its occupied flag, and given up again if an
+  // overlapping slot turns out to be occupied as well.
+  //
+  // Arenas are only deleted with the planner, and their memory is released
+  // once they are no longer used and empty, so that a deallocation racing
+  // with the start of the next step can still look at them.
+  struct Arena {
+    Arena(std::shared_ptr<const Plan> plan, char* base, size_t bytes);
+
+    const std::shared_ptr<const Plan> plan;
+    char* const base;
+    const size_t bytes;
+    // By slot.
+    std::unique_ptr<std::atomic<bool>[]> occupied;
+    // The slot occupying each of plan->offsets, -1 if none.
+    std::unique_ptr<std::atomic<int>[]> owner;
+    std::atomic<int64> num_live{0};
+    std::atomic<bool> released{false};
+
+    void* Claim(int slot);
+    // Returns false if ptr is not from this arena.
+    bool Release(void* ptr);
+  };
+
+  ~AllocationPlanner() override;
+
+  void* Allocate(int node, size_t alignment, size_t num_bytes,
+                 const AllocationAttributes& allocation_attr);
+  void Deallocate(void* ptr);
+
+  // Returns false if ptr is not from any arena.
+  bool DeallocateToArenas(void* ptr) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Releases the memory of retired arenas which became empty.
+  void ReleaseRetired() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void ReleaseArena(Arena* arena) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  void BuildPlan() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  static uint64 MakeKey(int node, int index)
+  {
+      return (static_cast<uint64>(node) << 32) | static_cast<uint32>(index);
+  }
+
+  Allocator* const base_;
+  const int num_nodes_;
+  const int trace_steps_;
+  std::vector<std::unique_ptr<NodeAllocator>> nodes_;
+
+  // Number of allocations each node made so far in the current step.
+  std::unique_ptr<std::atomic<int>[]> node_counts_;
+
+  // The arena of the current planned step, null otherwise.
+  std::atomic<Arena*> step_arena_{nullptr};
+  // The arena laid out last, which may still have live allocations.
+  std::atomic<Arena*> arena_{nullptr};
+  // Number of earlier arenas with live allocations.
+  std::atomic<int> num_retired_{0};
+  // Whether the current step is traced.
+  std::atomic<bool> tracing_{false};
+
+  std::atomic<int64> num_planned_{0};
+  std::atomic<int64> num_unplanned_{0};
+
+  mutable mutex mu_;
+  State state_ GUARDED_BY(mu_) = State::kTracing;
+  bool in_step_ GUARDED_BY(mu_) = false;
+
+  // Tracing.
+  int64 clock_ GUARDED_BY(mu_) = 0;
+  Trace trace_ GUARDED_BY(mu_);
+  std::unordered_map<void*, size_t> traced_live_ GUARDED_BY(mu_);
+  std::vector<Trace> traces_ GUARDED_BY(mu_);
+
+  // Planned.
+  std::shared_ptr<const Plan> plan_ GUARDED_BY(mu_);
+  size_t plan_bytes_ GUARDED_BY(mu_) = 0;
+  // Every arena laid out so far, the last one is arena_.
+  std::vector<std::unique_ptr<Arena>> arenas_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AllocationPlanner);
+};
+
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_COMMON_RUNTIME_ALLOCATION_PLANNER_H_
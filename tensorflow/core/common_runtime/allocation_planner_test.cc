@@ -0,0 +1,254 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/allocation_planner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace {
+
+// Counts the calls reaching the cpu allocator.
+class CountingAllocator : public Allocator {
+ public:
+  string Name() override { return "counting"; }
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override {
+    ++num_allocs;
+    return cpu_allocator()->AllocateRaw(alignment, num_bytes);
+  }
+  void DeallocateRaw(void* ptr) override {
+    ++num_deallocs;
+    cpu_allocator()->DeallocateRaw(ptr);
+  }
+
+  int num_allocs = 0;
+  int num_deallocs = 0;
+};
+
+// Node 0 and node 2 allocate one after another, node 1 in between.
+void RunStep(AllocationPlanner* planner, std::vector<void*>* ptrs) {
+  ASSERT_TRUE(planner->BeginStep());
+  ptrs->clear();
+  void* a = planner->ForNode(0)->AllocateRaw(32, 1000);
+  void* b = planner->ForNode(1)->AllocateRaw(32, 2000);
+  planner->ForNode(0)->DeallocateRaw(a);
+  void* c = planner->ForNode(2)->AllocateRaw(32, 1000);
+  planner->ForNode(1)->DeallocateRaw(b);
+  planner->ForNode(2)->DeallocateRaw(c);
+  *ptrs = {a, b, c};
+  planner->EndStep();
+}
+
+TEST(AllocationPlannerTest, ReusesSlotsAfterTracing) {
+  CountingAllocator base;
+  auto planner = new AllocationPlanner(&base, 3, 2);
+  core::ScopedUnref unref(planner);
+
+  std::vector<void*> ptrs;
+  RunStep(planner, &ptrs);
+  RunStep(planner, &ptrs);
+  EXPECT_EQ(6, base.num_allocs);
+  // a and c can share a slot.
+  EXPECT_EQ(3072, planner->plan_bytes());
+
+  RunStep(planner, &ptrs);
+  RunStep(planner, &ptrs);
+  // Only the arena.
+  EXPECT_EQ(7, base.num_allocs);
+  EXPECT_EQ(6, planner->num_planned());
+  EXPECT_EQ(ptrs[0], ptrs[2]);
+  EXPECT_NE(ptrs[0], ptrs[1]);
+}
+
+TEST(AllocationPlannerTest, FallsBackWhenPlanDoesNotMatch) {
+  CountingAllocator base;
+  auto planner = new AllocationPlanner(&base, 3, 1);
+  core::ScopedUnref unref(planner);
+
+  std::vector<void*> ptrs;
+  RunStep(planner, &ptrs);
+  const int allocs = base.num_allocs;
+  const int deallocs = base.num_deallocs;
+  ASSERT_TRUE(planner->BeginStep());
+
+  void* a = planner->ForNode(0)->AllocateRaw(32, 1000);
+  // Another size.
+  void* b = planner->ForNode(1)->AllocateRaw(32, 3000);
+  // Planned, but its slot is still taken by a.
+  void* c = planner->ForNode(2)->AllocateRaw(32, 1000);
+  EXPECT_EQ(1, planner->num_planned());
+  EXPECT_EQ(allocs + 3, base.num_allocs);  // The arena, b and c
+
+  planner->ForNode(0)->DeallocateRaw(a);
+  planner->ForNode(1)->DeallocateRaw(b);
+  planner->ForNode(2)->DeallocateRaw(c);
+  planner->EndStep();
+  EXPECT_EQ(deallocs + 2, base.num_deallocs);
+}
+
+TEST(AllocationPlannerTest, SkipsAllocationsOutlivingTheStep) {
+  CountingAllocator base;
+  auto planner = new AllocationPlanner(&base, 2, 1);
+  core::ScopedUnref unref(planner);
+
+  ASSERT_TRUE(planner->BeginStep());
+  void* kept = planner->ForNode(0)->AllocateRaw(32, 1000);
+  void* temp = planner->ForNode(1)->AllocateRaw(32, 1000);
+  planner->ForNode(1)->DeallocateRaw(temp);
+  planner->EndStep();
+  planner->ForNode(0)->DeallocateRaw(kept);
+
+  EXPECT_EQ(1024, planner->plan_bytes());
+}
+
+TEST(AllocationPlannerTest, DisabledWithoutStableAllocations) {
+  CountingAllocator base;
+  auto planner = new AllocationPlanner(&base, 1, 1);
+  core::ScopedUnref unref(planner);
+
+  ASSERT_TRUE(planner->BeginStep());
+  void* kept = planner->ForNode(0)->AllocateRaw(32, 1000);
+  planner->EndStep();
+  planner->ForNode(0)->DeallocateRaw(kept);
+
+  EXPECT_TRUE(planner->disabled());
+  EXPECT_FALSE(planner->BeginStep());
+}
+
+TEST(AllocationPlannerTest, OneStepAtATime) {
+  CountingAllocator base;
+  auto planner = new AllocationPlanner(&base, 1, 2);
+  core::ScopedUnref unref(planner);
+
+  EXPECT_TRUE(planner->BeginStep());
+  EXPECT_FALSE(planner->BeginStep());
+  planner->EndStep();
+  EXPECT_TRUE(planner->BeginStep());
+  planner->EndStep();
+}
+
+TEST(AllocationPlannerTest, AllocationsOutliveThePlanner) {
+  CountingAllocator base;
+  auto planner = new AllocationPlanner(&base, 3, 1);
+
+  std::vector<void*> ptrs;
+  RunStep(planner, &ptrs);
+  ASSERT_TRUE(planner->BeginStep());
+  Allocator* node = planner->ForNode(1);
+  void* b = node->AllocateRaw(32, 2000);
+  planner->EndStep();
+  planner->Unref();
+
+  // Still planned, and the arena goes away with it.
+  node->DeallocateRaw(b);
+  EXPECT_EQ(base.num_allocs, base.num_deallocs);
+}
+
+TEST(AllocationPlannerTest, AlignsSlotsToTheArena) {
+  CountingAllocator base;
+  auto planner = new AllocationPlanner(&base, 2, 1);
+  core::ScopedUnref unref(planner);
+
+  for (int step = 0; step < 2; ++step) {
+    ASSERT_TRUE(planner->BeginStep());
+    void* a = planner->ForNode(0)->AllocateRaw(256, 100);
+    void* b = planner->ForNode(1)->AllocateRaw(256, 100);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(a) % 256);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(b) % 256);
+    planner->ForNode(0)->DeallocateRaw(a);
+    planner->ForNode(1)->DeallocateRaw(b);
+    planner->EndStep();
+  }
+  EXPECT_EQ(2, planner->num_planned());
+}
+
+TEST(AllocationPlannerTest, OverlappingSlotsFromManyThreads) {
+  const int kNodes = 32;
+  const int kThreads = 8;
+  auto planner = new AllocationPlanner(cpu_allocator(), kNodes, 1);
+  core::ScopedUnref unref(planner);
+
+  // Traced one node after the other, so all slots share the same bytes.
+  ASSERT_TRUE(planner->BeginStep());
+  for (int n = 0; n < kNodes; ++n) {
+    Allocator* node = planner->ForNode(n);
+    node->DeallocateRaw(node->AllocateRaw(32, 4096));
+  }
+  planner->EndStep();
+  ASSERT_EQ(4096, planner->plan_bytes());
+
+  // Running them at once, only one at a time may get the slot.
+  std::atomic<int> overwritten(0);
+  for (int step = 0; step < 20; ++step) {
+    ASSERT_TRUE(planner->BeginStep());
+    {
+      thread::ThreadPool pool(Env::Default(), "test", kThreads);
+      for (int n = 0; n < kNodes; ++n) {
+        pool.Schedule([planner, n, &overwritten]() {
+          Allocator* node = planner->ForNode(n);
+          auto ptr = static_cast<int*>(node->AllocateRaw(32, 4096));
+          std::fill(ptr, ptr + 1024, n);
+          Env::Default()->SleepForMicroseconds(100);
+          if (std::count(ptr, ptr + 1024, n) != 1024) {
+            ++overwritten;
+          }
+          node->DeallocateRaw(ptr);
+        });
+      }
+    }
+    planner->EndStep();
+  }
+  EXPECT_EQ(0, overwritten);
+  EXPECT_GT(planner->num_planned(), 0);
+}
+
+static void BM_Step(int iters, int plan_steps) {
+  const int kNodes = 64;
+  CountingAllocator base;
+  auto planner = new AllocationPlanner(&base, kNodes, plan_steps);
+  core::ScopedUnref unref(planner);
+
+  std::vector<void*> ptrs(kNodes);
+  for (int i = 0; i < iters; ++i) {
+    if (plan_steps == 0 || !planner->BeginStep()) {
+      for (int n = 0; n < kNodes; ++n) {
+        ptrs[n] = base.AllocateRaw(32, 1024 * (n + 1));
+      }
+      for (int n = 0; n < kNodes; ++n) {
+        base.DeallocateRaw(ptrs[n]);
+      }
+      continue;
+    }
+    for (int n = 0; n < kNodes; ++n) {
+      ptrs[n] = planner->ForNode(n)->AllocateRaw(32, 1024 * (n + 1));
+    }
+    for (int n = 0; n < kNodes; ++n) {
+      planner->ForNode(n)->DeallocateRaw(ptrs[n]);
+    }
+    planner->EndStep();
+  }
+  testing::ItemsProcessed(static_cast<int64>(iters) * kNodes);
+}
+BENCHMARK(BM_Step)->Arg(0)->Arg(2);
+
+}  // namespace
+}  // namespace tensorflow
@@ -15,6 +15,10 @@ limitations under the License.
 
 #include "tensorflow/core/common_runtime/bfc_allocator.h"
 
+#include <algorithm>
+#include <functional>
+#include <thread>
+
 #include "tensorflow/core/common_runtime/allocator_retry.h"
 #include "tensorflow/core/lib/core/bits.h"
 #include "tensorflow/core/lib/gtl/stl_util.h"
@@ -28,7 +32,8 @@ limitations under the License.
 namespace tensorflow {
 
 BFCAllocator::BFCAllocator(SubAllocator* sub_allocator, size_t total_memory,
-                           bool allow_growth, const string& name)
+                           bool allow_growth, const string& name,
+                           bool chunk_cache)
     : suballocator_(sub_allocator),
       name_(name),
       free_chunks_list_(kInvalidChunkHandle),
@@ -63,6 +68,11 @@ BFCAllocator::BFCAllocator(SubAllocator* sub_allocator, size_t total_memory,
       CHECK_NE(BinForSize(bin_size * 2), BinFromIndex(b));
     }
   }
+
+  if (chunk_cache) {
+    VLOG(1) << "Enabling chunk cache for " << name_;
+    cache_shards_.reset(new CacheShard[kNumCacheShards]);
+  }
 }
 
 BFCAllocator::~BFCAllocator() {
@@ -80,8 +90,13 @@ BFCAllocator::~BFCAllocator() {
 
 BFCAllocator::Chunk* BFCAllocator::ChunkFromHandle(ChunkHandle h) {
   DCHECK_GE(h, 0);
-  DCHECK_LT(h, static_cast<int>(chunks_.size()));
-  return &(chunks_[h]);
+  DCHECK_LT(h, num_chunks_);
+  return &(chunk_blocks_[h >> kChunkBlockBits][h & (kChunkBlockSize - 1)]);
+}
+
+BFCAllocator::Chunk* BFCAllocator::OwnedChunkFromHandle(ChunkHandle h) {
+  // The block was allocated under lock_ before h was handed out.
+  return &(chunk_blocks_[h >> kChunkBlockBits][h & (kChunkBlockSize - 1)]);
 }
 
 bool BFCAllocator::Extend(size_t rounded_bytes) {
@@ -141,6 +156,19 @@ bool BFCAllocator::Extend(size_t rounded_bytes) {
           << static_cast<void*>(static_cast<char*>(mem_addr) + bytes);
   region_manager_.AddAllocationRegion(mem_addr, bytes);
 
+  // Publish the region for the chunk cache.
+  size_t n = num_published_regions_.load(std::memory_order_relaxed);
+  if (cache_shards_ && n < kMaxPublishedRegions) {
+    for (const auto& region : region_manager_.regions()) {
+      if (region.ptr() == mem_addr) {
+        auto begin = reinterpret_cast<std::uintptr_t>(mem_addr);
+        published_regions_[n] = {begin, begin + bytes, region.handles()};
+        num_published_regions_.store(n + 1, std::memory_order_release);
+        break;
+      }
+    }
+  }
+
   // Create one large chunk for the whole memory space that will
   // be chunked later.
   ChunkHandle h = AllocateChunk();
@@ -174,8 +202,13 @@ BFCAllocator::ChunkHandle BFCAllocator::AllocateChunk() {
     free_chunks_list_ = c->next;
     return h;
   } else {
-    ChunkHandle h = chunks_.size();
-    chunks_.resize(h + 1);
+    ChunkHandle h = num_chunks_;
+    size_t block = h >> kChunkBlockBits;
+    CHECK(block < kMaxChunkBlocks) << "Too many chunks in " << name_;
+    if (!chunk_blocks_[block]) {
+      chunk_blocks_[block].reset(new Chunk[kChunkBlockSize]);
+    }
+    ++num_chunks_;
     return h;
   }
 }
@@ -260,6 +293,13 @@ void* BFCAllocator::AllocateRawInternal(size_t unused_alignment,
   // so all memory addresses are nicely byte aligned.
   size_t rounded_bytes = RoundedBytes(num_bytes);
 
+  if (cache_shards_ && rounded_bytes <= kMaxCachedBytes) {
+    void* ptr = AllocateFromCache(rounded_bytes, num_bytes);
+    if (ptr != nullptr) {
+      return ptr;
+    }
+  }
+
   // The BFC allocator tries to find the best fit first.
   BinNum bin_num = BinNumForSize(rounded_bytes);
 
@@ -269,6 +309,15 @@ void* BFCAllocator::AllocateRawInternal(size_t unused_alignment,
     return ptr;
   }
 
+  // The cached chunks may be enough once coalesced, so try them before
+  // growing.
+  if (cache_shards_ && FlushChunkCache()) {
+    ptr = FindChunkPtr(bin_num, rounded_bytes, num_bytes);
+    if (ptr != nullptr) {
+      return ptr;
+    }
+  }
+
   // Try to extend
   if (Extend(rounded_bytes)) {
     ptr = FindChunkPtr(bin_num, rounded_bytes, num_bytes);
@@ -332,6 +381,9 @@ void* BFCAllocator::FindChunkPtr(BinNum bin_num, size_t rounded_bytes,
             std::max(stats_.max_bytes_in_use, stats_.bytes_in_use);
         stats_.max_alloc_size =
             std::max<std::size_t>(stats_.max_alloc_size, chunk->size);
+        if (cache_shards_) {
+          AddBytesInUse(chunk->size);
+        }
 
         VLOG(4) << "Returning: " << chunk->ptr;
         if (VLOG_IS_ON(4)) {
@@ -382,10 +434,137 @@ void BFCAllocator::SplitChunk(BFCAllocator::ChunkHandle h, size_t num_bytes) {
 
 void BFCAllocator::DeallocateRaw(void* ptr) {
   if (ptr) VLOG(1) << "-0, " << ptr;
+  if (cache_shards_ && ptr && DeallocateToCache(ptr)) {
+    return;
+  }
   DeallocateRawInternal(ptr);
   retry_helper_.NotifyDealloc();
 }
 
+BFCAllocator::CacheShard* BFCAllocator::ShardForCurrentThread() {
+  size_t h = std::hash<std::thread::id>()(std::this_thread::get_id());
+  return &cache_shards_[h % kNumCacheShards];
+}
+
+BFCAllocator::ChunkHandle BFCAllocator::OwnedHandleForPtr(
+    const void* ptr) const {
+  auto p = reinterpret_cast<std::uintptr_t>(ptr);
+  size_t n = num_published_regions_.load(std::memory_order_acquire);
+  for (size_t i = 0; i < n; ++i) {
+    const PublishedRegion& r = published_regions_[i];
+    if (p >= r.begin && p < r.end) {
+      return r.handles[(p - r.begin) >> kMinAllocationBits];
+    }
+  }
+  return kInvalidChunkHandle;
+}
+
+void* BFCAllocator::AllocateFromCache(size_t rounded_bytes, size_t num_bytes) {
+  CacheShard* shard = ShardForCurrentThread();
+  ChunkHandle h;
+  {
+    mutex_lock l(shard->mu);
+    auto& chunks = shard->chunks[rounded_bytes / kMinAllocationSize - 1];
+    if (chunks.empty()) {
+      return nullptr;
+    }
+    h = chunks.back();
+    chunks.pop_back();
+    shard->cached_bytes -= rounded_bytes;
+    ++shard->num_hits;
+  }
+  bytes_cached_ -= rounded_bytes;
+  AddBytesInUse(rounded_bytes);
+
+  Chunk* chunk = OwnedChunkFromHandle(h);
+  chunk->requested_size.store(num_bytes, std::memory_order_relaxed);
+  chunk->allocation_id.store(next_allocation_id_++, std::memory_order_relaxed);
+  return chunk->ptr;
+}
+
+bool BFCAllocator::DeallocateToCache(void* ptr) {
+  ChunkHandle h = OwnedHandleForPtr(ptr);
+  if (h == kInvalidChunkHandle) {
+    return false;
+  }
+  Chunk* chunk = OwnedChunkFromHandle(h);
+  const size_t size = chunk->size;
+  if (size > kMaxCachedBytes) {
+    return false;
+  }
+
+  bytes_in_use_ -= size;
+
+  // Chunks over the limits, freed below without holding the shard lock.
+  std::vector<ChunkHandle> overflow;
+  int64 overflow_bytes = 0;
+  CacheShard* shard = ShardForCurrentThread();
+  {
+    mutex_lock l(shard->mu);
+    auto& chunks = shard->chunks[size / kMinAllocationSize - 1];
+    chunks.push_back(h);
+    shard->cached_bytes += size;
+
+    // Keep the most recently freed half of the class.
+    const size_t max_chunks =
+        std::max<size_t>(4, kMaxCachedBytesPerClass / size);
+    if (chunks.size() > max_chunks) {
+      auto keep = chunks.begin() + chunks.size() / 2;
+      overflow.assign(chunks.begin(), keep);
+      chunks.erase(chunks.begin(), keep);
+      overflow_bytes = overflow.size() * size;
+      shard->cached_bytes -= overflow_bytes;
+    }
+
+    if (shard->cached_bytes > static_cast<int64>(kMaxCachedBytesPerShard)) {
+      for (auto& c : shard->chunks) {
+        overflow.insert(overflow.end(), c.begin(), c.end());
+        c.clear();
+      }
+      overflow_bytes += shard->cached_bytes;
+      shard->cached_bytes = 0;
+    }
+  }
+  bytes_cached_ += size - overflow_bytes;
+
+  if (!overflow.empty()) {
+    {
+      mutex_lock l(lock_);
+      for (ChunkHandle o : overflow) {
+        FreeAndMaybeCoalesce(o);
+      }
+    }
+    retry_helper_.NotifyDealloc();
+  }
+  return true;
+}
+
+bool BFCAllocator::FlushChunkCache() {
+  bool flushed = false;
+  for (size_t i = 0; i < kNumCacheShards; ++i) {
+    CacheShard& shard = cache_shards_[i];
+    mutex_lock l(shard.mu);
+    for (auto& chunks : shard.chunks) {
+      for (ChunkHandle h : chunks) {
+        FreeAndMaybeCoalesce(h);
+        flushed = true;
+      }
+      chunks.clear();
+    }
+    bytes_cached_ -= shard.cached_bytes;
+    shard.cached_bytes = 0;
+  }
+  return flushed;
+}
+
+void BFCAllocator::AddBytesInUse(int64 bytes) {
+  int64 in_use = bytes_in_use_.fetch_add(bytes) + bytes;
+  int64 max = max_bytes_in_use_.load(std::memory_order_relaxed);
+  while (in_use > max &&
+         !max_bytes_in_use_.compare_exchange_weak(max, in_use)) {
+  }
+}
+
 void BFCAllocator::DeallocateRawInternal(void* ptr) {
   if (ptr == nullptr) {
     LOG(ERROR) << "tried to deallocate nullptr";
@@ -396,6 +575,9 @@ void BFCAllocator::DeallocateRawInternal(void* ptr) {
   // Find the chunk from the ptr.
   BFCAllocator::ChunkHandle h = region_manager_.get_handle(ptr);
   CHECK(h != kInvalidChunkHandle);
+  if (cache_shards_) {
+    bytes_in_use_ -= ChunkFromHandle(h)->size;
+  }
 
   // Consider coalescing it.
   FreeAndMaybeCoalesce(h);
@@ -695,12 +877,28 @@ void BFCAllocator::DumpMemoryLog(size_t num_bytes) {
   }
   LOG(INFO) << "Sum Total of in-use chunks: "
             << strings::HumanReadableNumBytes(total_bytes);
-  LOG(INFO) << "Stats: \n" << stats_.DebugString();
+  AllocatorStats stats;
+  GetStatsLocked(&stats);
+  LOG(INFO) << "Stats: \n" << stats.DebugString();
 }
 
 void BFCAllocator::GetStats(AllocatorStats* stats) {
   mutex_lock l(lock_);
+  GetStatsLocked(stats);
+}
+
+void BFCAllocator::GetStatsLocked(AllocatorStats* stats) {
   *stats = stats_;
+  if (cache_shards_) {
+    for (size_t i = 0; i < kNumCacheShards; ++i) {
+      CacheShard& shard = cache_shards_[i];
+      mutex_lock sl(shard.mu);
+      stats->num_allocs += shard.num_hits;
+    }
+    stats->bytes_in_use = bytes_in_use_;
+    stats->max_bytes_in_use = max_bytes_in_use_;
+    stats->bytes_cached = bytes_cached_;
+  }
 }
 
 std::array<BFCAllocator::BinDebugInfo, BFCAllocator::kNumBins>
@@ -17,6 +17,7 @@ limitations under the License.
 #define TENSORFLOW_COMMON_RUNTIME_BFC_ALLOCATOR_H_
 
 #include <array>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -45,8 +46,17 @@ namespace tensorflow {
 class BFCAllocator : public VisitableAllocator {
  public:
   // Takes ownership of sub_allocator.
+  //
+  // If chunk_cache is true, freed chunks of up to kMaxCachedBytes are kept
+  // in a cache in front of the bins, so that freeing and allocating the same
+  // small sizes again does not need lock_. The cache is split into
+  // kNumCacheShards mutex-protected shards picked by thread id, so threads
+  // rarely contend on it. Cached chunks stay in use as far as the bins and
+  // regions are concerned. GetStats reports them as bytes_cached, and leaves
+  // them out of bytes_in_use and max_bytes_in_use.
   BFCAllocator(SubAllocator* sub_allocator, size_t total_memory,
-               bool allow_growth, const string& name);
+               bool allow_growth, const string& name,
+               bool chunk_cache = false);
   ~BFCAllocator() override;
 
   string Name() override { return name_; }
@@ -98,13 +108,16 @@ class BFCAllocator : public VisitableAllocator {
     // fragmentation.  requested_size keeps track of what the client
     // actually wanted so we can understand whether our splitting
     // strategy is efficient.
-    size_t requested_size = 0;
+    //
+    // Atomic because it is set without lock_ when the chunk is handed out
+    // from the chunk cache.
+    std::atomic<size_t> requested_size{0};
 
     // allocation_id is set to -1 when the chunk is not in use. It is assigned a
     // value greater than zero before the chunk is returned from
     // AllocateRaw, and this value is unique among values assigned by
-    // the parent allocator.
-    int64 allocation_id = -1;
+    // the parent allocator. Atomic for the same reason as requested_size.
+    std::atomic<int64> allocation_id{-1};
     void* ptr = nullptr;  // pointer to granted subbuffer.
 
     // If not kInvalidChunkHandle, the memory referred to by 'prev' is directly
@@ -120,7 +133,9 @@ class BFCAllocator : public VisitableAllocator {
     // What bin are we in?
     BinNum bin_num = kInvalidBinNum;
 
-    bool in_use() const { return allocation_id != -1; }
+    bool in_use() const {
+      return allocation_id.load(std::memory_order_relaxed) != -1;
+    }
 
     string DebugString(BFCAllocator* a,
                        bool recurse) NO_THREAD_SAFETY_ANALYSIS {
@@ -209,6 +224,7 @@ class BFCAllocator : public VisitableAllocator {
     void* ptr() const { return ptr_; }
     void* end_ptr() const { return end_ptr_; }
     size_t memory_size() const { return memory_size_; }
+    const ChunkHandle* handles() const { return handles_; }
     ChunkHandle get_handle(const void* p) const {
       return handles_[IndexFor(p)];
     }
@@ -345,6 +361,54 @@ class BFCAllocator : public VisitableAllocator {
 
   Chunk* ChunkFromHandle(ChunkHandle h) EXCLUSIVE_LOCKS_REQUIRED(lock_);
 
+  // Chunk cache.
+  //
+  // Cached chunks are never split or merged, so their handle, ptr and size
+  // can be read without lock_ by whoever holds them.
+  static const size_t kMaxCachedBytes = 64 << 10;
+  static const size_t kNumCacheClasses = kMaxCachedBytes / kMinAllocationSize;
+  static const size_t kNumCacheShards = 16;
+  // Bound on the bytes held by one size class and by a whole shard, beyond
+  // which chunks are flushed back to the bins.
+  static const size_t kMaxCachedBytesPerClass = 256 << 10;
+  static const size_t kMaxCachedBytesPerShard = 2 << 20;
+
+  struct CacheShard {
+    mutex mu;
+    // Free lists of chunks of exactly (i + 1) * kMinAllocationSize bytes.
+    std::vector<ChunkHandle> chunks[kNumCacheClasses] GUARDED_BY(mu);
+    int64 cached_bytes GUARDED_BY(mu) = 0;
+    int64 num_hits GUARDED_BY(mu) = 0;
+  };
+
+  // Threads are spread over the shards by id. With fewer threads than
+  // shards, each one mostly has a shard to itself.
+  CacheShard* ShardForCurrentThread();
+
+  // Returns a cached chunk of exactly rounded_bytes, or nullptr.
+  void* AllocateFromCache(size_t rounded_bytes, size_t num_bytes)
+      LOCKS_EXCLUDED(lock_);
+
+  // Returns false if ptr can't be cached and must be freed to the bins.
+  bool DeallocateToCache(void* ptr) LOCKS_EXCLUDED(lock_);
+
+  // Frees every cached chunk into the bins. Returns false if the cache was
+  // empty.
+  bool FlushChunkCache() EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Adds to bytes_in_use_ and raises max_bytes_in_use_ to match.
+  void AddBytesInUse(int64 bytes);
+
+  void GetStatsLocked(AllocatorStats* stats) EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  // Like ChunkFromHandle, for chunks owned by the caller or a cache.
+  Chunk* OwnedChunkFromHandle(ChunkHandle h) NO_THREAD_SAFETY_ANALYSIS;
+
+  // Like region_manager_.get_handle, for pointers owned by the caller.
+  // Returns kInvalidChunkHandle if the region is not published, see
+  // published_regions_.
+  ChunkHandle OwnedHandleForPtr(const void* ptr) const;
+
   // Information about a Bin that is useful for debugging.
   struct BinDebugInfo {
     size_t total_bytes_in_use = 0;
@@ -418,21 +482,51 @@ class BFCAllocator : public VisitableAllocator {
   mutable mutex lock_;
   RegionManager region_manager_ GUARDED_BY(lock_);
 
-  std::vector<Chunk> chunks_;
+  // Chunks are kept in fixed-size blocks rather than one vector, so that a
+  // Chunk doesn't move when more are added and can be used without lock_ by
+  // the chunk cache.
+  static const size_t kChunkBlockBits = 12;
+  static const size_t kChunkBlockSize = 1 << kChunkBlockBits;
+  static const size_t kMaxChunkBlocks = 4096;
+  std::unique_ptr<Chunk[]> chunk_blocks_[kMaxChunkBlocks];
+  size_t num_chunks_ = 0;
   ChunkHandle free_chunks_list_;  // Ptr to head of linked list of free Chunks
 
+  // Append-only copy of the regions' address ranges and handle arrays, so
+  // the chunk cache can map pointers to chunks without lock_. Regions are
+  // only added under lock_ and never freed before destruction. Regions
+  // beyond kMaxPublishedRegions simply bypass the caches.
+  struct PublishedRegion {
+    std::uintptr_t begin;
+    std::uintptr_t end;
+    const ChunkHandle* handles;
+  };
+  static const size_t kMaxPublishedRegions = 64;
+  PublishedRegion published_regions_[kMaxPublishedRegions];
+  std::atomic<size_t> num_published_regions_{0};
+
+  // Null unless the chunk cache is enabled.
+  std::unique_ptr<CacheShard[]> cache_shards_;
+
+  // With the chunk cache enabled, the bytes held by clients and their peak
+  // are tracked here instead of in stats_, whose counts include cached
+  // chunks, since the cache updates them without lock_.
+  std::atomic<int64> bytes_in_use_{0};
+  std::atomic<int64> max_bytes_in_use_{0};
+  std::atomic<int64> bytes_cached_{0};
+
   // Called once on each region, ASAP.
   std::vector<Visitor> region_visitors_;
 
   // Counter containing the next unique identifier to assign to a
   // newly-created chunk.
-  int64 next_allocation_id_ GUARDED_BY(lock_);
+  std::atomic<int64> next_allocation_id_;
 
   // Stats.
   AllocatorStats stats_ GUARDED_BY(lock_);
 
   friend class GPUBFCAllocatorPrivateMethodsTest;
-  friend class GPUDoubleBFCAllocator;
+  friend class MultiPoolBFCAllocator;
   TF_DISALLOW_COPY_AND_ASSIGN(BFCAllocator);
 };
 
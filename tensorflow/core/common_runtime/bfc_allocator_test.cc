@@ -0,0 +1,242 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/bfc_allocator.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mem.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace {
+
+class HostSubAllocator : public SubAllocator {
+ public:
+  void* Alloc(size_t alignment, size_t num_bytes) override {
+    return port::AlignedMalloc(num_bytes, std::max<size_t>(alignment, 64));
+  }
+  void Free(void* ptr, size_t num_bytes) override { port::AlignedFree(ptr); }
+};
+
+TEST(BFCAllocatorChunkCacheTest, ReusesCachedChunks) {
+  BFCAllocator a(new HostSubAllocator, 1 << 24, false, "test", true);
+
+  void* p1 = a.AllocateRaw(1, 1000);
+  int64 id1 = a.AllocationId(p1);
+  a.DeallocateRaw(p1);
+
+  AllocatorStats stats;
+  a.GetStats(&stats);
+  EXPECT_EQ(0, stats.bytes_in_use);
+  EXPECT_EQ(1024, stats.bytes_cached);
+
+  // Same rounded size comes back from the cache, with fresh metadata.
+  void* p2 = a.AllocateRaw(1, 900);
+  EXPECT_EQ(p1, p2);
+  EXPECT_EQ(900, a.RequestedSize(p2));
+  EXPECT_EQ(1024, a.AllocatedSize(p2));
+  EXPECT_GT(a.AllocationId(p2), id1);
+
+  a.GetStats(&stats);
+  EXPECT_EQ(2, stats.num_allocs);
+  EXPECT_EQ(1024, stats.bytes_in_use);
+  EXPECT_EQ(0, stats.bytes_cached);
+  a.DeallocateRaw(p2);
+
+  // Large allocations bypass the cache.
+  void* large = a.AllocateRaw(1, 1 << 20);
+  a.DeallocateRaw(large);
+  a.GetStats(&stats);
+  EXPECT_EQ(0, stats.bytes_in_use);
+  EXPECT_EQ(1024, stats.bytes_cached);
+}
+
+TEST(BFCAllocatorChunkCacheTest, FlushesOnOverflow) {
+  BFCAllocator a(new HostSubAllocator, 1 << 26, false, "test", true);
+
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 4096; ++i) {
+    ptrs.push_back(a.AllocateRaw(1, 4096));
+  }
+  for (void* p : ptrs) {
+    a.DeallocateRaw(p);
+  }
+
+  AllocatorStats stats;
+  a.GetStats(&stats);
+  EXPECT_EQ(0, stats.bytes_in_use);
+  EXPECT_GT(stats.bytes_cached, 0);
+  EXPECT_LE(stats.bytes_cached, 2 << 20);
+}
+
+TEST(BFCAllocatorChunkCacheTest, FlushesWhenOutOfMemory) {
+  const size_t kTotal = 1 << 20;
+  BFCAllocator a(new HostSubAllocator, kTotal, false, "test", true);
+
+  // Fill the allocator with small chunks and park them all in the cache.
+  std::vector<void*> ptrs;
+  for (size_t i = 0; i < kTotal / 1024; ++i) {
+    void* p = a.AllocateRaw(1, 1024);
+    ASSERT_NE(nullptr, p);
+    ptrs.push_back(p);
+  }
+  for (void* p : ptrs) {
+    a.DeallocateRaw(p);
+  }
+
+  // Only satisfiable once the cached chunks are coalesced again.
+  AllocationAttributes attr;
+  attr.no_retry_on_failure = true;
+  void* big = a.AllocateRaw(1, kTotal, attr);
+  ASSERT_NE(nullptr, big);
+  a.DeallocateRaw(big);
+}
+
+TEST(BFCAllocatorChunkCacheTest, MaxBytesInUseExcludesCache) {
+  BFCAllocator a(new HostSubAllocator, 1 << 24, false, "test", true);
+
+  a.DeallocateRaw(a.AllocateRaw(1, 1024));
+  void* p = a.AllocateRaw(1, 2048);
+
+  // The cached 1KB chunk is not held by anyone.
+  AllocatorStats stats;
+  a.GetStats(&stats);
+  EXPECT_EQ(2048, stats.bytes_in_use);
+  EXPECT_EQ(2048, stats.max_bytes_in_use);
+  EXPECT_EQ(1024, stats.bytes_cached);
+
+  // Handing it out again counts.
+  void* q = a.AllocateRaw(1, 1024);
+  a.GetStats(&stats);
+  EXPECT_EQ(3072, stats.bytes_in_use);
+  EXPECT_EQ(3072, stats.max_bytes_in_use);
+  EXPECT_EQ(0, stats.bytes_cached);
+  a.DeallocateRaw(p);
+  a.DeallocateRaw(q);
+}
+
+class CountingSubAllocator : public HostSubAllocator {
+ public:
+  explicit CountingSubAllocator(int* num_allocs) : num_allocs_(num_allocs) {}
+  void* Alloc(size_t alignment, size_t num_bytes) override {
+    ++*num_allocs_;
+    return HostSubAllocator::Alloc(alignment, num_bytes);
+  }
+
+ private:
+  int* num_allocs_;
+};
+
+TEST(BFCAllocatorChunkCacheTest, FlushesBeforeExtending) {
+  const size_t kRegion = 1 << 20;
+  int num_regions = 0;
+  BFCAllocator a(new CountingSubAllocator(&num_regions), 4 * kRegion, true,
+                 "test", true);
+
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 200; ++i) {
+    ptrs.push_back(a.AllocateRaw(1, 1024));
+  }
+  for (void* p : ptrs) {
+    a.DeallocateRaw(p);
+  }
+  EXPECT_EQ(1, num_regions);
+
+  // Fits the first region once the cached chunks are coalesced.
+  void* big = a.AllocateRaw(1, kRegion);
+  ASSERT_NE(nullptr, big);
+  EXPECT_EQ(1, num_regions);
+  a.DeallocateRaw(big);
+}
+
+TEST(BFCAllocatorChunkCacheTest, Concurrent) {
+  BFCAllocator a(new HostSubAllocator, 1 << 28, true, "test", true);
+  {
+    thread::ThreadPool pool(Env::Default(), "test", 8);
+    for (int t = 0; t < 8; ++t) {
+      pool.Schedule([&a, t]() {
+        random::PhiloxRandom philox(t, 17);
+        random::SimplePhilox rand(&philox);
+        void* ptrs[16] = {};
+        std::set<int64> ids;
+        for (int i = 0; i < 1000; ++i) {
+          auto& p = ptrs[i % 16];
+          if (p) a.DeallocateRaw(p);
+          size_t bytes = rand.Uniform(1 << 17) + 1;
+          p = a.AllocateRaw(1, bytes);
+          ASSERT_NE(nullptr, p);
+          EXPECT_EQ(bytes, a.RequestedSize(p));
+          EXPECT_TRUE(ids.insert(a.AllocationId(p)).second);
+        }
+        for (void* p : ptrs) {
+          if (p) a.DeallocateRaw(p);
+        }
+      });
+    }
+  }
+  AllocatorStats stats;
+  a.GetStats(&stats);
+  EXPECT_EQ(0, stats.bytes_in_use);
+  EXPECT_EQ(8000, stats.num_allocs);
+}
+
+static void BM_SmallAllocationThreaded(int iters, int num_threads,
+                                       bool chunk_cache) {
+  testing::StopTiming();
+  BFCAllocator a(new HostSubAllocator, 1 << 28, false, "test", chunk_cache);
+  thread::ThreadPool pool(Env::Default(), "test", num_threads);
+  testing::StartTiming();
+
+  BlockingCounter done(num_threads);
+  for (int t = 0; t < num_threads; ++t) {
+    pool.Schedule([&a, &done, iters, num_threads, t]() {
+      random::PhiloxRandom philox(t, 17);
+      random::SimplePhilox rand(&philox);
+      void* ptrs[16] = {};
+      for (int i = 0; i < iters / num_threads; ++i) {
+        auto& p = ptrs[i % 16];
+        if (p) a.DeallocateRaw(p);
+        p = a.AllocateRaw(1, 256 * (rand.Uniform(16) + 1));
+      }
+      for (void* p : ptrs) {
+        if (p) a.DeallocateRaw(p);
+      }
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  testing::ItemsProcessed(iters);
+}
+
+static void BM_NoCache(int iters, int num_threads) {
+  BM_SmallAllocationThreaded(iters, num_threads, false);
+}
+BENCHMARK(BM_NoCache)->Arg(1)->Arg(4)->Arg(16);
+
+static void BM_ChunkCache(int iters, int num_threads) {
+  BM_SmallAllocationThreaded(iters, num_threads, true);
+}
+BENCHMARK(BM_ChunkCache)->Arg(1)->Arg(4)->Arg(16);
+
+}  // namespace
+}  // namespace tensorflow
@@ -0,0 +1,400 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/cost_model_placement.h"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+#include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/graph/algorithm.h"
+#include "tensorflow/core/grappler/clusters/cluster.h"
+#include "tensorflow/core/grappler/clusters/utils.h"
+#include "tensorflow/core/grappler/costs/analytical_cost_estimator.h"
+#include "tensorflow/core/grappler/costs/graph_properties.h"
+#include "tensorflow/core/grappler/costs/op_level_cost_estimator.h"
+#include "tensorflow/core/grappler/grappler_item.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/util/device_name_utils.h"
+
+namespace tensorflow {
+
+namespace {
+
+// Size in bytes of a tensor, counting unknown dimensions as 1.
+int64 TensorBytes(const OpInfo::TensorProperties& tensor) {
+  int64 elements = 1;
+  if (!tensor.shape().unknown_rank()) {
+    for (const auto& dim : tensor.shape().dim()) {
+      elements *= std::max<int64>(dim.size(), 1);
+    }
+  }
+  return elements * DataTypeSize(tensor.dtype());
+}
+
+// The devices nodes may be placed on, with their properties.
+class DeviceSlots {
+ public:
+  explicit DeviceSlots(const grappler::Cluster* cluster) : cluster_(cluster) {}
+
+  int Find(const string& name) {
+    auto it = index_.find(name);
+    if (it != index_.end()) {
+      return it->second;
+    }
+    DeviceProperties device;
+    const auto& devices = cluster_->GetDevices();
+    auto dit = devices.find(name);
+    DeviceNameUtils::ParsedName parsed;
+    if (dit != devices.end()) {
+      device = dit->second;
+    } else if (DeviceNameUtils::ParseFullName(name, &parsed)) {
+      device = grappler::GetDeviceInfo(parsed);
+    } else {
+      device.set_type("UNKNOWN");
+    }
+    names_.push_back(name);
+    properties_.push_back(std::move(device));
+    index_.emplace(name, names_.size() - 1);
+    return names_.size() - 1;
+  }
+
+  size_t size() const { return names_.size(); }
+  const string& name(int slot) const { return names_[slot]; }
+  const DeviceProperties& properties(int slot) const {
+    return properties_[slot];
+  }
+
+ private:
+  const grappler::Cluster* const cluster_;
+  std::vector<string> names_;
+  std::vector<DeviceProperties> properties_;
+  std::unordered_map<string, int> index_;
+};
+
+// OpLevelCostEstimator, which grappler uses with _Send ops for free, except
+// that they cost the transfer between their devices. Placing nodes is all
+// about trading compute for transfers.
+class TransferCostEstimator : public grappler::OpLevelCostEstimator {
+ public:
+  grappler::Costs PredictCosts(
+      const grappler::OpContext& op_context) const override {
+    const auto& op_info = op_context.op_info;
+    const auto& attr = op_info.attr();
+    // _Send ops added by the VirtualScheduler name both ends in src_device_
+    // and dst_device_.
+    if (op_info.op() != "_Send" || op_info.inputs_size() == 0 ||
+        !attr.count("src_device_") || !attr.count("dst_device_")) {
+      return grappler::OpLevelCostEstimator::PredictCosts(op_context);
+    }
+    grappler::Costs costs = grappler::Costs::ZeroCosts();
+    costs.execution_time =
+        TransferTime(TensorBytes(op_info.inputs(0)),
+                     attr.at("src_device_").s(), attr.at("dst_device_").s());
+    costs.memory_time = costs.execution_time;
+    return costs;
+  }
+
+  // Time to move a tensor of the given size from one device to another,
+  // zero if both names refer to the same device.
+  grappler::Costs::Duration TransferTime(int64 bytes, const string& src_device,
+                                         const string& dst_device) const {
+    DeviceNameUtils::ParsedName src;
+    DeviceNameUtils::ParsedName dst;
+    if (!DeviceNameUtils::ParseFullName(src_device, &src) ||
+        !DeviceNameUtils::ParseFullName(dst_device, &dst)) {
+      VLOG(1) << "Can't parse device names " << src_device << " and "
+              << dst_device << ", assuming a free transfer";
+      return grappler::Costs::Duration::zero();
+    }
+    if (DeviceNameUtils::IsSameAddressSpace(src, dst) &&
+        src.type == dst.type && src.id == dst.id) {
+      return grappler::Costs::Duration::zero();
+    }
+
+    // Rough defaults: tensors between CPU devices in one process are passed
+    // by reference, copies to or from a GPU go over PCIe, and anything
+    // between tasks over a 10Gb network.
+    double latency_ns;
+    double gb_per_sec;
+    if (!DeviceNameUtils::IsSameAddressSpace(src, dst)) {
+      latency_ns = 50000;
+      gb_per_sec = 1.25;
+    } else if (src.type == "GPU" || dst.type == "GPU") {
+      latency_ns = 10000;
+      gb_per_sec = 12;
+    } else {
+      latency_ns = 5000;
+      gb_per_sec = 0;
+    }
+    double transfer_ns = latency_ns;
+    if (gb_per_sec > 0) {
+      transfer_ns += bytes / gb_per_sec;
+    }
+    return grappler::Costs::Duration(transfer_ns);
+  }
+};
+
+}  // namespace
+
+CostModelPlacement::CostModelPlacement(grappler::Cluster* cluster)
+    : cluster_(cluster) {}
+
+Status CostModelPlacement::Place(
+    const Graph& graph, const std::vector<std::vector<Node*>>& groups,
+    const std::vector<std::vector<Device*>>& candidates,
+    std::vector<int>* choices) {
+  default_time_ns_ = -1;
+  placed_time_ns_ = -1;
+  choices->clear();
+  if (groups.empty()) {
+    return Status::OK();
+  }
+  if (candidates.size() != groups.size()) {
+    return errors::InvalidArgument("Got ", candidates.size(),
+                                   " lists of candidate devices for ",
+                                   groups.size(), " groups");
+  }
+  for (size_t g = 0; g < groups.size(); ++g) {
+    if (candidates[g].empty()) {
+      return errors::InvalidArgument(
+          "No candidate device for group ", g,
+          groups[g].empty() ? "" : " of node ",
+          groups[g].empty() ? "" : groups[g][0]->name());
+    }
+  }
+
+  // Everything not consumed by another node is what a step computes.
+  grappler::GrapplerItem item;
+  item.id = "cost_model_placement";
+  graph.ToGraphDef(&item.graph);
+  for (const Node* node : graph.op_nodes()) {
+    const bool consumed =
+        std::any_of(node->out_edges().begin(), node->out_edges().end(),
+                    [](const Edge* e) { return e->dst()->IsOp(); });
+    if (!consumed) {
+      item.fetch.push_back(node->name());
+    }
+  }
+
+  grappler::GraphProperties properties(item);
+  Status status = properties.InferStatically(false);
+  if (!status.ok()) {
+    VLOG(1) << "Placing without inferred shapes: " << status;
+  }
+
+  // Nodes in a group may go to any of its candidates, the others stay on
+  // their assigned device.
+  const int num_ids = graph.num_node_ids();
+  std::vector<int> group_of(num_ids, -1);
+  for (size_t g = 0; g < groups.size(); ++g) {
+    for (const Node* node : groups[g]) {
+      group_of[node->id()] = g;
+    }
+  }
+  DeviceSlots slots(cluster_);
+  std::vector<std::vector<int>> candidate_slots(groups.size());
+  for (size_t g = 0; g < groups.size(); ++g) {
+    for (const Device* device : candidates[g]) {
+      candidate_slots[g].push_back(slots.Find(device->name()));
+    }
+  }
+
+  std::vector<Node*> order;
+  GetReversePostOrder(graph, &order);
+  std::vector<int> position(num_ids, -1);
+  for (size_t i = 0; i < order.size(); ++i) {
+    position[order[i]->id()] = i;
+  }
+
+  // Predicted time of each node on each of its options, which are the
+  // candidates of its group or its assigned device.
+  TransferCostEstimator estimator;
+  std::vector<std::vector<int>> options(num_ids);
+  std::vector<std::vector<int64>> costs(num_ids);
+  std::vector<int64> mean_cost(num_ids, 0);
+  for (const Node* node : order) {
+    if (!node->IsOp()) {
+      continue;
+    }
+    const int id = node->id();
+    if (group_of[id] >= 0) {
+      options[id] = candidate_slots[group_of[id]];
+    } else {
+      options[id].push_back(slots.Find(node->assigned_device_name()));
+    }
+
+    grappler::OpContext op_context;
+    op_context.name = node->name();
+    auto& op_info = op_context.op_info;
+    op_info.set_op(node->type_string());
+    *op_info.mutable_attr() = node->def().attr();
+    if (properties.HasInputProperties(node->name())) {
+      for (const auto& input : properties.GetInputProperties(node->name())) {
+        *op_info.add_inputs() = input;
+      }
+    }
+    if (properties.HasOutputProperties(node->name())) {
+      for (const auto& output : properties.GetOutputProperties(node->name())) {
+        *op_info.add_outputs() = output;
+      }
+    }
+    for (int slot : options[id]) {
+      op_context.device_name = slots.name(slot);
+      *op_info.mutable_device() = slots.properties(slot);
+      const int64 cost =
+          estimator.PredictCosts(op_context).execution_time.count();
+      costs[id].push_back(cost);
+      mean_cost[id] += cost;
+    }
+    mean_cost[id] /= options[id].size();
+  }
+
+  auto edge_bytes = [&properties](const Edge* e) -> int64 {
+    if (e->IsControlEdge() ||
+        !properties.HasOutputProperties(e->src()->name())) {
+      return 0;
+    }
+    const auto& outputs = properties.GetOutputProperties(e->src()->name());
+    if (e->src_output() >= static_cast<int>(outputs.size())) {
+      return 0;
+    }
+    return TensorBytes(outputs[e->src_output()]);
+  };
+  // Back edges of loops are ignored.
+  auto is_forward = [&position](const Edge* e) {
+    return e->src()->IsOp() && e->dst()->IsOp() &&
+           position[e->src()->id()] < position[e->dst()->id()];
+  };
+
+  // Longest path from the start of each node to the end of the graph.
+  std::vector<int64> rank(num_ids, 0);
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    const Node* node = *it;
+    if (!node->IsOp()) {
+      continue;
+    }
+    int64 tail = 0;
+    for (const Edge* e : node->out_edges()) {
+      if (is_forward(e)) {
+        tail = std::max(tail, rank[e->dst()->id()]);
+      }
+    }
+    rank[node->id()] = mean_cost[node->id()] + tail;
+  }
+
+  // A node never ranks below its successors, so this is a topological order
+  // too.
+  std::vector<const Node*> schedule;
+  for (const Node* node : order) {
+    if (node->IsOp()) {
+      schedule.push_back(node);
+    }
+  }
+  std::stable_sort(schedule.begin(), schedule.end(),
+                   [&rank](const Node* a, const Node* b) {
+                     return rank[a->id()] > rank[b->id()];
+                   });
+
+  std::vector<int> group_choice(groups.size(), -1);
+  std::vector<int> slot_of(num_ids, -1);
+  std::vector<int64> finish(num_ids, 0);
+  std::vector<int64> device_free(slots.size(), 0);
+  int64 makespan = 0;
+  for (const Node* node : schedule) {
+    const int id = node->id();
+    const int g = group_of[id];
+    int best = -1;
+    int64 best_finish = std::numeric_limits<int64>::max();
+    for (size_t k = 0; k < options[id].size(); ++k) {
+      if (g >= 0 && group_choice[g] >= 0 &&
+          group_choice[g] != static_cast<int>(k)) {
+        continue;
+      }
+      const int slot = options[id][k];
+      int64 ready = device_free[slot];
+      for (const Edge* e : node->in_edges()) {
+        if (!is_forward(e)) {
+          continue;
+        }
+        const int src_slot = slot_of[e->src()->id()];
+        int64 arrival = finish[e->src()->id()];
+        if (src_slot != slot) {
+          arrival += estimator
+                         .TransferTime(edge_bytes(e), slots.name(src_slot),
+                                       slots.name(slot))
+                         .count();
+        }
+        ready = std::max(ready, arrival);
+      }
+      if (ready + costs[id][k] < best_finish) {
+        best = k;
+        best_finish = ready + costs[id][k];
+      }
+    }
+    if (g >= 0) {
+      group_choice[g] = best;
+    }
+    const int slot = options[id][best];
+    slot_of[id] = slot;
+    finish[id] = best_finish;
+    device_free[slot] = best_finish;
+    makespan = std::max(makespan, best_finish);
+  }
+  VLOG(1) << "List scheduling predicts a step time of " << makespan << " ns";
+
+  // Check against the default placement with a full simulation.
+  grappler::AnalyticalCostEstimator simulator(
+      cluster_, new TransferCostEstimator(), true);
+  TF_RETURN_IF_ERROR(simulator.Initialize(item));
+  std::unordered_map<string, int> node_index;
+  for (int i = 0; i < item.graph.node_size(); ++i) {
+    node_index[item.graph.node(i).name()] = i;
+  }
+  auto simulate = [&](const std::vector<int>& plan) -> int64 {
+    GraphDef placed = item.graph;
+    for (size_t g = 0; g < groups.size(); ++g) {
+      for (const Node* node : groups[g]) {
+        placed.mutable_node(node_index[node->name()])
+            ->set_device(candidates[g][plan[g]]->name());
+      }
+    }
+    grappler::Costs costs;
+    Status s = simulator.PredictCosts(placed, nullptr, &costs);
+    if (!s.ok()) {
+      VLOG(1) << "Failed to simulate the placement: " << s;
+      return -1;
+    }
+    return costs.execution_time.count();
+  };
+  const std::vector<int> default_choice(groups.size(), 0);
+  default_time_ns_ = simulate(default_choice);
+  placed_time_ns_ = simulate(group_choice);
+  VLOG(1) << "Predicted step time " << placed_time_ns_
+          << " ns with cost model placement, " << default_time_ns_
+          << " ns with the default placement";
+
+  if (default_time_ns_ >= 0 &&
+      (placed_time_ns_ < 0 || default_time_ns_ <= placed_time_ns_)) {
+    *choices = default_choice;
+  } else {
+    *choices = std::move(group_choice);
+  }
+  return Status::OK();
+}
+
+}  // namespace tensorflow
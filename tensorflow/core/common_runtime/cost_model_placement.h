@@ -0,0 +1,66 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMMON_RUNTIME_COST_MODEL_PLACEMENT_H_
+#define TENSORFLOW_COMMON_RUNTIME_COST_MODEL_PLACEMENT_H_
+
+#include <vector>
+
+#include "tensorflow/core/common_runtime/placer.h"
+
+namespace tensorflow {
+
+namespace grappler {
+class Cluster;
+}  // namespace grappler
+
+// Places each colocation group to minimize the predicted step time of the
+// graph, counting both compute and the transfers between devices.
+//
+// Op costs on every candidate device come from grappler's
+// OpLevelCostEstimator, using statically inferred shapes, except that _Send
+// ops cost a transfer between their devices instead of nothing. Nodes are list
+// scheduled by the length of their critical path to the end of the graph, as
+// in HEFT, and the first scheduled node of a group decides the device for the
+// whole group: the one it would finish earliest on, given what is already
+// queued on each device and the transfers from its inputs. The result is then
+// simulated with the VirtualScheduler against the default placement, i.e. the
+// first candidate of every group, and the faster of the two is used.
+class CostModelPlacement : public PlacementPolicy {
+ public:
+  // Does not take ownership of cluster, which describes the devices.
+  explicit CostModelPlacement(grappler::Cluster* cluster);
+
+  Status Place(const Graph& graph,
+               const std::vector<std::vector<Node*>>& groups,
+               const std::vector<std::vector<Device*>>& candidates,
+               std::vector<int>* choices) override;
+
+  // Step times predicted by the VirtualScheduler in the last Place call, in
+  // nanoseconds, or -1 if the simulation failed.
+  int64 default_time_ns() const { return default_time_ns_; }
+  int64 placed_time_ns() const { return placed_time_ns_; }
+
+ private:
+  grappler::Cluster* const cluster_;
+  int64 default_time_ns_ = -1;
+  int64 placed_time_ns_ = -1;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CostModelPlacement);
+};
+
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_COMMON_RUNTIME_COST_MODEL_PLACEMENT_H_
@@ -0,0 +1,170 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/cost_model_placement.h"
+
+#include <memory>
+#include <vector>
+
+#include "tensorflow/core/common_runtime/device_factory.h"
+#include "tensorflow/core/common_runtime/device_set.h"
+#include "tensorflow/core/framework/function_testlib.h"
+#include "tensorflow/core/graph/graph_constructor.h"
+#include "tensorflow/core/grappler/clusters/virtual_cluster.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/public/session_options.h"
+
+namespace tensorflow {
+namespace {
+
+using test::function::NDef;
+
+class CostModelPlacementTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    SessionOptions options;
+    (*options.config.mutable_device_count())["CPU"] = 2;
+    TF_ASSERT_OK(DeviceFactory::GetFactory("CPU")->CreateDevices(
+        options, "/job:localhost/replica:0/task:0", &devices_));
+    ASSERT_EQ(2, devices_.size());
+
+    std::unordered_map<string, DeviceProperties> device_map;
+    for (Device* device : devices_) {
+      device_set_.AddDevice(device);
+      DeviceProperties properties;
+      properties.set_type("CPU");
+      properties.set_num_cores(4);
+      properties.set_frequency(2000);
+      properties.set_bandwidth(32000000);
+      device_map[device->name()] = properties;
+    }
+    cluster_.reset(new grappler::VirtualCluster(device_map));
+  }
+
+  void TearDown() override {
+    for (Device* device : devices_) {
+      delete device;
+    }
+  }
+
+  // Two independent chains of MatMuls, a0 -> m0_1 -> m0_2 -> m0_3 and the
+  // same for a1.
+  GraphDef TwoChains() {
+    GraphDef def;
+    for (int c = 0; c < 2; ++c) {
+      const string chain = strings::StrCat(c);
+      TensorShape shape({512, 512});
+      *def.add_node() = NDef(strings::StrCat("a", chain), "Placeholder", {},
+                             {{"dtype", DT_FLOAT}, {"shape", shape}});
+      string prev = strings::StrCat("a", chain);
+      for (int i = 1; i <= 3; ++i) {
+        const string name = strings::StrCat("m", chain, "_", i);
+        *def.add_node() = NDef(name, "MatMul", {prev, prev}, {{"T", DT_FLOAT}});
+        prev = name;
+      }
+    }
+    return def;
+  }
+
+  Status Place(const GraphDef& def, CostModelPlacement* policy) {
+    graph_.reset(new Graph(OpRegistry::Global()));
+    GraphConstructorOptions opts;
+    TF_RETURN_IF_ERROR(ConvertGraphDefToGraph(opts, def, graph_.get()));
+    Placer placer(graph_.get(), &device_set_);
+    placer.set_placement_policy(policy);
+    return placer.Run();
+  }
+
+  string DeviceOf(const string& name) {
+    for (Node* node : graph_->op_nodes()) {
+      if (node->name() == name) {
+        return node->assigned_device_name();
+      }
+    }
+    return "";
+  }
+
+  std::vector<Device*> devices_;
+  DeviceSet device_set_;
+  std::unique_ptr<grappler::VirtualCluster> cluster_;
+  std::unique_ptr<Graph> graph_;
+};
+
+TEST_F(CostModelPlacementTest, SpreadsIndependentWork) {
+  CostModelPlacement policy(cluster_.get());
+  TF_ASSERT_OK(Place(TwoChains(), &policy));
+
+  EXPECT_NE(DeviceOf("m0_3"), DeviceOf("m1_3"));
+  for (const string& chain : {"m0_", "m1_"}) {
+    EXPECT_EQ(DeviceOf(chain + "1"), DeviceOf(chain + "2"));
+    EXPECT_EQ(DeviceOf(chain + "1"), DeviceOf(chain + "3"));
+  }
+  EXPECT_GT(policy.default_time_ns(), 0);
+  EXPECT_LT(policy.placed_time_ns(), policy.default_time_ns() * 3 / 4);
+}
+
+TEST_F(CostModelPlacementTest, RespectsConstraints) {
+  GraphDef def = TwoChains();
+  for (auto& node : *def.mutable_node()) {
+    if (node.name() == "m1_2") {
+      (*node.mutable_attr())["_class"].mutable_list()->add_s("loc:@m0_2");
+    } else if (node.name() == "m0_1") {
+      node.set_device("/device:CPU:1");
+    }
+  }
+  CostModelPlacement policy(cluster_.get());
+  TF_ASSERT_OK(Place(def, &policy));
+
+  EXPECT_EQ(devices_[1]->name(), DeviceOf("m0_1"));
+  EXPECT_EQ(DeviceOf("m0_2"), DeviceOf("m1_2"));
+}
+
+TEST_F(CostModelPlacementTest, KeepsCheapGraphOnFirstDevice) {
+  GraphDef def;
+  for (const string& chain : {"0", "1"}) {
+    *def.add_node() = NDef("a" + chain, "Placeholder", {},
+                           {{"dtype", DT_FLOAT}, {"shape", TensorShape({4})}});
+    *def.add_node() = NDef("i" + chain, "Identity", {"a" + chain},
+                           {{"T", DT_FLOAT}});
+  }
+  CostModelPlacement policy(cluster_.get());
+  TF_ASSERT_OK(Place(def, &policy));
+
+  for (const string& name : {"a0", "i0", "a1", "i1"}) {
+    EXPECT_EQ(devices_[0]->name(), DeviceOf(name));
+  }
+}
+
+TEST_F(CostModelPlacementTest, RejectsGroupWithoutCandidates) {
+  graph_.reset(new Graph(OpRegistry::Global()));
+  TF_ASSERT_OK(ConvertGraphDefToGraph(GraphConstructorOptions(), TwoChains(),
+                                      graph_.get()));
+  std::vector<std::vector<Node*>> groups(2);
+  for (Node* node : graph_->op_nodes()) {
+    groups[node->name()[1] == '0' ? 0 : 1].push_back(node);
+  }
+  std::vector<std::vector<Device*>> candidates = {devices_, {}};
+  CostModelPlacement policy(cluster_.get());
+  std::vector<int> choices;
+  EXPECT_TRUE(errors::IsInvalidArgument(
+      policy.Place(*graph_, groups, candidates, &choices)));
+  EXPECT_TRUE(choices.empty());
+}
+
+}  // namespace
+}  // namespace tensorflow
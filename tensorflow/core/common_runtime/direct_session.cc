@@ -28,6 +28,7 @@ limitations under the License.
 #include "tensorflow/core/common_runtime/memory_types.h"
 #include "tensorflow/core/common_runtime/optimization_registry.h"
 #include "tensorflow/core/common_runtime/step_stats_collector.h"
+#include "tensorflow/core/common_runtime/step_trace.h"
 #include "tensorflow/core/framework/function.h"
 #include "tensorflow/core/framework/graph.pb_text.h"
 #include "tensorflow/core/framework/graph.pb.h"
@@ -48,6 +49,7 @@ limitations under the License.
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/gtl/array_slice.h"
+#include "tensorflow/core/lib/gtl/cleanup.h"
 #include "tensorflow/core/lib/gtl/stl_util.h"
 #include "tensorflow/core/lib/monitoring/counter.h"
 #include "tensorflow/core/lib/strings/numbers.h"
@@ -69,6 +71,8 @@ namespace {
 auto* direct_session_runs = monitoring::Counter<0>::New(
     "/tensorflow/core/direct_session_runs",
     "The number of times DirectSession::Run() has been called.");
+// Looking up the cell takes a lock, so do it once.
+auto* direct_session_runs_cell = direct_session_runs->GetCell();
 
 int32 NumInterOpThreadsFromSessionOptions(const SessionOptions& options) {
   const int32 t = options.config.inter_op_parallelism_threads();
@@ -259,6 +263,8 @@ DirectSession::DirectSession(const SessionOptions& options,
       factory_(factory),
       cancellation_manager_(new CancellationManager()),
       operation_timeout_in_ms_(options_.config.operation_timeout_in_ms()) {
+  std::atomic_store(&executors_,
+                    std::shared_ptr<const ExecutorsMap>(new ExecutorsMap));
   if (options_.config.session_inter_op_thread_pool_size() > 0) {
     for (int i = 0; i < options_.config.session_inter_op_thread_pool_size();
          ++i) {
@@ -315,9 +321,15 @@ DirectSession::~DirectSession() {
   for (auto& it : partial_runs_) {
     it.second.reset(nullptr);
   }
-  for (auto& it : executors_) {
-    it.second.reset();
+  {
+    mutex_lock l(callables_lock_);
+    for (int64 i = 0; i < num_callable_slots_; ++i) {
+      delete callable_storage_[i / kCallableBlockSize][i % kCallableBlockSize]
+          .callable.load(std::memory_order_relaxed);
+    }
+    released_callables_.clear();
   }
+  std::atomic_store(&executors_, std::shared_ptr<const ExecutorsMap>());
   for (auto d : device_mgr_->ListDevices()) {
     d->op_segment()->RemoveHold(session_handle_);
   }
@@ -436,7 +448,7 @@ Status DirectSession::Run(const RunOptions& run_options,
                           std::vector<Tensor>* outputs,
                           RunMetadata* run_metadata) {
   TF_RETURN_IF_ERROR(CheckNotClosed());
-  direct_session_runs->GetCell()->IncrementBy(1);
+  direct_session_runs_cell->IncrementBy(1);
   {
     mutex_lock l(graph_def_lock_);
     if (!graph_created_) {
@@ -452,30 +464,22 @@ Status DirectSession::Run(const RunOptions& run_options,
     input_tensor_names.push_back(it.first);
   }
 
-  if (run_options.inter_op_thread_pool() < 0 ||
-      run_options.inter_op_thread_pool() >= thread_pools_.size()) {
-    return errors::InvalidArgument("Invalid inter_op_thread_pool: ",
-                                   run_options.inter_op_thread_pool());
-  }
-  thread::ThreadPool* pool =
-      thread_pools_[run_options.inter_op_thread_pool()].first;
-
   // Check if we already have an executor for these arguments.
   ExecutorsAndKeys* executors_and_keys;
+  const CallFrameBinding* binding;
   RunStateArgs run_state_args(run_options.debug_options());
 
-  Executor::Args args;
-  args.step_id = step_id_counter_.fetch_add(1);
+  const int64 step_id = step_id_counter_.fetch_add(1);
 
-  TF_RETURN_IF_ERROR(
-      GetOrCreateExecutors(input_tensor_names, output_names, target_nodes,
-                           &executors_and_keys, &run_state_args));
+  TF_RETURN_IF_ERROR(GetOrCreateExecutors(input_tensor_names, output_names,
+                                          target_nodes, &executors_and_keys,
+                                          &run_state_args, &binding));
   const int64 executor_step_count = executors_and_keys->step_count.fetch_add(1);
 
   std::unique_ptr<DebuggerStateInterface> debugger_state;
   if (!run_options.debug_options().debug_tensor_watch_opts().empty()) {
     TF_RETURN_IF_ERROR(CreateDebuggerState(
-        run_options.debug_options(), args.step_id, executor_step_count,
+        run_options.debug_options(), step_id, executor_step_count,
         input_tensor_names, output_names, target_nodes, &debugger_state));
   }
 
@@ -484,15 +488,13 @@ Status DirectSession::Run(const RunOptions& run_options,
   FunctionCallFrame call_frame(executors_and_keys->input_types,
                                executors_and_keys->output_types);
   gtl::InlinedVector<Tensor, 4> feed_args(inputs.size());
-  for (const auto& it : inputs) {
-    if (it.second.dtype() == DT_RESOURCE) {
-      Tensor tensor_from_handle;
-      TF_RETURN_IF_ERROR(
-          ResourceHandleToInputTensor(it.second, &tensor_from_handle));
-      feed_args[executors_and_keys->input_name_to_index[it.first]] =
-          tensor_from_handle;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const Tensor& feed = inputs[i].second;
+    if (feed.dtype() == DT_RESOURCE) {
+      TF_RETURN_IF_ERROR(ResourceHandleToInputTensor(
+          feed, &feed_args[binding->feed_to_arg[i]]));
     } else {
-      feed_args[executors_and_keys->input_name_to_index[it.first]] = it.second;
+      feed_args[binding->feed_to_arg[i]] = feed;
     }
   }
   const Status s = call_frame.SetArgs(feed_args);
@@ -502,11 +504,57 @@ Status DirectSession::Run(const RunOptions& run_options,
     return s;
   }
 
+  TF_RETURN_IF_ERROR(RunInternal(step_id, run_options, &call_frame,
+                                 executors_and_keys, executor_step_count,
+                                 run_state_args.handle, output_names,
+                                 run_metadata));
+
+  // Receive outputs.
+  if (outputs) {
+    std::vector<Tensor> sorted_outputs;
+    const Status s = call_frame.ConsumeRetvals(&sorted_outputs);
+    if (errors::IsInternal(s)) {
+      return errors::InvalidArgument(s.error_message());
+    } else if (!s.ok()) {
+      return s;
+    }
+    outputs->clear();
+    outputs->reserve(binding->fetch_to_retval.size());
+    for (size_t index : binding->fetch_to_retval) {
+      if (binding->duplicate_fetches) {
+        outputs->push_back(sorted_outputs[index]);
+      } else {
+        outputs->push_back(std::move(sorted_outputs[index]));
+      }
+    }
+  }
+
+  return Status::OK();
+}
+
+Status DirectSession::RunInternal(int64 step_id, const RunOptions& run_options,
+                                  FunctionCallFrame* call_frame,
+                                  ExecutorsAndKeys* executors_and_keys,
+                                  int64 executor_step_count,
+                                  const string& handle,
+                                  const std::vector<string>& output_names,
+                                  RunMetadata* run_metadata) {
+  if (run_options.inter_op_thread_pool() < 0 ||
+      run_options.inter_op_thread_pool() >= thread_pools_.size()) {
+    return errors::InvalidArgument("Invalid inter_op_thread_pool: ",
+                                   run_options.inter_op_thread_pool());
+  }
+  thread::ThreadPool* pool =
+      thread_pools_[run_options.inter_op_thread_pool()].first;
+
+  Executor::Args args;
+  args.step_id = step_id;
+
   // Create a run state and start execution.
   RunState run_state(args.step_id, &devices_);
   run_state.rendez = new IntraProcessRendezvous(device_mgr_.get());
   CancellationManager step_cancellation_manager;
-  args.call_frame = &call_frame;
+  args.call_frame = call_frame;
 
   // Start parallel Executors.
   const size_t num_executors = executors_and_keys->items.size();
@@ -526,7 +574,7 @@ Status DirectSession::Run(const RunOptions& run_options,
   args.tensor_store = &run_state.tensor_store;
   args.step_container = &run_state.step_container;
   if (LogMemory::IsEnabled()) {
-    LogMemory::RecordStep(args.step_id, run_state_args.handle);
+    LogMemory::RecordStep(args.step_id, handle);
   }
   args.sync_on_finish = sync_on_finish_;
 
@@ -551,6 +599,16 @@ Status DirectSession::Run(const RunOptions& run_options,
     args.stats_collector = run_state.collector.get();
   }
 
+  // Steps fully traced already have their StepStats.
+  std::shared_ptr<StepTrace> step_trace;
+  const int32 compact_trace_steps =
+      options_.config.graph_options().compact_trace_steps();
+  if (compact_trace_steps > 0 && !do_trace &&
+      executor_step_count % compact_trace_steps == 0) {
+    step_trace = std::make_shared<StepTrace>();
+    args.step_trace = step_trace.get();
+  }
+
   std::unique_ptr<DeviceTracer> tracer;
   if (run_options.trace_level() >= RunOptions::HARDWARE_TRACE) {
     tracer = CreateDeviceTracer();
@@ -614,6 +672,11 @@ Status DirectSession::Run(const RunOptions& run_options,
     run_state.status.Update(errors::Cancelled("Run call was cancelled"));
   }
 
+  if (step_trace) {
+    mutex_lock l(step_trace_lock_);
+    last_step_trace_ = std::move(step_trace);
+  }
+
   if (tracer) {
     TF_RETURN_IF_ERROR(tracer->Stop());
     TF_RETURN_IF_ERROR(tracer->Collect(args.stats_collector));
@@ -624,45 +687,6 @@ Status DirectSession::Run(const RunOptions& run_options,
     TF_RETURN_IF_ERROR(run_state.status);
   }
 
-  // Receive outputs.
-  if (outputs) {
-    std::vector<Tensor> sorted_outputs;
-    const Status s = call_frame.ConsumeRetvals(&sorted_outputs);
-    if (errors::IsInternal(s)) {
-      return errors::InvalidArgument(s.error_message());
-    } else if (!s.ok()) {
-      return s;
-    }
-    const bool unique_outputs =
-        output_names.size() == executors_and_keys->output_name_to_index.size();
-    // first_indices[i] = j implies that j is the smallest value for which
-    // output_names[i] == output_names[j].
-    std::vector<int> first_indices;
-    if (!unique_outputs) {
-      first_indices.resize(output_names.size());
-      for (int i = 0; i < output_names.size(); ++i) {
-        for (int j = 0; j <= i; ++j) {
-          if (output_names[i] == output_names[j]) {
-            first_indices[i] = j;
-            break;
-          }
-        }
-      }
-    }
-    outputs->clear();
-    outputs->reserve(sorted_outputs.size());
-    for (int i = 0; i < output_names.size(); ++i) {
-      const string& output_name = output_names[i];
-      if (first_indices.empty() || first_indices[i] == i) {
-        outputs->emplace_back(
-            std::move(sorted_outputs[executors_and_keys
-                                         ->output_name_to_index[output_name]]));
-      } else {
-        outputs->push_back((*outputs)[first_indices[i]]);
-      }
-    }
-  }
-
   // Save the output tensors of this run we choose to keep.
   TF_RETURN_IF_ERROR(
       run_state.tensor_store.SaveTensors(output_names, &session_state_));
@@ -671,8 +695,9 @@ Status DirectSession::Run(const RunOptions& run_options,
   }
 
   // Build and return the cost model as instructed.
-  mutex_lock l(executor_lock_);
   if (update_cost_model) {
+    // Cost models are not thread-safe.
+    mutex_lock l(executor_lock_);
     // Build the cost model
     std::unordered_map<string, const Graph*> device_to_graph;
     for (const PerPartitionExecutorsAndLib& partition :
@@ -705,6 +730,208 @@ Status DirectSession::Run(const RunOptions& run_options,
   return Status::OK();
 }
 
+Status DirectSession::MakeCallable(const CallableOptions& callable_options,
+                                   CallableHandle* out_handle) {
+  TF_RETURN_IF_ERROR(CheckNotClosed());
+  {
+    mutex_lock l(graph_def_lock_);
+    if (!graph_created_) {
+      return errors::InvalidArgument(
+          "Session was not created with a graph before MakeCallable()!");
+    }
+  }
+
+  std::unique_ptr<Callable> callable(new Callable);
+  callable->options = callable_options;
+  const std::vector<string> feeds(callable_options.feed().begin(),
+                                  callable_options.feed().end());
+  const std::vector<string> fetches(callable_options.fetch().begin(),
+                                    callable_options.fetch().end());
+  const std::vector<string> targets(callable_options.target().begin(),
+                                    callable_options.target().end());
+
+  std::unordered_set<string> unique_feeds;
+  for (const string& feed : feeds) {
+    if (!unique_feeds.insert(feed).second) {
+      return errors::InvalidArgument("Callable feeds ", feed, " twice");
+    }
+  }
+
+  RunStateArgs run_state_args(callable->options.run_options().debug_options());
+  TF_RETURN_IF_ERROR(GetOrCreateExecutors(
+      feeds, fetches, targets, &callable->executors_and_keys, &run_state_args,
+      &callable->binding));
+  callable->handle = run_state_args.handle;
+  callable->fetch_names = fetches;
+
+  mutex_lock l(callables_lock_);
+  ReclaimCallables();
+  int64 index;
+  if (!free_callable_slots_.empty()) {
+    index = free_callable_slots_.back();
+    free_callable_slots_.pop_back();
+  } else {
+    index = num_callable_slots_;
+    const int64 block = index / kCallableBlockSize;
+    if (block >= kMaxCallableBlocks) {
+      return errors::ResourceExhausted("Too many callables in this session");
+    }
+    if (index % kCallableBlockSize == 0) {
+      callable_storage_.emplace_back(new CallableSlot[kCallableBlockSize]);
+      callable_blocks_[block].store(callable_storage_.back().get(),
+                                    std::memory_order_release);
+    }
+    ++num_callable_slots_;
+  }
+  CallableSlot& slot =
+      callable_storage_[index / kCallableBlockSize][index % kCallableBlockSize];
+  // The generation is published along with the callable.
+  const int64 generation = slot.generation.load(std::memory_order_relaxed) + 1;
+  slot.generation.store(generation, std::memory_order_relaxed);
+  slot.callable.store(callable.release(), std::memory_order_release);
+  *out_handle = generation * kMaxCallables + index;
+  return Status::OK();
+}
+
+Status DirectSession::RunCallable(CallableHandle handle,
+                                  const std::vector<Tensor>& feed_tensors,
+                                  std::vector<Tensor>* fetch_tensors,
+                                  RunMetadata* run_metadata) {
+  TF_RETURN_IF_ERROR(CheckNotClosed());
+  direct_session_runs_cell->IncrementBy(1);
+
+  CallableSlot* slot = FindCallableSlot(handle);
+  if (slot == nullptr) {
+    return errors::InvalidArgument("No such callable handle: ", handle);
+  }
+  // Keeps a released callable from being deleted until this returns.
+  slot->users.fetch_add(1);
+  auto release_slot = gtl::MakeCleanup([slot]() { slot->users.fetch_sub(1); });
+  const Callable* callable = slot->callable.load();
+  if (callable == nullptr ||
+      slot->generation.load(std::memory_order_relaxed) !=
+          handle / kMaxCallables) {
+    return errors::InvalidArgument("No such callable handle: ", handle);
+  }
+  const CallFrameBinding* binding = callable->binding;
+  if (feed_tensors.size() != binding->feed_to_arg.size()) {
+    return errors::InvalidArgument(
+        "Invalid number of feed tensors specified: expected ",
+        binding->feed_to_arg.size(), " but got ", feed_tensors.size());
+  }
+  ExecutorsAndKeys* executors_and_keys = callable->executors_and_keys;
+  const RunOptions& run_options = callable->options.run_options();
+
+  const int64 step_id = step_id_counter_.fetch_add(1);
+  const int64 executor_step_count = executors_and_keys->step_count.fetch_add(1);
+
+  std::unique_ptr<DebuggerStateInterface> debugger_state;
+  if (!run_options.debug_options().debug_tensor_watch_opts().empty()) {
+    const auto& options = callable->options;
+    TF_RETURN_IF_ERROR(CreateDebuggerState(
+        run_options.debug_options(), step_id, executor_step_count,
+        {options.feed().begin(), options.feed().end()},
+        {options.fetch().begin(), options.fetch().end()},
+        {options.target().begin(), options.target().end()}, &debugger_state));
+  }
+
+  FunctionCallFrame call_frame(executors_and_keys->input_types,
+                               executors_and_keys->output_types);
+  gtl::InlinedVector<Tensor, 4> feed_args(feed_tensors.size());
+  for (size_t i = 0; i < feed_tensors.size(); ++i) {
+    const Tensor& feed = feed_tensors[i];
+    if (feed.dtype() == DT_RESOURCE) {
+      TF_RETURN_IF_ERROR(ResourceHandleToInputTensor(
+          feed, &feed_args[binding->feed_to_arg[i]]));
+    } else {
+      feed_args[binding->feed_to_arg[i]] = feed;
+    }
+  }
+  const Status s = call_frame.SetArgs(feed_args);
+  if (errors::IsInternal(s)) {
+    return errors::InvalidArgument(s.error_message());
+  } else if (!s.ok()) {
+    return s;
+  }
+
+  RunMetadata unused_metadata;
+  TF_RETURN_IF_ERROR(RunInternal(
+      step_id, run_options, &call_frame, executors_and_keys,
+      executor_step_count, callable->handle, callable->fetch_names,
+      run_metadata ? run_metadata : &unused_metadata));
+
+  if (fetch_tensors) {
+    std::vector<Tensor> retvals;
+    const Status s = call_frame.ConsumeRetvals(&retvals);
+    if (errors::IsInternal(s)) {
+      return errors::InvalidArgument(s.error_message());
+    } else if (!s.ok()) {
+      return s;
+    }
+    fetch_tensors->clear();
+    fetch_tensors->reserve(binding->fetch_to_retval.size());
+    for (size_t index : binding->fetch_to_retval) {
+      if (binding->duplicate_fetches) {
+        fetch_tensors->push_back(retvals[index]);
+      } else {
+        fetch_tensors->push_back(std::move(retvals[index]));
+      }
+    }
+  }
+  return Status::OK();
+}
+
+Status DirectSession::ReleaseCallable(CallableHandle handle) {
+  mutex_lock l(callables_lock_);
+  CallableSlot* slot = FindCallableSlot(handle);
+  if (slot == nullptr ||
+      slot->generation.load(std::memory_order_relaxed) !=
+          handle / kMaxCallables) {
+    return errors::InvalidArgument("No such callable handle: ", handle);
+  }
+  std::unique_ptr<Callable> callable(slot->callable.exchange(nullptr));
+  if (callable == nullptr) {
+    return errors::InvalidArgument("No such callable handle: ", handle);
+  }
+  // A concurrent RunCallable may still be using it.
+  released_callables_.emplace_back(handle % kMaxCallables,
+                                   std::move(callable));
+  ReclaimCallables();
+  return Status::OK();
+}
+
+void DirectSession::ReclaimCallables() {
+  auto it = released_callables_.begin();
+  while (it != released_callables_.end()) {
+    const int64 index = it->first;
+    // RunCallable counts itself as a user before it loads the callable, so
+    // once the slot was cleared and has no users, nobody can see the
+    // callable any more.
+    if (callable_storage_[index / kCallableBlockSize]
+                         [index % kCallableBlockSize]
+                             .users.load() > 0) {
+      ++it;
+      continue;
+    }
+    free_callable_slots_.push_back(index);
+    it = released_callables_.erase(it);
+  }
+}
+
+DirectSession::CallableSlot* DirectSession::FindCallableSlot(
+    CallableHandle handle) {
+  if (handle < 0) {
+    return nullptr;
+  }
+  const int64 index = handle % kMaxCallables;
+  CallableSlot* block = callable_blocks_[index / kCallableBlockSize].load(
+      std::memory_order_acquire);
+  if (block == nullptr) {
+    return nullptr;
+  }
+  return &block[index % kCallableBlockSize];
+}
+
 Status DirectSession::PRunSetup(const std::vector<string>& input_names,
                                 const std::vector<string>& output_names,
                                 const std::vector<string>& target_nodes,
@@ -795,14 +1022,14 @@ Status DirectSession::PRun(const string& handle, const NamedTensorList& inputs,
   ExecutorsAndKeys* executors_and_keys;
   RunState* run_state;
   {
-    mutex_lock l(executor_lock_);  // could use reader lock
-    auto exc_it = executors_.find(key);
-    if (exc_it == executors_.end()) {
+    ExecutorsEntry entry;
+    if (!FindExecutors(key, &entry)) {
       return errors::InvalidArgument(
           "Must run 'setup' before performing partial runs!");
     }
-    executors_and_keys = exc_it->second.get();
+    executors_and_keys = entry.executors_and_keys.get();
 
+    mutex_lock l(executor_lock_);
     auto prun_it = partial_runs_.find(handle);
     if (prun_it == partial_runs_.end()) {
       return errors::InvalidArgument(
@@ -1060,7 +1287,7 @@ Status DirectSession::CheckFetch(const NamedTensorList& feeds,
 Status DirectSession::GetOrCreateExecutors(
     gtl::ArraySlice<string> inputs, gtl::ArraySlice<string> outputs,
     gtl::ArraySlice<string> target_nodes, ExecutorsAndKeys** executors_and_keys,
-    RunStateArgs* run_state_args) {
+    RunStateArgs* run_state_args, const CallFrameBinding** binding) {
   int64 handle_name_counter_value = -1;
   if (LogMemory::IsEnabled() || run_state_args->is_partial_run) {
     handle_name_counter_value = handle_name_counter_.fetch_add(1);
@@ -1084,13 +1311,14 @@ Status DirectSession::GetOrCreateExecutors(
   }
 
   // See if we already have the executors for this run.
-  {
-    mutex_lock l(executor_lock_);  // could use reader lock
-    auto it = executors_.find(key);
-    if (it != executors_.end()) {
-      *executors_and_keys = it->second.get();
-      return Status::OK();
+  ExecutorsEntry entry;
+  if (FindExecutors(key, &entry) &&
+      (entry.binding != nullptr || run_state_args->is_partial_run)) {
+    *executors_and_keys = entry.executors_and_keys.get();
+    if (binding != nullptr) {
+      *binding = entry.binding.get();
     }
+    return Status::OK();
   }
 
   // Slow lookup path, the unsorted key missed the cache.
@@ -1117,15 +1345,16 @@ Status DirectSession::GetOrCreateExecutors(
   }
 
   // See if we already have the executors for this run.
-  {
+  if (FindExecutors(sorted_key, &entry)) {
+    // Insert this under the original key.
     mutex_lock l(executor_lock_);
-    auto it = executors_.find(sorted_key);
-    if (it != executors_.end()) {
-      *executors_and_keys = it->second.get();
-      // Insert this under the original key.
-      executors_.emplace(key, it->second);
-      return Status::OK();
+    entry = InsertExecutors(sorted_key, key, entry.executors_and_keys, inputs,
+                            outputs, run_state_args->is_partial_run);
+    *executors_and_keys = entry.executors_and_keys.get();
+    if (binding != nullptr) {
+      *binding = entry.binding.get();
     }
+    return Status::OK();
   }
 
   // Nothing found, so create the executors and store in the cache.
@@ -1226,6 +1455,8 @@ Status DirectSession::GetOrCreateExecutors(
       }
     };
     params.node_outputs_cb = node_outputs_callback_;
+    params.ready_queue_policy =
+        options_.config.salus_options().ready_queue_policy();
 
     optimizer.Optimize(lib, options_.env, device, &iter->second,
                        /*shape_map=*/nullptr);
@@ -1286,16 +1517,111 @@ Status DirectSession::GetOrCreateExecutors(
   mutex_lock l(executor_lock_);
 
   // Another thread may have created the entry before us, in which case we will
-  // reuse the already created one.
-  auto insert_result = executors_.emplace(sorted_key, ek);
-  // Insert the value under the original key, so the fast path lookup will work
-  // if the user uses the same order of inputs, outputs, and targets again.
-  executors_.emplace(key, insert_result.first->second);
-  *executors_and_keys = insert_result.first->second.get();
+  // reuse the already created one. The value is inserted under the original
+  // key too, so the fast path lookup will work if the user uses the same order
+  // of inputs, outputs, and targets again.
+  entry = InsertExecutors(sorted_key, key, std::move(ek), inputs, outputs,
+                          run_state_args->is_partial_run);
+  *executors_and_keys = entry.executors_and_keys.get();
+  if (binding != nullptr) {
+    *binding = entry.binding.get();
+  }
+
+  return Status::OK();
+}
 
+namespace {
+
+// Resolves 'inputs' and 'outputs' to their indices in the call frame, so that
+// running the step needs no lookups by name.
+Status BindCallFrame(
+    const std::unordered_map<string, size_t>& input_name_to_index,
+    const std::unordered_map<string, size_t>& output_name_to_index,
+    gtl::ArraySlice<string> inputs, gtl::ArraySlice<string> outputs,
+    std::vector<size_t>* feed_to_arg, std::vector<size_t>* fetch_to_retval) {
+  feed_to_arg->reserve(inputs.size());
+  for (const string& input : inputs) {
+    auto it = input_name_to_index.find(input);
+    if (it == input_name_to_index.end()) {
+      return errors::Internal("No argument for feed ", input);
+    }
+    feed_to_arg->push_back(it->second);
+  }
+  fetch_to_retval->reserve(outputs.size());
+  for (const string& output : outputs) {
+    auto it = output_name_to_index.find(output);
+    if (it == output_name_to_index.end()) {
+      return errors::Internal("No return value for fetch ", output);
+    }
+    fetch_to_retval->push_back(it->second);
+  }
   return Status::OK();
 }
 
+}  // namespace
+
+std::shared_ptr<const DirectSession::ExecutorsMap>
+DirectSession::LoadExecutors() const {
+  return std::atomic_load(&executors_);
+}
+
+bool DirectSession::FindExecutors(const string& key,
+                                  ExecutorsEntry* entry) const {
+  std::shared_ptr<const ExecutorsMap> executors = LoadExecutors();
+  auto it = executors->find(key);
+  if (it == executors->end()) {
+    return false;
+  }
+  *entry = it->second;
+  return true;
+}
+
+DirectSession::ExecutorsEntry DirectSession::InsertExecutors(
+    const string& sorted_key, const string& key,
+    std::shared_ptr<ExecutorsAndKeys> ek, gtl::ArraySlice<string> inputs,
+    gtl::ArraySlice<string> outputs, bool is_partial_run) {
+  std::shared_ptr<const ExecutorsMap> current = LoadExecutors();
+  auto it = current->find(key);
+  if (it != current->end() &&
+      (it->second.binding != nullptr || is_partial_run)) {
+    return it->second;
+  }
+
+  std::unique_ptr<ExecutorsMap> updated(new ExecutorsMap(*current));
+  // The executors under the sorted key win, whoever created them.
+  auto sorted_it = updated->find(sorted_key);
+  if (sorted_it != updated->end()) {
+    ek = sorted_it->second.executors_and_keys;
+  }
+
+  ExecutorsEntry entry;
+  entry.executors_and_keys = std::move(ek);
+  if (!is_partial_run) {
+    // Partial runs feed and fetch through the rendezvous instead.
+    std::unique_ptr<CallFrameBinding> binding(new CallFrameBinding);
+    // The names were used to build the executors, so they are all there.
+    TF_CHECK_OK(BindCallFrame(entry.executors_and_keys->input_name_to_index,
+                              entry.executors_and_keys->output_name_to_index,
+                              inputs, outputs, &binding->feed_to_arg,
+                              &binding->fetch_to_retval));
+    binding->duplicate_fetches =
+        outputs.size() !=
+        entry.executors_and_keys->output_name_to_index.size();
+    entry.binding = std::move(binding);
+  }
+
+  if (sorted_it == updated->end() && sorted_key != key) {
+    // Gets its binding once a run uses the sorted order.
+    updated->emplace(sorted_key,
+                     ExecutorsEntry{entry.executors_and_keys, nullptr});
+  }
+  (*updated)[key] = entry;
+
+  std::atomic_store(&executors_,
+                    std::shared_ptr<const ExecutorsMap>(std::move(updated)));
+  return entry;
+}
+
 Status DirectSession::CreateGraphs(
     const BuildGraphOptions& subgraph_options,
     std::unordered_map<string, std::unique_ptr<Graph>>* outputs,
@@ -1467,12 +1793,28 @@ Status DirectSession::CreateGraphs(
   return ::tensorflow::Status::OK();
 }
 
+::tensorflow::Status DirectSession::LastCompactTrace(StepStats* step_stats) {
+  std::shared_ptr<StepTrace> step_trace;
+  {
+    mutex_lock l(step_trace_lock_);
+    step_trace = last_step_trace_;
+  }
+  if (!step_trace) {
+    return errors::NotFound("No step was sampled for a compact trace");
+  }
+  if (!step_trace->ToStepStats(step_stats)) {
+    return errors::DataLoss(
+        "The compact trace of the last sampled step is incomplete");
+  }
+  return ::tensorflow::Status::OK();
+}
+
 ::tensorflow::Status DirectSession::Close() {
   cancellation_manager_->StartCancel();
   {
     mutex_lock l(closed_lock_);
     if (closed_) return ::tensorflow::Status::OK();
-    closed_ = true;
+    closed_.store(true, std::memory_order_release);
   }
   if (factory_ != nullptr) factory_->Deregister(this);
   return ::tensorflow::Status::OK();
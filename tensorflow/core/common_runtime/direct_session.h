@@ -50,6 +50,8 @@ class CostModel;
 class DebugGateway;
 class Device;
 class DirectSessionFactory;
+class StepStats;
+class StepTrace;
 
 class DirectSession : public Session {
  public:
@@ -91,6 +93,17 @@ class DirectSession : public Session {
                             const std::vector<string>& output_names,
                             std::vector<Tensor>* outputs) override;
 
+  // NOTE: Experimental and subject to change. RunCallable takes no locks and
+  // does no work by name, unless it traces or the callable has debug
+  // options.
+  ::tensorflow::Status MakeCallable(const CallableOptions& callable_options,
+                                    CallableHandle* out_handle) override;
+  ::tensorflow::Status RunCallable(CallableHandle handle,
+                                   const std::vector<Tensor>& feed_tensors,
+                                   std::vector<Tensor>* fetch_tensors,
+                                   RunMetadata* run_metadata) override;
+  ::tensorflow::Status ReleaseCallable(CallableHandle handle) override;
+
   // Reset clears 'containers' from the device_mgr of the DirectSession.
   // If 'containers' is empty, then Reset clears the default container.
   ::tensorflow::Status Reset(const std::vector<string>& containers);
@@ -107,6 +120,11 @@ class DirectSession : public Session {
     cost_model_manager_.ExportCostModels(cost_models);
   }
 
+  // Converts the compact trace of the last step sampled by
+  // GraphOptions.compact_trace_steps to "step_stats". Returns NotFound if no
+  // step was sampled yet, and DataLoss if later steps overwrote part of it.
+  ::tensorflow::Status LastCompactTrace(StepStats* step_stats);
+
  private:
   // We create one executor and its dependent library runtime for
   // every partition.
@@ -176,6 +194,49 @@ class DirectSession : public Session {
     ~RunState();
   };
 
+  // Feeds and fetches, in the order a caller passes them, resolved to the
+  // arguments and return values of the call frame.
+  struct CallFrameBinding {
+    // Feed i is argument feed_to_arg[i].
+    std::vector<size_t> feed_to_arg;
+    // Fetch i is return value fetch_to_retval[i].
+    std::vector<size_t> fetch_to_retval;
+    // Whether some return value is fetched more than once.
+    bool duplicate_fetches = false;
+  };
+
+  // An entry of the executor cache. The executors are a shared_ptr since
+  // multiple keys can point to the same ExecutorsAndKeys. The binding is
+  // for the order of feeds and fetches in the key, and null for partial runs.
+  struct ExecutorsEntry {
+    std::shared_ptr<ExecutorsAndKeys> executors_and_keys;
+    std::shared_ptr<const CallFrameBinding> binding;
+  };
+
+  // Maps signatures to the executors that process them.
+  typedef std::unordered_map<string, ExecutorsEntry> ExecutorsMap;
+
+  // A callable made by MakeCallable.
+  struct Callable {
+    CallableOptions options;
+    ExecutorsAndKeys* executors_and_keys = nullptr;  // not owned.
+    const CallFrameBinding* binding = nullptr;       // not owned.
+    std::vector<string> fetch_names;
+    // Set if memory logging was enabled when the callable was made.
+    string handle;
+  };
+
+  // Where a callable is published for RunCallable.
+  struct CallableSlot {
+    // The callable, owned by the session. Null while the slot is free or its
+    // callable was released.
+    std::atomic<Callable*> callable{nullptr};
+    // Bumped each time the slot is reused.
+    std::atomic<int64> generation{0};
+    // Number of RunCallable calls looking at the slot.
+    std::atomic<int64> users{0};
+  };
+
   struct RunStateArgs {
     RunStateArgs(const DebugOptions& options) : debug_options(options) {}
 
@@ -192,11 +253,52 @@ class DirectSession : public Session {
       EXCLUSIVE_LOCKS_REQUIRED(graph_def_lock_);
 
   // Retrieves an already existing set of executors to run 'inputs' and
-  // 'outputs', or creates and caches them for future use.
+  // 'outputs', or creates and caches them for future use. Unless this is a
+  // partial run, '*binding' is set to where 'inputs' and 'outputs' are in the
+  // call frame. Both stay valid as long as the session.
   ::tensorflow::Status GetOrCreateExecutors(
       gtl::ArraySlice<string> inputs, gtl::ArraySlice<string> outputs,
       gtl::ArraySlice<string> target_nodes,
-      ExecutorsAndKeys** executors_and_keys, RunStateArgs* run_state_args);
+      ExecutorsAndKeys** executors_and_keys, RunStateArgs* run_state_args,
+      const CallFrameBinding** binding = nullptr);
+
+  // Snapshot of executors_, without taking executor_lock_.
+  std::shared_ptr<const ExecutorsMap> LoadExecutors() const;
+
+  // Lookup in executors_ without taking executor_lock_. Returns false if
+  // 'key' is not cached.
+  bool FindExecutors(const string& key, ExecutorsEntry* entry) const;
+
+  // Publishes a copy of executors_ with 'ek' under 'sorted_key', unless
+  // another entry is already there, and the entry under 'key' too, bound to
+  // 'inputs' and 'outputs' unless this is a partial run. Returns the entry
+  // under 'key'.
+  ExecutorsEntry InsertExecutors(const string& sorted_key, const string& key,
+                                 std::shared_ptr<ExecutorsAndKeys> ek,
+                                 gtl::ArraySlice<string> inputs,
+                                 gtl::ArraySlice<string> outputs,
+                                 bool is_partial_run)
+      EXCLUSIVE_LOCKS_REQUIRED(executor_lock_);
+
+  // Runs one step of 'executors_and_keys', with feeds and fetches passed in
+  // 'call_frame'. Saves the tensors of 'output_names' that the step chose to
+  // keep.
+  ::tensorflow::Status RunInternal(int64 step_id,
+                                   const RunOptions& run_options,
+                                   FunctionCallFrame* call_frame,
+                                   ExecutorsAndKeys* executors_and_keys,
+                                   int64 executor_step_count,
+                                   const string& handle,
+                                   const std::vector<string>& output_names,
+                                   RunMetadata* run_metadata);
+
+  // Lock-free lookup in callable_blocks_ of the slot of 'handle', nullptr if
+  // it is out of range. The slot may hold another callable, or none.
+  CallableSlot* FindCallableSlot(CallableHandle handle);
+
+  // Deletes the released callables no RunCallable uses any more, and frees
+  // their slots.
+  void ReclaimCallables() EXCLUSIVE_LOCKS_REQUIRED(callables_lock_);
 
   // Creates several graphs given the existing graph_def_ and the
   // input feeds and fetches, given 'devices'. The graphs share a common
@@ -244,8 +346,9 @@ class DirectSession : public Session {
                            int64 timeout_in_ms);
 
   ::tensorflow::Status CheckNotClosed() {
-    mutex_lock l(closed_lock_);
-    if (closed_) return errors::Cancelled("Session has been closed.");
+    if (closed_.load(std::memory_order_acquire)) {
+      return errors::Cancelled("Session has been closed.");
+    }
     return ::tensorflow::Status::OK();
   }
 
@@ -283,19 +386,42 @@ class DirectSession : public Session {
   // Schedules 'c' for execution on pool.
   void SchedClosure(thread::ThreadPool* pool, std::function<void()> c);
 
-  mutex executor_lock_;  // protects executors_
-  // Holds mappings from signature to the executors that process
-  // it. The reason for a level of indirection around mapped_type is
-  // to guarantee address stability.
-  // The map value is a shared_ptr since multiple map keys can point to the
-  // same ExecutorsAndKey object.
-  std::unordered_map<string, std::shared_ptr<ExecutorsAndKeys>> executors_
-      GUARDED_BY(executor_lock_);
+  mutex executor_lock_;  // serializes updates of executors_
+  // The current ExecutorsMap, only accessed through std::atomic_load and
+  // std::atomic_store. Updates copy the map and publish the copy, and a
+  // replaced version is freed once the last reader drops its snapshot.
+  // Entries are never removed, so the executors and bindings they point to
+  // live as long as the session.
+  std::shared_ptr<const ExecutorsMap> executors_;
 
   // Holds mappings from handle to partial run state.
   std::unordered_map<string, std::unique_ptr<RunState>> partial_runs_
       GUARDED_BY(executor_lock_);
 
+  // Callables by slot, in blocks of kCallableBlockSize slots. Blocks are
+  // published once and never freed before the session, so that RunCallable
+  // looks up a handle without a lock. A handle is the slot index plus its
+  // generation times kMaxCallables, so that handles of released callables
+  // stay invalid once their slot is reused.
+  //
+  // A released callable is unpublished, and deleted once no RunCallable uses
+  // its slot any more, at which point the slot is reused.
+  static constexpr int64 kCallableBlockSize = 1024;
+  static constexpr int64 kMaxCallableBlocks = 1024;
+  static constexpr int64 kMaxCallables =
+      kCallableBlockSize * kMaxCallableBlocks;
+  std::atomic<CallableSlot*> callable_blocks_[kMaxCallableBlocks] = {};
+  mutex callables_lock_;
+  std::vector<std::unique_ptr<CallableSlot[]>> callable_storage_
+      GUARDED_BY(callables_lock_);
+  // Number of slots used so far.
+  int64 num_callable_slots_ GUARDED_BY(callables_lock_) = 0;
+  // Slots whose callable was released and deleted, reused first.
+  std::vector<int64> free_callable_slots_ GUARDED_BY(callables_lock_);
+  // Released callables a RunCallable may still use, with their slot.
+  std::vector<std::pair<int64, std::unique_ptr<Callable>>> released_callables_
+      GUARDED_BY(callables_lock_);
+
   // This holds all the tensors that are currently alive in the session.
   SessionState session_state_;
 
@@ -319,8 +445,9 @@ class DirectSession : public Session {
   std::unique_ptr<FunctionLibraryDefinition> flib_def_;
 
   // true if the Session has been Closed.
+  // closed_ is set under closed_lock_, but read without it.
   mutex closed_lock_;
-  bool closed_ GUARDED_BY(closed_lock_) = false;
+  std::atomic<bool> closed_{false};
 
   // For generating unique names for this session instance.
   std::atomic<int64> edge_name_counter_ = {0};
@@ -335,6 +462,9 @@ class DirectSession : public Session {
   // Manages all the cost models for the graphs executed in this session.
   CostModelManager cost_model_manager_;
 
+  mutex step_trace_lock_;
+  std::shared_ptr<StepTrace> last_step_trace_ GUARDED_BY(step_trace_lock_);
+
   Executor::Args::NodeOutputsCallback node_outputs_callback_ = nullptr;
 
   TF_DISALLOW_COPY_AND_ASSIGN(DirectSession);
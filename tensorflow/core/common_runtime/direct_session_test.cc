@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "tensorflow/core/common_runtime/direct_session.h"
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <string>
@@ -436,6 +437,152 @@ TEST(DirectSessionTest, FetchMultipleTimes) {
   }
 }
 
+TEST_F(DirectSessionMinusAXTest, RunCallable) {
+  Initialize({1, 2, 3, 4});
+  auto session = CreateSession();
+  ASSERT_TRUE(session != nullptr);
+  TF_ASSERT_OK(session->Create(def_));
+
+  // Fetch y twice, and y_neg once.
+  CallableOptions callable_options;
+  callable_options.add_feed(x_);
+  callable_options.add_fetch(y_ + ":0");
+  callable_options.add_fetch(y_neg_ + ":0");
+  callable_options.add_fetch(y_ + ":0");
+  Session::CallableHandle handle;
+  TF_ASSERT_OK(session->MakeCallable(callable_options, &handle));
+
+  for (int i = 0; i < 2; ++i) {
+    Tensor t(DT_FLOAT, TensorShape({2, 1}));
+    t.matrix<float>()(0, 0) = 5 + i;
+    t.matrix<float>()(1, 0) = 6;
+    std::vector<Tensor> outputs;
+    TF_ASSERT_OK(session->RunCallable(handle, {t}, &outputs, nullptr));
+    ASSERT_EQ(3, outputs.size());
+    EXPECT_FLOAT_EQ(17.0 + i, outputs[0].matrix<float>()(0, 0));
+    EXPECT_FLOAT_EQ(39.0 + 3 * i, outputs[0].matrix<float>()(1, 0));
+    EXPECT_FLOAT_EQ(-17.0 - i, outputs[1].matrix<float>()(0, 0));
+    EXPECT_FLOAT_EQ(17.0 + i, outputs[2].matrix<float>()(0, 0));
+  }
+
+  // Wrong number of feeds.
+  std::vector<Tensor> outputs;
+  EXPECT_TRUE(errors::IsInvalidArgument(
+      session->RunCallable(handle, {}, &outputs, nullptr)));
+
+  TF_ASSERT_OK(session->ReleaseCallable(handle));
+  EXPECT_TRUE(errors::IsInvalidArgument(
+      session->RunCallable(handle, {}, &outputs, nullptr)));
+  EXPECT_TRUE(errors::IsInvalidArgument(session->ReleaseCallable(handle)));
+  EXPECT_TRUE(errors::IsInvalidArgument(
+      session->RunCallable(handle + 1, {}, &outputs, nullptr)));
+}
+
+TEST_F(DirectSessionMinusAXTest, MakeCallableRejectsDuplicateFeeds) {
+  Initialize({1, 2, 3, 4});
+  auto session = CreateSession();
+  ASSERT_TRUE(session != nullptr);
+  TF_ASSERT_OK(session->Create(def_));
+
+  CallableOptions callable_options;
+  callable_options.add_feed(x_);
+  callable_options.add_feed(x_);
+  callable_options.add_fetch(y_ + ":0");
+  Session::CallableHandle handle;
+  EXPECT_TRUE(errors::IsInvalidArgument(
+      session->MakeCallable(callable_options, &handle)));
+}
+
+TEST_F(DirectSessionMinusAXTest, RunCallableConcurrently) {
+  Initialize({1, 2, 3, 4});
+  auto session = CreateSession();
+  ASSERT_TRUE(session != nullptr);
+  TF_ASSERT_OK(session->Create(def_));
+
+  // Many callables, so that they span more than one block of handles.
+  std::vector<Session::CallableHandle> handles(1500);
+  for (auto& handle : handles) {
+    CallableOptions callable_options;
+    callable_options.add_fetch(y_ + ":0");
+    TF_ASSERT_OK(session->MakeCallable(callable_options, &handle));
+  }
+  {
+    thread::ThreadPool tp(Env::Default(), "test", 4);
+    for (int i = 0; i < 4; ++i) {
+      tp.Schedule([&session, &handles, i]() {
+        for (int j = i; j < handles.size(); j += 4) {
+          std::vector<Tensor> outputs;
+          TF_EXPECT_OK(
+              session->RunCallable(handles[j], {}, &outputs, nullptr));
+          ASSERT_EQ(1, outputs.size());
+          EXPECT_FLOAT_EQ(3.0, outputs[0].matrix<float>()(0, 0));
+        }
+      });
+    }
+  }
+  for (auto handle : handles) {
+    TF_EXPECT_OK(session->ReleaseCallable(handle));
+  }
+}
+
+TEST_F(DirectSessionMinusAXTest, ReleasedCallablesAreReclaimed) {
+  Initialize({1, 2, 3, 4});
+  auto session = CreateSession();
+  ASSERT_TRUE(session != nullptr);
+  TF_ASSERT_OK(session->Create(def_));
+
+  CallableOptions callable_options;
+  callable_options.add_fetch(y_ + ":0");
+  Session::CallableHandle first;
+  TF_ASSERT_OK(session->MakeCallable(callable_options, &first));
+  TF_ASSERT_OK(session->ReleaseCallable(first));
+
+  // More callables than fit in a block of handles, made and released one at
+  // a time, all in the first slot but with distinct handles.
+  std::vector<Session::CallableHandle> handles;
+  std::vector<Tensor> outputs;
+  for (int i = 0; i < 2000; ++i) {
+    Session::CallableHandle handle;
+    TF_ASSERT_OK(session->MakeCallable(callable_options, &handle));
+    ASSERT_EQ(first % 1024, handle % 1024);
+    TF_ASSERT_OK(session->RunCallable(handle, {}, &outputs, nullptr));
+    EXPECT_FLOAT_EQ(3.0, outputs[0].matrix<float>()(0, 0));
+    TF_ASSERT_OK(session->ReleaseCallable(handle));
+    handles.push_back(handle);
+  }
+  std::sort(handles.begin(), handles.end());
+  EXPECT_TRUE(std::adjacent_find(handles.begin(), handles.end()) ==
+              handles.end());
+
+  // Handles of released callables stay invalid once their slot is reused.
+  Session::CallableHandle live;
+  TF_ASSERT_OK(session->MakeCallable(callable_options, &live));
+  EXPECT_TRUE(errors::IsInvalidArgument(
+      session->RunCallable(first, {}, &outputs, nullptr)));
+  EXPECT_TRUE(errors::IsInvalidArgument(session->ReleaseCallable(first)));
+  TF_ASSERT_OK(session->RunCallable(live, {}, &outputs, nullptr));
+  EXPECT_FLOAT_EQ(3.0, outputs[0].matrix<float>()(0, 0));
+
+  // Making and releasing callables from many threads.
+  {
+    thread::ThreadPool tp(Env::Default(), "test", 4);
+    for (int i = 0; i < 4; ++i) {
+      tp.Schedule([&session, &callable_options]() {
+        for (int j = 0; j < 100; ++j) {
+          Session::CallableHandle handle;
+          TF_EXPECT_OK(session->MakeCallable(callable_options, &handle));
+          std::vector<Tensor> outputs;
+          TF_EXPECT_OK(session->RunCallable(handle, {}, &outputs, nullptr));
+          TF_EXPECT_OK(session->ReleaseCallable(handle));
+          Status s = session->RunCallable(handle, {}, &outputs, nullptr);
+          EXPECT_TRUE(errors::IsInvalidArgument(s)) << s;
+        }
+      });
+    }
+  }
+  TF_EXPECT_OK(session->ReleaseCallable(live));
+}
+
 REGISTER_OP("Darth")
     .Input("x: float")
     .Output("y: float")
@@ -1265,7 +1412,7 @@ TEST(DirectSessionTest, LocalDeviceManager) {
 
 // A simple benchmark for the overhead of `DirectSession::Run()` calls
 // with varying numbers of feeds/fetches.
-void FeedFetchBenchmarkHelper(int num_feeds, int iters) {
+void FeedFetchBenchmarkHelper(int num_feeds, int iters, bool use_callable) {
   testing::StopTiming();
 
   Tensor value(DT_FLOAT, TensorShape());
@@ -1311,6 +1458,28 @@ void FeedFetchBenchmarkHelper(int num_feeds, int iters) {
     std::vector<Tensor> output_values;
     TF_CHECK_OK(session->Run(inputs, outputs, {}, &output_values));
   }
+  if (use_callable) {
+    CallableOptions callable_options;
+    std::vector<Tensor> input_tensors;
+    for (const auto& input : inputs) {
+      callable_options.add_feed(input.first);
+      input_tensors.push_back(input.second);
+    }
+    for (const string& output : outputs) {
+      callable_options.add_fetch(output);
+    }
+    Session::CallableHandle handle;
+    TF_CHECK_OK(session->MakeCallable(callable_options, &handle));
+    testing::StartTiming();
+    for (int i = 0; i < iters; ++i) {
+      std::vector<Tensor> output_values;
+      TF_CHECK_OK(
+          session->RunCallable(handle, input_tensors, &output_values, nullptr));
+    }
+    testing::StopTiming();
+    TF_CHECK_OK(session->ReleaseCallable(handle));
+    return;
+  }
   testing::StartTiming();
   for (int i = 0; i < iters; ++i) {
     std::vector<Tensor> output_values;
@@ -1320,10 +1489,73 @@ void FeedFetchBenchmarkHelper(int num_feeds, int iters) {
 }
 
 void BM_FeedFetch(int iters, int num_feeds) {
-  FeedFetchBenchmarkHelper(iters, num_feeds);
+  FeedFetchBenchmarkHelper(num_feeds, iters, false);
+}
+void BM_FeedFetchCallable(int iters, int num_feeds) {
+  FeedFetchBenchmarkHelper(num_feeds, iters, true);
 }
 
-BENCHMARK(BM_FeedFetch)->Arg(1)->Arg(2)->Arg(5)->Arg(10);
+BENCHMARK(BM_FeedFetch)->Arg(1)->Arg(2)->Arg(5)->Arg(10)->Arg(100)->Arg(500);
+BENCHMARK(BM_FeedFetchCallable)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(5)
+    ->Arg(10)
+    ->Arg(100)
+    ->Arg(500);
+
+// Runs a chain of small adds, with a compact trace of one step in
+// "compact_trace_steps", or of none if 0, to measure the overhead of tracing
+// on whole steps.
+void BM_CompactTrace(int iters, int compact_trace_steps) {
+  testing::StopTiming();
+  const int kNodes = 200;
+  Graph g(OpRegistry::Global());
+  Node* x;
+  TF_CHECK_OK(NodeBuilder(g.NewName("Placeholder"), "Placeholder")
+                  .Attr("shape", TensorShape({64}))
+                  .Attr("dtype", DT_FLOAT)
+                  .Device("/cpu:0")
+                  .Finalize(&g, &x));
+  Node* y = x;
+  for (int i = 0; i < kNodes; ++i) {
+    y = test::graph::Add(&g, y, x);
+  }
+  GraphDef gd;
+  g.ToGraphDef(&gd);
+
+  SessionOptions opts;
+  // Keep every add in the graph that runs.
+  opts.config.mutable_graph_options()
+      ->mutable_optimizer_options()
+      ->set_opt_level(OptimizerOptions_Level_L0);
+  opts.config.mutable_graph_options()
+      ->mutable_rewrite_options()
+      ->set_constant_folding(RewriterConfig::OFF);
+  opts.config.mutable_graph_options()
+      ->mutable_rewrite_options()
+      ->set_arithmetic_optimization(RewriterConfig::OFF);
+  opts.config.mutable_graph_options()->set_compact_trace_steps(
+      compact_trace_steps);
+  std::unique_ptr<Session> session(NewSession(opts));
+  TF_CHECK_OK(session->Create(gd));
+
+  Tensor value(DT_FLOAT, TensorShape({64}));
+  value.flat<float>().setConstant(1.0);
+  const std::vector<std::pair<string, Tensor>> inputs = {
+      {x->name() + ":0", value}};
+  const std::vector<string> outputs = {y->name() + ":0"};
+  std::vector<Tensor> output_values;
+  // Leave the first run, which prunes and partitions the graph, out.
+  TF_CHECK_OK(session->Run(inputs, outputs, {}, &output_values));
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    TF_CHECK_OK(session->Run(inputs, outputs, {}, &output_values));
+  }
+  testing::StopTiming();
+  testing::ItemsProcessed(static_cast<int64>(iters) * kNodes);
+}
+BENCHMARK(BM_CompactTrace)->Arg(0)->Arg(1)->Arg(100);
 
 }  // namespace
 }  // namespace tensorflow
@@ -22,9 +22,12 @@ limitations under the License.
 #include <unordered_map>
 #include <vector>
 
+#include "tensorflow/core/common_runtime/allocation_planner.h"
 #include "tensorflow/core/common_runtime/costmodel_manager.h"
 #include "tensorflow/core/common_runtime/pending_counts.h"
+#include "tensorflow/core/common_runtime/ready_queue_policy.h"
 #include "tensorflow/core/common_runtime/step_stats_collector.h"
+#include "tensorflow/core/common_runtime/step_trace.h"
 #include "tensorflow/core/framework/allocation_description.pb.h"
 #include "tensorflow/core/framework/allocator.h"
 #include "tensorflow/core/framework/cancellation.h"
@@ -355,6 +358,9 @@ class ExecutorImpl : public Executor {
     for (auto fiter : frame_info_) {
       delete fiter.second;
     }
+    if (planner_) {
+      planner_->Unref();
+    }
     delete graph_;
   }
 
@@ -425,6 +431,19 @@ class ExecutorImpl : public Executor {
   // A cached value of params_
   bool device_record_tensor_accesses_ = false;
 
+  // Serves allocations from a plan once the graph is traced. Null if
+  // disabled.
+  AllocationPlanner* planner_ = nullptr;
+
+  // Orders the ready set. Null for FIFO.
+  std::unique_ptr<ReadyQueuePolicy> ready_policy_;
+
+  // Node names by id, for the steps with a StepTrace. Built by the first one.
+  std::shared_ptr<const StepTrace::NodeNames> TraceNodeNames() const;
+  mutable mutex trace_names_mu_;
+  mutable std::shared_ptr<const StepTrace::NodeNames> trace_names_
+      GUARDED_BY(trace_names_mu_);
+
   // Root nodes (with no in edges) that should form the initial ready queue
   std::vector<const Node*> root_nodes_;
 
@@ -731,6 +750,24 @@ Status ExecutorImpl::Initialize() {
   // all nodes.
   InitializePending(graph_, cf_info);
 
+  // Planned allocations are keyed by node, so every node must run at most
+  // once per step, i.e. there must be no loops.
+  int64 plan_steps = params_.allocation_plan_steps;
+  if (plan_steps < 0) {
+    TF_RETURN_IF_ERROR(
+        ReadInt64FromEnvVar("TF_EXECUTOR_ALLOCATION_PLAN_STEPS", 0, &plan_steps));
+  }
+  if (plan_steps > 0 && cf_info.unique_frame_names.size() == 1) {
+    Allocator* base = params_.device->GetStepAllocator(
+        AllocatorAttributes(), params_.device->resource_manager());
+    planner_ = new AllocationPlanner(base, graph_->num_node_ids(),
+                                     static_cast<int>(plan_steps));
+  }
+
+  ready_policy_ = NewReadyQueuePolicy(
+      params_.ready_queue_policy, graph_,
+      [this](int id) { return gview_.node(id)->kernel_is_expensive; });
+
   return gview_.SetAllocAttrs(graph_, params_.device);
 }
 
@@ -1240,6 +1277,13 @@ class ExecutorState {
   CancellationManager* cancellation_manager_;
   Executor::Args::Runner runner_;
   bool sync_on_finish_;
+  // Whether this step uses impl_->planner_.
+  bool planned_ = false;
+  // Snapshot of impl_->ready_policy_ for this step, null for FIFO.
+  std::shared_ptr<const ReadyQueuePolicy::Priorities> priorities_;
+  // Not owned. Null unless this step is sampled for a compact trace.
+  StepTrace* step_trace_;
+  int trace_partition_ = -1;
 
   // Owned.
 
@@ -1298,6 +1342,9 @@ class ExecutorState {
   Status ProcessOutputs(const NodeItem& item, OpKernelContext* ctx,
                         EntryVector* outputs, NodeExecStatsWrapper* stats);
 
+  // Records node "id" in step_trace_, with the bytes of its outputs.
+  void RecordTrace(int id, uint64 start, const EntryVector& outputs);
+
   // After processing the outputs, propagates the outputs to their dsts.
   // Contents of *outputs are left in an indeterminate state after
   // returning from this method.
@@ -1359,7 +1406,16 @@ ExecutorState::ExecutorState(const Executor::Args& args, ExecutorImpl* impl)
       cancellation_manager_(args.cancellation_manager),
       runner_(args.runner),
       sync_on_finish_(args.sync_on_finish),
+      step_trace_(args.step_trace),
       num_outstanding_ops_(0) {
+  if (impl_->ready_policy_) {
+    priorities_ = impl_->ready_policy_->priorities();
+  }
+  if (step_trace_) {
+    trace_partition_ = step_trace_->AddPartition(impl_->params_.device->name(),
+                                                 impl_->TraceNodeNames());
+  }
+
   // We start the entire execution in iteration 0 of the root frame
   // so let us create the root frame and the state for iteration 0.
   // We assume root_frame_->frame_name.empty().
@@ -1467,6 +1523,19 @@ void ExecutorImpl::InitializePending(const Graph* graph,
   }
 }
 
+std::shared_ptr<const StepTrace::NodeNames> ExecutorImpl::TraceNodeNames()
+    const {
+  mutex_lock l(trace_names_mu_);
+  if (!trace_names_) {
+    auto names = std::make_shared<StepTrace::NodeNames>(graph_->num_node_ids());
+    for (const Node* n : graph_->nodes()) {
+      (*names)[n->id()] = n->name();
+    }
+    trace_names_ = std::move(names);
+  }
+  return trace_names_;
+}
+
 void ExecutorState::RunAsync(Executor::DoneCallback done) {
   const Graph* graph = impl_->graph_;
   TaggedNodeSeq ready;
@@ -1491,6 +1560,7 @@ void ExecutorState::RunAsync(Executor::DoneCallback done) {
     num_outstanding_ops_ = ready.size();
     root_frame_->iterations[0]->outstanding_ops = ready.size();
     done_cb_ = std::move(done);
+    planned_ = impl_->planner_ && impl_->planner_->BeginStep();
     // Schedule to run all the ready ops in thread pool.
     ScheduleReady(ready, nullptr);
   }
@@ -1505,7 +1575,7 @@ void ExecutorState::RunAsync(Executor::DoneCallback done) {
 struct ExecutorState::AsyncState {
   AsyncState(const OpKernelContext::Params& p, const TaggedNode& _tagged_node,
              const NodeItem* _item, Entry* _first_input,
-             NodeExecStatsWrapper* _stats)
+             NodeExecStatsWrapper* _stats, uint64 _trace_start)
       : saved_inputs(*p.inputs),
         saved_input_device_contexts(*p.input_device_contexts),
         saved_input_alloc_attrs(*p.input_alloc_attrs),
@@ -1516,7 +1586,8 @@ struct ExecutorState::AsyncState {
         // ParamsButClearingEigenGPUDevice does equivalent of
         //   params.eigen_gpu_device = nullptr;
         ctx(ParamsButClearingEigenGPUDevice(&params), item->num_outputs),
-        stats(_stats) {
+        stats(_stats),
+        trace_start(_trace_start) {
     params.inputs = &saved_inputs;
     params.input_device_contexts = &saved_input_device_contexts;
     params.input_alloc_attrs = &saved_input_alloc_attrs;
@@ -1531,6 +1602,7 @@ struct ExecutorState::AsyncState {
   Entry* first_input;
   OpKernelContext ctx;
   NodeExecStatsWrapper* stats;
+  uint64 trace_start;
 
  private:
   OpKernelContext::Params* ParamsButClearingEigenGPUDevice(
@@ -1575,6 +1647,7 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
 
   Status s;
   NodeExecStatsWrapper* stats = nullptr;
+  uint64 trace_start = 0;
   EntryVector outputs;
   bool completed = false;
   inline_ready.push_back(tagged_node);
@@ -1600,6 +1673,8 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
     }
 
     params.track_allocations = false;
+    params.planned_allocator =
+        planned_ ? impl_->planner_->ForNode(id) : nullptr;
     stats = nullptr;
     if (stats_collector_ && !tagged_node.is_dead) {
       // track allocations if and only if we are collecting statistics
@@ -1609,6 +1684,10 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
       nodestats::SetScheduled(stats, scheduled_usec);
       nodestats::SetAllStart(stats);
     }
+    const bool traced = step_trace_ && !tagged_node.is_dead;
+    if (traced) {
+      trace_start = StepTrace::Now();
+    }
 
     if (vlog_) {
       VLOG(1) << "Process node: " << id << " step " << params.step_id << " "
@@ -1657,7 +1736,8 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
         DCHECK(async != nullptr);
         launched_asynchronously = true;
         AsyncState* state =
-            new AsyncState(params, tagged_node, &item, first_input, stats);
+            new AsyncState(params, tagged_node, &item, first_input, stats,
+                           trace_start);
 
         auto done = [this, state]() {
           Device* device = impl_->params_.device;
@@ -1668,6 +1748,9 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
           EntryVector outputs;
           Status s = ProcessOutputs(*state->item, &state->ctx, &outputs, stats);
           nodestats::SetMemory(stats, &state->ctx);
+          if (step_trace_ && !state->tagged_node.is_dead) {
+            RecordTrace(state->item->node->id(), state->trace_start, outputs);
+          }
           if (vlog_) {
             VLOG(2) << "Async kernel done: " << state->item->node->id()
                     << " step " << step_id_ << " "
@@ -1718,6 +1801,9 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
           device_context = ctx.op_device_context();
         }
         nodestats::SetMemory(stats, &ctx);
+        if (traced) {
+          RecordTrace(id, trace_start, outputs);
+        }
       }
     }
 
@@ -1969,6 +2055,18 @@ Status ExecutorState::ProcessOutputs(const NodeItem& item, OpKernelContext* ctx,
   return s;
 }
 
+void ExecutorState::RecordTrace(int id, uint64 start,
+                                const EntryVector& outputs) {
+  int64 output_bytes = 0;
+  for (const Entry& out : outputs) {
+    if (out.val_field_is_set) {
+      output_bytes += out.val->TotalBytes();
+    }
+  }
+  step_trace_->Record(trace_partition_, id, start, StepTrace::Now(),
+                      output_bytes);
+}
+
 void ExecutorState::PropagateOutputs(const TaggedNode& tagged_node,
                                      const NodeItem* item, EntryVector* outputs,
                                      TaggedNodeSeq* ready) {
@@ -2085,6 +2183,9 @@ bool ExecutorState::NodeDone(const Status& s, const Node* node,
       }
   }
   nodestats::SetAllEnd(stats);
+  if (stats && impl_->ready_policy_ && s.ok()) {
+    impl_->ready_policy_->Record(node, *stats->stats());
+  }
   if (stats_collector_ != nullptr && !SetTimelineLabel(node, stats)) {
     // Only record non-transfer nodes.
     // Transfers 'stats' ownership to 'stats_collector_'.
@@ -2127,9 +2228,22 @@ bool ExecutorState::NodeDone(const Status& s, const Node* node,
   return completed;
 }
 
-void ExecutorState::ScheduleReady(const TaggedNodeSeq& ready,
+void ExecutorState::ScheduleReady(const TaggedNodeSeq& ready_in,
                                   TaggedNodeReadyQueue* inline_ready) {
-  if (ready.empty()) return;
+  if (ready_in.empty()) return;
+
+  // Highest priority first, otherwise in the order they became ready.
+  TaggedNodeSeq sorted;
+  if (priorities_ && ready_in.size() > 1) {
+    sorted = ready_in;
+    const auto& priorities = *priorities_;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&priorities](const TaggedNode& a, const TaggedNode& b) {
+                       return priorities[a.node->id()] >
+                              priorities[b.node->id()];
+                     });
+  }
+  const TaggedNodeSeq& ready = sorted.empty() ? ready_in : sorted;
 
   int64 scheduled_usec = 0;
   if (stats_collector_) {
@@ -2316,7 +2430,12 @@ void ExecutorState::Finish() {
     // the user until the step (and its side-effects) has actually completed.
     status = impl_->params_.device->Sync();
   }
+  // Tensors of the step are freed along with this.
+  AllocationPlanner* planner = planned_ ? impl_->planner_ : nullptr;
   delete this;
+  if (planner) {
+    planner->EndStep();
+  }
   CHECK(done_cb != nullptr);
   runner([=]() { done_cb(status); });
 }
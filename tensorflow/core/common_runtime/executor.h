@@ -25,10 +25,12 @@ limitations under the License.
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/protobuf/config.pb.h"
 
 namespace tensorflow {
 
 class StepStatsCollector;
+class StepTrace;
 
 // Executor runs a graph computation.
 // Example:
@@ -68,6 +70,10 @@ class Executor {
   // RunAsync() calls "stats_collector", if not null, to keep track of
   // stats. This allows us to collect statistics and traces on demand.
   //
+  // RunAsync() records the nodes it runs in "step_trace", if not null. This
+  // is much cheaper than "stats_collector", so that steps can be sampled all
+  // the time.
+  //
   // RunAsync() is provided a "call_frame", if the executor is used
   // for executing a function, is used to pass arguments and return
   // values between the caller and the callee.
@@ -84,6 +90,7 @@ class Executor {
     int64 step_id = 0;
     Rendezvous* rendezvous = nullptr;
     StepStatsCollector* stats_collector = nullptr;
+    StepTrace* step_trace = nullptr;
     CallFrameInterface* call_frame = nullptr;
     CancellationManager* cancellation_manager = nullptr;
     SessionState* session_state = nullptr;
@@ -141,6 +148,15 @@ struct LocalExecutorParams {
   std::function<void(OpKernel*)> delete_kernel;
 
   Executor::Args::NodeOutputsCallback node_outputs_cb;
+
+  // Number of steps to trace before serving allocations from a static plan,
+  // see AllocationPlanner. 0 disables it, and -1 reads the number from the
+  // TF_EXECUTOR_ALLOCATION_PLAN_STEPS environment variable.
+  int allocation_plan_steps = -1;
+
+  // How nodes that become ready at the same time are ordered, see
+  // ReadyQueuePolicy.
+  SalusOptions::ReadyQueuePolicy ready_queue_policy = SalusOptions::FIFO;
 };
 ::tensorflow::Status NewLocalExecutor(const LocalExecutorParams& params,
                                       const Graph* graph, Executor** executor);
@@ -19,70 +19,31 @@
 #ifndef TENSORFLOW_COMMON_RUNTIME_GPU_GPU_DOUBLE_BFC_ALLOCATOR_H_
 #define TENSORFLOW_COMMON_RUNTIME_GPU_GPU_DOUBLE_BFC_ALLOCATOR_H_
 
-#include "tensorflow/core/common_runtime/bfc_allocator.h"
-#include "tensorflow/core/platform/mutex.h"
-
-#include <memory>
-#include <unordered_map>
-#include <ostream>
+#include "tensorflow/core/common_runtime/multi_pool_bfc_allocator.h"
+#include "tensorflow/core/protobuf/config.pb.h"
 
 namespace tensorflow {
 
 // A GPU allocator that uses small allocation optimization to reduce fragmentation
-class GPUDoubleBFCAllocator : public VisitableAllocator {
+//
+// Allocations up to `max_small` bytes go to a separate pool of `small_pool` bytes,
+// optionally with a cache of freed chunks in front of it.
+class GPUDoubleBFCAllocator : public MultiPoolBFCAllocator {
  public:
+  static const size_t kDefaultMaxSmall = 1 * 1024 * 1024; // 1MB
+  static const size_t kDefaultSmallPool = 500 * 1024 * 1024; // 500MB
+
   TF_DISALLOW_COPY_AND_ASSIGN(GPUDoubleBFCAllocator);
 
   // 'device_id' refers to the StreamExecutor ID of the device within
   // the process and must reference a valid ID in the process.
   GPUDoubleBFCAllocator(int device_id, size_t total_memory);
   GPUDoubleBFCAllocator(int device_id, size_t total_memory,
-                        const GPUOptions& gpu_options, bool use_small_opt);
+                        const GPUOptions& gpu_options, bool use_small_opt,
+                        size_t max_small = kDefaultMaxSmall,
+                        size_t small_pool = kDefaultSmallPool,
+                        bool small_chunk_cache = false);
   ~GPUDoubleBFCAllocator() override {}
-
-  string Name() override { return name_; }
-  void* AllocateRaw(size_t alignment, size_t num_bytes) override;
-  void* AllocateRaw(size_t alignment, size_t num_bytes,
-                    const AllocationAttributes& allocation_attr) override;
-  void DeallocateRaw(void* ptr) override;
-
-  void AddAllocVisitor(Visitor visitor) override;
-
-  void AddFreeVisitor(Visitor visitor) override;
-
-  bool TracksAllocationSizes() override { return true; }
-
-  size_t RequestedSize(void* ptr) override;
-
-  size_t AllocatedSize(void* ptr) override;
-
-  int64 AllocationId(void* ptr) override;
-
-  void GetStats(AllocatorStats* stats) override;
-
-  void DumpMemoryLog() const;
-
-  string GenerateMemoryMap() const;
-
- private:
-  BFCAllocator *SelectAllocator(size_t num_bytes) const;
-
-  std::ostream &GenerateMemoryMapForBFC(BFCAllocator* alloc, std::ostream &out) const;
-
-  struct Chunk {
-    BFCAllocator *allocator;
-    int64 allocation_id;
-  };
-  Chunk FindAllocator(void* ptr) const;
-
-  string name_;
-
-  std::unique_ptr<BFCAllocator> small_alloc_;
-  std::unique_ptr<BFCAllocator> big_alloc_;
-
-  mutable mutex lock_;
-  std::unordered_map<void*, Chunk> used_allocator GUARDED_BY(lock_);
-  int64 next_allocation_id_ GUARDED_BY(lock_);
 };
 
 } // namespace tensorflow
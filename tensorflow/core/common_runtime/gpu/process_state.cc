@@ -88,6 +88,27 @@ bool useSmallAllocOptimization() {
       return false;
 }
 
+// Size classes of the small allocation optimization.
+size_t smallAllocMaxBytes() {
+  int64 value;
+  TF_CHECK_OK(ReadInt64FromEnvVar("TF_GPU_SMALL_ALLOC_MAX_BYTES",
+                                  GPUDoubleBFCAllocator::kDefaultMaxSmall, &value));
+  return static_cast<size_t>(value);
+}
+
+size_t smallPoolBytes() {
+  int64 value;
+  TF_CHECK_OK(ReadInt64FromEnvVar("TF_GPU_SMALL_POOL_BYTES",
+                                  GPUDoubleBFCAllocator::kDefaultSmallPool, &value));
+  return static_cast<size_t>(value);
+}
+
+bool smallPoolChunkCache() {
+  bool value;
+  TF_CHECK_OK(ReadBoolFromEnvVar("TF_GPU_SMALL_POOL_CHUNK_CACHE", false, &value));
+  return value;
+}
+
 }  // namespace
 
 ProcessState* ProcessState::instance_ = nullptr;
@@ -155,7 +176,9 @@ Allocator* ProcessState::GetGPUAllocator(const GPUOptions& options, int gpu_id,
       return nullptr;
     }
 
-    gpu_allocator = new GPUDoubleBFCAllocator(gpu_id, total_bytes, options, useSmallAllocOptimization());
+    gpu_allocator = new GPUDoubleBFCAllocator(gpu_id, total_bytes, options, useSmallAllocOptimization(),
+                                              smallAllocMaxBytes(), smallPoolBytes(),
+                                              smallPoolChunkCache());
 
     // If true, checks for memory overwrites by writing
     // distinctive patterns on both ends of allocated memory.
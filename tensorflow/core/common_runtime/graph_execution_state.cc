@@ -41,6 +41,7 @@ limitations under the License.
 #include "tensorflow/core/util/util.h"
 
 #ifndef IS_MOBILE_PLATFORM
+#include "tensorflow/core/common_runtime/cost_model_placement.h"
 #include "tensorflow/core/grappler/clusters/utils.h"
 #include "tensorflow/core/grappler/clusters/virtual_cluster.h"
 #include "tensorflow/core/grappler/grappler_item.h"
@@ -266,6 +267,21 @@ Status GraphExecutionState::InitBaseGraph(const BuildGraphOptions& options) {
       OptimizationPassRegistry::PRE_PLACEMENT, optimization_options));
 
   Placer placer(new_graph.get(), device_set_, session_options_);
+#ifndef IS_MOBILE_PLATFORM
+  std::unique_ptr<grappler::VirtualCluster> cluster;
+  std::unique_ptr<CostModelPlacement> placement;
+  if (session_options_ &&
+      session_options_->config.graph_options().cost_model_placement()) {
+    std::unordered_map<string, DeviceProperties> device_map;
+    for (const auto& device : device_set_->devices()) {
+      device_map[device->name()] =
+          grappler::GetDeviceInfo(device->parsed_name());
+    }
+    cluster.reset(new grappler::VirtualCluster(device_map));
+    placement.reset(new CostModelPlacement(cluster.get()));
+    placer.set_placement_policy(placement.get());
+  }
+#endif  // IS_MOBILE_PLATFORM
   // TODO(mrry): Consider making the Placer cancelable.
   TF_RETURN_IF_ERROR(placer.Run());
 
@@ -0,0 +1,239 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/multi_pool_bfc_allocator.h"
+
+#include "tensorflow/core/platform/logging.h"
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+namespace tensorflow {
+
+// Records the regions handed out by a SubAllocator.
+//
+// BFCAllocator only calls Alloc while holding its lock, so there is a single
+// writer, and never frees a region before it is destroyed, so the list only
+// grows. Readers therefore need no lock.
+class MultiPoolBFCAllocator::RegionTracker : public SubAllocator {
+ public:
+  explicit RegionTracker(SubAllocator* sub_allocator)
+      : sub_allocator_(sub_allocator), num_regions_(0) {}
+  ~RegionTracker() override {}
+
+  void* Alloc(size_t alignment, size_t num_bytes) override
+  {
+      auto ptr = sub_allocator_->Alloc(alignment, num_bytes);
+      if (!ptr) {
+          return ptr;
+      }
+      auto n = num_regions_.load(std::memory_order_relaxed);
+      CHECK_LT(n, kMaxRegions) << "Too many regions in one pool";
+      auto begin = reinterpret_cast<std::uintptr_t>(ptr);
+      regions_[n] = {begin, begin + num_bytes};
+      num_regions_.store(n + 1, std::memory_order_release);
+      return ptr;
+  }
+
+  void Free(void* ptr, size_t num_bytes) override
+  {
+      sub_allocator_->Free(ptr, num_bytes);
+  }
+
+  bool Contains(const void* ptr) const
+  {
+      auto p = reinterpret_cast<std::uintptr_t>(ptr);
+      auto n = num_regions_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < n; ++i) {
+          if (p >= regions_[i].begin && p < regions_[i].end) {
+              return true;
+          }
+      }
+      return false;
+  }
+
+ private:
+  // Regions at least double in size as a pool grows, so this is plenty.
+  static constexpr size_t kMaxRegions = 64;
+
+  struct Region {
+    std::uintptr_t begin;
+    std::uintptr_t end;
+  };
+
+  std::unique_ptr<SubAllocator> sub_allocator_;
+  Region regions_[kMaxRegions];
+  std::atomic<size_t> num_regions_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(RegionTracker);
+};
+
+constexpr size_t MultiPoolBFCAllocator::RegionTracker::kMaxRegions;
+
+MultiPoolBFCAllocator::MultiPoolBFCAllocator(const string& name,
+                                             std::vector<PoolOptions> pools)
+    : name_(name)
+{
+    CHECK(!pools.empty()) << "MultiPoolBFCAllocator needs at least one pool";
+    CHECK_EQ(pools.back().max_allocation_size, 0)
+        << "The last pool must take allocations of any size";
+
+    pools_.reserve(pools.size());
+    for (auto& opts : pools) {
+        auto tracker = new RegionTracker(opts.sub_allocator);
+        pools_.push_back(Pool{
+            opts.max_allocation_size, tracker,
+            std::unique_ptr<BFCAllocator>(new BFCAllocator(
+                tracker, opts.total_memory, opts.allow_growth, opts.name,
+                opts.chunk_cache))});
+    }
+}
+
+MultiPoolBFCAllocator::~MultiPoolBFCAllocator() {}
+
+const MultiPoolBFCAllocator::Pool& MultiPoolBFCAllocator::SelectPool(size_t num_bytes) const
+{
+    for (const auto& pool : pools_) {
+        if (pool.max_allocation_size == 0 || num_bytes <= pool.max_allocation_size) {
+            return pool;
+        }
+    }
+    return pools_.back();
+}
+
+int MultiPoolBFCAllocator::FindPool(const void* ptr) const
+{
+    for (size_t i = 0; i < pools_.size(); ++i) {
+        if (pools_[i].regions->Contains(ptr)) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+BFCAllocator* MultiPoolBFCAllocator::PoolFor(const void* ptr, const char* what) const
+{
+    auto idx = FindPool(ptr);
+    CHECK(idx >= 0) << what << " of pointer we never allocated: " << ptr;
+    return pools_[idx].bfc.get();
+}
+
+void* MultiPoolBFCAllocator::AllocateRaw(size_t alignment, size_t num_bytes)
+{
+    return SelectPool(num_bytes).bfc->AllocateRaw(alignment, num_bytes);
+}
+
+void* MultiPoolBFCAllocator::AllocateRaw(size_t alignment, size_t num_bytes,
+                                         const AllocationAttributes& allocation_attr)
+{
+    return SelectPool(num_bytes).bfc->AllocateRaw(alignment, num_bytes, allocation_attr);
+}
+
+void MultiPoolBFCAllocator::DeallocateRaw(void* ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    PoolFor(ptr, "DeallocateRaw")->DeallocateRaw(ptr);
+}
+
+void MultiPoolBFCAllocator::AddAllocVisitor(Visitor visitor)
+{
+    for (auto& pool : pools_) {
+        pool.bfc->AddAllocVisitor(visitor);
+    }
+}
+
+void MultiPoolBFCAllocator::AddFreeVisitor(Visitor visitor)
+{
+    for (auto& pool : pools_) {
+        pool.bfc->AddFreeVisitor(visitor);
+    }
+}
+
+size_t MultiPoolBFCAllocator::RequestedSize(void* ptr)
+{
+    return PoolFor(ptr, "Asked for requested size")->RequestedSize(ptr);
+}
+
+size_t MultiPoolBFCAllocator::AllocatedSize(void* ptr)
+{
+    return PoolFor(ptr, "Asked for allocated size")->AllocatedSize(ptr);
+}
+
+int64 MultiPoolBFCAllocator::AllocationId(void* ptr)
+{
+    auto idx = FindPool(ptr);
+    CHECK(idx >= 0) << "Asked for allocation id of pointer we never allocated: " << ptr;
+    // Ids of each pool start from 1, interleave them to keep them unique.
+    return pools_[idx].bfc->AllocationId(ptr) * static_cast<int64>(pools_.size()) + idx;
+}
+
+void MultiPoolBFCAllocator::GetStats(AllocatorStats* stats)
+{
+    stats->Clear();
+    for (auto& pool : pools_) {
+        AllocatorStats s;
+        pool.bfc->GetStats(&s);
+        stats->num_allocs += s.num_allocs;
+        stats->bytes_in_use += s.bytes_in_use;
+        stats->max_bytes_in_use += s.max_bytes_in_use;
+        stats->max_alloc_size = std::max(stats->max_alloc_size, s.max_alloc_size);
+        stats->bytes_limit += s.bytes_limit;
+        stats->bytes_cached += s.bytes_cached;
+    }
+}
+
+void MultiPoolBFCAllocator::DumpMemoryLog() const
+{
+    for (auto& pool : pools_) {
+        mutex_lock l(pool.bfc->lock_);
+        pool.bfc->DumpMemoryLog(128);
+    }
+}
+
+std::ostream& MultiPoolBFCAllocator::GenerateMemoryMapForBFC(BFCAllocator* alloc,
+                                                             std::ostream& out) const
+{
+    mutex_lock l(alloc->lock_);
+
+    out << alloc->name_ << "\t";
+    for (const auto& region : alloc->region_manager_.regions()) {
+        auto h = alloc->region_manager_.get_handle(region.ptr());
+        while (h != BFCAllocator::kInvalidChunkHandle) {
+            const auto c = alloc->ChunkFromHandle(h);
+            const size_t bsize = c->bin_num == BFCAllocator::kInvalidBinNum ? 0
+                                : alloc->BinFromIndex(c->bin_num)->bin_size;
+            out << c->ptr << "," << c->size << "," << c->in_use() << "," << bsize << ";";
+            h = c->next;
+        }
+    }
+    out << "&";
+
+    return out;
+}
+
+string MultiPoolBFCAllocator::GenerateMemoryMap() const
+{
+    // Largest pool first
+    std::ostringstream oss;
+    for (auto it = pools_.rbegin(); it != pools_.rend(); ++it) {
+        GenerateMemoryMapForBFC(it->bfc.get(), oss);
+    }
+    return oss.str();
+}
+
+}  // namespace tensorflow
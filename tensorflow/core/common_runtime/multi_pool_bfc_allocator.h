@@ -0,0 +1,106 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMMON_RUNTIME_MULTI_POOL_BFC_ALLOCATOR_H_
+#define TENSORFLOW_COMMON_RUNTIME_MULTI_POOL_BFC_ALLOCATOR_H_
+
+#include "tensorflow/core/common_runtime/bfc_allocator.h"
+#include "tensorflow/core/framework/allocator.h"
+
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace tensorflow {
+
+// An allocator that routes allocations to one of several BFCAllocator pools
+// by size, so that small allocations don't fragment the memory used by large
+// ones.
+//
+// The pool owning a pointer is found from the address ranges each pool got
+// from its SubAllocator, which only grow, so no lock or per-allocation
+// bookkeeping is needed on top of the pools themselves.
+class MultiPoolBFCAllocator : public VisitableAllocator {
+ public:
+  struct PoolOptions {
+    // Owned by the allocator once passed in.
+    SubAllocator* sub_allocator = nullptr;
+    // Largest allocation served by this pool, 0 for no limit. Each
+    // allocation goes to the first pool that can take its size.
+    size_t max_allocation_size = 0;
+    size_t total_memory = 0;
+    bool allow_growth = false;
+    // See BFCAllocator.
+    bool chunk_cache = false;
+    string name;
+  };
+
+  // The last pool should have no size limit.
+  MultiPoolBFCAllocator(const string& name, std::vector<PoolOptions> pools);
+  ~MultiPoolBFCAllocator() override;
+
+  string Name() override { return name_; }
+  void* AllocateRaw(size_t alignment, size_t num_bytes) override;
+  void* AllocateRaw(size_t alignment, size_t num_bytes,
+                    const AllocationAttributes& allocation_attr) override;
+  void DeallocateRaw(void* ptr) override;
+
+  void AddAllocVisitor(Visitor visitor) override;
+
+  void AddFreeVisitor(Visitor visitor) override;
+
+  bool TracksAllocationSizes() override { return true; }
+
+  size_t RequestedSize(void* ptr) override;
+
+  size_t AllocatedSize(void* ptr) override;
+
+  // Unique across pools.
+  int64 AllocationId(void* ptr) override;
+
+  // Sum over all pools, except max_alloc_size.
+  void GetStats(AllocatorStats* stats) override;
+
+  size_t NumPools() const { return pools_.size(); }
+
+  void DumpMemoryLog() const;
+
+  string GenerateMemoryMap() const;
+
+ private:
+  class RegionTracker;
+  struct Pool {
+    size_t max_allocation_size;
+    RegionTracker* regions;  // Owned by bfc
+    std::unique_ptr<BFCAllocator> bfc;
+  };
+
+  const Pool& SelectPool(size_t num_bytes) const;
+  // Returns the index of the pool owning ptr, or -1.
+  int FindPool(const void* ptr) const;
+  BFCAllocator* PoolFor(const void* ptr, const char* what) const;
+
+  std::ostream& GenerateMemoryMapForBFC(BFCAllocator* alloc,
+                                        std::ostream& out) const;
+
+  string name_;
+  std::vector<Pool> pools_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(MultiPoolBFCAllocator);
+};
+
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_COMMON_RUNTIME_MULTI_POOL_BFC_ALLOCATOR_H_
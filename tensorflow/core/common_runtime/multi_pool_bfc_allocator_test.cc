@@ -0,0 +1,166 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/multi_pool_bfc_allocator.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mem.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace {
+
+class HostSubAllocator : public SubAllocator {
+ public:
+  void* Alloc(size_t alignment, size_t num_bytes) override {
+    return port::AlignedMalloc(num_bytes, std::max<size_t>(alignment, 64));
+  }
+  void Free(void* ptr, size_t num_bytes) override { port::AlignedFree(ptr); }
+};
+
+const size_t kMaxSmall = 1 << 10;
+const size_t kMaxMedium = 1 << 16;
+const size_t kSmallPool = 1 << 22;
+const size_t kMediumPool = 1 << 26;
+const size_t kLargePool = 1 << 28;
+
+std::vector<MultiPoolBFCAllocator::PoolOptions> ThreePools(bool allow_growth) {
+  std::vector<MultiPoolBFCAllocator::PoolOptions> pools(3);
+  const size_t limits[] = {kMaxSmall, kMaxMedium, 0};
+  const size_t sizes[] = {kSmallPool, kMediumPool, kLargePool};
+  for (int i = 0; i < 3; ++i) {
+    pools[i].sub_allocator = new HostSubAllocator;
+    pools[i].max_allocation_size = limits[i];
+    pools[i].total_memory = sizes[i];
+    pools[i].allow_growth = allow_growth;
+    pools[i].name = strings::StrCat("test_pool_", i);
+  }
+  return pools;
+}
+
+TEST(MultiPoolBFCAllocatorTest, RoutesBySize) {
+  MultiPoolBFCAllocator a("test", ThreePools(false));
+  EXPECT_EQ(3, a.NumPools());
+
+  void* small = a.AllocateRaw(1, kMaxSmall);
+  void* medium = a.AllocateRaw(1, kMaxSmall + 1);
+  void* large = a.AllocateRaw(1, kMaxMedium + 1);
+  ASSERT_NE(nullptr, small);
+  ASSERT_NE(nullptr, medium);
+  ASSERT_NE(nullptr, large);
+
+  EXPECT_EQ(kMaxSmall, a.RequestedSize(small));
+  EXPECT_EQ(kMaxSmall + 1, a.RequestedSize(medium));
+  EXPECT_EQ(kMaxMedium + 1, a.RequestedSize(large));
+  EXPECT_LE(kMaxMedium + 1, a.AllocatedSize(large));
+
+  // Ids are unique across pools
+  std::set<int64> ids = {a.AllocationId(small), a.AllocationId(medium),
+                         a.AllocationId(large)};
+  EXPECT_EQ(3, ids.size());
+
+  AllocatorStats stats;
+  a.GetStats(&stats);
+  EXPECT_EQ(3, stats.num_allocs);
+  EXPECT_EQ(kSmallPool + kMediumPool + kLargePool, stats.bytes_limit);
+
+  a.DeallocateRaw(small);
+  a.DeallocateRaw(medium);
+  a.DeallocateRaw(large);
+  a.GetStats(&stats);
+  EXPECT_EQ(0, stats.bytes_in_use);
+}
+
+TEST(MultiPoolBFCAllocatorTest, GrowthAcrossRegions) {
+  MultiPoolBFCAllocator a("test", ThreePools(true));
+
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 64; ++i) {
+    void* p = a.AllocateRaw(1, kMaxMedium + 1);
+    ASSERT_NE(nullptr, p);
+    ptrs.push_back(p);
+  }
+  for (void* p : ptrs) {
+    EXPECT_EQ(kMaxMedium + 1, a.RequestedSize(p));
+    a.DeallocateRaw(p);
+  }
+}
+
+TEST(MultiPoolBFCAllocatorTest, ConcurrentAllocations) {
+  MultiPoolBFCAllocator a("test", ThreePools(true));
+  {
+    thread::ThreadPool pool(Env::Default(), "test", 8);
+    for (int t = 0; t < 8; ++t) {
+      pool.Schedule([&a, t]() {
+        random::PhiloxRandom philox(t, 17);
+        random::SimplePhilox rand(&philox);
+        void* ptrs[16] = {};
+        for (int i = 0; i < 1000; ++i) {
+          auto& p = ptrs[i % 16];
+          a.DeallocateRaw(p);
+          p = a.AllocateRaw(1, rand.Uniform(kMaxMedium * 2) + 1);
+          ASSERT_NE(nullptr, p);
+        }
+        for (void* p : ptrs) {
+          a.DeallocateRaw(p);
+        }
+      });
+    }
+  }
+  AllocatorStats stats;
+  a.GetStats(&stats);
+  EXPECT_EQ(0, stats.bytes_in_use);
+  EXPECT_EQ(8000, stats.num_allocs);
+}
+
+static void BM_AllocationThreaded(int iters, int num_threads) {
+  testing::StopTiming();
+  MultiPoolBFCAllocator a("test", ThreePools(false));
+  thread::ThreadPool pool(Env::Default(), "test", num_threads);
+  testing::StartTiming();
+
+  BlockingCounter done(num_threads);
+  for (int t = 0; t < num_threads; ++t) {
+    pool.Schedule([&a, &done, iters, num_threads, t]() {
+      random::PhiloxRandom philox(t, 17);
+      random::SimplePhilox rand(&philox);
+      void* ptrs[16] = {};
+      for (int i = 0; i < iters / num_threads; ++i) {
+        auto& p = ptrs[i % 16];
+        a.DeallocateRaw(p);
+        p = a.AllocateRaw(1, rand.Uniform(kMaxMedium * 2) + 1);
+      }
+      for (void* p : ptrs) {
+        a.DeallocateRaw(p);
+      }
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  testing::ItemsProcessed(iters);
+}
+BENCHMARK(BM_AllocationThreaded)->Arg(1)->Arg(4)->Arg(16);
+
+}  // namespace
+}  // namespace tensorflow
@@ -735,7 +735,63 @@ Status Placer::Run() {
     }
   }
 
-  // 3. For each node, assign a device based on the constraints in the
+  // 3. If there is a placement policy, let it choose a device for each set
+  // of colocated nodes out of the devices valid for it.
+  if (policy_ != nullptr) {
+    std::vector<std::vector<Node*>> groups;
+    std::vector<std::vector<Device*>> candidates;
+    std::unordered_map<int, int> group_of_root;
+    for (Node* node : graph_->op_nodes()) {
+      if (node->has_assigned_device_name()) {
+        continue;
+      }
+      std::vector<Device*>* devices;
+      Status status = colocation_graph.GetDevicesForNode(node, &devices);
+      if (!status.ok()) {
+        return AttachDef(
+            errors::InvalidArgument("Cannot assign a device for operation '",
+                                    node->name(),
+                                    "': ", status.error_message()),
+            *node);
+      }
+      auto it = group_of_root.emplace(colocation_graph.FindRoot(node->id()),
+                                      groups.size());
+      if (it.second) {
+        groups.emplace_back();
+        candidates.push_back(*devices);
+      }
+      groups[it.first->second].push_back(node);
+    }
+
+    std::vector<int> choices;
+    Status status = policy_->Place(*graph_, groups, candidates, &choices);
+    for (size_t i = 0; status.ok() && i < groups.size(); ++i) {
+      if (i >= choices.size() || choices[i] < 0 ||
+          choices[i] >= static_cast<int>(candidates[i].size())) {
+        status = errors::Internal("No valid device chosen for operation '",
+                                  groups[i][0]->name(), "'");
+      }
+    }
+    if (status.ok()) {
+      for (const Node* node : graph_->op_nodes()) {
+        if (node->has_assigned_device_name()) {
+          LogDeviceAssignment(node);
+        }
+      }
+      for (size_t i = 0; i < groups.size(); ++i) {
+        const int assigned_device =
+            graph_->InternDeviceName(candidates[i][choices[i]]->name());
+        for (Node* node : groups[i]) {
+          AssignAndLog(assigned_device, node);
+        }
+      }
+      return Status::OK();
+    }
+    LOG(WARNING) << "Placement policy failed, using the default placement: "
+                 << status;
+  }
+
+  // 4. For each node, assign a device based on the constraints in the
   // disjoint node set.
   std::vector<Node*> second_pass;
   for (Node* node : graph_->op_nodes()) {
@@ -770,12 +826,7 @@ Status Placer::Run() {
     // Returns the first device in sorted devices list so we will always
     // choose the same device.
     //
-    // TODO(vrv): Factor this assignment out into a pluggable
-    // algorithm, so that Placer is responsible for enforcing
-    // preconditions and we can experiment with other algorithms when
-    // given a choice of devices. Once we have a better idea of the
-    // types of heuristics we want to use and the information needed
-    // to perform good placement we can add an interface for this.
+    // A PlacementPolicy replaces this choice, see step 3.
     int assigned_device = -1;
 
     // Heuristic B: If the node only operates on metadata, not data,
@@ -802,7 +853,7 @@ Status Placer::Run() {
     AssignAndLog(assigned_device, node);
   }
 
-  // 4. Perform a second pass assignment for those nodes explicitly
+  // 5. Perform a second pass assignment for those nodes explicitly
   // skipped during the first pass.
   for (Node* node : second_pass) {
     std::vector<Device*>* devices;
@@ -18,6 +18,7 @@ limitations under the License.
 
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "tensorflow/core/common_runtime/device_set.h"
 #include "tensorflow/core/graph/graph.h"
@@ -29,6 +30,25 @@ limitations under the License.
 
 namespace tensorflow {
 
+// Chooses devices for the nodes the Placer has a choice for.
+class PlacementPolicy {
+ public:
+  virtual ~PlacementPolicy() {}
+
+  // Each of "groups" is a set of unassigned nodes of "graph" which must be
+  // colocated, and may be placed on any device of the corresponding entry
+  // in "candidates", which is never empty. Nodes not in any group already
+  // have an assigned device.
+  //
+  // On success, sets (*choices)[i] to the index into candidates[i] of the
+  // device to place groups[i] on. On failure the Placer falls back to its
+  // default heuristics.
+  virtual Status Place(const Graph& graph,
+                       const std::vector<std::vector<Node*>>& groups,
+                       const std::vector<std::vector<Device*>>& candidates,
+                       std::vector<int>* choices) = 0;
+};
+
 // A placement algorithm that assigns the nodes of the given Graph to
 // devices the given DeviceSet, respecting the following constraints:
 //
@@ -48,6 +68,9 @@ namespace tensorflow {
 // Run() will finally assign the device to each node given the list of
 // possible devices.
 //
+// Which device out of the valid ones a node gets is decided by a few
+// heuristics, or by a PlacementPolicy if one is set.
+//
 // TODO(mrry): "Soft" constraints, such as "place node 'x' as close as
 // possible to node 'y' while respecting the other constraints"?
 // TODO(mrry): Create a common interface for this and the other
@@ -77,6 +100,10 @@ class Placer {
   // Run() may be invoked at most once.
   Status Run();
 
+  // Lets "policy" choose the devices in Run(), instead of the default
+  // heuristics. Does not take ownership, "policy" must outlive Run().
+  void set_placement_policy(PlacementPolicy* policy) { policy_ = policy; }
+
  private:
   // Returns true if the device type of 'candidate_device_name' is
   // found in 'devices'.
@@ -92,6 +119,7 @@ class Placer {
   const DeviceSet* const devices_;               // Not owned.
   const SessionOptions* options_;                // Not owned.
   const bool log_device_placement_;
+  PlacementPolicy* policy_ = nullptr;            // Not owned.
 
   TF_DISALLOW_COPY_AND_ASSIGN(Placer);
 };
@@ -0,0 +1,177 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/ready_queue_policy.h"
+
+#include "tensorflow/core/platform/logging.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace tensorflow {
+
+namespace {
+
+// Unknown sizes count as one byte, so that without measurements tensors are
+// simply counted.
+int64 OutputBytes(const std::vector<int64>& output_bytes, int slot)
+{
+    if (slot < 0 || static_cast<size_t>(slot) >= output_bytes.size()) {
+        return 1;
+    }
+    return std::max<int64>(output_bytes[slot], 1);
+}
+
+} // namespace
+
+constexpr int64 ReadyQueuePolicy::kExpensiveCost;
+
+ReadyQueuePolicy::ReadyQueuePolicy(const Graph* graph, const std::function<bool(int)>& is_expensive)
+    : graph_(graph)
+    , costs_(graph->num_node_ids())
+{
+    for (const Node* n : graph->nodes()) {
+        auto& cost = costs_[n->id()];
+        cost.micros = is_expensive(n->id()) ? kExpensiveCost : 1;
+        cost.output_bytes.assign(n->num_outputs(), 0);
+    }
+}
+
+ReadyQueuePolicy::~ReadyQueuePolicy() = default;
+
+std::shared_ptr<const ReadyQueuePolicy::Priorities> ReadyQueuePolicy::priorities()
+{
+    mutex_lock l(mu_);
+    if (dirty_) {
+        auto priorities = std::make_shared<Priorities>(costs_.size(), 0);
+        Compute(*graph_, costs_, priorities.get());
+        priorities_ = std::move(priorities);
+        dirty_ = false;
+    }
+    return priorities_;
+}
+
+void ReadyQueuePolicy::Record(const Node* node, const NodeExecStats& stats)
+{
+    const int64 micros = std::max<int64>(stats.op_end_rel_micros() - stats.op_start_rel_micros(), 1);
+
+    mutex_lock l(mu_);
+    auto& cost = costs_[node->id()];
+    // Smooth out the noise of single steps.
+    cost.micros = cost.measured ? (cost.micros + micros) / 2 : micros;
+    cost.measured = true;
+    for (const auto& output : stats.output()) {
+        if (output.slot() < 0 || static_cast<size_t>(output.slot()) >= cost.output_bytes.size()) {
+            continue;
+        }
+        cost.output_bytes[output.slot()] =
+            output.tensor_description().allocation_description().requested_bytes();
+    }
+    dirty_ = true;
+}
+
+CriticalPathPolicy::CriticalPathPolicy(const Graph* graph, const std::function<bool(int)>& is_expensive)
+    : ReadyQueuePolicy(graph, is_expensive)
+{
+}
+
+void CriticalPathPolicy::Compute(const Graph& graph, const std::vector<NodeCost>& costs,
+                                 Priorities* priorities) const
+{
+    // Visit successors first. The back edges of loops are ignored.
+    std::vector<int> pending(graph.num_node_ids(), 0);
+    std::deque<const Node*> ready;
+    for (const Node* n : graph.nodes()) {
+        if (!n->IsNextIteration()) {
+            pending[n->id()] = n->out_edges().size();
+        }
+        if (pending[n->id()] == 0) {
+            ready.push_back(n);
+        }
+    }
+    while (!ready.empty()) {
+        const Node* n = ready.front();
+        ready.pop_front();
+
+        int64 longest = 0;
+        if (!n->IsNextIteration()) {
+            for (const Edge* e : n->out_edges()) {
+                longest = std::max(longest, (*priorities)[e->dst()->id()]);
+            }
+        }
+        (*priorities)[n->id()] = costs[n->id()].micros + longest;
+
+        for (const Edge* e : n->in_edges()) {
+            if (!e->src()->IsNextIteration() && --pending[e->src()->id()] == 0) {
+                ready.push_back(e->src());
+            }
+        }
+    }
+}
+
+MemoryPressurePolicy::MemoryPressurePolicy(const Graph* graph,
+                                           const std::function<bool(int)>& is_expensive)
+    : ReadyQueuePolicy(graph, is_expensive)
+{
+}
+
+void MemoryPressurePolicy::Compute(const Graph& graph, const std::vector<NodeCost>& costs,
+                                   Priorities* priorities) const
+{
+    // Number of consumers of each output.
+    std::vector<std::vector<int>> consumers(graph.num_node_ids());
+    for (const Node* n : graph.nodes()) {
+        consumers[n->id()].assign(n->num_outputs(), 0);
+    }
+    for (const Edge* e : graph.edges()) {
+        if (!e->IsControlEdge()) {
+            ++consumers[e->src()->id()][e->src_output()];
+        }
+    }
+
+    for (const Node* n : graph.nodes()) {
+        int64 freed = 0;
+        for (const Edge* e : n->in_edges()) {
+            if (e->IsControlEdge()) {
+                continue;
+            }
+            const int src = e->src()->id();
+            if (consumers[src][e->src_output()] == 1) {
+                freed += OutputBytes(costs[src].output_bytes, e->src_output());
+            }
+        }
+        int64 allocated = 0;
+        for (int i = 0; i < n->num_outputs(); ++i) {
+            allocated += OutputBytes(costs[n->id()].output_bytes, i);
+        }
+        (*priorities)[n->id()] = freed - allocated;
+    }
+}
+
+std::unique_ptr<ReadyQueuePolicy> NewReadyQueuePolicy(SalusOptions::ReadyQueuePolicy type,
+                                                      const Graph* graph,
+                                                      const std::function<bool(int)>& is_expensive)
+{
+    switch (type) {
+    case SalusOptions::CRITICAL_PATH:
+        return std::unique_ptr<ReadyQueuePolicy>(new CriticalPathPolicy(graph, is_expensive));
+    case SalusOptions::MEMORY_PRESSURE:
+        return std::unique_ptr<ReadyQueuePolicy>(new MemoryPressurePolicy(graph, is_expensive));
+    default:
+        return nullptr;
+    }
+}
+
+} // namespace tensorflow
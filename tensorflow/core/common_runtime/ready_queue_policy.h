@@ -0,0 +1,118 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMMON_RUNTIME_READY_QUEUE_POLICY_H_
+#define TENSORFLOW_COMMON_RUNTIME_READY_QUEUE_POLICY_H_
+
+#include "tensorflow/core/framework/step_stats.pb.h"
+#include "tensorflow/core/graph/graph.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace tensorflow {
+
+// Decides in which order an executor runs nodes that become ready at the
+// same time. Each node gets a priority, and the ready set is sorted by
+// descending priority before it is scheduled.
+//
+// Priorities are first computed from static estimates: expensive kernels
+// cost kExpensiveCost, everything else 1, and tensor sizes are unknown.
+// Stats of traced steps refine the estimates with measured op durations and
+// output sizes, and the priorities are recomputed for the next step.
+//
+// Thread-safe. Steps take a snapshot of the priorities when they start.
+class ReadyQueuePolicy {
+ public:
+  typedef std::vector<int64> Priorities;
+
+  static constexpr int64 kExpensiveCost = 10;
+
+  // Does not take ownership of graph, which must outlive this.
+  // is_expensive(id) tells whether the kernel of node id is expensive.
+  ReadyQueuePolicy(const Graph* graph, const std::function<bool(int)>& is_expensive);
+  virtual ~ReadyQueuePolicy();
+
+  virtual const char* Name() const = 0;
+
+  // Priorities by node id, higher runs first. Recomputed if something was
+  // recorded since the last call.
+  std::shared_ptr<const Priorities> priorities();
+
+  // Feeds the stats of one node from a traced step.
+  void Record(const Node* node, const NodeExecStats& stats);
+
+ protected:
+  // Measured or estimated, by node id.
+  struct NodeCost {
+    int64 micros = 1;
+    bool measured = false;
+    // Bytes by output slot, 0 if unknown.
+    std::vector<int64> output_bytes;
+  };
+
+  virtual void Compute(const Graph& graph, const std::vector<NodeCost>& costs,
+                       Priorities* priorities) const = 0;
+
+ private:
+  const Graph* graph_;
+
+  mutex mu_;
+  std::vector<NodeCost> costs_ GUARDED_BY(mu_);
+  bool dirty_ GUARDED_BY(mu_) = true;
+  std::shared_ptr<const Priorities> priorities_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ReadyQueuePolicy);
+};
+
+// Runs the node with the longest remaining path to the end of the graph
+// first, which is the one most likely to delay the end of the step.
+class CriticalPathPolicy : public ReadyQueuePolicy {
+ public:
+  CriticalPathPolicy(const Graph* graph, const std::function<bool(int)>& is_expensive);
+
+  const char* Name() const override { return "critical_path"; }
+
+ protected:
+  void Compute(const Graph& graph, const std::vector<NodeCost>& costs,
+               Priorities* priorities) const override;
+};
+
+// Runs the node that frees the most memory first: the bytes of inputs it is
+// the only consumer of, minus the bytes of its own outputs. This keeps the
+// peak memory of a step lower when devices are shared by many jobs.
+class MemoryPressurePolicy : public ReadyQueuePolicy {
+ public:
+  MemoryPressurePolicy(const Graph* graph, const std::function<bool(int)>& is_expensive);
+
+  const char* Name() const override { return "memory_pressure"; }
+
+ protected:
+  void Compute(const Graph& graph, const std::vector<NodeCost>& costs,
+               Priorities* priorities) const override;
+};
+
+// Returns nullptr for FIFO, which needs no priorities.
+std::unique_ptr<ReadyQueuePolicy> NewReadyQueuePolicy(SalusOptions::ReadyQueuePolicy type,
+                                                      const Graph* graph,
+                                                      const std::function<bool(int)>& is_expensive);
+
+} // namespace tensorflow
+
+#endif // TENSORFLOW_COMMON_RUNTIME_READY_QUEUE_POLICY_H_
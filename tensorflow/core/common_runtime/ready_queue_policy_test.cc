@@ -0,0 +1,109 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/ready_queue_policy.h"
+
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/graph/testlib.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace {
+
+bool NeverExpensive(int) { return false; }
+
+Node* Scalar(Graph* g) {
+  return test::graph::Constant(g, Tensor(DT_FLOAT, TensorShape({})));
+}
+
+NodeExecStats Stats(int64 micros, int64 output_bytes) {
+  NodeExecStats stats;
+  stats.set_op_start_rel_micros(0);
+  stats.set_op_end_rel_micros(micros);
+  auto output = stats.add_output();
+  output->set_slot(0);
+  output->mutable_tensor_description()
+      ->mutable_allocation_description()
+      ->set_requested_bytes(output_bytes);
+  return stats;
+}
+
+TEST(ReadyQueuePolicyTest, FifoHasNoPolicy) {
+  Graph g(OpRegistry::Global());
+  EXPECT_EQ(nullptr, NewReadyQueuePolicy(SalusOptions::FIFO, &g, NeverExpensive));
+}
+
+TEST(ReadyQueuePolicyTest, CriticalPathPrefersLongerChains) {
+  Graph g(OpRegistry::Global());
+  Node* a = Scalar(&g);
+  Node* tail = a;
+  for (int i = 0; i < 3; ++i) {
+    tail = test::graph::Identity(&g, tail);
+  }
+  Node* b = Scalar(&g);
+  Node* b1 = test::graph::Identity(&g, b);
+
+  auto policy = NewReadyQueuePolicy(SalusOptions::CRITICAL_PATH, &g, NeverExpensive);
+  ASSERT_NE(nullptr, policy);
+  auto priorities = policy->priorities();
+  EXPECT_EQ(4, (*priorities)[a->id()]);
+  EXPECT_EQ(2, (*priorities)[b->id()]);
+
+  // Measured costs take over.
+  policy->Record(b1, Stats(100, 4));
+  auto updated = policy->priorities();
+  EXPECT_NE(priorities, updated);
+  EXPECT_EQ(101, (*updated)[b->id()]);
+  EXPECT_EQ(4, (*updated)[a->id()]);
+
+  // Unchanged without new stats.
+  EXPECT_EQ(updated, policy->priorities());
+}
+
+TEST(ReadyQueuePolicyTest, ExpensiveKernelsCostMore) {
+  Graph g(OpRegistry::Global());
+  Node* a = Scalar(&g);
+  Node* a1 = test::graph::Identity(&g, a);
+  auto policy = NewReadyQueuePolicy(SalusOptions::CRITICAL_PATH, &g,
+                                    [a1](int id) { return id == a1->id(); });
+  EXPECT_EQ(1 + ReadyQueuePolicy::kExpensiveCost, (*policy->priorities())[a->id()]);
+}
+
+TEST(ReadyQueuePolicyTest, MemoryPressurePrefersFreeingInputs) {
+  Graph g(OpRegistry::Global());
+  Node* a = Scalar(&g);
+  // Only consumer of a.
+  Node* a1 = test::graph::Identity(&g, a);
+  Node* b = Scalar(&g);
+  // b has two consumers, neither frees it.
+  Node* b1 = test::graph::Identity(&g, b);
+  Node* b2 = test::graph::Identity(&g, b);
+
+  auto policy = NewReadyQueuePolicy(SalusOptions::MEMORY_PRESSURE, &g, NeverExpensive);
+  ASSERT_NE(nullptr, policy);
+  auto priorities = policy->priorities();
+  EXPECT_EQ(0, (*priorities)[a1->id()]);
+  EXPECT_EQ(-1, (*priorities)[b1->id()]);
+  EXPECT_EQ(-1, (*priorities)[b2->id()]);
+
+  policy->Record(a, Stats(1, 1000));
+  policy->Record(a1, Stats(1, 10));
+  priorities = policy->priorities();
+  EXPECT_EQ(990, (*priorities)[a1->id()]);
+  EXPECT_EQ(-1000, (*priorities)[a->id()]);
+}
+
+}  // namespace
+}  // namespace tensorflow
@@ -0,0 +1,281 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/step_trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+
+#include "tensorflow/core/framework/step_stats.pb.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+namespace tensorflow {
+
+namespace {
+
+struct Event {
+  uint64 start;
+  uint64 end;
+  int64 output_bytes;
+  uint32 trace;
+  int32 partition;
+  int32 node_id;
+};
+
+const uint64 kRingMask = StepTrace::kRingEvents - 1;
+
+// Events recorded by one thread at a time. Slots are guarded by a sequence
+// number, odd while being written, so readers can skip the ones overwritten
+// while they were being read. The fields of a slot are atomics accessed with
+// relaxed ordering, so that a reader racing with the writer reads a torn
+// event, which it then discards, instead of causing a data race.
+class Ring {
+ public:
+  explicit Ring(int index)
+      : index_(index), slots_(new Slot[StepTrace::kRingEvents]) {}
+
+  int index() const { return index_; }
+
+  void Push(const Event& event) {
+    const uint64 i = head_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[i & kRingMask];
+    slot.seq.store(2 * i + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.start.store(event.start, std::memory_order_relaxed);
+    slot.end.store(event.end, std::memory_order_relaxed);
+    slot.output_bytes.store(event.output_bytes, std::memory_order_relaxed);
+    slot.trace.store(event.trace, std::memory_order_relaxed);
+    slot.partition.store(event.partition, std::memory_order_relaxed);
+    slot.node_id.store(event.node_id, std::memory_order_relaxed);
+    slot.seq.store(2 * i + 2, std::memory_order_release);
+    head_.store(i + 1, std::memory_order_release);
+  }
+
+  // Calls fn on every event still in the ring, oldest first. Returns
+  // whether the ring has wrapped around.
+  template <typename Fn>
+  bool ForEach(Fn fn) const {
+    const uint64 head = head_.load(std::memory_order_acquire);
+    const uint64 begin = head > kRingMask ? head - kRingMask - 1 : 0;
+    for (uint64 i = begin; i < head; ++i) {
+      const Slot& slot = slots_[i & kRingMask];
+      const uint64 seq = slot.seq.load(std::memory_order_acquire);
+      if (seq != 2 * i + 2) {
+        continue;
+      }
+      Event event;
+      event.start = slot.start.load(std::memory_order_relaxed);
+      event.end = slot.end.load(std::memory_order_relaxed);
+      event.output_bytes = slot.output_bytes.load(std::memory_order_relaxed);
+      event.trace = slot.trace.load(std::memory_order_relaxed);
+      event.partition = slot.partition.load(std::memory_order_relaxed);
+      event.node_id = slot.node_id.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != seq) {
+        continue;
+      }
+      fn(event);
+    }
+    return begin > 0;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<uint64> seq{0};
+    std::atomic<uint64> start{0};
+    std::atomic<uint64> end{0};
+    std::atomic<int64> output_bytes{0};
+    std::atomic<uint32> trace{0};
+    std::atomic<int32> partition{0};
+    std::atomic<int32> node_id{0};
+  };
+
+  const int index_;
+  std::atomic<uint64> head_{0};
+  std::unique_ptr<Slot[]> slots_;
+};
+
+// All rings ever created. A ring goes back to the free list when its thread
+// exits, and is reused by the next new thread. Rings are never destroyed, so
+// pointers to them stay valid after the lock is released.
+struct RingRegistry {
+  mutex mu;
+  std::vector<std::unique_ptr<Ring>> rings GUARDED_BY(mu);
+  std::vector<Ring*> free GUARDED_BY(mu);
+};
+
+RingRegistry* Registry() {
+  static RingRegistry* registry = new RingRegistry;
+  return registry;
+}
+
+class ThreadRing {
+ public:
+  ThreadRing() {
+    auto registry = Registry();
+    mutex_lock l(registry->mu);
+    if (!registry->free.empty()) {
+      ring = registry->free.back();
+      registry->free.pop_back();
+    } else {
+      registry->rings.emplace_back(new Ring(registry->rings.size()));
+      ring = registry->rings.back().get();
+    }
+  }
+
+  ~ThreadRing() {
+    auto registry = Registry();
+    mutex_lock l(registry->mu);
+    registry->free.push_back(ring);
+  }
+
+  Ring* ring;
+};
+
+Ring* CurrentRing() {
+  static thread_local ThreadRing thread_ring;
+  return thread_ring.ring;
+}
+
+uint32 NextTraceId() {
+  // 0 never names a trace.
+  static std::atomic<uint32> next{1};
+  uint32 id = next.fetch_add(1, std::memory_order_relaxed);
+  return id != 0 ? id : next.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+StepTrace::StepTrace()
+    : id_(NextTraceId()),
+      start_cycles_(Now()),
+      start_micros_(Env::Default()->NowMicros()) {}
+
+int StepTrace::AddPartition(const string& device,
+                            std::shared_ptr<const NodeNames> names) {
+  mutex_lock l(mu_);
+  partitions_.push_back(Partition{device, std::move(names)});
+  return partitions_.size() - 1;
+}
+
+void StepTrace::Record(int partition, int node_id, uint64 start, uint64 end,
+                       int64 output_bytes) const {
+  CurrentRing()->Push(
+      Event{start, end, output_bytes, id_, partition, node_id});
+}
+
+bool StepTrace::ToStepStats(StepStats* step_stats) const {
+  std::vector<Partition> partitions;
+  {
+    mutex_lock l(mu_);
+    partitions = partitions_;
+  }
+
+  // Calibrate the cycle counter against the wall clock over the life of
+  // the trace, which spans at least the step.
+  const uint64 now_cycles = Now();
+  const int64 now_micros = Env::Default()->NowMicros();
+  double micros_per_cycle = 0;
+  if (now_cycles > start_cycles_ && now_micros > start_micros_) {
+    micros_per_cycle = static_cast<double>(now_micros - start_micros_) /
+                       (now_cycles - start_cycles_);
+  }
+  auto to_micros = [this, micros_per_cycle](uint64 cycles) {
+    const double elapsed =
+        static_cast<double>(static_cast<int64>(cycles - start_cycles_));
+    return start_micros_ + static_cast<int64>(elapsed * micros_per_cycle);
+  };
+
+  std::unordered_map<string, DeviceStepStats*> devices;
+  std::vector<DeviceStepStats*> device_of;
+  for (const auto& p : partitions) {
+    auto& dev = devices[p.device];
+    if (!dev) {
+      dev = step_stats->add_dev_stats();
+      dev->set_device(p.device);
+    }
+    device_of.push_back(dev);
+  }
+
+  // Scan the rings without the registry lock, so that threads starting or
+  // exiting meanwhile are not held up.
+  std::vector<const Ring*> rings;
+  {
+    auto registry = Registry();
+    mutex_lock l(registry->mu);
+    rings.reserve(registry->rings.size());
+    for (const auto& ring : registry->rings) {
+      rings.push_back(ring.get());
+    }
+  }
+
+  // Events are pushed to a ring in order of their end. If a ring dropped
+  // events which ended after this trace started and before its last event,
+  // some of them may have been ours.
+  std::vector<uint64> first_retained;
+  uint64 last_end = 0;
+  int64 num_events = 0;
+  for (const Ring* ring : rings) {
+    uint64 first = 0;
+    bool seen = false;
+    const bool wrapped = ring->ForEach([&](const Event& event) {
+      if (!seen) {
+        first = event.end;
+        seen = true;
+      }
+      if (event.trace != id_ || event.partition < 0 ||
+          event.partition >= static_cast<int>(partitions.size())) {
+        return;
+      }
+      const auto& names = *partitions[event.partition].names;
+      auto ns = device_of[event.partition]->add_node_stats();
+      if (event.node_id >= 0 &&
+          event.node_id < static_cast<int>(names.size())) {
+        ns->set_node_name(names[event.node_id]);
+      }
+      const int64 start = to_micros(event.start);
+      const int64 duration = std::max<int64>(to_micros(event.end) - start, 0);
+      ns->set_all_start_micros(start);
+      ns->set_op_start_rel_micros(0);
+      ns->set_op_end_rel_micros(duration);
+      ns->set_all_end_rel_micros(duration);
+      ns->set_thread_id(ring->index());
+      if (event.output_bytes > 0) {
+        auto memory = ns->add_memory();
+        memory->set_allocator_name("outputs");
+        memory->set_total_bytes(event.output_bytes);
+      }
+      last_end = std::max(last_end, event.end);
+      ++num_events;
+    });
+    if (wrapped && seen) {
+      first_retained.push_back(first);
+    }
+  }
+
+  bool complete = num_events > 0;
+  for (auto first : first_retained) {
+    if (first > start_cycles_ && first <= last_end) {
+      complete = false;
+    }
+  }
+  VLOG(2) << "Converted " << num_events << " events of trace " << id_
+          << " to StepStats";
+  return complete;
+}
+
+}  // namespace tensorflow
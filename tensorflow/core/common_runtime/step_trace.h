@@ -0,0 +1,89 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_COMMON_RUNTIME_STEP_TRACE_H_
+#define TENSORFLOW_COMMON_RUNTIME_STEP_TRACE_H_
+
+#include <memory>
+#include <vector>
+
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/profile_utils/cpu_utils.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+
+class StepStats;
+
+// A compact trace of the nodes executed in one step, cheap enough to keep
+// sampling steps in production.
+//
+// Executors record one fixed-size event per node, with the node id, its
+// start and end in clock cycles and the bytes of its outputs, into a ring
+// buffer owned by the recording thread. Recording takes no lock and
+// allocates nothing. Names, devices and times in microseconds are only
+// filled in when the trace is converted to StepStats, which may happen any
+// time after the step, as long as later traced steps did not wrap around the
+// thread's ring in between.
+class StepTrace {
+ public:
+  // Names of the nodes of a graph, by node id.
+  typedef std::vector<string> NodeNames;
+
+  StepTrace();
+
+  // Registers the graph an executor runs on "device" for this step. Returns
+  // the partition to pass to Record().
+  int AddPartition(const string& device,
+                   std::shared_ptr<const NodeNames> names);
+
+  static uint64 Now() {
+    return profile_utils::CpuUtils::GetCurrentClockCycle();
+  }
+
+  // Records that node "node_id" of "partition" ran from "start" to "end", as
+  // returned by Now(). Thread-safe and lock-free.
+  void Record(int partition, int node_id, uint64 start, uint64 end,
+              int64 output_bytes) const;
+
+  // Adds a DeviceStats per device with a NodeExecStats per recorded node to
+  // "step_stats". Returns false if the trace may be incomplete, because
+  // nothing was recorded or some events were overwritten by later steps.
+  bool ToStepStats(StepStats* step_stats) const;
+
+  // Capacity of each thread's ring, in events.
+  static constexpr int kRingEvents = 1 << 13;
+
+ private:
+  struct Partition {
+    string device;
+    std::shared_ptr<const NodeNames> names;
+  };
+
+  const uint32 id_;
+  // For converting cycles to microseconds.
+  const uint64 start_cycles_;
+  const int64 start_micros_;
+
+  mutable mutex mu_;
+  std::vector<Partition> partitions_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(StepTrace);
+};
+
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_COMMON_RUNTIME_STEP_TRACE_H_
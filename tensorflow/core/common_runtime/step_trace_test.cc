@@ -0,0 +1,169 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/step_trace.h"
+
+#include <map>
+#include <vector>
+
+#include "tensorflow/core/framework/step_stats.pb.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace {
+
+std::shared_ptr<const StepTrace::NodeNames> Names(const string& prefix, int n) {
+  auto names = std::make_shared<StepTrace::NodeNames>();
+  for (int i = 0; i < n; ++i) {
+    names->push_back(strings::StrCat(prefix, i));
+  }
+  return names;
+}
+
+// Node name to its stats, across all devices.
+std::map<string, NodeExecStats> ByName(const StepStats& step_stats) {
+  std::map<string, NodeExecStats> nodes;
+  for (const auto& dev : step_stats.dev_stats()) {
+    for (const auto& ns : dev.node_stats()) {
+      nodes[ns.node_name()] = ns;
+    }
+  }
+  return nodes;
+}
+
+TEST(StepTraceTest, ConvertsToStepStats) {
+  StepTrace trace;
+  const int cpu = trace.AddPartition("/cpu:0", Names("a", 2));
+  const int gpu = trace.AddPartition("/gpu:0", Names("b", 1));
+
+  const int64 before = Env::Default()->NowMicros();
+  const uint64 start = StepTrace::Now();
+  Env::Default()->SleepForMicroseconds(2000);
+  trace.Record(cpu, 1, start, StepTrace::Now(), 1024);
+  trace.Record(gpu, 0, StepTrace::Now(), StepTrace::Now(), 0);
+
+  StepStats step_stats;
+  ASSERT_TRUE(trace.ToStepStats(&step_stats));
+  ASSERT_EQ(2, step_stats.dev_stats_size());
+  EXPECT_EQ("/cpu:0", step_stats.dev_stats(0).device());
+  EXPECT_EQ("/gpu:0", step_stats.dev_stats(1).device());
+
+  auto nodes = ByName(step_stats);
+  ASSERT_EQ(2, nodes.size());
+  const NodeExecStats& a1 = nodes["a1"];
+  EXPECT_LE(before, a1.all_start_micros());
+  EXPECT_LE(1000, a1.op_end_rel_micros());
+  EXPECT_EQ(a1.op_end_rel_micros(), a1.all_end_rel_micros());
+  ASSERT_EQ(1, a1.memory_size());
+  EXPECT_EQ(1024, a1.memory(0).total_bytes());
+  EXPECT_EQ(0, nodes["b0"].memory_size());
+  EXPECT_LE(a1.all_start_micros(), nodes["b0"].all_start_micros());
+}
+
+TEST(StepTraceTest, RecordsFromManyThreads) {
+  const int kThreads = 8;
+  const int kNodes = 100;
+  StepTrace trace;
+  const int partition =
+      trace.AddPartition("/cpu:0", Names("n", kThreads * kNodes));
+  {
+    thread::ThreadPool pool(Env::Default(), "test", kThreads);
+    for (int t = 0; t < kThreads; ++t) {
+      pool.Schedule([&trace, partition, t]() {
+        for (int i = 0; i < kNodes; ++i) {
+          const uint64 start = StepTrace::Now();
+          trace.Record(partition, t * kNodes + i, start, StepTrace::Now(), i);
+        }
+      });
+    }
+  }
+
+  StepStats step_stats;
+  ASSERT_TRUE(trace.ToStepStats(&step_stats));
+  auto nodes = ByName(step_stats);
+  EXPECT_EQ(kThreads * kNodes, nodes.size());
+  EXPECT_EQ(kNodes - 1,
+            nodes[strings::StrCat("n", kNodes - 1)].memory(0).total_bytes());
+}
+
+TEST(StepTraceTest, KeepsStepsApart) {
+  StepTrace first;
+  StepTrace second;
+  const int p1 = first.AddPartition("/cpu:0", Names("first", 1));
+  const int p2 = second.AddPartition("/cpu:0", Names("second", 1));
+  first.Record(p1, 0, StepTrace::Now(), StepTrace::Now(), 0);
+  second.Record(p2, 0, StepTrace::Now(), StepTrace::Now(), 0);
+  second.Record(p2, 0, StepTrace::Now(), StepTrace::Now(), 0);
+
+  StepStats step_stats;
+  ASSERT_TRUE(first.ToStepStats(&step_stats));
+  ASSERT_EQ(1, step_stats.dev_stats_size());
+  ASSERT_EQ(1, step_stats.dev_stats(0).node_stats_size());
+  EXPECT_EQ("first0", step_stats.dev_stats(0).node_stats(0).node_name());
+}
+
+TEST(StepTraceTest, ReportsIncompleteTraces) {
+  StepTrace empty;
+  StepStats step_stats;
+  EXPECT_FALSE(empty.ToStepStats(&step_stats));
+
+  // Later steps overwrite the beginning of this one.
+  StepTrace trace;
+  StepTrace later;
+  const int p = trace.AddPartition("/cpu:0", Names("n", 2));
+  const int q = later.AddPartition("/cpu:0", Names("m", 1));
+  trace.Record(p, 0, StepTrace::Now(), StepTrace::Now(), 0);
+  for (int i = 0; i < StepTrace::kRingEvents - 1; ++i) {
+    later.Record(q, 0, StepTrace::Now(), StepTrace::Now(), 0);
+  }
+  trace.Record(p, 1, StepTrace::Now(), StepTrace::Now(), 0);
+  later.Record(q, 0, StepTrace::Now(), StepTrace::Now(), 0);
+
+  step_stats.Clear();
+  EXPECT_FALSE(trace.ToStepStats(&step_stats));
+  auto nodes = ByName(step_stats);
+  EXPECT_EQ(1, nodes.size());
+  EXPECT_EQ(1, nodes.count("n1"));
+}
+
+static void BM_Record(int iters, int num_threads) {
+  testing::StopTiming();
+  StepTrace trace;
+  const int partition = trace.AddPartition("/cpu:0", Names("n", 64));
+  thread::ThreadPool pool(Env::Default(), "test", num_threads);
+  testing::StartTiming();
+
+  BlockingCounter done(num_threads);
+  for (int t = 0; t < num_threads; ++t) {
+    pool.Schedule([&trace, &done, partition, iters, num_threads]() {
+      for (int i = 0; i < iters / num_threads; ++i) {
+        const uint64 start = StepTrace::Now();
+        trace.Record(partition, i % 64, start, StepTrace::Now(), 1024);
+      }
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  testing::ItemsProcessed(iters);
+}
+BENCHMARK(BM_Record)->Arg(1)->Arg(8);
+
+}  // namespace
+}  // namespace tensorflow
@@ -60,6 +60,17 @@ class MasterInterface {
     return RunStep(call_options, wrapped_request.get(), wrapped_response.get());
   }
 
+  // Asynchronous version of `RunStep()`. `done` is called once the step
+  // finishes, and `request` and `response` must outlive that call.
+  //
+  // The default implementation runs the step synchronously.
+  virtual void RunStepAsync(CallOptions* call_options,
+                            RunStepRequestWrapper* request,
+                            MutableRunStepResponseWrapper* response,
+                            StatusCallback done) {
+    done(RunStep(call_options, request, response));
+  }
+
   // Returns a request object for use in calls to
   // `RunStep()`. Ownership is transferred to the caller.
   //
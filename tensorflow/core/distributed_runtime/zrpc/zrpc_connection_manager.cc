@@ -0,0 +1,81 @@
+/*
+ * <one line to give the library's name and an idea of what it does.>
+ * Copyright (C) 2017  Aetf <aetf@unlimitedcodeworks.xyz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_connection_manager.h"
+
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+
+#include <algorithm>
+
+namespace tensorflow {
+
+ZrpcConnectionManager &ZrpcConnectionManager::Global()
+{
+    // Intentionally leaked, stubs may still be in use during static destruction
+    static auto manager = new ZrpcConnectionManager;
+    return *manager;
+}
+
+std::shared_ptr<zmq::context_t> ZrpcConnectionManager::context(const SalusOptions &options)
+{
+    auto ctx = m_ctx.lock();
+    if (!ctx) {
+        auto ioThreads = std::max(options.io_threads(), 1);
+        VLOG(2) << "Creating shared ZeroMQ context with " << ioThreads << " I/O threads";
+        ctx = std::make_shared<zmq::context_t>(ioThreads);
+        m_ctx = ctx;
+    }
+    return ctx;
+}
+
+std::shared_ptr<ZrpcMasterServiceStub> ZrpcConnectionManager::get(Env *env, const std::string &endpoint,
+                                                                  const SalusOptions &options)
+{
+    mutex_lock locker(m_mu);
+    auto &slot = m_stubs[endpoint];
+    auto stub = slot.lock();
+    if (!stub) {
+        VLOG(2) << "Opening shared connection to " << endpoint;
+        auto raw = new ZrpcMasterServiceStub(env, endpoint, options.callback_threads(),
+                                             std::max(options.num_sockets(), 1), context(options));
+        stub.reset(raw, [env](ZrpcMasterServiceStub *stub) {
+            // The last reference may be dropped by a callback, e.g. one deleting its session.
+            // The destructor joins the receiving and callback threads, so it can't run on them.
+            if (stub->onOwnThread()) {
+                env->SchedClosure([stub]() { delete stub; });
+            } else {
+                delete stub;
+            }
+        });
+        slot = stub;
+    }
+
+    // Drop entries of closed connections
+    for (auto it = m_stubs.begin(); it != m_stubs.end();) {
+        if (it->second.expired()) {
+            it = m_stubs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return stub;
+}
+
+} // namespace tensorflow
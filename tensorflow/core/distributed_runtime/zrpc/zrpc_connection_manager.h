@@ -0,0 +1,69 @@
+/*
+ * <one line to give the library's name and an idea of what it does.>
+ * Copyright (C) 2017  Aetf <aetf@unlimitedcodeworks.xyz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_CONNECTION_MANAGER_H_
+#define TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_CONNECTION_MANAGER_H_
+
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_master_service_stub.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+
+#include "zmq.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace tensorflow {
+class Env;
+
+// Process-wide registry of connections to executors.
+//
+// All sessions talking to the same endpoint share one ZrpcMasterServiceStub, so
+// they share its receiving thread and sockets, and calls are told apart by their
+// seq and session id. All stubs share one ZeroMQ context.
+class ZrpcConnectionManager
+{
+public:
+    static ZrpcConnectionManager &Global();
+
+    // Returns the stub connected to `endpoint`, creating it on first use. The stub
+    // is closed once the last reference to it is dropped. If that happens on one of
+    // the stub's own threads, it is closed on a thread scheduled in `env` instead.
+    //
+    // `options` only takes effect when a new stub or context is created, later
+    // callers get whatever is already open.
+    std::shared_ptr<ZrpcMasterServiceStub> get(Env *env, const std::string &endpoint,
+                                               const SalusOptions &options);
+
+private:
+    ZrpcConnectionManager() = default;
+
+    std::shared_ptr<zmq::context_t> context(const SalusOptions &options) EXCLUSIVE_LOCKS_REQUIRED(m_mu);
+
+    mutex m_mu;
+    std::weak_ptr<zmq::context_t> m_ctx GUARDED_BY(m_mu);
+    std::unordered_map<std::string, std::weak_ptr<ZrpcMasterServiceStub>> m_stubs GUARDED_BY(m_mu);
+
+    TF_DISALLOW_COPY_AND_ASSIGN(ZrpcConnectionManager);
+};
+
+} // namespace tensorflow
+
+#endif // TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_CONNECTION_MANAGER_H_
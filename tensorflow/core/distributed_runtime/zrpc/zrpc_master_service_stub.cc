@@ -19,12 +19,16 @@
 
 #include "tensorflow/core/distributed_runtime/zrpc/zrpc_master_service_stub.h"
 
+#include "tensorflow/core/distributed_runtime/call_options.h"
 #include "tensorflow/core/distributed_runtime/zrpc/protos/executor.pb.h"
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_tensor_coding.h"
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/random/random.h"
 #include "tensorflow/core/lib/strings/numbers.h"
 #include "tensorflow/core/protobuf/master.pb.h"
 #include "tensorflow/core/platform/env.h"
 
+#include <algorithm>
 #include <sstream>
 #include <cstring>
 #include <random>
@@ -57,36 +61,125 @@ inline ::zrpc::Status ToZrpcStatus(const ::tensorflow::Status& s) {
 
 } // namespace
 
-ZrpcMasterServiceStub::ZrpcMasterServiceStub(Env *env, const std::string &executorAddr)
-    : m_execAddr(executorAddr)
-    , m_zmqctx(1)
+ZrpcMasterServiceStub::ZrpcMasterServiceStub(Env *env, const std::string &executorAddr,
+                                             int numCallbackThreads, int numSendSockets,
+                                             std::shared_ptr<zmq::context_t> ctx)
+    : m_env(env)
+    , m_execAddr(executorAddr)
+    , m_zmqctx(ctx ? std::move(ctx) : std::make_shared<zmq::context_t>(1))
     , m_seq(0)
-    , m_sendSock(m_zmqctx, zmq::socket_type::dealer)
+    , m_stopping(false)
     , m_recvId(strings::FpToString(random::New64()))
+    , m_wakeAddr(strings::StrCat("inproc://zrpc-wake-", m_recvId))
+    , m_wakeSock(*m_zmqctx, zmq::socket_type::push)
 {
-    VLOG(2) << "Created ZeroMQ context with recv id" << m_recvId;
+    VLOG(2) << "Created ZeroMQ stub with recv id" << m_recvId;
+
+    for (int i = 0; i < std::max(numSendSockets, 1); ++i) {
+        m_sendSocks.emplace_back(new SendSocket(*m_zmqctx));
+    }
+
+    if (numCallbackThreads > 0) {
+        m_cbPool.reset(new thread::ThreadPool(env, "zrpc_callbacks", numCallbackThreads));
+    }
 
     m_recvThread = env->StartThread(ThreadOptions(),
                                     strings::StrCat("ZrpcMasterServiceStub::recvLoop::", m_recvId),
                                     std::bind(&ZrpcMasterServiceStub::recvLoop, this));
 
-    try {
-        m_sendSock.connect(m_execAddr);
-    } catch (zmq::error_t &err) {
-        LOG(ERROR) << "ZeroMQ socket connect failed: " << err.what();
+    for (auto &sendSock : m_sendSocks) {
+        mutex_lock locker(sendSock->mu);
+        try {
+            // Don't let unsent messages block context termination
+            sendSock->sock.setsockopt(ZMQ_LINGER, 0);
+            sendSock->sock.connect(m_execAddr);
+        } catch (zmq::error_t &err) {
+            LOG(ERROR) << "ZeroMQ socket connect failed: " << err.what();
+        }
     }
 
     m_recvReady.WaitForNotification();
+
+    mutex_lock locker(m_mwake);
+    try {
+        m_wakeSock.setsockopt(ZMQ_LINGER, 0);
+        m_wakeSock.connect(m_wakeAddr);
+    } catch (zmq::error_t &err) {
+        LOG(ERROR) << "ZeroMQ wake socket connect failed: " << err.what();
+    }
 }
 
 ZrpcMasterServiceStub::~ZrpcMasterServiceStub()
 {
-    // close socket before context, otherwise context close blocks
-    m_sendSock.close();
-    // close context before delete recv thread, so that recv thread will return.
-    m_zmqctx.close();
-
+    // The context may be shared with other stubs, so the recv thread is stopped
+    // through a flag instead of by closing the context.
+    m_stopping = true;
+    wakeRecvLoop();
     delete m_recvThread;
+
+    // No reply is received from here on. Fail the pending calls so their callers return,
+    // including synchronous calls blocking a callback thread, then wait for callbacks
+    // still running, which may have started more calls.
+    failPendingCalls(errors::Cancelled("ZrpcMasterServiceStub destroyed"));
+    m_cbPool.reset();
+    failPendingCalls(errors::Cancelled("ZrpcMasterServiceStub destroyed"));
+
+    // close sockets before releasing the context, otherwise context close blocks
+    for (auto &sendSock : m_sendSocks) {
+        mutex_lock locker(sendSock->mu);
+        sendSock->sock.close();
+    }
+    {
+        mutex_lock locker(m_mwake);
+        m_wakeSock.close();
+    }
+}
+
+void ZrpcMasterServiceStub::failPendingCalls(const Status &status)
+{
+    // Callbacks may start other calls, so repeat until none is left
+    while (true) {
+        std::vector<Item> items;
+        for (auto &shard : m_shards) {
+            mutex_lock locker(shard.mu);
+            for (auto &p : shard.items) {
+                items.emplace_back(std::move(p.second));
+            }
+            shard.items.clear();
+        }
+        if (items.empty()) {
+            return;
+        }
+        VLOG(2) << "Failing " << items.size() << " pending calls: " << status;
+        // Typed callbacks are cancelled when the items are destroyed
+        for (auto &item : items) {
+            if (item.done) {
+                item.done(status, std::move(item.reply), {});
+            }
+        }
+    }
+}
+
+bool ZrpcMasterServiceStub::onOwnThread() const
+{
+    if (std::this_thread::get_id() == m_recvThreadId) {
+        return true;
+    }
+    return m_cbPool && m_cbPool->CurrentThreadId() >= 0;
+}
+
+constexpr size_t ZrpcMasterServiceStub::kNumShards;
+
+size_t ZrpcMasterServiceStub::socketFor(const std::string &sessionId, uint64_t seq) const
+{
+    if (m_sendSocks.size() == 1) {
+        return 0;
+    }
+    // Keep requests of one session in order, spread the rest
+    if (sessionId.empty()) {
+        return seq % m_sendSocks.size();
+    }
+    return std::hash<std::string>()(sessionId) % m_sendSocks.size();
 }
 
 ZrpcMasterServiceStub::Item::Item() {}
@@ -95,6 +188,9 @@ ZrpcMasterServiceStub::Item::Item(Item &&other)
     : reply(std::move(other.reply))
     , done(std::move(other.done))
     , typedCallbacks(std::move(other.typedCallbacks))
+    , deadline(other.deadline)
+    , cancelled(other.cancelled)
+    , sessionId(std::move(other.sessionId))
 {}
 
 ZrpcMasterServiceStub::Item::Item(ProtoPtr &&rep, DoneCallback done) : reply(std::move(rep)), done(done) {}
@@ -104,54 +200,119 @@ ZrpcMasterServiceStub::Item &ZrpcMasterServiceStub::Item::operator=(Item &&other
     std::swap(this->reply, other.reply);
     std::swap(this->done, other.done);
     std::swap(this->typedCallbacks, other.typedCallbacks);
+    std::swap(this->deadline, other.deadline);
+    std::swap(this->cancelled, other.cancelled);
+    std::swap(this->sessionId, other.sessionId);
     return *this;
 }
 
 ZrpcMasterServiceStub::Item::~Item()
 {
     for (auto &item : typedCallbacks) {
-        item.second(errors::Cancelled("Callback function cancelled"), nullptr);
+        item.second(errors::Cancelled("Callback function cancelled"), nullptr, {});
     }
 }
 
 void ZrpcMasterServiceStub::dumpWaitingCb()
 {
-    mutex_lock locker(m_mtable);
+    if (!VLOG_IS_ON(3)) {
+        return;
+    }
+
     VLOG(3) << "Pending callbacks:";
-    for (auto &p : m_recvCallbacks) {
-        auto &item = p.second;
-        VLOG(3) << "  seq: " << p.first;
-        if (item.reply) {
-            VLOG(3) << "    reply type: " << item.reply->GetTypeName();
-        } else {
-            VLOG(3) << "    reply type: nullptr";
+    for (auto &shard : m_shards) {
+        mutex_lock locker(shard.mu);
+        for (auto &p : shard.items) {
+            auto &item = p.second;
+            VLOG(3) << "  seq: " << p.first;
+            if (item.reply) {
+                VLOG(3) << "    reply type: " << item.reply->GetTypeName();
+            } else {
+                VLOG(3) << "    reply type: nullptr";
+            }
+            VLOG(3) << "   done: " << item.done.target_type().name();
+            for (auto &typed : item.typedCallbacks) {
+                VLOG(3) << "    " << typed.first
+                       << " -> " << typed.second.target_type().name();
+            }
         }
-        VLOG(3) << "   done: " << item.done.target_type().name();
-        for (auto &typed : item.typedCallbacks) {
-            VLOG(3) << "    " << typed.first
-                   << " -> " << typed.second.target_type().name();
+    }
+}
+
+bool ZrpcMasterServiceStub::takeItem(uint64_t seq, Item *item)
+{
+    auto &shard = shardOf(seq);
+    mutex_lock locker(shard.mu);
+    auto it = shard.items.find(seq);
+    if (it == shard.items.end()) {
+        return false;
+    }
+    *item = std::move(it->second);
+    shard.items.erase(it);
+    return true;
+}
+
+void ZrpcMasterServiceStub::dispatch(DoneCallback cb, ProtoPtr &&reply, bool has_body, zmq::message_t &&msg_body,
+                                     zmq::MultiPartMessage &&frames, const zrpc::EvenlopDef &edef)
+{
+    // Now parse our message body
+    if (reply && !has_body) {
+        LOG(ERROR) << "Skipped one iteration due to no body message part found after evenlop frame";
+        cb(errors::Internal("No body message found"), std::move(reply), {});
+        return;
+    } else if (reply) {
+        if(!reply->ParseFromArray(msg_body.data(), msg_body.size())) {
+            LOG(ERROR) << "Received malformatted message body. Dropping";
+            cb(errors::Internal("Body message malformatted"), std::move(reply), {});
+            return;
         }
     }
+
+    // Invoke callback regardless whether we have a body or not
+    VLOG(2) << "Calling callback function for seq " << edef.seq() << " and type " << edef.type();
+    cb(Status::OK(), std::move(reply), std::move(frames));
+    VLOG(4) << "Callback function returned for seq " << edef.seq() << " and type " << edef.type();
 }
 
 void ZrpcMasterServiceStub::recvLoop()
 {
     VLOG(2) << "Started zmq recving thread, using ZMQ_IDENTITY: " << m_recvId;
+    m_recvThreadId = std::this_thread::get_id();
 
-    zmq::socket_t recvSock(m_zmqctx, zmq::socket_type::dealer);
+    zmq::socket_t recvSock(*m_zmqctx, zmq::socket_type::dealer);
+    zmq::socket_t wakeSock(*m_zmqctx, zmq::socket_type::pull);
     try {
         recvSock.setsockopt(ZMQ_IDENTITY, m_recvId.c_str(), m_recvId.size());
+        recvSock.setsockopt(ZMQ_LINGER, 0);
         recvSock.connect(m_execAddr);
+        wakeSock.setsockopt(ZMQ_LINGER, 0);
+        wakeSock.bind(m_wakeAddr);
     } catch (zmq::error_t &err) {
         LOG(ERROR) << "ZeroMQ recving socket creation failed: " << err.what();
+        m_recvReady.Notify();
         return;
     }
 
     m_recvReady.Notify();
 
-    while (true) {
+    while (!m_stopping) {
         try {
             dumpWaitingCb();
+
+            // Wait for incoming messages until the next deadline, or until woken up
+            // because an earlier deadline was added
+            zmq::pollitem_t items[] = {{static_cast<void *>(recvSock), 0, ZMQ_POLLIN, 0},
+                                       {static_cast<void *>(wakeSock), 0, ZMQ_POLLIN, 0}};
+            zmq::poll(items, 2, expireCalls());
+            if (items[1].revents & ZMQ_POLLIN) {
+                zmq::message_t wake;
+                while (wakeSock.recv(&wake, ZMQ_DONTWAIT)) {
+                }
+            }
+            if (!(items[0].revents & ZMQ_POLLIN)) {
+                continue;
+            }
+
             // Receive and skip identification frames
             zmq::message_t msg;
             do {
@@ -175,6 +336,12 @@ void ZrpcMasterServiceStub::recvLoop()
                 has_body = true;
             }
 
+            // Any remaining frames carry tensor payloads for the body
+            zmq::MultiPartMessage frames;
+            while (recvSock.getsockopt<int64_t>(ZMQ_RCVMORE)) {
+                recvSock.recv(&frames.emplace_back());
+            }
+
             // Parse what we have received
             zrpc::EvenlopDef edef;
             if(!edef.ParseFromArray(msg_evenlop.data(), msg_evenlop.size())) {
@@ -187,63 +354,75 @@ void ZrpcMasterServiceStub::recvLoop()
             // Find corresonding item in table
             DoneCallback cb;
             ProtoPtr reply;
+            // Any typed callbacks left in a finished item are cancelled when it is
+            // destroyed, which must happen outside the lock.
+            Item finished;
             {
-                mutex_lock locker(m_mtable);
-                auto it = m_recvCallbacks.find(edef.seq());
-                if (it == m_recvCallbacks.end()) {
-                    LOG(ERROR) << "Skipped one iteration due to seq not found in table: " << edef.seq();
+                auto &shard = shardOf(edef.seq());
+                mutex_lock locker(shard.mu);
+                auto it = shard.items.find(edef.seq());
+                if (it == shard.items.end()) {
+                    // This happens normally for calls that expired or were cancelled
+                    LOG(WARNING) << "Skipped one iteration due to seq not found in table: " << edef.seq();
                     continue;
                 }
                 auto itt = it->second.typedCallbacks.find(edef.type());
                 if (itt != it->second.typedCallbacks.end()) {
                     cb = itt->second;
-                    // we have a typed callback
-                    if (!cb) {
-                        LOG(WARNING) << "Skipped one iteration due to no callback";
-                        continue;
-                    }
-                    auto desc = ::google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(edef.type());
-                    if (!desc) {
-                        LOG(ERROR) << "Protobuf descriptor not found for type name: " << edef.type();
-                        cb(errors::Internal("Protobuf descriptor not found for type"), nullptr);
-                        continue;
-                    }
-                    auto message = ::google::protobuf::MessageFactory::generated_factory()->GetPrototype(desc)->New();
-                    if (!message) {
-                        LOG(ERROR) << "Failed to create message object from descriptor of type name: {}" << edef.type();
-                        cb(errors::Internal("Failed to create message object from descriptor of type"), nullptr);
-                        continue;
-                    }
-                    reply.reset(message);
                 } else {
-                    if (!it->second.done) {
-                        LOG(WARNING) << "Skipped one iteration due to no callback";
-                        continue;
-                    }
                     std::swap(cb ,it->second.done);
                     std::swap(reply ,it->second.reply);
-                    auto t = it->second.typedCallbacks;
-                    m_recvCallbacks.erase(it);
+                    finished = std::move(it->second);
+                    shard.items.erase(it);
                 }
             }
-
-            // Now receive our message body
-            if (reply && !has_body) {
-                LOG(ERROR) << "Skipped one iteration due to no body message part found after evenlop frame";
-                cb(errors::Internal("No body message found"), std::move(reply));
+            forgetDeadline(finished.deadline, edef.seq());
+            if (!cb) {
+                LOG(WARNING) << "Skipped one iteration due to no callback";
                 continue;
-            } else if (reply) {
-                if(!reply->ParseFromArray(msg_body.data(), msg_body.size())) {
-                    LOG(ERROR) << "Received malformatted message body. Dropping";
-                    cb(errors::Internal("Body message malformatted"), std::move(reply));
+            }
+            if (!reply) {
+                // we have a typed callback
+                auto desc = ::google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(edef.type());
+                if (!desc) {
+                    LOG(ERROR) << "Protobuf descriptor not found for type name: " << edef.type();
+                    cb(errors::Internal("Protobuf descriptor not found for type"), nullptr, {});
+                    continue;
+                }
+                auto message = ::google::protobuf::MessageFactory::generated_factory()->GetPrototype(desc)->New();
+                if (!message) {
+                    LOG(ERROR) << "Failed to create message object from descriptor of type name: {}" << edef.type();
+                    cb(errors::Internal("Failed to create message object from descriptor of type"), nullptr, {});
                     continue;
                 }
+                reply.reset(message);
             }
 
-            // Invoke callback regardless whether we have a body or not
-            VLOG(2) << "Calling callback function for seq " << edef.seq() << " and type " << edef.type();
-            cb(Status::OK(), std::move(reply));
-            VLOG(4) << "Callback function returned for seq " << edef.seq() << " and type " << edef.type();
+            if (!m_cbPool) {
+                dispatch(std::move(cb), std::move(reply), has_body, std::move(msg_body), std::move(frames), edef);
+                continue;
+            }
+
+            // Parse the body and run the callback off the receiving thread, so a slow
+            // callback doesn't hold up other calls.
+            struct Pending
+            {
+                DoneCallback cb;
+                ProtoPtr reply;
+                zmq::message_t body;
+                zmq::MultiPartMessage frames;
+                zrpc::EvenlopDef edef;
+            };
+            auto pending = std::make_shared<Pending>();
+            pending->cb = std::move(cb);
+            pending->reply = std::move(reply);
+            pending->body = std::move(msg_body);
+            pending->frames = std::move(frames);
+            pending->edef = std::move(edef);
+            m_cbPool->Schedule([this, pending, has_body]() {
+                dispatch(std::move(pending->cb), std::move(pending->reply), has_body, std::move(pending->body),
+                         std::move(pending->frames), pending->edef);
+            });
         } catch (zmq::error_t &err) {
             if (err.num() == ETERM || err.num() == EINTR) {
                 break;
@@ -256,19 +435,26 @@ void ZrpcMasterServiceStub::recvLoop()
 }
 
 template<typename ResponseType>
-ZrpcMasterServiceStub::AsyncCallStarter ZrpcMasterServiceStub::rpcCallAsync(const std::string &sessionId,
+ZrpcMasterServiceStub::AsyncCallStarter ZrpcMasterServiceStub::rpcCallAsync(CallOptions *call_options,
+                                                          const std::string &sessionId,
                                                           const google::protobuf::Message& msg,
-                                                          std::function<void(const Status&, std::unique_ptr<ResponseType>&&)> done)
+                                                          zmq::MultiPartMessage &&frames,
+                                                          std::function<void(const Status&, std::unique_ptr<ResponseType>&&,
+                                                                             zmq::MultiPartMessage &&)> done)
 {
     using ResponsePtr = std::unique_ptr<ResponseType>;
     Item args;
     if (done) {
-        args = Item { ResponsePtr(new ResponseType), [done](const Status &s, ProtoPtr &&rep){
-            done(s, ResponsePtr(static_cast<ResponseType*>(rep.release())));
+        args = Item { ResponsePtr(new ResponseType), [done, call_options](const Status &s, ProtoPtr &&rep,
+                                                                          zmq::MultiPartMessage &&repFrames){
+            if (call_options) {
+                call_options->ClearCancelCallback();
+            }
+            done(s, ResponsePtr(static_cast<ResponseType*>(rep.release())), std::move(repFrames));
         }};
     }
 
-    return makeStarter(sessionId, msg, std::move(args));
+    return makeStarter(sessionId, msg, std::move(args), std::move(frames), call_options);
 }
 
 ZrpcMasterServiceStub::AsyncCallStarter ZrpcMasterServiceStub::rpcCallAsync(const std::string &sessionId,
@@ -279,7 +465,8 @@ ZrpcMasterServiceStub::AsyncCallStarter ZrpcMasterServiceStub::rpcCallAsync(cons
 
 ZrpcMasterServiceStub::AsyncCallStarter ZrpcMasterServiceStub::makeStarter(const std::string &sessionId,
                                                          const ::google::protobuf::Message &msg,
-                                                         Item &&cbitem)
+                                                         Item &&cbitem, zmq::MultiPartMessage &&frames,
+                                                         CallOptions *call_options)
 {
     auto seq = m_seq.fetch_add(1);
     // Create evenlop message
@@ -302,13 +489,156 @@ ZrpcMasterServiceStub::AsyncCallStarter ZrpcMasterServiceStub::makeStarter(const
 
     if (cbitem.empty()) {
         return AsyncCallStarter(nullptr,
-                                *this, seq, std::move(evenlop), std::move(zmqmsg));
-    } else {
-        mutex_lock locker(m_mtable);
-        auto it = m_recvCallbacks.end();
-        std::tie(it, std::ignore) = m_recvCallbacks.emplace(seq, std::move(cbitem));
-        return AsyncCallStarter(&it->second.typedCallbacks,
-                                *this, seq, std::move(evenlop), std::move(zmqmsg));
+                                *this, seq, socketFor(sessionId, seq), std::move(evenlop), std::move(zmqmsg), std::move(frames));
+    }
+
+    cbitem.sessionId = sessionId;
+    auto timeout = call_options ? call_options->GetTimeout() : 0;
+    if (timeout > 0) {
+        cbitem.deadline = m_env->NowMicros() + static_cast<uint64>(timeout) * 1000;
+    }
+
+    auto deadline = cbitem.deadline;
+    auto pTypedCallbacks = &cbitem.typedCallbacks;
+    {
+        auto &shard = shardOf(seq);
+        mutex_lock locker(shard.mu);
+        auto it = shard.items.end();
+        std::tie(it, std::ignore) = shard.items.emplace(seq, std::move(cbitem));
+        pTypedCallbacks = &it->second.typedCallbacks;
+    }
+    if (deadline) {
+        bool earlier;
+        {
+            mutex_lock locker(m_mdeadlines);
+            m_deadlines.emplace(deadline, seq);
+            earlier = m_pollDeadline == 0 || deadline < m_pollDeadline;
+            if (earlier) {
+                m_pollDeadline = deadline;
+            }
+        }
+        if (earlier) {
+            wakeRecvLoop();
+        }
+    }
+
+    if (call_options) {
+        call_options->SetCancelCallback([this, seq]() {
+            markCancelled(seq);
+        });
+    }
+
+    return AsyncCallStarter(pTypedCallbacks,
+                            *this, seq, socketFor(sessionId, seq), std::move(evenlop), std::move(zmqmsg), std::move(frames));
+}
+
+long ZrpcMasterServiceStub::expireCalls()
+{
+    // (seq, cancelled)
+    std::vector<std::pair<uint64_t, bool>> expired;
+    long timeout = -1;
+    {
+        mutex_lock locker(m_mdeadlines);
+        m_pollDeadline = 0;
+        auto now = m_env->NowMicros();
+        while (!m_deadlines.empty()) {
+            auto top = *m_deadlines.begin();
+            auto &shard = shardOf(top.second);
+            mutex_lock shardLocker(shard.mu);
+            auto it = shard.items.find(top.second);
+            if (it == shard.items.end() || it->second.deadline != top.first) {
+                // Already finished
+                m_deadlines.erase(m_deadlines.begin());
+                continue;
+            }
+            if (top.first > now) {
+                timeout = static_cast<long>((top.first - now + 999) / 1000);
+                m_pollDeadline = top.first;
+                break;
+            }
+            expired.emplace_back(top.second, it->second.cancelled);
+            m_deadlines.erase(m_deadlines.begin());
+        }
+    }
+
+    for (auto &p : expired) {
+        if (p.second) {
+            VLOG(2) << "Call seq " << p.first << " cancelled";
+            cancelCall(p.first, errors::Cancelled("Call cancelled"));
+        } else {
+            VLOG(2) << "Call seq " << p.first << " passed its deadline";
+            cancelCall(p.first, errors::DeadlineExceeded("Deadline exceeded waiting for response"));
+        }
+    }
+    return timeout;
+}
+
+void ZrpcMasterServiceStub::forgetDeadline(uint64 deadline, uint64_t seq)
+{
+    if (deadline == 0) {
+        return;
+    }
+    mutex_lock locker(m_mdeadlines);
+    m_deadlines.erase(Deadline(deadline, seq));
+}
+
+size_t ZrpcMasterServiceStub::numDeadlines()
+{
+    mutex_lock locker(m_mdeadlines);
+    return m_deadlines.size();
+}
+
+void ZrpcMasterServiceStub::wakeRecvLoop()
+{
+    mutex_lock locker(m_mwake);
+    try {
+        // A wake-up already queued does as well, so never block
+        m_wakeSock.send(zmq::message_t(), ZMQ_DONTWAIT);
+    } catch (zmq::error_t &err) {
+        LOG(ERROR) << "Failed to wake up the receiving thread: " << err.what();
+    }
+}
+
+void ZrpcMasterServiceStub::markCancelled(uint64_t seq)
+{
+    // Called with the CallOptions lock held, so only schedule the cancellation
+    // for the receiving thread.
+    uint64 oldDeadline;
+    {
+        auto &shard = shardOf(seq);
+        mutex_lock locker(shard.mu);
+        auto it = shard.items.find(seq);
+        if (it == shard.items.end()) {
+            return;
+        }
+        oldDeadline = it->second.deadline;
+        it->second.cancelled = true;
+        it->second.deadline = 1;
+    }
+    // Never hold a shard lock while taking m_mdeadlines, expireCalls nests them the other way.
+    {
+        mutex_lock locker(m_mdeadlines);
+        m_deadlines.erase(Deadline(oldDeadline, seq));
+        m_deadlines.emplace(1, seq);
+        m_pollDeadline = 1;
+    }
+    wakeRecvLoop();
+}
+
+void ZrpcMasterServiceStub::cancelCall(uint64_t seq, const Status &status)
+{
+    Item item;
+    if (!takeItem(seq, &item)) {
+        return;
+    }
+
+    // Ask the executor to drop the call, no reply expected
+    zrpc::CancelRequest req;
+    req.set_seq(seq);
+    rpcCallAsync(item.sessionId, req);
+
+    if (item.done) {
+        item.done(status, std::move(item.reply), {});
     }
 }
 
@@ -318,29 +648,46 @@ void ZrpcMasterServiceStub::AsyncCallStarter::start()
     m_started = true;
     try {
         {
-            mutex_lock locker(m_client.m_mu);
-            m_client.m_sendSock.send(zmq::message_t(), ZMQ_SNDMORE);
-            m_client.m_sendSock.send(m_evenlop, ZMQ_SNDMORE);
-            m_client.m_sendSock.send(m_zmqmsg);
+            auto &sendSock = *m_client.m_sendSocks[m_sockIdx];
+            mutex_lock locker(sendSock.mu);
+            sendSock.sock.send(zmq::message_t(), ZMQ_SNDMORE);
+            sendSock.sock.send(m_evenlop, ZMQ_SNDMORE);
+            if (m_frames->empty()) {
+                sendSock.sock.send(m_zmqmsg);
+            } else {
+                sendSock.sock.send(m_zmqmsg, ZMQ_SNDMORE);
+                auto &frames = m_frames.messages();
+                for (size_t i = 0; i != frames.size(); ++i) {
+                    sendSock.sock.send(frames[i], i + 1 == frames.size() ? 0 : ZMQ_SNDMORE);
+                }
+            }
         }
         VLOG(3) << "Message sent for seq: " << m_seq;
     } catch (zmq::error_t &err) {
         LOG(ERROR) << "Error when sending message seq " << m_seq << ": " << err.what();
-        // cleanup callback if any
-        mutex_lock locker(m_client.m_mtable);
-        m_client.m_recvCallbacks.erase(m_seq);
+        // cleanup callback if any, and let the caller know
+        Item item;
+        if (!m_client.takeItem(m_seq, &item)) {
+            return;
+        }
+        m_client.forgetDeadline(item.deadline, m_seq);
+        if (item.done) {
+            item.done(errors::Unavailable("Failed to send message: ", err.what()), std::move(item.reply), {});
+        }
     }
 }
 
 template<typename ResponseType>
-Status ZrpcMasterServiceStub::rpcCall(const std::string &sessionId, const ::google::protobuf::Message &msg,
-                             std::unique_ptr<ResponseType> &reply)
+Status ZrpcMasterServiceStub::rpcCall(CallOptions *call_options, const std::string &sessionId,
+                             const ::google::protobuf::Message &msg, std::unique_ptr<ResponseType> &reply,
+                             zmq::MultiPartMessage &&frames)
 {
     using ResponsePtr = std::unique_ptr<ResponseType>;
 
     Status status;
     Notification n;
-    rpcCallAsync<ResponseType>(sessionId, msg, [&n, &status, &reply](const Status &s, ResponsePtr &&rep){
+    rpcCallAsync<ResponseType>(call_options, sessionId, msg, std::move(frames),
+                               [&n, &status, &reply](const Status &s, ResponsePtr &&rep, zmq::MultiPartMessage &&){
         status = s;
         reply = std::move(rep);
         n.Notify();
@@ -351,8 +698,35 @@ Status ZrpcMasterServiceStub::rpcCall(const std::string &sessionId, const ::goog
     return status;
 }
 
+namespace {
+
+// Combines the transport status and the status carried in the response
+Status checkCustomResponse(const char *name, Status status, const zrpc::CustomResponse *pResponse)
+{
+    if (!status.ok() || !pResponse) {
+        LOG(ERROR) << "ZrpcMasterServiceStub::" << name << " failed: " << status;
+        status.Update(errors::Internal("ZrpcMasterServiceStub::", name, " failed"));
+        return status;
+    }
+    return FromZrpcStatus(pResponse->result());
+}
+
+Status parseCustomResponse(const char *name, const Status &status, const zrpc::CustomResponse *pResponse,
+                           ::google::protobuf::Message *resp)
+{
+    TF_RETURN_IF_ERROR(checkCustomResponse(name, status, pResponse));
+    if (!resp->ParseFromString(pResponse->extra())) {
+        LOG(ERROR) << "Response->extra is not a valid " << name << "Response object";
+        return errors::Internal("Response->extra is not a valid ", name, "Response object");
+    }
+    return Status::OK();
+}
+
+} // namespace
+
 #define HANDLER_IMPL(name, sessIdExpr) \
-Status ZrpcMasterServiceStub:: name (const name ## Request &req, name ## Response *resp) \
+Status ZrpcMasterServiceStub:: name (CallOptions *call_options, const name ## Request &req, \
+                                    name ## Response *resp) \
 { \
     VLOG(2) << "==================================================================="; \
     VLOG(2) << "RpcClient::" #name; \
@@ -362,24 +736,9 @@ Status ZrpcMasterServiceStub:: name (const name ## Request &req, name ## Respons
     request.set_type(req.GetTypeName()); \
 \
     std::unique_ptr<zrpc::CustomResponse> pResponse; \
-    auto status = rpcCall((sessIdExpr), request, pResponse); \
-\
-    if (!status.ok() || !pResponse) { \
-        LOG(ERROR) << "ZrpcMasterServiceStub::" << #name << " failed: " << status; \
-        status.Update(errors::Internal("ZrpcMasterServiceStub::" #name " failed")); \
-        return status; \
-    } \
-    status.Update(FromZrpcStatus(pResponse->result())); \
-    if (!status.ok()) { \
-        return status; \
-    } \
-    if (!resp->ParseFromString(pResponse->extra())) { \
-        LOG(ERROR) << "Response->extra is not a valid " #name "Response object"; \
-        status.Update(errors::Internal("Response->extra is not a valid " #name "Response object")); \
-        return status; \
-    } \
+    auto status = rpcCall(call_options, (sessIdExpr), request, pResponse); \
 \
-    return Status::OK(); \
+    return parseCustomResponse(#name, status, pResponse.get(), resp); \
 }
 
 HANDLER_IMPL(ListDevices, "")
@@ -389,8 +748,154 @@ HANDLER_IMPL(CreateSession, "")
 HANDLER_IMPL(CloseSession, req.session_handle())
 HANDLER_IMPL(ExtendSession, req.session_handle())
 HANDLER_IMPL(PartialRunSetup, req.session_handle())
-HANDLER_IMPL(RunStep, req.session_handle())
 
 #undef HANDLER_IMPL
 
+namespace {
+// Const values smaller than this stay inline in the graph
+const size_t kMinGraphFrameBytes = 1024;
+} // namespace
+
+Status ZrpcMasterServiceStub::CreateSessionWithFrames(CallOptions *call_options, const CreateSessionRequest &req,
+                                                      CreateSessionResponse *resp, bool byFingerprint)
+{
+    VLOG(2) << "===================================================================";
+    VLOG(2) << "RpcClient::CreateSession with graph frames";
+
+    zrpc::CustomRequest request;
+    request.set_type(req.GetTypeName());
+    zmq::MultiPartMessage frames;
+
+    CreateSessionRequest body;
+    *body.mutable_config() = req.config();
+    body.set_target(req.target());
+
+    if (byFingerprint) {
+        // Ask with the fingerprint only. The graph must be encoded to get the fingerprint,
+        // but not serialized.
+        GraphDef graph;
+        TF_RETURN_IF_ERROR(ZrpcTensorCoding::encodeGraphDef(req.graph_def(), kMinGraphFrameBytes, &graph,
+                                                            &request, &frames));
+        request.set_graph_fingerprint(ZrpcTensorCoding::fingerprintGraph(graph, frames));
+
+        zrpc::CustomRequest probe;
+        probe.set_type(req.GetTypeName());
+        probe.set_graph_fingerprint(request.graph_fingerprint());
+        body.SerializeToString(probe.mutable_extra());
+
+        std::unique_ptr<zrpc::CustomResponse> pResponse;
+        auto status = rpcCall(call_options, "", probe, pResponse);
+        status = parseCustomResponse("CreateSession", status, pResponse.get(), resp);
+        if (status.code() != error::NOT_FOUND) {
+            return status;
+        }
+        VLOG(2) << "Graph " << request.graph_fingerprint() << " not cached by executor, uploading";
+
+        body.mutable_graph_def()->Swap(&graph);
+    } else {
+        TF_RETURN_IF_ERROR(ZrpcTensorCoding::encodeGraphDef(req.graph_def(), kMinGraphFrameBytes,
+                                                            body.mutable_graph_def(), &request, &frames));
+    }
+    body.SerializeToString(request.mutable_extra());
+
+    std::unique_ptr<zrpc::CustomResponse> pResponse;
+    auto status = rpcCall(call_options, "", request, pResponse, std::move(frames));
+    return parseCustomResponse("CreateSession", status, pResponse.get(), resp);
+}
+
+Status ZrpcMasterServiceStub::ExtendSessionWithFrames(CallOptions *call_options, const ExtendSessionRequest &req,
+                                                      ExtendSessionResponse *resp)
+{
+    VLOG(2) << "===================================================================";
+    VLOG(2) << "RpcClient::ExtendSession with graph frames";
+
+    zrpc::CustomRequest request;
+    request.set_type(req.GetTypeName());
+    zmq::MultiPartMessage frames;
+
+    ExtendSessionRequest body;
+    body.set_session_handle(req.session_handle());
+    body.set_current_graph_version(req.current_graph_version());
+    TF_RETURN_IF_ERROR(ZrpcTensorCoding::encodeGraphDef(req.graph_def(), kMinGraphFrameBytes,
+                                                        body.mutable_graph_def(), &request, &frames));
+    body.SerializeToString(request.mutable_extra());
+
+    std::unique_ptr<zrpc::CustomResponse> pResponse;
+    auto status = rpcCall(call_options, req.session_handle(), request, pResponse, std::move(frames));
+    return parseCustomResponse("ExtendSession", status, pResponse.get(), resp);
+}
+
+Status ZrpcMasterServiceStub::RunStep(CallOptions *call_options, const RunStepRequest &req,
+                                      RunStepResponse *resp)
+{
+    Status status;
+    Notification n;
+    RunStepAsync(call_options, req, resp, [&n, &status](const Status &s) {
+        status = s;
+        n.Notify();
+    });
+    n.WaitForNotification();
+    return status;
+}
+
+Status ZrpcMasterServiceStub::RunStep(CallOptions *call_options, const RunStepRequestWrapper &req,
+                                      ZrpcRunStepResponse *resp)
+{
+    Status status;
+    Notification n;
+    RunStepAsync(call_options, req, resp, [&n, &status](const Status &s) {
+        status = s;
+        n.Notify();
+    });
+    n.WaitForNotification();
+    return status;
+}
+
+void ZrpcMasterServiceStub::RunStepAsync(CallOptions *call_options, const RunStepRequest &req,
+                                         RunStepResponse *resp, StatusCallback done)
+{
+    VLOG(2) << "===================================================================";
+    VLOG(2) << "RpcClient::RunStep";
+
+    zrpc::CustomRequest request;
+    req.SerializeToString(request.mutable_extra());
+    request.set_type(req.GetTypeName());
+
+    rpcCallAsync<zrpc::CustomResponse>(call_options, req.session_handle(), request, {},
+                                       [resp, done](const Status &s, std::unique_ptr<zrpc::CustomResponse> &&pResponse,
+                                                    zmq::MultiPartMessage &&) {
+        done(parseCustomResponse("RunStep", s, pResponse.get(), resp));
+    });
+}
+
+void ZrpcMasterServiceStub::RunStepAsync(CallOptions *call_options, const RunStepRequestWrapper &req,
+                                         ZrpcRunStepResponse *resp, StatusCallback done)
+{
+    VLOG(2) << "===================================================================";
+    VLOG(2) << "RpcClient::RunStep with tensor frames";
+
+    zrpc::CustomRequest request;
+    zmq::MultiPartMessage frames;
+    {
+        RunStepRequest body;
+        auto s = ZrpcTensorCoding::encodeRunStepRequest(req, &body, &request, &frames);
+        if (!s.ok()) {
+            done(s);
+            return;
+        }
+        body.SerializeToString(request.mutable_extra());
+    }
+
+    rpcCallAsync<zrpc::CustomResponse>(call_options, req.session_handle(), request, std::move(frames),
+                                       [resp, done](const Status &s, std::unique_ptr<zrpc::CustomResponse> &&pResponse,
+                                                    zmq::MultiPartMessage &&replyFrames) {
+        RunStepResponse body;
+        auto status = parseCustomResponse("RunStep", s, pResponse.get(), &body);
+        if (status.ok()) {
+            status = resp->setFromFrames(std::move(body), pResponse->frames(), std::move(replyFrames));
+        }
+        done(status);
+    });
+}
+
 } // namespace tensorflow
@@ -32,11 +32,18 @@
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <set>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace tensorflow {
+class CallOptions;
 class Env;
 class Thread;
+namespace thread {
+class ThreadPool;
+} // namespace thread
 
 class CreateSessionRequest;
 class CreateSessionResponse;
@@ -52,29 +59,72 @@ class ListDevicesRequest;
 class ListDevicesResponse;
 class ResetRequest;
 class ResetResponse;
+class RunStepRequestWrapper;
+class ZrpcRunStepResponse;
 
 using ProtoPtr = std::unique_ptr<::google::protobuf::Message>;
 
 class ZrpcMasterServiceStub
 {
 public:
-    ZrpcMasterServiceStub(Env *env, const std::string &executorAddr);
-
+    // If `numCallbackThreads` is positive, response bodies are parsed and callbacks are
+    // run on a pool of that many threads, instead of inline on the receiving thread.
+    // Callbacks for different calls may then complete out of order.
+    //
+    // Requests are spread over `numSendSockets` connections, with all requests of one
+    // session going through the same one. Sockets are created in `ctx` if given, so
+    // several stubs can share the ZeroMQ I/O threads, or in a private context otherwise.
+    ZrpcMasterServiceStub(Env *env, const std::string &executorAddr, int numCallbackThreads = 0,
+                          int numSendSockets = 1, std::shared_ptr<zmq::context_t> ctx = nullptr);
+
+    // Calls still pending fail with CANCELLED.
     ~ZrpcMasterServiceStub();
 
-    Status CreateSession(const CreateSessionRequest &req, CreateSessionResponse *resp);
-    Status CloseSession(const CloseSessionRequest &req, CloseSessionResponse *resp);
-    Status ExtendSession(const ExtendSessionRequest &req, ExtendSessionResponse *resp);
-    Status PartialRunSetup(const PartialRunSetupRequest &req, PartialRunSetupResponse *resp);
-    Status RunStep(const RunStepRequest &req, RunStepResponse *resp);
-    Status ListDevices(const ListDevicesRequest &req, ListDevicesResponse *resp);
-    Status Reset(const ResetRequest &req, ResetResponse *resp);
+    // All calls fail with DEADLINE_EXCEEDED if no response arrives within the timeout
+    // set in `call_options`, and can be cancelled through it. In both cases the executor
+    // is asked to drop the call.
+    Status CreateSession(CallOptions *call_options, const CreateSessionRequest &req,
+                         CreateSessionResponse *resp);
+    Status CloseSession(CallOptions *call_options, const CloseSessionRequest &req, CloseSessionResponse *resp);
+    Status ExtendSession(CallOptions *call_options, const ExtendSessionRequest &req,
+                         ExtendSessionResponse *resp);
+    Status PartialRunSetup(CallOptions *call_options, const PartialRunSetupRequest &req,
+                           PartialRunSetupResponse *resp);
+    Status RunStep(CallOptions *call_options, const RunStepRequest &req, RunStepResponse *resp);
+    // Sends feed and fetch tensor payloads as separate frames without copying.
+    Status RunStep(CallOptions *call_options, const RunStepRequestWrapper &req, ZrpcRunStepResponse *resp);
+    Status ListDevices(CallOptions *call_options, const ListDevicesRequest &req, ListDevicesResponse *resp);
+
+    // Like CreateSession and ExtendSession, but values of large constants in the graph
+    // are sent as separate frames without copying. If `byFingerprint`, at first only the
+    // fingerprint of the graph is sent, and the graph is uploaded only if the executor
+    // doesn't have it cached.
+    Status CreateSessionWithFrames(CallOptions *call_options, const CreateSessionRequest &req,
+                                   CreateSessionResponse *resp, bool byFingerprint);
+    Status ExtendSessionWithFrames(CallOptions *call_options, const ExtendSessionRequest &req,
+                                   ExtendSessionResponse *resp);
+    Status Reset(CallOptions *call_options, const ResetRequest &req, ResetResponse *resp);
+
+    // Asynchronous versions of RunStep. `done` is called on the callback thread once the
+    // response arrives, and `call_options` and `resp` must be kept alive until then.
+    void RunStepAsync(CallOptions *call_options, const RunStepRequest &req, RunStepResponse *resp,
+                      StatusCallback done);
+    void RunStepAsync(CallOptions *call_options, const RunStepRequestWrapper &req, ZrpcRunStepResponse *resp,
+                      StatusCallback done);
+
+    // Number of deadlines being tracked, for tests.
+    size_t numDeadlines();
+
+    // Whether the caller runs on the receiving thread or a callback thread of this stub.
+    // The destructor joins those threads, so it must not be called from them.
+    bool onOwnThread() const;
 
 private:
-    using DoneCallback = std::function<void(const Status &, ProtoPtr &&)>;
+    using DoneCallback = std::function<void(const Status &, ProtoPtr &&, zmq::MultiPartMessage &&)>;
     template<typename ResponseType>
-    Status rpcCall(const std::string &sessionId, const ::google::protobuf::Message &msg,
-                   std::unique_ptr<ResponseType> &pReply);
+    Status rpcCall(CallOptions *call_options, const std::string &sessionId,
+                   const ::google::protobuf::Message &msg, std::unique_ptr<ResponseType> &pReply,
+                   zmq::MultiPartMessage &&frames = {});
 
     struct AsyncCallStarter
     {
@@ -85,8 +135,10 @@ private:
             : m_pTypedCallbacks(other.m_pTypedCallbacks)
             , m_client(other.m_client)
             , m_seq(other.m_seq)
+            , m_sockIdx(other.m_sockIdx)
             , m_evenlop(std::move(other.m_evenlop))
             , m_zmqmsg(std::move(other.m_zmqmsg))
+            , m_frames(std::move(other.m_frames))
             , m_started(std::move(other.m_started))
         {
             other.m_pTypedCallbacks = nullptr;
@@ -94,12 +146,15 @@ private:
         }
 
         AsyncCallStarter(std::unordered_map<std::string, DoneCallback> *pTypedCallbacks, ZrpcMasterServiceStub &client,
-                         uint64_t seq, zmq::message_t &&evenlop, zmq::message_t &&zmqmsg)
+                         uint64_t seq, size_t sockIdx, zmq::message_t &&evenlop, zmq::message_t &&zmqmsg,
+                         zmq::MultiPartMessage &&frames)
             : m_pTypedCallbacks(pTypedCallbacks)
             , m_client(client)
             , m_seq(seq)
+            , m_sockIdx(sockIdx)
             , m_evenlop(std::move(evenlop))
             , m_zmqmsg(std::move(zmqmsg))
+            , m_frames(std::move(frames))
             , m_started(false)
         {
         }
@@ -130,39 +185,84 @@ private:
         std::unordered_map<std::string, DoneCallback> *m_pTypedCallbacks;
         ZrpcMasterServiceStub &m_client;
         uint64_t m_seq;
+        size_t m_sockIdx;
         zmq::message_t m_evenlop;
         zmq::message_t m_zmqmsg;
+        zmq::MultiPartMessage m_frames;
         bool m_started;
     };
 
+    // Sends `frames` after the body, and passes any frames following the reply body
+    // to `done`.
     template<typename ResponseType>
-    AsyncCallStarter rpcCallAsync(const std::string &sessionId, const ::google::protobuf::Message &msg,
-                                  std::function<void(const Status &, std::unique_ptr<ResponseType> &&)> done);
+    AsyncCallStarter rpcCallAsync(CallOptions *call_options, const std::string &sessionId,
+                                  const ::google::protobuf::Message &msg, zmq::MultiPartMessage &&frames,
+                                  std::function<void(const Status &, std::unique_ptr<ResponseType> &&,
+                                                     zmq::MultiPartMessage &&)> done);
 
     AsyncCallStarter rpcCallAsync(const std::string &sessionId, const ::google::protobuf::Message &msg);
 
     void recvLoop();
+    // Only walks the table when VLOG level 3 is on.
     void dumpWaitingCb();
+    // Parses the reply body and invokes `cb`.
+    void dispatch(DoneCallback cb, ProtoPtr &&reply, bool has_body, zmq::message_t &&msg_body,
+                  zmq::MultiPartMessage &&frames, const executor::EvenlopDef &edef);
+
+    // Fails calls whose deadline has passed, and returns the time in milliseconds
+    // until the next deadline, or -1 if there is none.
+    long expireCalls();
+    // Stops tracking the deadline of a call that finished.
+    void forgetDeadline(uint64 deadline, uint64_t seq);
+    // Interrupts the receiving thread's poll, so it rechecks deadlines and m_stopping.
+    void wakeRecvLoop();
+    // Fails the call with `status` if it is still pending, and asks the executor to drop it.
+    void cancelCall(uint64_t seq, const Status &status);
+    // Schedules the call to be cancelled by the receiving thread.
+    void markCancelled(uint64_t seq);
+    // Calls `done` of every pending call with `status`. Only used once the receiving
+    // thread stopped.
+    void failPendingCalls(const Status &status);
 
     struct Item;
+    // Removes the call from the table and moves it to `item`, returns false if not found.
+    bool takeItem(uint64_t seq, Item *item);
     AsyncCallStarter makeStarter(const std::string &sessionId, const ::google::protobuf::Message &msg,
-                                 Item &&cbitem);
+                                 Item &&cbitem, zmq::MultiPartMessage &&frames = {},
+                                 CallOptions *call_options = nullptr);
 
 private:
+    Env *m_env;
     std::string m_execAddr;
 
-    zmq::context_t m_zmqctx;
+    std::shared_ptr<zmq::context_t> m_zmqctx;
 
     std::atomic<uint64_t> m_seq;
+    std::atomic<bool> m_stopping;
+
+    struct SendSocket
+    {
+        explicit SendSocket(zmq::context_t &ctx)
+            : sock(ctx, zmq::socket_type::dealer)
+        {
+        }
 
-    mutex m_mu;
-    zmq::socket_t m_sendSock GUARDED_BY(m_mu);
+        mutex mu;
+        zmq::socket_t sock GUARDED_BY(mu);
+    };
+    std::vector<std::unique_ptr<SendSocket>> m_sendSocks;
+    // Index of the send socket used for requests of `sessionId`.
+    size_t socketFor(const std::string &sessionId, uint64_t seq) const;
 
     struct Item
     {
         ProtoPtr reply;
         DoneCallback done;
         std::unordered_map<std::string, DoneCallback> typedCallbacks;
+        // Absolute deadline in microseconds, 0 if none
+        uint64 deadline = 0;
+        bool cancelled = false;
+        std::string sessionId;
 
         ~Item();
         bool empty() const
@@ -176,12 +276,42 @@ private:
         Item &operator=(Item &&other);
     };
 
-    mutex m_mtable;
-    std::unordered_map<uint64_t, Item> m_recvCallbacks GUARDED_BY(m_mtable);
+    // Pending calls, sharded by seq. Since seqs are handed out in order, consecutive
+    // calls land in different shards and senders rarely contend with the receiving thread.
+    struct Shard
+    {
+        mutex mu;
+        std::unordered_map<uint64_t, Item> items GUARDED_BY(mu);
+    };
+    static constexpr size_t kNumShards = 16;
+    Shard m_shards[kNumShards];
+    Shard &shardOf(uint64_t seq)
+    {
+        return m_shards[seq % kNumShards];
+    }
+
+    // Ordered (deadline, seq) of pending calls. Finished calls are removed, except for the
+    // few racing with a cancellation, which are skipped once they come up.
+    // Lock order is m_mdeadlines before any shard lock.
+    using Deadline = std::pair<uint64, uint64_t>;
+    mutex m_mdeadlines;
+    std::set<Deadline> m_deadlines GUARDED_BY(m_mdeadlines);
+    // Deadline the receiving thread is polling until, 0 if it polls without timeout.
+    uint64 m_pollDeadline GUARDED_BY(m_mdeadlines) = 0;
+
     std::string m_recvId;
+    // Wakes the receiving thread up through an inproc socket, polled along with the
+    // receiving socket.
+    std::string m_wakeAddr;
+    mutex m_mwake;
+    zmq::socket_t m_wakeSock GUARDED_BY(m_mwake);
     Thread *m_recvThread;
+    // Set by the receiving thread before m_recvReady is notified.
+    std::thread::id m_recvThreadId;
     Notification m_recvReady;
 
+    std::unique_ptr<thread::ThreadPool> m_cbPool;
+
     TF_DISALLOW_COPY_AND_ASSIGN(ZrpcMasterServiceStub);
 };
 
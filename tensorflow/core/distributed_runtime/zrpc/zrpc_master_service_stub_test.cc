@@ -0,0 +1,373 @@
+/*
+ * <one line to give the library's name and an idea of what it does.>
+ * Copyright (C) 2017  Aetf <aetf@unlimitedcodeworks.xyz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_master_service_stub.h"
+
+#include "tensorflow/core/distributed_runtime/call_options.h"
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_connection_manager.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/net.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow/core/protobuf/master.pb.h"
+
+#include <atomic>
+
+namespace zrpc = executor;
+
+namespace tensorflow {
+namespace {
+
+// A minimal in-process executor that answers every request with an empty
+// CustomResponse, or never answers when `silent` is set.
+class EchoServer
+{
+public:
+    explicit EchoServer(bool silent = false)
+        : m_ctx(1)
+        , m_sock(m_ctx, zmq::socket_type::router)
+        , m_silent(silent)
+        , m_stop(false)
+    {
+        m_addr = strings::StrCat("tcp://127.0.0.1:", testing::PickUnusedPortOrDie());
+        m_sock.bind(m_addr);
+        m_thread.reset(Env::Default()->StartThread(ThreadOptions(), "zrpc_echo_server",
+                                                   [this]() { serve(); }));
+    }
+
+    ~EchoServer()
+    {
+        m_stop = true;
+        m_thread.reset();
+    }
+
+    const std::string &addr() const
+    {
+        return m_addr;
+    }
+
+private:
+    void serve()
+    {
+        zrpc::CustomResponse resp;
+        std::string body;
+        resp.SerializeToString(&body);
+
+        while (!m_stop) {
+            zmq::pollitem_t items[] = {{static_cast<void *>(m_sock), 0, ZMQ_POLLIN, 0}};
+            zmq::poll(items, 1, 10);
+            if (!(items[0].revents & ZMQ_POLLIN)) {
+                continue;
+            }
+
+            // [sender identity, empty, evenlop, body, frames...]
+            zmq::MultiPartMessage parts;
+            do {
+                m_sock.recv(&parts.emplace_back());
+            } while (m_sock.getsockopt<int64_t>(ZMQ_RCVMORE));
+            if (m_silent || parts->size() < 3) {
+                continue;
+            }
+
+            auto &evenlop = parts->at(2);
+            zrpc::EvenlopDef edef;
+            if (!edef.ParseFromArray(evenlop.data(), evenlop.size())
+                || edef.type() == zrpc::CancelRequest().GetTypeName()) {
+                continue;
+            }
+
+            const auto &recvId = edef.recvidentity();
+            m_sock.send(recvId.data(), recvId.size(), ZMQ_SNDMORE);
+            m_sock.send(zmq::message_t(), ZMQ_SNDMORE);
+            m_sock.send(evenlop, ZMQ_SNDMORE);
+            m_sock.send(body.data(), body.size());
+        }
+    }
+
+    zmq::context_t m_ctx;
+    zmq::socket_t m_sock;
+    std::string m_addr;
+    const bool m_silent;
+    std::atomic<bool> m_stop;
+    std::unique_ptr<Thread> m_thread;
+};
+
+TEST(ZrpcMasterServiceStubTest, ListDevices)
+{
+    EchoServer server;
+    ZrpcMasterServiceStub stub(Env::Default(), server.addr());
+
+    CallOptions opts;
+    ListDevicesRequest req;
+    ListDevicesResponse resp;
+    TF_EXPECT_OK(stub.ListDevices(&opts, req, &resp));
+}
+
+TEST(ZrpcMasterServiceStubTest, CallbackPool)
+{
+    EchoServer server;
+    ZrpcMasterServiceStub stub(Env::Default(), server.addr(), 4);
+
+    const int kCalls = 100;
+    std::vector<CallOptions> opts(kCalls);
+    std::vector<RunStepResponse> resps(kCalls);
+    RunStepRequest req;
+    std::atomic<int> ok(0);
+    BlockingCounter counter(kCalls);
+    for (int i = 0; i != kCalls; ++i) {
+        stub.RunStepAsync(&opts[i], req, &resps[i], [&ok, &counter](const Status &s) {
+            if (s.ok()) {
+                ++ok;
+            }
+            counter.DecrementCount();
+        });
+    }
+    counter.Wait();
+    EXPECT_EQ(kCalls, ok);
+}
+
+TEST(ZrpcMasterServiceStubTest, DeadlineExceeded)
+{
+    EchoServer server(true);
+    ZrpcMasterServiceStub stub(Env::Default(), server.addr());
+
+    CallOptions opts;
+    opts.SetTimeout(100);
+    ListDevicesRequest req;
+    ListDevicesResponse resp;
+    EXPECT_EQ(error::DEADLINE_EXCEEDED, stub.ListDevices(&opts, req, &resp).code());
+}
+
+TEST(ZrpcMasterServiceStubTest, EarlierDeadlineWakesReceiver)
+{
+    EchoServer server(true);
+    ZrpcMasterServiceStub stub(Env::Default(), server.addr());
+
+    // The receiving thread waits for this one when the next call comes in
+    CallOptions longOpts;
+    longOpts.SetTimeout(60000);
+    RunStepRequest req;
+    RunStepResponse longResp;
+    Notification longDone;
+    Status longStatus;
+    stub.RunStepAsync(&longOpts, req, &longResp, [&longDone, &longStatus](const Status &s) {
+        longStatus = s;
+        longDone.Notify();
+    });
+
+    const auto start = Env::Default()->NowMicros();
+    CallOptions opts;
+    opts.SetTimeout(100);
+    ListDevicesRequest listReq;
+    ListDevicesResponse listResp;
+    EXPECT_EQ(error::DEADLINE_EXCEEDED, stub.ListDevices(&opts, listReq, &listResp).code());
+    EXPECT_LT(Env::Default()->NowMicros() - start, 10000000);
+    EXPECT_FALSE(longDone.HasBeenNotified());
+
+    longOpts.StartCancel();
+    longDone.WaitForNotification();
+    EXPECT_EQ(error::CANCELLED, longStatus.code());
+    EXPECT_EQ(0, stub.numDeadlines());
+}
+
+TEST(ZrpcMasterServiceStubTest, DestructorFailsPendingCalls)
+{
+    EchoServer server(true);
+    CallOptions opts;
+    RunStepRequest req;
+    RunStepResponse resp;
+    Status status;
+    Notification done;
+    {
+        ZrpcMasterServiceStub stub(Env::Default(), server.addr(), 2);
+        stub.RunStepAsync(&opts, req, &resp, [&status, &done](const Status &s) {
+            status = s;
+            done.Notify();
+        });
+    }
+    EXPECT_TRUE(done.HasBeenNotified());
+    EXPECT_EQ(error::CANCELLED, status.code());
+}
+
+TEST(ZrpcMasterServiceStubTest, FinishedCallsReleaseDeadlines)
+{
+    EchoServer server;
+    ZrpcMasterServiceStub stub(Env::Default(), server.addr());
+
+    const int kCalls = 50;
+    std::vector<CallOptions> opts(kCalls);
+    std::vector<RunStepResponse> resps(kCalls);
+    RunStepRequest req;
+    BlockingCounter counter(kCalls);
+    for (int i = 0; i != kCalls; ++i) {
+        opts[i].SetTimeout(60000);
+        stub.RunStepAsync(&opts[i], req, &resps[i], [&counter](const Status &s) {
+            TF_EXPECT_OK(s);
+            counter.DecrementCount();
+        });
+    }
+    counter.Wait();
+    EXPECT_EQ(0, stub.numDeadlines());
+}
+
+TEST(ZrpcMasterServiceStubTest, MultipleSockets)
+{
+    EchoServer server;
+    ZrpcMasterServiceStub stub(Env::Default(), server.addr(), 0, 3);
+
+    for (int i = 0; i != 10; ++i) {
+        CallOptions opts;
+        RunStepRequest req;
+        req.set_session_handle(strings::StrCat("session", i));
+        RunStepResponse resp;
+        TF_EXPECT_OK(stub.RunStep(&opts, req, &resp));
+    }
+}
+
+TEST(ZrpcConnectionManagerTest, SharedPerEndpoint)
+{
+    EchoServer server1;
+    EchoServer server2;
+    SalusOptions options;
+    auto &manager = ZrpcConnectionManager::Global();
+
+    auto a = manager.get(Env::Default(), server1.addr(), options);
+    auto b = manager.get(Env::Default(), server1.addr(), options);
+    auto c = manager.get(Env::Default(), server2.addr(), options);
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, c);
+
+    CallOptions opts;
+    ListDevicesRequest req;
+    ListDevicesResponse resp;
+    TF_EXPECT_OK(c->ListDevices(&opts, req, &resp));
+
+    // Reopened once all users are gone
+    std::weak_ptr<ZrpcMasterServiceStub> weak = a;
+    a.reset();
+    b.reset();
+    EXPECT_TRUE(weak.expired());
+    a = manager.get(Env::Default(), server1.addr(), options);
+    TF_EXPECT_OK(a->ListDevices(&opts, req, &resp));
+}
+
+// Notifies once closures scheduled through it have run
+class ClosureTrackingEnv : public EnvWrapper
+{
+public:
+    ClosureTrackingEnv()
+        : EnvWrapper(Env::Default())
+    {
+    }
+
+    void SchedClosure(std::function<void()> closure) override
+    {
+        EnvWrapper::SchedClosure([this, closure]() {
+            closure();
+            ran.Notify();
+        });
+    }
+
+    Notification ran;
+};
+
+void ReleaseInCallback(int callbackThreads)
+{
+    EchoServer server;
+    ClosureTrackingEnv env;
+    SalusOptions options;
+    options.set_callback_threads(callbackThreads);
+
+    // The callback holds the only reference to the stub
+    auto holder = std::make_shared<std::shared_ptr<ZrpcMasterServiceStub>>(
+        ZrpcConnectionManager::Global().get(&env, server.addr(), options));
+
+    CallOptions opts;
+    RunStepRequest req;
+    RunStepResponse resp;
+    Notification done;
+    (*holder)->RunStepAsync(&opts, req, &resp, [holder, &done](const Status &s) {
+        TF_EXPECT_OK(s);
+        holder->reset();
+        done.Notify();
+    });
+    holder.reset();
+    done.WaitForNotification();
+
+    // Closed on another thread instead of joining the one it is called on
+    EXPECT_TRUE(WaitForNotificationWithTimeout(&env.ran, 10 * 1000 * 1000));
+}
+
+TEST(ZrpcConnectionManagerTest, ReleasedOnReceivingThread)
+{
+    ReleaseInCallback(0);
+}
+
+TEST(ZrpcConnectionManagerTest, ReleasedOnCallbackThread)
+{
+    ReleaseInCallback(2);
+}
+
+static void BM_ListDevices(int iters)
+{
+    testing::StopTiming();
+    EchoServer server;
+    ZrpcMasterServiceStub stub(Env::Default(), server.addr());
+    ListDevicesRequest req;
+    testing::StartTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        CallOptions opts;
+        ListDevicesResponse resp;
+        TF_CHECK_OK(stub.ListDevices(&opts, req, &resp));
+    }
+    testing::ItemsProcessed(iters);
+}
+BENCHMARK(BM_ListDevices);
+
+// Messages per second with all calls in flight at once.
+static void BM_PipelinedRunStep(int iters, int callbackThreads)
+{
+    testing::StopTiming();
+    EchoServer server;
+    ZrpcMasterServiceStub stub(Env::Default(), server.addr(), callbackThreads);
+    std::vector<CallOptions> opts(iters);
+    std::vector<RunStepResponse> resps(iters);
+    RunStepRequest req;
+    req.set_session_handle("bench");
+    BlockingCounter counter(iters);
+    testing::StartTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        stub.RunStepAsync(&opts[i], req, &resps[i], [&counter](const Status &s) {
+            TF_CHECK_OK(s);
+            counter.DecrementCount();
+        });
+    }
+    counter.Wait();
+    testing::ItemsProcessed(iters);
+}
+BENCHMARK(BM_PipelinedRunStep)->Arg(0)->Arg(4);
+
+} // namespace
+} // namespace tensorflow
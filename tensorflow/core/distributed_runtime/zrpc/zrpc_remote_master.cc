@@ -17,7 +17,9 @@ limitations under the License.
 
 #include "tensorflow/core/distributed_runtime/call_options.h"
 #include "tensorflow/core/distributed_runtime/master_interface.h"
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_connection_manager.h"
 #include "tensorflow/core/distributed_runtime/zrpc/zrpc_master_service_stub.h"
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_tensor_coding.h"
 #include "tensorflow/core/distributed_runtime/zrpc/zrpc_util.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
@@ -31,8 +33,10 @@ namespace tensorflow {
 class ZrpcRemoteMaster : public MasterInterface
 {
 public:
-    explicit ZrpcRemoteMaster(Env *env, const std::string &endpoint)
-        : stub_(env, endpoint)
+    explicit ZrpcRemoteMaster(Env *env, const std::string &endpoint, const SalusOptions &salus_options)
+        : stub_(ZrpcConnectionManager::Global().get(env, endpoint, salus_options))
+        , use_tensor_frames_(salus_options.use_tensor_frames())
+        , cache_graphs_(salus_options.cache_graphs())
     {
     }
 
@@ -43,8 +47,12 @@ public:
     Status CreateSession(CallOptions *call_options, const CreateSessionRequest *request,
                          CreateSessionResponse *response) override
     {
-        SetDeadline(call_options->GetTimeout());
-        auto s = stub_.CreateSession(*request, response);
+        Status s;
+        if (use_tensor_frames_) {
+            s = stub_->CreateSessionWithFrames(call_options, *request, response, cache_graphs_);
+        } else {
+            s = stub_->CreateSession(call_options, *request, response);
+        }
         VLOG(2) << "RpcClient created session with id " << response->session_handle();
         return s;
     }
@@ -52,59 +60,84 @@ public:
     Status ExtendSession(CallOptions *call_options, const ExtendSessionRequest *request,
                          ExtendSessionResponse *response) override
     {
-        SetDeadline(call_options->GetTimeout());
-        return stub_.ExtendSession(*request, response);
+        if (use_tensor_frames_) {
+            return stub_->ExtendSessionWithFrames(call_options, *request, response);
+        }
+        return stub_->ExtendSession(call_options, *request, response);
     }
 
     Status PartialRunSetup(CallOptions *call_options, const PartialRunSetupRequest *request,
                            PartialRunSetupResponse *response) override
     {
-        SetDeadline(call_options->GetTimeout());
-        return stub_.PartialRunSetup(*request, response);
+        return stub_->PartialRunSetup(call_options, *request, response);
     }
 
     Status RunStep(CallOptions *call_options, RunStepRequestWrapper *request,
                    MutableRunStepResponseWrapper *response) override
     {
-        SetDeadline(call_options->GetTimeout());
-        return stub_.RunStep(request->ToProto(), get_proto_from_wrapper(response));
+        if (use_tensor_frames_) {
+            // Responses not created by us can't hold decoded frames
+            auto zresp = dynamic_cast<ZrpcRunStepResponse *>(response);
+            if (zresp) {
+                return stub_->RunStep(call_options, *request, zresp);
+            }
+        }
+        return stub_->RunStep(call_options, request->ToProto(), get_proto_from_wrapper(response));
+    }
+
+    void RunStepAsync(CallOptions *call_options, RunStepRequestWrapper *request,
+                      MutableRunStepResponseWrapper *response, StatusCallback done) override
+    {
+        if (use_tensor_frames_) {
+            auto zresp = dynamic_cast<ZrpcRunStepResponse *>(response);
+            if (zresp) {
+                stub_->RunStepAsync(call_options, *request, zresp, std::move(done));
+                return;
+            }
+        }
+        stub_->RunStepAsync(call_options, request->ToProto(), get_proto_from_wrapper(response), std::move(done));
+    }
+
+    MutableRunStepRequestWrapper *CreateRunStepRequest() override
+    {
+        if (use_tensor_frames_) {
+            // Keep feeds as tensors so they can be sent without encoding
+            return new InMemoryRunStepRequest;
+        }
+        return new MutableProtoRunStepRequest;
+    }
+
+    MutableRunStepResponseWrapper *CreateRunStepResponse() override
+    {
+        return new ZrpcRunStepResponse;
     }
 
     Status CloseSession(CallOptions *call_options, const CloseSessionRequest *request,
                         CloseSessionResponse *response) override
     {
-        SetDeadline(call_options->GetTimeout());
-        return stub_.CloseSession(*request, response);
+        return stub_->CloseSession(call_options, *request, response);
     }
 
     Status ListDevices(CallOptions *call_options, const ListDevicesRequest *request,
                        ListDevicesResponse *response) override
     {
-        SetDeadline(call_options->GetTimeout());
-        return stub_.ListDevices(*request, response);
+        return stub_->ListDevices(call_options, *request, response);
     }
 
     Status Reset(CallOptions *call_options, const ResetRequest *request, ResetResponse *response) override
     {
-        SetDeadline(call_options->GetTimeout());
-        return stub_.Reset(*request, response);
+        return stub_->Reset(call_options, *request, response);
     }
 
 private:
-    ZrpcMasterServiceStub stub_;
-
-    void SetDeadline(int64 time_in_ms)
-    {
-        if (time_in_ms > 0) {
-            LOG(WARNING) << "Setting deadline is not supported in Zrpc";
-            // ctx->set_deadline(gpr_time_from_millis(time_in_ms, GPR_TIMESPAN));
-        }
-    }
+    std::shared_ptr<ZrpcMasterServiceStub> stub_;
+    const bool use_tensor_frames_;
+    const bool cache_graphs_;
 };
 
-MasterInterface *NewZrpcRemoteMaster(Env *env, const std::string &endpoint)
+MasterInterface *NewZrpcRemoteMaster(Env *env, const std::string &endpoint, const SalusOptions &salus_options)
 {
-    return new ZrpcRemoteMaster(env, endpoint);
+    return new ZrpcRemoteMaster(env, endpoint, salus_options);
 }
 
 } // namespace tensorflow
@@ -17,13 +17,15 @@ limitations under the License.
 #define TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_REMOTE_MASTER_H_
 
 #include "tensorflow/core/distributed_runtime/master_interface.h"
+#include "tensorflow/core/protobuf/config.pb.h"
 
 #include <string>
 
 namespace tensorflow {
 class Env;
 // Returns a MasterInterface wrapped around the ZRPC endpoint.
-MasterInterface* NewZrpcRemoteMaster(Env *env, const std::string &endpoint);
+MasterInterface* NewZrpcRemoteMaster(Env *env, const std::string &endpoint,
+                                     const SalusOptions &salus_options);
 }  // namespace tensorflow
 
 #endif  // TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_REMOTE_MASTER_H_
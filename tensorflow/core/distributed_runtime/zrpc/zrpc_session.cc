@@ -19,11 +19,14 @@ limitations under the License.
 #include "tensorflow/core/distributed_runtime/call_options.h"
 #include "tensorflow/core/distributed_runtime/master_interface.h"
 #include "tensorflow/core/distributed_runtime/zrpc/zrpc_remote_master.h"
+#include "tensorflow/core/grappler/costs/resource_map_estimator.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/hash/hash.h"
 #include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/protobuf/master.pb.h"
 
 #include <unordered_map>
+#include <unordered_set>
 
 namespace tensorflow {
 
@@ -35,6 +38,15 @@ ZrpcSession::ZrpcSession(const SessionOptions &options)
 
 ZrpcSession::~ZrpcSession()
 {
+    // Pending steps still reference this session. Their replies may never come, so
+    // cancel them and only wait for their callbacks.
+    mutex_lock l(pending_mu_);
+    for (auto call_options : pending_calls_) {
+        call_options->StartCancel();
+    }
+    while (!pending_calls_.empty()) {
+        pending_cv_.wait(l);
+    }
 }
 
 namespace {
@@ -44,7 +56,8 @@ const size_t kSchemePrefixLength = strlen(kSchemePrefix);
 std::unique_ptr<MasterInterface> createMaster(const SessionOptions &options)
 {
     return std::unique_ptr<MasterInterface>(
-        NewZrpcRemoteMaster(options.env, options.target.substr(kSchemePrefixLength)));
+        NewZrpcRemoteMaster(options.env, options.target.substr(kSchemePrefixLength),
+                            options.config.salus_options()));
 }
 
 } // namespace
@@ -102,7 +115,21 @@ Status ZrpcSession::CreateImpl(CallOptions *call_options, const GraphDef &graph)
     *req.mutable_config() = options_.config;
     *req.mutable_graph_def() = graph;
     req.set_target(options_.target);
-    ReEncodeConsts(req.mutable_graph_def());
+    if (!options_.config.salus_options().use_tensor_frames()) {
+        // Large constants are sent as separate frames otherwise
+        ReEncodeConsts(req.mutable_graph_def());
+    }
+    auto salus_options = req.mutable_config()->mutable_salus_options();
+    if (salus_options->estimate_resource_map() && !salus_options->has_resource_map()) {
+        auto s = grappler::EstimateResourceMap(graph, salus_options->estimate_batch_size(),
+                                               salus_options->mutable_resource_map());
+        if (s.ok()) {
+            VLOG(1) << "Estimated resource map: " << salus_options->resource_map().DebugString();
+        } else {
+            LOG(WARNING) << "Failed to estimate resource map: " << s;
+            salus_options->clear_resource_map();
+        }
+    }
     CreateSessionResponse resp;
     Status s = master_->CreateSession(call_options, &req, &resp);
     if (s.ok()) {
@@ -110,10 +137,79 @@ Status ZrpcSession::CreateImpl(CallOptions *call_options, const GraphDef &graph)
         mutex_lock l(mu_);
         swap(handle_, *(resp.mutable_session_handle()));
         current_graph_version_ = resp.graph_version();
+        sent_nodes_.clear();
+        sent_functions_.clear();
+        sent_gradients_.clear();
+        RecordSent(graph);
     }
     return s;
 }
 
+namespace {
+uint64 Fingerprint(const protobuf::MessageLite &msg)
+{
+    string bytes;
+    SerializeToStringDeterministic(msg, &bytes);
+    return Hash64(bytes);
+}
+} // namespace
+
+Status ZrpcSession::GraphDelta(const GraphDef &graph, GraphDef *delta)
+{
+    *delta->mutable_versions() = graph.versions();
+
+    std::unordered_set<string> names;
+    for (const auto &node : graph.node()) {
+        if (!names.insert(node.name()).second) {
+            return errors::InvalidArgument("Duplicate node name in graph: '", node.name(), "'");
+        }
+        auto it = sent_nodes_.find(node.name());
+        if (it == sent_nodes_.end()) {
+            *delta->add_node() = node;
+        } else if (it->second != Fingerprint(node)) {
+            return errors::InvalidArgument("GraphDef argument to Extend includes node '", node.name(),
+                                           "', which differs from the one created by a previous call "
+                                           "to Create or Extend in this session.");
+        }
+    }
+
+    for (const auto &func : graph.library().function()) {
+        const auto &name = func.signature().name();
+        auto it = sent_functions_.find(name);
+        if (it == sent_functions_.end()) {
+            *delta->mutable_library()->add_function() = func;
+        } else if (it->second != Fingerprint(func)) {
+            return errors::InvalidArgument("Cannot redefine function '", name, "' in Extend");
+        }
+    }
+    for (const auto &grad : graph.library().gradient()) {
+        auto it = sent_gradients_.find(grad.function_name());
+        if (it == sent_gradients_.end()) {
+            *delta->mutable_library()->add_gradient() = grad;
+        } else if (it->second != grad.gradient_func()) {
+            return errors::InvalidArgument("Cannot change the gradient of function '", grad.function_name(),
+                                           "' in Extend");
+        }
+    }
+    return Status::OK();
+}
+
+void ZrpcSession::RecordSent(const GraphDef &graph)
+{
+    if (!options_.config.salus_options().use_tensor_frames()) {
+        return;
+    }
+    for (const auto &node : graph.node()) {
+        sent_nodes_[node.name()] = Fingerprint(node);
+    }
+    for (const auto &func : graph.library().function()) {
+        sent_functions_[func.signature().name()] = Fingerprint(func);
+    }
+    for (const auto &grad : graph.library().gradient()) {
+        sent_gradients_[grad.function_name()] = grad.gradient_func();
+    }
+}
+
 Status ZrpcSession::Create(const GraphDef &graph)
 {
     CallOptions call_options;
@@ -142,12 +238,23 @@ Status ZrpcSession::ExtendImpl(CallOptions *call_options, const GraphDef &graph)
     mutex_lock l(mu_);
     ExtendSessionRequest req;
     req.set_session_handle(handle_);
-    *req.mutable_graph_def() = graph;
     req.set_current_graph_version(current_graph_version_);
+
+    if (options_.config.salus_options().use_tensor_frames()) {
+        // Callers may pass the whole graph again, only send what the master doesn't have yet
+        TF_RETURN_IF_ERROR(GraphDelta(graph, req.mutable_graph_def()));
+        if (req.graph_def().node_size() == 0 && !req.graph_def().has_library()) {
+            return Status::OK();
+        }
+    } else {
+        *req.mutable_graph_def() = graph;
+    }
+
     ExtendSessionResponse resp;
     Status s = master_->ExtendSession(call_options, &req, &resp);
     if (s.ok()) {
         current_graph_version_ = resp.new_graph_version();
+        RecordSent(req.graph_def());
     }
     return s;
 }
@@ -166,15 +273,20 @@ Status ZrpcSession::Extend(const RunOptions &run_options, const GraphDef &graph)
     return ExtendImpl(&call_options, graph);
 }
 
-Status ZrpcSession::RunHelper(const RunOptions &run_options,
-                              const std::vector<std::pair<string, Tensor>> &inputs,
-                              const std::vector<string> &output_tensor_names,
-                              const std::vector<string> &target_node_names, std::vector<Tensor> *outputs,
-                              RunMetadata *run_metadata, const string &prun_handle)
+Status ZrpcSession::PrepareRunStep(const RunOptions &run_options,
+                                   const std::vector<std::pair<string, Tensor>> &inputs,
+                                   const std::vector<string> &output_tensor_names,
+                                   const std::vector<string> &target_node_names, const string &prun_handle,
+                                   MutableRunStepRequestWrapper *req, FetchOffsets *output_name_to_offset)
 {
-    // Convert to proto
-    std::unique_ptr<MutableRunStepRequestWrapper> req(master_->CreateRunStepRequest());
-    std::unique_ptr<MutableRunStepResponseWrapper> resp(master_->CreateRunStepResponse());
+    {
+        mutex_lock l(mu_);
+        if (handle_.empty()) {
+            return errors::InvalidArgument("A session is not created yet....");
+        }
+
+        req->set_session_handle(handle_);
+    }
 
     *req->mutable_options() = run_options;
 
@@ -192,21 +304,23 @@ Status ZrpcSession::RunHelper(const RunOptions &run_options,
     }
 
     // Build an index from fetch tensor name to offset.
-    std::unordered_map<string, int> output_name_to_offset;
     for (size_t i = 0; i < output_tensor_names.size(); ++i) {
         const string& name = output_tensor_names[i];
-        if (output_name_to_offset.insert(std::make_pair(name, i)).second) {
+        if (output_name_to_offset->insert(std::make_pair(name, i)).second) {
             req->add_fetch(name);
         }
     }
     for (const string &target : target_node_names) {
         req->add_target(target);
     }
+    return Status::OK();
+}
 
-    CallOptions call_options;
-    call_options.SetTimeout(run_options.timeout_in_ms());
-    TF_RETURN_IF_ERROR(RunProto(&call_options, req.get(), resp.get()));
-
+Status ZrpcSession::ProcessRunStepResponse(const std::vector<string> &output_tensor_names,
+                                           FetchOffsets &output_name_to_offset,
+                                           MutableRunStepResponseWrapper *resp, std::vector<Tensor> *outputs,
+                                           RunMetadata *run_metadata)
+{
     if (!output_tensor_names.empty()) {
         outputs->resize(output_tensor_names.size());
     }
@@ -242,6 +356,86 @@ Status ZrpcSession::RunHelper(const RunOptions &run_options,
     return Status::OK();
 }
 
+Status ZrpcSession::RunHelper(const RunOptions &run_options,
+                              const std::vector<std::pair<string, Tensor>> &inputs,
+                              const std::vector<string> &output_tensor_names,
+                              const std::vector<string> &target_node_names, std::vector<Tensor> *outputs,
+                              RunMetadata *run_metadata, const string &prun_handle)
+{
+    // Convert to proto
+    std::unique_ptr<MutableRunStepRequestWrapper> req(master_->CreateRunStepRequest());
+    std::unique_ptr<MutableRunStepResponseWrapper> resp(master_->CreateRunStepResponse());
+
+    FetchOffsets output_name_to_offset;
+    TF_RETURN_IF_ERROR(PrepareRunStep(run_options, inputs, output_tensor_names, target_node_names, prun_handle,
+                                      req.get(), &output_name_to_offset));
+
+    CallOptions call_options;
+    call_options.SetTimeout(req->options().timeout_in_ms());
+    TF_RETURN_IF_ERROR(master_->RunStep(&call_options, req.get(), resp.get()));
+
+    return ProcessRunStepResponse(output_tensor_names, output_name_to_offset, resp.get(), outputs,
+                                  run_metadata);
+}
+
+void ZrpcSession::RunAsync(const RunOptions &run_options, const std::vector<std::pair<string, Tensor>> &inputs,
+                           const std::vector<string> &output_tensor_names,
+                           const std::vector<string> &target_node_names, RunCallback done)
+{
+    // State kept alive until the step finishes
+    struct Call
+    {
+        std::unique_ptr<MutableRunStepRequestWrapper> req;
+        std::unique_ptr<MutableRunStepResponseWrapper> resp;
+        FetchOffsets output_name_to_offset;
+        std::vector<string> output_tensor_names;
+        CallOptions call_options;
+        RunCallback done;
+    };
+    auto call = std::make_shared<Call>();
+    call->req.reset(master_->CreateRunStepRequest());
+    call->resp.reset(master_->CreateRunStepResponse());
+    call->output_tensor_names = output_tensor_names;
+    call->done = std::move(done);
+
+    auto s = PrepareRunStep(run_options, inputs, output_tensor_names, target_node_names,
+                            /* prun_handle */ "", call->req.get(), &call->output_name_to_offset);
+    if (!s.ok()) {
+        std::vector<Tensor> outputs;
+        RunMetadata run_metadata;
+        call->done(s, &outputs, &run_metadata);
+        return;
+    }
+    call->call_options.SetTimeout(call->req->options().timeout_in_ms());
+
+    {
+        mutex_lock l(pending_mu_);
+        const auto max_pending = options_.config.salus_options().max_outstanding_steps();
+        while (max_pending > 0 && static_cast<int>(pending_calls_.size()) >= max_pending) {
+            pending_cv_.wait(l);
+        }
+        pending_calls_.insert(&call->call_options);
+    }
+
+    master_->RunStepAsync(&call->call_options, call->req.get(), call->resp.get(), [this, call](const Status &s) {
+        std::vector<Tensor> outputs;
+        RunMetadata run_metadata;
+        auto status = s;
+        if (status.ok()) {
+            status = ProcessRunStepResponse(call->output_tensor_names, call->output_name_to_offset,
+                                            call->resp.get(), &outputs, &run_metadata);
+        }
+        {
+            // Release the slot first, `done` may delete the session or start another step
+            mutex_lock l(pending_mu_);
+            pending_calls_.erase(&call->call_options);
+            pending_cv_.notify_all();
+        }
+        // Nothing of the session may be touched from here on
+        call->done(status, &outputs, &run_metadata);
+    });
+}
+
 Status ZrpcSession::Run(const RunOptions &run_options, const std::vector<std::pair<string, Tensor>> &inputs,
                         const std::vector<string> &output_tensor_names,
                         const std::vector<string> &target_node_names, std::vector<Tensor> *outputs,
@@ -260,20 +454,6 @@ Status ZrpcSession::Run(const std::vector<std::pair<string, Tensor>> &inputs,
     return Run(run_options, inputs, output_tensor_names, target_node_names, outputs, nullptr);
 }
 
-Status ZrpcSession::RunProto(CallOptions *call_options, MutableRunStepRequestWrapper *req,
-                             MutableRunStepResponseWrapper *resp)
-{
-    {
-        mutex_lock l(mu_);
-        if (handle_.empty()) {
-            return errors::InvalidArgument("A session is not created yet....");
-        }
-
-        req->set_session_handle(handle_);
-    }
-    return master_->RunStep(call_options, req, resp);
-}
-
 Status ZrpcSession::PRunSetup(const std::vector<string> &input_names, const std::vector<string> &output_names,
                               const std::vector<string> &target_nodes, string *handle)
 {
@@ -16,8 +16,11 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_SESSION_H_
 #define TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_SESSION_H_
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "tensorflow/core/distributed_runtime/call_options.h"
@@ -71,6 +74,23 @@ public:
                const std::vector<string> &output_tensor_names, const std::vector<string> &target_node_names,
                std::vector<Tensor> *outputs, RunMetadata *run_metadata) override;
 
+    // Called once an asynchronous step finishes. `outputs` and `run_metadata` are only
+    // valid during the call, but may be swapped out.
+    using RunCallback = std::function<void(const Status &s, std::vector<Tensor> *outputs,
+                                           RunMetadata *run_metadata)>;
+
+    // Runs one step without waiting for it to finish, so that multiple steps can be
+    // in flight on the same session. `done` is called from the zrpc receiving thread,
+    // or a callback thread. It may start another step or delete the session.
+    //
+    // At most `SalusOptions.max_outstanding_steps` steps are pending at any time, further
+    // calls block until an earlier step finishes. A step no longer counts as pending
+    // once its `done` is called. Steps still pending when the session is destroyed are
+    // cancelled, and the destructor waits for their `done`.
+    void RunAsync(const RunOptions &run_options, const std::vector<std::pair<string, Tensor>> &inputs,
+                  const std::vector<string> &output_tensor_names, const std::vector<string> &target_node_names,
+                  RunCallback done);
+
     Status Extend(const GraphDef &graph) override;
     Status Extend(const RunOptions &run_options, const GraphDef &graph) override;
 
@@ -102,13 +122,39 @@ private:
     // The current version of the graph.
     int64 current_graph_version_ GUARDED_BY(mu_);
 
+    // Fingerprints of the nodes and functions already sent to the master by name, and the
+    // gradients already registered. Only tracked with `SalusOptions.use_tensor_frames`.
+    std::unordered_map<string, uint64> sent_nodes_ GUARDED_BY(mu_);
+    std::unordered_map<string, uint64> sent_functions_ GUARDED_BY(mu_);
+    std::unordered_map<string, string> sent_gradients_ GUARDED_BY(mu_);
+
+    // Call options of the RunAsync steps in flight, so they can be cancelled when the
+    // session is destroyed.
+    mutex pending_mu_;
+    condition_variable pending_cv_;
+    std::unordered_set<CallOptions *> pending_calls_ GUARDED_BY(pending_mu_);
+
+    // Maps fetch tensor names to their first offset in the output.
+    using FetchOffsets = std::unordered_map<string, int>;
+
+    Status PrepareRunStep(const RunOptions &run_options, const std::vector<std::pair<string, Tensor>> &inputs,
+                          const std::vector<string> &output_tensor_names,
+                          const std::vector<string> &target_node_names, const string &prun_handle,
+                          MutableRunStepRequestWrapper *req, FetchOffsets *output_name_to_offset);
+
+    Status ProcessRunStepResponse(const std::vector<string> &output_tensor_names,
+                                  FetchOffsets &output_name_to_offset, MutableRunStepResponseWrapper *resp,
+                                  std::vector<Tensor> *outputs, RunMetadata *run_metadata);
+
     Status RunHelper(const RunOptions &run_options, const std::vector<std::pair<string, Tensor>> &inputs,
                      const std::vector<string> &output_tensor_names,
                      const std::vector<string> &target_node_names, std::vector<Tensor> *outputs,
                      RunMetadata *run_metadata, const string &prun_handle);
 
-    Status RunProto(CallOptions *call_options, MutableRunStepRequestWrapper *req,
-                    MutableRunStepResponseWrapper *resp);
+    // Fills `delta` with the parts of `graph` not sent to the master yet. Fails if a node
+    // or function redefines one already sent, or a node name appears twice in `graph`.
+    Status GraphDelta(const GraphDef &graph, GraphDef *delta) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+    void RecordSent(const GraphDef &graph) EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
     // Implementations for all the public interfaces.
     Status CreateImpl(CallOptions *call_options, const GraphDef &graph);
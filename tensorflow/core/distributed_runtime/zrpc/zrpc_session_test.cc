@@ -0,0 +1,424 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_session.h"
+
+#include "tensorflow/core/distributed_runtime/call_options.h"
+#include "tensorflow/core/distributed_runtime/master_interface.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/protobuf/master.pb.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace tensorflow {
+namespace {
+
+// Holds RunStepAsync calls until the test completes them. Each fetch is answered with
+// the first feed of its step.
+class FakeMaster : public MasterInterface
+{
+public:
+    Status CreateSession(CallOptions *, const CreateSessionRequest *, CreateSessionResponse *resp) override
+    {
+        resp->set_session_handle("session");
+        return Status::OK();
+    }
+
+    Status ExtendSession(CallOptions *, const ExtendSessionRequest *req, ExtendSessionResponse *resp) override
+    {
+        mutex_lock l(mu_);
+        extended_.push_back(req->graph_def());
+        resp->set_new_graph_version(req->current_graph_version() + 1);
+        return Status::OK();
+    }
+
+    Status PartialRunSetup(CallOptions *, const PartialRunSetupRequest *, PartialRunSetupResponse *) override
+    {
+        return errors::Unimplemented("PartialRunSetup");
+    }
+
+    Status RunStep(CallOptions *, RunStepRequestWrapper *, MutableRunStepResponseWrapper *) override
+    {
+        return errors::Unimplemented("RunStep");
+    }
+
+    // A cancelled call fails with CANCELLED on another thread, like in the zrpc stub.
+    void RunStepAsync(CallOptions *call_options, RunStepRequestWrapper *request,
+                      MutableRunStepResponseWrapper *response, StatusCallback done) override
+    {
+        {
+            mutex_lock l(mu_);
+            pending_.push_back({call_options, request, response, std::move(done)});
+        }
+        call_options->SetCancelCallback([this, request]() {
+            Env::Default()->SchedClosure([this, request]() { Cancel(request); });
+        });
+    }
+
+    Status CloseSession(CallOptions *, const CloseSessionRequest *, CloseSessionResponse *) override
+    {
+        return Status::OK();
+    }
+
+    Status ListDevices(CallOptions *, const ListDevicesRequest *, ListDevicesResponse *) override
+    {
+        return Status::OK();
+    }
+
+    Status Reset(CallOptions *, const ResetRequest *, ResetResponse *) override
+    {
+        return Status::OK();
+    }
+
+    // Graphs received by ExtendSession
+    std::vector<GraphDef> Extended()
+    {
+        mutex_lock l(mu_);
+        return extended_;
+    }
+
+    int NumPending()
+    {
+        mutex_lock l(mu_);
+        return pending_.size();
+    }
+
+    // Finishes the i-th pending call with `s`. The master may be deleted by the
+    // callback, so nothing is touched after it.
+    void Complete(int i, const Status &s)
+    {
+        Pending call;
+        {
+            mutex_lock l(mu_);
+            CHECK_LT(i, pending_.size());
+            call = std::move(pending_[i]);
+            pending_.erase(pending_.begin() + i);
+        }
+        Finish(std::move(call), s);
+    }
+
+private:
+    struct Pending
+    {
+        CallOptions *call_options;
+        RunStepRequestWrapper *request;
+        MutableRunStepResponseWrapper *response;
+        StatusCallback done;
+    };
+
+    void Cancel(RunStepRequestWrapper *request)
+    {
+        Pending call;
+        {
+            mutex_lock l(mu_);
+            auto it = std::find_if(pending_.begin(), pending_.end(),
+                                   [request](const Pending &p) { return p.request == request; });
+            if (it == pending_.end()) {
+                return;
+            }
+            call = std::move(*it);
+            pending_.erase(it);
+        }
+        Finish(std::move(call), errors::Cancelled("Step cancelled"));
+    }
+
+    void Finish(Pending call, const Status &s)
+    {
+        call.call_options->ClearCancelCallback();
+        if (s.ok()) {
+            Tensor value;
+            TF_CHECK_OK(call.request->FeedValue(0, &value));
+            auto resp = get_proto_from_wrapper(call.response);
+            for (size_t j = 0; j < call.request->num_fetches(); ++j) {
+                auto tensor = resp->add_tensor();
+                tensor->set_name(call.request->fetch_name(j));
+                value.AsProtoTensorContent(tensor->mutable_tensor());
+            }
+        }
+        call.done(s);
+    }
+
+    mutex mu_;
+    std::deque<Pending> pending_ GUARDED_BY(mu_);
+    std::vector<GraphDef> extended_ GUARDED_BY(mu_);
+};
+
+class TestSession : public ZrpcSession
+{
+public:
+    TestSession(const SessionOptions &options, FakeMaster *master)
+        : ZrpcSession(options)
+    {
+        SetRemoteMaster(std::unique_ptr<MasterInterface>(master));
+    }
+};
+
+class ZrpcSessionTest : public ::testing::Test
+{
+protected:
+    void NewSession(int maxOutstandingSteps, bool useTensorFrames = false, const GraphDef &graph = GraphDef())
+    {
+        SessionOptions options;
+        options.config.mutable_salus_options()->set_max_outstanding_steps(maxOutstandingSteps);
+        options.config.mutable_salus_options()->set_use_tensor_frames(useTensorFrames);
+        master_ = new FakeMaster;
+        session_.reset(new TestSession(options, master_));
+        TF_ASSERT_OK(session_->Create(graph));
+    }
+
+    void RunAsync(float x, ZrpcSession::RunCallback done)
+    {
+        session_->RunAsync(RunOptions(), {{"x:0", test::AsScalar(x)}}, {"y:0"}, {}, std::move(done));
+    }
+
+    FakeMaster *master_ = nullptr;
+    std::unique_ptr<ZrpcSession> session_;
+};
+
+TEST_F(ZrpcSessionTest, PipelinesSteps)
+{
+    NewSession(0);
+    const int kSteps = 8;
+    std::vector<float> results(kSteps, -1);
+    for (int i = 0; i != kSteps; ++i) {
+        RunAsync(i, [&results, i](const Status &s, std::vector<Tensor> *outputs, RunMetadata *) {
+            TF_ASSERT_OK(s);
+            ASSERT_EQ(1, outputs->size());
+            results[i] = (*outputs)[0].scalar<float>()();
+        });
+    }
+    // All steps are in flight before any finished
+    EXPECT_EQ(kSteps, master_->NumPending());
+
+    for (int i = 0; i != kSteps; ++i) {
+        master_->Complete(0, Status::OK());
+    }
+    for (int i = 0; i != kSteps; ++i) {
+        EXPECT_EQ(i, results[i]);
+    }
+}
+
+TEST_F(ZrpcSessionTest, OutOfOrderCompletion)
+{
+    NewSession(0);
+    std::vector<float> order;
+    for (int i = 0; i != 3; ++i) {
+        RunAsync(i, [&order, i](const Status &s, std::vector<Tensor> *outputs, RunMetadata *) {
+            TF_ASSERT_OK(s);
+            // Each step gets its own outputs
+            EXPECT_EQ(i, (*outputs)[0].scalar<float>()());
+            order.push_back(i);
+        });
+    }
+    master_->Complete(2, Status::OK());
+    master_->Complete(0, Status::OK());
+    master_->Complete(0, Status::OK());
+    EXPECT_EQ(std::vector<float>({2, 0, 1}), order);
+}
+
+TEST_F(ZrpcSessionTest, BlocksAtMaxOutstandingSteps)
+{
+    NewSession(2);
+    auto ignore = [](const Status &, std::vector<Tensor> *, RunMetadata *) {};
+    RunAsync(0, ignore);
+    RunAsync(1, ignore);
+
+    Notification started;
+    std::unique_ptr<Thread> thread(Env::Default()->StartThread(ThreadOptions(), "third_step", [&]() {
+        RunAsync(2, ignore);
+        started.Notify();
+    }));
+    Env::Default()->SleepForMicroseconds(50 * 1000);
+    EXPECT_FALSE(started.HasBeenNotified());
+    EXPECT_EQ(2, master_->NumPending());
+
+    master_->Complete(0, Status::OK());
+    started.WaitForNotification();
+    EXPECT_EQ(2, master_->NumPending());
+
+    master_->Complete(0, Status::OK());
+    master_->Complete(0, Status::OK());
+}
+
+TEST_F(ZrpcSessionTest, PropagatesErrors)
+{
+    NewSession(0);
+    Status status;
+    RunAsync(0, [&status](const Status &s, std::vector<Tensor> *, RunMetadata *) { status = s; });
+    master_->Complete(0, errors::Internal("step failed"));
+    EXPECT_EQ(error::INTERNAL, status.code());
+    EXPECT_EQ("step failed", status.error_message());
+
+    // Errors before the step is sent are reported through the callback too
+    std::unique_ptr<ZrpcSession> uncreated(new TestSession(SessionOptions(), new FakeMaster));
+    status = Status::OK();
+    uncreated->RunAsync(RunOptions(), {}, {}, {"y"},
+                        [&status](const Status &s, std::vector<Tensor> *, RunMetadata *) { status = s; });
+    EXPECT_EQ(error::INVALID_ARGUMENT, status.code());
+}
+
+TEST_F(ZrpcSessionTest, RunAsyncFromCallbackAtMaxOutstandingSteps)
+{
+    NewSession(1);
+    bool secondDone = false;
+    RunAsync(0, [this, &secondDone](const Status &s, std::vector<Tensor> *, RunMetadata *) {
+        TF_EXPECT_OK(s);
+        RunAsync(1, [&secondDone](const Status &s, std::vector<Tensor> *, RunMetadata *) {
+            TF_EXPECT_OK(s);
+            secondDone = true;
+        });
+    });
+    master_->Complete(0, Status::OK());
+    EXPECT_EQ(1, master_->NumPending());
+    master_->Complete(0, Status::OK());
+    EXPECT_TRUE(secondDone);
+}
+
+TEST_F(ZrpcSessionTest, DeleteSessionFromCallback)
+{
+    NewSession(0);
+    auto master = master_;
+    bool done = false;
+    RunAsync(0, [this, &done](const Status &s, std::vector<Tensor> *outputs, RunMetadata *) {
+        TF_EXPECT_OK(s);
+        session_.reset();
+        // Outputs stay valid after the session is gone
+        EXPECT_EQ(0, (*outputs)[0].scalar<float>()());
+        done = true;
+    });
+    master->Complete(0, Status::OK());
+    EXPECT_TRUE(done);
+    EXPECT_EQ(nullptr, session_);
+}
+
+TEST_F(ZrpcSessionTest, DestructorCancelsPendingSteps)
+{
+    NewSession(0);
+    Status status;
+    Notification done;
+    RunAsync(0, [&status, &done](const Status &s, std::vector<Tensor> *, RunMetadata *) {
+        status = s;
+        done.Notify();
+    });
+    // The step is never completed by the master
+    session_.reset();
+    done.WaitForNotification();
+    EXPECT_EQ(error::CANCELLED, status.code());
+}
+
+NodeDef MakeNode(const string &name, const string &op = "NoOp")
+{
+    NodeDef node;
+    node.set_name(name);
+    node.set_op(op);
+    return node;
+}
+
+FunctionDef MakeFunction(const string &name, const string &ret = "")
+{
+    FunctionDef func;
+    func.mutable_signature()->set_name(name);
+    if (!ret.empty()) {
+        (*func.mutable_ret())["out"] = ret;
+    }
+    return func;
+}
+
+std::vector<string> NodeNames(const GraphDef &graph)
+{
+    std::vector<string> names;
+    for (const auto &node : graph.node()) {
+        names.push_back(node.name());
+    }
+    return names;
+}
+
+TEST_F(ZrpcSessionTest, ExtendSendsOnlyNewParts)
+{
+    GraphDef graph;
+    *graph.add_node() = MakeNode("a");
+    NewSession(0, true, graph);
+
+    *graph.add_node() = MakeNode("b");
+    *graph.mutable_library()->add_function() = MakeFunction("f");
+    TF_ASSERT_OK(session_->Extend(graph));
+
+    // Nothing new, nothing sent
+    TF_ASSERT_OK(session_->Extend(graph));
+
+    *graph.mutable_library()->add_function() = MakeFunction("g");
+    auto grad = graph.mutable_library()->add_gradient();
+    grad->set_function_name("g");
+    grad->set_gradient_func("f");
+    TF_ASSERT_OK(session_->Extend(graph));
+
+    auto extended = master_->Extended();
+    ASSERT_EQ(2, extended.size());
+    EXPECT_EQ(std::vector<string>({"b"}), NodeNames(extended[0]));
+    ASSERT_EQ(1, extended[0].library().function_size());
+    EXPECT_EQ("f", extended[0].library().function(0).signature().name());
+
+    EXPECT_EQ(0, extended[1].node_size());
+    ASSERT_EQ(1, extended[1].library().function_size());
+    EXPECT_EQ("g", extended[1].library().function(0).signature().name());
+    ASSERT_EQ(1, extended[1].library().gradient_size());
+    EXPECT_EQ("g", extended[1].library().gradient(0).function_name());
+}
+
+TEST_F(ZrpcSessionTest, ExtendRejectsRedefinitions)
+{
+    GraphDef graph;
+    *graph.add_node() = MakeNode("a");
+    *graph.mutable_library()->add_function() = MakeFunction("f");
+    NewSession(0, true, graph);
+
+    GraphDef changedNode;
+    *changedNode.add_node() = MakeNode("a", "Identity");
+    EXPECT_EQ(error::INVALID_ARGUMENT, session_->Extend(changedNode).code());
+
+    GraphDef duplicated;
+    *duplicated.add_node() = MakeNode("b");
+    *duplicated.add_node() = MakeNode("b");
+    EXPECT_EQ(error::INVALID_ARGUMENT, session_->Extend(duplicated).code());
+
+    GraphDef changedFunction;
+    *changedFunction.mutable_library()->add_function() = MakeFunction("f", "x:0");
+    EXPECT_EQ(error::INVALID_ARGUMENT, session_->Extend(changedFunction).code());
+
+    EXPECT_TRUE(master_->Extended().empty());
+}
+
+TEST_F(ZrpcSessionTest, ExtendWithoutTensorFramesSendsGraphAsIs)
+{
+    GraphDef graph;
+    *graph.add_node() = MakeNode("a");
+    NewSession(0, false, graph);
+
+    *graph.add_node() = MakeNode("b");
+    TF_ASSERT_OK(session_->Extend(graph));
+
+    auto extended = master_->Extended();
+    ASSERT_EQ(1, extended.size());
+    EXPECT_EQ(std::vector<string>({"a", "b"}), NodeNames(extended[0]));
+}
+
+} // namespace
+} // namespace tensorflow
@@ -0,0 +1,326 @@
+/*
+ * <one line to give the library's name and an idea of what it does.>
+ * Copyright (C) 2017  Aetf <aetf@unlimitedcodeworks.xyz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_tensor_coding.h"
+
+#include "tensorflow/core/common_runtime/dma_helper.h"
+#include "tensorflow/core/framework/allocation_description.pb.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+#include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/platform/logging.h"
+
+#include <cstring>
+
+namespace zrpc = executor;
+
+namespace tensorflow {
+
+namespace {
+
+// A TensorBuffer that owns a received ZeroMQ frame.
+class ZmqMessageBuffer : public TensorBuffer
+{
+public:
+    explicit ZmqMessageBuffer(zmq::message_t &&msg)
+        : m_msg(std::move(msg))
+    {
+    }
+
+    void *data() const override
+    {
+        return const_cast<void *>(m_msg.data());
+    }
+
+    size_t size() const override
+    {
+        return m_msg.size();
+    }
+
+    TensorBuffer *root_buffer() override
+    {
+        return this;
+    }
+
+    void FillAllocationDescription(AllocationDescription *proto) const override
+    {
+        proto->set_requested_bytes(size());
+        proto->set_allocated_bytes(size());
+        proto->set_allocator_name("zrpc_frame");
+    }
+
+private:
+    zmq::message_t m_msg;
+};
+
+bool isAligned(const void *ptr)
+{
+#if EIGEN_MAX_ALIGN_BYTES == 0
+    return true;
+#else
+    return reinterpret_cast<intptr_t>(ptr) % EIGEN_MAX_ALIGN_BYTES == 0;
+#endif
+}
+
+} // namespace
+
+void ZrpcTensorCoding::unrefBuffer(void *data, void *hint)
+{
+    static_cast<TensorBuffer *>(hint)->Unref();
+}
+
+zmq::message_t ZrpcTensorCoding::encodeTensor(const Tensor &tensor, TensorProto *header,
+                                              zrpc::TensorFrameDef *def)
+{
+    header->set_dtype(tensor.dtype());
+    tensor.shape().AsProto(header->mutable_tensor_shape());
+
+    if (!DataTypeCanUseMemcpy(tensor.dtype())) {
+        def->set_encoding(zrpc::TensorFrameDef::TENSOR_PROTO);
+        TensorProto proto;
+        tensor.AsProtoTensorContent(&proto);
+        zmq::message_t frame(proto.ByteSizeLong());
+        proto.SerializeToArray(frame.data(), frame.size());
+        return frame;
+    }
+
+    def->set_encoding(zrpc::TensorFrameDef::RAW);
+    auto data = tensor.tensor_data();
+    auto buf = DMAHelper::buffer(&tensor);
+    if (data.empty() || !buf) {
+        return zmq::message_t();
+    }
+    // The ref is dropped by ZeroMQ once the frame is sent.
+    buf->Ref();
+    return zmq::message_t(const_cast<char *>(data.data()), data.size(), &ZrpcTensorCoding::unrefBuffer,
+                          const_cast<TensorBuffer *>(buf));
+}
+
+Status ZrpcTensorCoding::decodeTensor(const TensorProto &header, const zrpc::TensorFrameDef &def,
+                                      zmq::message_t &&frame, Tensor *out)
+{
+    if (def.encoding() == zrpc::TensorFrameDef::TENSOR_PROTO) {
+        TensorProto proto;
+        if (!proto.ParseFromArray(frame.data(), frame.size())) {
+            return errors::InvalidArgument("Malformatted TensorProto in tensor frame");
+        }
+        Tensor parsed;
+        if (!parsed.FromProto(proto)) {
+            return errors::InvalidArgument("Invalid TensorProto in tensor frame");
+        }
+        *out = std::move(parsed);
+        return Status::OK();
+    }
+
+    if (def.encoding() != zrpc::TensorFrameDef::RAW) {
+        return errors::InvalidArgument("Unknown tensor frame encoding: ", def.encoding());
+    }
+    if (!DataTypeCanUseMemcpy(header.dtype())) {
+        return errors::InvalidArgument("Raw tensor frame with unsupported dtype: ",
+                                       DataTypeString(header.dtype()));
+    }
+    if (!TensorShape::IsValid(header.tensor_shape())) {
+        return errors::InvalidArgument("Invalid tensor shape in tensor frame header");
+    }
+    TensorShape shape(header.tensor_shape());
+    auto expected = static_cast<size_t>(shape.num_elements()) * DataTypeSize(header.dtype());
+    if (frame.size() != expected) {
+        return errors::InvalidArgument("Tensor frame has ", frame.size(), " bytes, expected ", expected);
+    }
+
+    if (expected == 0) {
+        *out = Tensor(header.dtype(), shape);
+        return Status::OK();
+    }
+
+    if (!isAligned(frame.data())) {
+        // Eigen requires aligned buffers, fall back to one copy.
+        Tensor copied(header.dtype(), shape);
+        std::memcpy(DMAHelper::base(&copied), frame.data(), frame.size());
+        *out = std::move(copied);
+        return Status::OK();
+    }
+
+    auto buf = new ZmqMessageBuffer(std::move(frame));
+    *out = Tensor(header.dtype(), shape, buf);
+    buf->Unref();
+    return Status::OK();
+}
+
+Status ZrpcTensorCoding::encodeRunStepRequest(const RunStepRequestWrapper &req, RunStepRequest *body,
+                                              zrpc::CustomRequest *request, zmq::MultiPartMessage *frames)
+{
+    body->set_session_handle(req.session_handle());
+    body->set_partial_run_handle(req.partial_run_handle());
+    *body->mutable_options() = req.options();
+    for (size_t i = 0; i < req.num_fetches(); ++i) {
+        body->add_fetch(req.fetch_name(i));
+    }
+    for (size_t i = 0; i < req.num_targets(); ++i) {
+        body->add_target(req.target_name(i));
+    }
+
+    frames->messages().reserve(req.num_feeds());
+    for (size_t i = 0; i < req.num_feeds(); ++i) {
+        auto feed = body->add_feed();
+        feed->set_name(req.feed_name(i));
+
+        Tensor value;
+        TF_RETURN_IF_ERROR(req.FeedValue(i, &value));
+        frames->emplace_back(encodeTensor(value, feed->mutable_tensor(), request->add_frames()));
+    }
+
+    request->set_type(body->GetTypeName());
+    request->set_accept_frames(true);
+    return Status::OK();
+}
+
+Status ZrpcTensorCoding::encodeGraphDef(const GraphDef &graph, size_t minFrameBytes, GraphDef *out,
+                                        zrpc::CustomRequest *request, zmq::MultiPartMessage *frames)
+{
+    *out->mutable_versions() = graph.versions();
+    if (graph.has_library()) {
+        *out->mutable_library() = graph.library();
+    }
+
+    out->mutable_node()->Reserve(graph.node_size());
+    for (const auto &node : graph.node()) {
+        const TensorProto *value = nullptr;
+        if (node.op() == "Const") {
+            auto it = node.attr().find("value");
+            if (it != node.attr().end() && it->second.has_tensor()) {
+                value = &it->second.tensor();
+            }
+        }
+        if (!value || value->ByteSizeLong() < minFrameBytes) {
+            *out->add_node() = node;
+            continue;
+        }
+
+        Tensor parsed;
+        if (!parsed.FromProto(*value)) {
+            return errors::InvalidArgument("Invalid value for Const node ", node.name());
+        }
+
+        // Copy everything but the value
+        auto dst = out->add_node();
+        dst->set_name(node.name());
+        dst->set_op(node.op());
+        dst->set_device(node.device());
+        *dst->mutable_input() = node.input();
+        for (const auto &attr : node.attr()) {
+            if (attr.first != "value") {
+                (*dst->mutable_attr())[attr.first] = attr.second;
+            }
+        }
+
+        auto def = request->add_frames();
+        def->set_name(node.name());
+        frames->emplace_back(encodeTensor(parsed, (*dst->mutable_attr())["value"].mutable_tensor(), def));
+    }
+    return Status::OK();
+}
+
+uint64 ZrpcTensorCoding::fingerprintGraph(const GraphDef &graph, const zmq::MultiPartMessage &frames)
+{
+    string header;
+    SerializeToStringDeterministic(graph, &header);
+    auto fp = Hash64(header);
+    for (const auto &frame : frames.messages()) {
+        fp = Hash64(static_cast<const char *>(frame.data()), frame.size(), fp);
+    }
+    return fp;
+}
+
+size_t ZrpcRunStepResponse::num_tensors() const
+{
+    return response_.tensor_size();
+}
+
+const string &ZrpcRunStepResponse::tensor_name(size_t i) const
+{
+    return response_.tensor(i).name();
+}
+
+Status ZrpcRunStepResponse::TensorValue(size_t i, Tensor *out_tensor) const
+{
+    if (!tensors_.empty()) {
+        *out_tensor = tensors_[i];
+        return Status::OK();
+    }
+    if (!out_tensor->FromProto(response_.tensor(i).tensor())) {
+        return errors::InvalidArgument("Invalid TensorProto for fetch value ", i);
+    }
+    return Status::OK();
+}
+
+Status ZrpcRunStepResponse::AddTensorFromRunGraphResponse(const string &name,
+                                                          MutableRunGraphResponseWrapper *run_graph_response,
+                                                          size_t i)
+{
+    NamedTensorProto *response_tensor = response_.add_tensor();
+    response_tensor->set_name(name);
+    return run_graph_response->RecvValue(i, response_tensor->mutable_tensor());
+}
+
+const RunMetadata &ZrpcRunStepResponse::metadata() const
+{
+    return response_.metadata();
+}
+
+RunMetadata *ZrpcRunStepResponse::mutable_metadata()
+{
+    return response_.mutable_metadata();
+}
+
+RunStepResponse *ZrpcRunStepResponse::get_proto()
+{
+    tensors_.clear();
+    return &response_;
+}
+
+Status ZrpcRunStepResponse::setFromFrames(RunStepResponse &&body,
+                                          const ::google::protobuf::RepeatedPtrField<zrpc::TensorFrameDef> &defs,
+                                          zmq::MultiPartMessage &&frames)
+{
+    response_.Swap(&body);
+    tensors_.clear();
+
+    if (defs.empty() && frames->empty()) {
+        // The server sent all tensors inline.
+        return Status::OK();
+    }
+    if (defs.size() != response_.tensor_size() || frames->size() != response_.tensor_size()) {
+        return errors::Internal("RunStep response has ", response_.tensor_size(), " tensors but ",
+                                defs.size(), " frame defs and ", frames->size(), " frames");
+    }
+
+    tensors_.resize(response_.tensor_size());
+    for (int i = 0; i != response_.tensor_size(); ++i) {
+        auto tensor = response_.mutable_tensor(i)->mutable_tensor();
+        TF_RETURN_IF_ERROR(ZrpcTensorCoding::decodeTensor(*tensor, defs.Get(i), std::move(frames->at(i)),
+                                                          &tensors_[i]));
+        tensor->Clear();
+    }
+    return Status::OK();
+}
+
+} // namespace tensorflow
@@ -0,0 +1,106 @@
+/*
+ * <one line to give the library's name and an idea of what it does.>
+ * Copyright (C) 2017  Aetf <aetf@unlimitedcodeworks.xyz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_TENSOR_CODING_H_
+#define TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_TENSOR_CODING_H_
+
+#include "tensorflow/core/distributed_runtime/message_wrappers.h"
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_util.h"
+#include "tensorflow/core/distributed_runtime/zrpc/protos/executor.pb.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/gtl/inlined_vector.h"
+#include "tensorflow/core/protobuf/master.pb.h"
+
+#include "zmq.hpp"
+
+namespace tensorflow {
+
+// Encodes tensors as standalone ZeroMQ frames, so that large payloads
+// don't go through protobuf serialization.
+//
+// For dtypes that can be memcpy'ed, the frame references the TensorBuffer
+// memory directly and holds a ref on the buffer until ZeroMQ frees the
+// message. Other dtypes are sent as a serialized TensorProto.
+class ZrpcTensorCoding
+{
+public:
+    // Encodes `tensor` into a frame. Fills `header` with the dtype and shape of
+    // the tensor and `def` with the encoding used.
+    static zmq::message_t encodeTensor(const Tensor &tensor, TensorProto *header,
+                                       executor::TensorFrameDef *def);
+
+    // Decodes `frame` into `out`, using the dtype and shape in `header`. The
+    // resulting tensor takes over `frame` without copying whenever the frame
+    // data is suitably aligned.
+    static Status decodeTensor(const TensorProto &header, const executor::TensorFrameDef &def,
+                               zmq::message_t &&frame, Tensor *out);
+
+    // Builds the body of a RunStep request from `req`, with all feed payloads
+    // moved to `frames`.
+    static Status encodeRunStepRequest(const RunStepRequestWrapper &req, RunStepRequest *body,
+                                       executor::CustomRequest *request, zmq::MultiPartMessage *frames);
+
+    // Copies `graph` to `out`, except that values of Const nodes taking at least
+    // `minFrameBytes` are moved to `frames`, named after their node.
+    static Status encodeGraphDef(const GraphDef &graph, size_t minFrameBytes, GraphDef *out,
+                                 executor::CustomRequest *request, zmq::MultiPartMessage *frames);
+
+    // Fingerprint of a graph encoded by `encodeGraphDef`, including its frames.
+    static uint64 fingerprintGraph(const GraphDef &graph, const zmq::MultiPartMessage &frames);
+
+private:
+    static void unrefBuffer(void *data, void *hint);
+};
+
+// RunStep response wrapper for the client side of Zrpc.
+//
+// Fetched tensors either come inline in the proto, or as separate frames
+// decoded by `ZrpcTensorCoding`, in which case they are kept as Tensors.
+class ZrpcRunStepResponse : public MutableRunStepResponseWrapper
+{
+public:
+    // MutableRunStepResponseWrapper methods.
+    size_t num_tensors() const override;
+    const string &tensor_name(size_t i) const override;
+    Status TensorValue(size_t i, Tensor *out_tensor) const override;
+    Status AddTensorFromRunGraphResponse(const string &name, MutableRunGraphResponseWrapper *run_graph_response,
+                                         size_t i) override;
+    const RunMetadata &metadata() const override;
+    RunMetadata *mutable_metadata() override;
+
+    // Takes `body` as the response header and decodes the fetched tensors
+    // from `frames`, which must match `defs` one to one.
+    Status setFromFrames(RunStepResponse &&body,
+                         const ::google::protobuf::RepeatedPtrField<executor::TensorFrameDef> &defs,
+                         zmq::MultiPartMessage &&frames);
+
+protected:
+    RunStepResponse *get_proto() override;
+
+private:
+    RunStepResponse response_;
+    // Decoded tensors, parallel to response_.tensor() when non-empty.
+    gtl::InlinedVector<Tensor, 4> tensors_;
+};
+
+} // namespace tensorflow
+
+#endif // TENSORFLOW_CORE_DISTRIBUTED_RUNTIME_ZRPC_ZRPC_TENSOR_CODING_H_
@@ -0,0 +1,208 @@
+/*
+ * <one line to give the library's name and an idea of what it does.>
+ * Copyright (C) 2017  Aetf <aetf@unlimitedcodeworks.xyz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "tensorflow/core/distributed_runtime/zrpc/zrpc_tensor_coding.h"
+
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace zrpc = executor;
+
+namespace tensorflow {
+namespace {
+
+Tensor roundTrip(const Tensor &in)
+{
+    TensorProto header;
+    zrpc::TensorFrameDef def;
+    auto frame = ZrpcTensorCoding::encodeTensor(in, &header, &def);
+
+    Tensor out;
+    TF_EXPECT_OK(ZrpcTensorCoding::decodeTensor(header, def, std::move(frame), &out));
+    return out;
+}
+
+TEST(ZrpcTensorCodingTest, RawFrameReferencesBuffer)
+{
+    Tensor a(DT_FLOAT, TensorShape({2, 3}));
+    test::FillValues<float>(&a, {1, 2, 3, 4, 5, 6});
+
+    TensorProto header;
+    zrpc::TensorFrameDef def;
+    auto frame = ZrpcTensorCoding::encodeTensor(a, &header, &def);
+    EXPECT_EQ(zrpc::TensorFrameDef::RAW, def.encoding());
+    EXPECT_EQ(DT_FLOAT, header.dtype());
+    EXPECT_TRUE(header.tensor_content().empty());
+    EXPECT_EQ(a.tensor_data().data(), frame.data());
+    EXPECT_EQ(a.TotalBytes(), frame.size());
+}
+
+TEST(ZrpcTensorCodingTest, RoundTrip)
+{
+    Tensor a(DT_INT32, TensorShape({2, 2}));
+    test::FillValues<int32>(&a, {3, 2, -1, 0});
+    test::ExpectTensorEqual<int32>(a, roundTrip(a));
+
+    Tensor s(DT_STRING, TensorShape({3}));
+    test::FillValues<string>(&s, {"a", "", "ccc"});
+    test::ExpectTensorEqual<string>(s, roundTrip(s));
+
+    Tensor empty(DT_FLOAT, TensorShape({0, 4}));
+    auto out = roundTrip(empty);
+    EXPECT_EQ(empty.shape(), out.shape());
+}
+
+TEST(ZrpcTensorCodingTest, SlicedTensor)
+{
+    Tensor a(DT_INT64, TensorShape({4, 2}));
+    test::FillValues<int64>(&a, {0, 1, 2, 3, 4, 5, 6, 7});
+    auto slice = a.Slice(1, 3);
+    test::ExpectTensorEqual<int64>(slice, roundTrip(slice));
+}
+
+TEST(ZrpcTensorCodingTest, SizeMismatch)
+{
+    TensorProto header;
+    header.set_dtype(DT_FLOAT);
+    TensorShape({4}).AsProto(header.mutable_tensor_shape());
+    zrpc::TensorFrameDef def;
+
+    Tensor out;
+    EXPECT_FALSE(ZrpcTensorCoding::decodeTensor(header, def, zmq::message_t(3), &out).ok());
+}
+
+TEST(ZrpcTensorCodingTest, RunStepRoundTrip)
+{
+    Tensor a(DT_FLOAT, TensorShape({2}));
+    test::FillValues<float>(&a, {1, 2});
+    Tensor b(DT_STRING, TensorShape({}));
+    b.scalar<string>()() = "hello";
+
+    InMemoryRunStepRequest req;
+    req.set_session_handle("handle");
+    req.add_feed("a:0", a);
+    req.add_feed("b:0", b);
+    req.add_fetch("c:0");
+
+    RunStepRequest body;
+    zrpc::CustomRequest request;
+    zmq::MultiPartMessage frames;
+    TF_ASSERT_OK(ZrpcTensorCoding::encodeRunStepRequest(req, &body, &request, &frames));
+    EXPECT_TRUE(request.accept_frames());
+    ASSERT_EQ(2, body.feed_size());
+    ASSERT_EQ(2, request.frames_size());
+    ASSERT_EQ(2, frames->size());
+    EXPECT_EQ("c:0", body.fetch(0));
+
+    // Reply with the feeds as fetches
+    RunStepResponse reply;
+    for (int i = 0; i != body.feed_size(); ++i) {
+        *reply.add_tensor() = body.feed(i);
+    }
+    ZrpcRunStepResponse resp;
+    TF_ASSERT_OK(resp.setFromFrames(std::move(reply), request.frames(), std::move(frames)));
+    ASSERT_EQ(2, resp.num_tensors());
+    EXPECT_EQ("a:0", resp.tensor_name(0));
+
+    Tensor val;
+    TF_ASSERT_OK(resp.TensorValue(0, &val));
+    test::ExpectTensorEqual<float>(a, val);
+    TF_ASSERT_OK(resp.TensorValue(1, &val));
+    test::ExpectTensorEqual<string>(b, val);
+}
+
+TEST(ZrpcTensorCodingTest, RunStepFrameCountMismatch)
+{
+    RunStepResponse reply;
+    reply.add_tensor()->set_name("a:0");
+    ::google::protobuf::RepeatedPtrField<zrpc::TensorFrameDef> defs;
+    defs.Add();
+
+    ZrpcRunStepResponse resp;
+    EXPECT_FALSE(resp.setFromFrames(std::move(reply), defs, {}).ok());
+}
+
+NodeDef *addConst(GraphDef *graph, const string &name, const Tensor &value)
+{
+    auto node = graph->add_node();
+    node->set_name(name);
+    node->set_op("Const");
+    (*node->mutable_attr())["dtype"].set_type(value.dtype());
+    value.AsProtoTensorContent((*node->mutable_attr())["value"].mutable_tensor());
+    return node;
+}
+
+TEST(ZrpcTensorCodingTest, GraphDefLargeConstsAsFrames)
+{
+    Tensor small(DT_FLOAT, TensorShape({2}));
+    test::FillValues<float>(&small, {1, 2});
+    Tensor large(DT_FLOAT, TensorShape({1024}));
+    test::FillIota<float>(&large, 0);
+
+    GraphDef graph;
+    addConst(&graph, "small", small);
+    addConst(&graph, "large", large);
+    graph.add_node()->set_name("other");
+
+    GraphDef out;
+    zrpc::CustomRequest request;
+    zmq::MultiPartMessage frames;
+    TF_ASSERT_OK(ZrpcTensorCoding::encodeGraphDef(graph, 1024, &out, &request, &frames));
+    ASSERT_EQ(3, out.node_size());
+    ASSERT_EQ(1, request.frames_size());
+    ASSERT_EQ(1, frames->size());
+    EXPECT_EQ("large", request.frames(0).name());
+    EXPECT_EQ(graph.node(0).DebugString(), out.node(0).DebugString());
+    EXPECT_EQ(DT_FLOAT, out.node(1).attr().at("dtype").type());
+
+    Tensor decoded;
+    TF_ASSERT_OK(ZrpcTensorCoding::decodeTensor(out.node(1).attr().at("value").tensor(), request.frames(0),
+                                                std::move(frames->at(0)), &decoded));
+    test::ExpectTensorEqual<float>(large, decoded);
+}
+
+TEST(ZrpcTensorCodingTest, GraphFingerprint)
+{
+    Tensor large(DT_INT32, TensorShape({512}));
+    test::FillIota<int32>(&large, 0);
+
+    auto fingerprint = [](const GraphDef &graph) {
+        GraphDef out;
+        zrpc::CustomRequest request;
+        zmq::MultiPartMessage frames;
+        TF_CHECK_OK(ZrpcTensorCoding::encodeGraphDef(graph, 1024, &out, &request, &frames));
+        return ZrpcTensorCoding::fingerprintGraph(out, frames);
+    };
+
+    GraphDef graph;
+    addConst(&graph, "large", large);
+    auto fp = fingerprint(graph);
+    EXPECT_EQ(fp, fingerprint(graph));
+
+    // Changes in frame content are covered
+    large.flat<int32>()(0) = -1;
+    GraphDef changed;
+    addConst(&changed, "large", large);
+    EXPECT_NE(fp, fingerprint(changed));
+}
+
+} // namespace
+} // namespace tensorflow
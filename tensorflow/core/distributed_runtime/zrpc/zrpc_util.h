@@ -78,6 +78,11 @@ public:
         return m_parts;
     }
 
+    const std::vector<message_t> &messages() const
+    {
+        return m_parts;
+    }
+
     template<typename ... Args>
     message_t &emplace_back(Args&&... args)
     {
@@ -57,6 +57,10 @@ struct AllocatorStats {
   // unknown.
   int64 bytes_limit;
 
+  // Bytes held in allocator-side caches for reuse, not counted in
+  // bytes_in_use.
+  int64 bytes_cached;
+
   AllocatorStats() { Clear(); }
 
   void Clear();
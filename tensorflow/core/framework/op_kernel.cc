@@ -277,7 +277,9 @@ OpKernelContext::~OpKernelContext() {
 
 Allocator* OpKernelContext::get_allocator(AllocatorAttributes attr) {
   Allocator* allocator =
-      params_->device->GetStepAllocator(attr, resource_manager());
+      (params_->planned_allocator && attr.value == 0)
+          ? params_->planned_allocator
+          : params_->device->GetStepAllocator(attr, resource_manager());
   if (track_allocations()) {
     mutex_lock lock(mu_);
     for (const auto& wrapped : wrapped_allocators_) {
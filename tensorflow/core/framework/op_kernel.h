@@ -506,6 +506,12 @@ class OpKernelContext {
 
     bool track_allocations = false;
     bool log_memory = false;
+
+    // If set, allocations with default attributes use this instead of the
+    // device's allocator. The executor sets it to serve allocations from an
+    // allocation plan.
+    Allocator* planned_allocator = nullptr;
+
     bool record_tensor_accesses = false;
 
     // Array indexed by output number for this node
@@ -17,6 +17,7 @@ limitations under the License.
 
 #include <deque>
 #include <functional>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -148,22 +149,26 @@ Status Rendezvous::Recv(const ParsedKey& key, const Args& args, Tensor* val,
 
 class LocalRendezvousImpl : public Rendezvous {
  public:
-  explicit LocalRendezvousImpl() {}
+  explicit LocalRendezvousImpl(int num_shards)
+      : num_shards_(num_shards), shards_(new Shard[num_shards]) {
+    CHECK_GT(num_shards, 0);
+  }
 
   Status Send(const ParsedKey& key, const Args& send_args, const Tensor& val,
               const bool is_dead) override {
     uint64 key_hash = KeyHash(key.FullKey());
     VLOG(2) << "Send " << this << " " << key_hash << " " << key.FullKey();
 
-    mu_.lock();
-    if (!status_.ok()) {
+    Shard* shard = ShardFor(key_hash);
+    shard->mu.lock();
+    if (!shard->status.ok()) {
       // Rendezvous has been aborted.
-      Status s = status_;
-      mu_.unlock();
+      Status s = shard->status;
+      shard->mu.unlock();
       return s;
     }
 
-    ItemQueue* queue = &table_[key_hash];
+    ItemQueue* queue = shard->QueueFor(key_hash);
     if (queue->empty() || queue->front()->IsSendValue()) {
       // There is no waiter for this message. Append the message
       // into the queue. The waiter will pick it up when arrives.
@@ -176,14 +181,14 @@ class LocalRendezvousImpl : public Rendezvous {
         item->send_args.device_context->Ref();
       }
       queue->push_back(item);
-      mu_.unlock();
+      shard->mu.unlock();
       return Status::OK();
     }
 
     // There is an earliest waiter to consume this message.
     Item* item = queue->front();
     queue->pop_front();
-    mu_.unlock();
+    shard->mu.unlock();
 
     // Notify the waiter by invoking its done closure, outside the
     // lock.
@@ -198,16 +203,17 @@ class LocalRendezvousImpl : public Rendezvous {
     uint64 key_hash = KeyHash(key.FullKey());
     VLOG(2) << "Recv " << this << " " << key_hash << " " << key.FullKey();
 
-    mu_.lock();
-    if (!status_.ok()) {
+    Shard* shard = ShardFor(key_hash);
+    shard->mu.lock();
+    if (!shard->status.ok()) {
       // Rendezvous has been aborted.
-      Status s = status_;
-      mu_.unlock();
+      Status s = shard->status;
+      shard->mu.unlock();
       done(s, Args(), recv_args, Tensor(), false);
       return;
     }
 
-    ItemQueue* queue = &table_[key_hash];
+    ItemQueue* queue = shard->QueueFor(key_hash);
     if (queue->empty() || !queue->front()->IsSendValue()) {
       // There is no message to pick up.
       // Only recv-related fields need to be filled.
@@ -218,7 +224,7 @@ class LocalRendezvousImpl : public Rendezvous {
         item->recv_args.device_context->Ref();
       }
       queue->push_back(item);
-      mu_.unlock();
+      shard->mu.unlock();
       return;
     }
 
@@ -226,7 +232,7 @@ class LocalRendezvousImpl : public Rendezvous {
     // this key.  Consumes the message and invokes the done closure.
     Item* item = queue->front();
     queue->pop_front();
-    mu_.unlock();
+    shard->mu.unlock();
 
     // Invokes the done() by invoking its done closure, outside scope
     // of the table lock.
@@ -237,18 +243,32 @@ class LocalRendezvousImpl : public Rendezvous {
 
   void StartAbort(const Status& status) override {
     CHECK(!status.ok());
-    Table table;
+    // All shards get the first abort status, even if several aborts race.
+    Status first;
     {
-      mutex_lock l(mu_);
+      mutex_lock l(status_mu_);
       status_.Update(status);
-      table_.swap(table);
+      first = status_;
     }
-    for (auto& p : table) {
-      for (Item* item : p.second) {
-        if (!item->IsSendValue()) {
-          item->waiter(status, Args(), Args(), Tensor(), false);
+    for (int i = 0; i < num_shards_; ++i) {
+      Shard* shard = &shards_[i];
+      std::unique_ptr<Table> table;
+      {
+        mutex_lock l(shard->mu);
+        shard->status = first;
+        table = std::move(shard->table);
+      }
+      if (table == nullptr) {
+        // No Send or Recv ever used this shard.
+        continue;
+      }
+      for (auto& p : *table) {
+        for (Item* item : p.second) {
+          if (!item->IsSendValue()) {
+            item->waiter(status, Args(), Args(), Tensor(), false);
+          }
+          delete item;
         }
-        delete item;
       }
     }
   }
@@ -290,10 +310,34 @@ class LocalRendezvousImpl : public Rendezvous {
   typedef std::deque<Item*> ItemQueue;
   typedef gtl::FlatMap<uint64, ItemQueue> Table;
 
-  // TODO(zhifengc): shard table_.
-  mutex mu_;
-  Table table_ GUARDED_BY(mu_);
-  Status status_ GUARDED_BY(mu_);
+  // A part of the table, with its own lock. Send and RecvAsync of one key
+  // only ever touch the shard of that key.
+  struct Shard {
+    mutex mu;
+    // Allocated by the first Send or Recv of the shard, as most per-step
+    // rendezvous only ever use a few of their shards.
+    std::unique_ptr<Table> table GUARDED_BY(mu);
+    // Copy of status_, set once the rendezvous is aborted.
+    Status status GUARDED_BY(mu);
+
+    ItemQueue* QueueFor(uint64 key_hash) EXCLUSIVE_LOCKS_REQUIRED(mu) {
+      if (table == nullptr) {
+        table.reset(new Table);
+      }
+      return &(*table)[key_hash];
+    }
+  };
+
+  Shard* ShardFor(uint64 key_hash) {
+    // The table hashes the low bits, so pick the shard by the high ones.
+    return &shards_[(key_hash >> 32) % num_shards_];
+  }
+
+  const int num_shards_;
+  std::unique_ptr<Shard[]> shards_;
+
+  mutex status_mu_;
+  Status status_ GUARDED_BY(status_mu_);
 
   ~LocalRendezvousImpl() override {
     StartAbort(errors::Cancelled("LocalRendezvousImpl deleted"));
@@ -302,6 +346,16 @@ class LocalRendezvousImpl : public Rendezvous {
   TF_DISALLOW_COPY_AND_ASSIGN(LocalRendezvousImpl);
 };
 
-Rendezvous* NewLocalRendezvous() { return new LocalRendezvousImpl(); }
+// Enough for the Send/Recv pairs of a few threads to rarely share a lock,
+// while aborting a rendezvous stays cheap.
+static const int kDefaultLocalRendezvousShards = 16;
+
+Rendezvous* NewLocalRendezvous() {
+  return new LocalRendezvousImpl(kDefaultLocalRendezvousShards);
+}
+
+Rendezvous* NewLocalRendezvous(int num_shards) {
+  return new LocalRendezvousImpl(num_shards);
+}
 
 }  // end namespace tensorflow
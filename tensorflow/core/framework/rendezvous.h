@@ -129,6 +129,10 @@ class Rendezvous : public core::RefCounted {
 // ownership of one Ref() on the returned object.
 Rendezvous* NewLocalRendezvous();
 
+// Same, with the table split into 'num_shards' independently locked parts.
+// NewLocalRendezvous(1) has a single lock for all keys.
+Rendezvous* NewLocalRendezvous(int num_shards);
+
 }  // end namespace tensorflow
 
 #endif  // TENSORFLOW_FRAMEWORK_RENDEZVOUS_H_
@@ -15,11 +15,15 @@ limitations under the License.
 
 #include "tensorflow/core/framework/rendezvous.h"
 
+#include <atomic>
+#include <vector>
+
 #include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/tensor_types.h"
 #include "tensorflow/core/framework/types.pb.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
@@ -274,6 +278,33 @@ TEST_F(LocalRendezvousTest, AbortThenRecvOrSend) {
       errors::IsAborted(rendez_->Recv(KeyFoo(), args, &val, &val_dead)));
 }
 
+TEST_F(LocalRendezvousTest, AbortReachesAllKeys) {
+  const int N = 100;
+  std::atomic<int> num_aborted(0);
+  Rendezvous::Args args;
+  for (int i = 0; i < N; ++i) {
+    rendez_->RecvAsync(
+        MakeKey(strings::StrCat("key", i)), args,
+        [&num_aborted](const Status& s, const Rendezvous::Args&,
+                       const Rendezvous::Args&, const Tensor&, bool) {
+          if (errors::IsAborted(s)) {
+            ++num_aborted;
+          }
+        });
+  }
+  rendez_->StartAbort(errors::Aborted(""));
+  EXPECT_EQ(N, num_aborted);
+
+  // Every shard remembers the first status.
+  rendez_->StartAbort(errors::Cancelled(""));
+  Tensor val(DT_STRING);
+  bool val_dead = false;
+  for (int i = 0; i < N; ++i) {
+    EXPECT_TRUE(errors::IsAborted(rendez_->Send(
+        MakeKey(strings::StrCat("key", i)), args, val, val_dead)));
+  }
+}
+
 class DummyDeviceContext : public DeviceContext {
  public:
   explicit DummyDeviceContext(int stream_id) : stream_id_(stream_id) {}
@@ -360,5 +391,50 @@ void BM_PingPong(int iters) {
 }
 BENCHMARK(BM_PingPong);
 
+// Each thread sends and receives on its own keys, so threads only contend
+// for the locks of the table.
+void BM_SendRecvContended(int iters, int num_threads, int num_shards) {
+  testing::StopTiming();
+  const int kKeysPerThread = 64;
+  Rendezvous* rendez = NewLocalRendezvous(num_shards);
+  std::vector<std::vector<Rendezvous::ParsedKey>> keys(num_threads);
+  for (int t = 0; t < num_threads; ++t) {
+    for (int k = 0; k < kKeysPerThread; ++k) {
+      keys[t].push_back(MakeKey(strings::StrCat("t", t, "_k", k)));
+    }
+  }
+  thread::ThreadPool pool(Env::Default(), "test", num_threads);
+  BlockingCounter done(num_threads);
+  testing::StartTiming();
+  for (int t = 0; t < num_threads; ++t) {
+    pool.Schedule([rendez, &keys, &done, iters, num_threads, t]() {
+      Tensor val = V("val");
+      Rendezvous::Args args;
+      for (int i = 0; i < iters / num_threads; ++i) {
+        const auto& key = keys[t][i % kKeysPerThread];
+        rendez->RecvAsync(key, args,
+                          [](const Status& s, const Rendezvous::Args&,
+                             const Rendezvous::Args&, const Tensor&,
+                             bool) { TF_CHECK_OK(s); });
+        TF_CHECK_OK(rendez->Send(key, args, val, false));
+      }
+      done.DecrementCount();
+    });
+  }
+  done.Wait();
+  testing::StopTiming();
+  testing::ItemsProcessed(static_cast<int64>(iters / num_threads) *
+                          num_threads);
+  rendez->Unref();
+}
+BENCHMARK(BM_SendRecvContended)
+    ->ArgPair(1, 1)
+    ->ArgPair(1, 16)
+    ->ArgPair(4, 1)
+    ->ArgPair(4, 16)
+    ->ArgPair(16, 1)
+    ->ArgPair(16, 16)
+    ->ArgPair(16, 64);
+
 }  // namespace
 }  // namespace tensorflow
@@ -42,6 +42,7 @@ class TensorCApi;
 class TensorDescription;
 class TensorProto;
 class VariantTensorData;
+class ZrpcTensorCoding;
 namespace batch_util {
 Status CopyElementToSlice(Tensor element, Tensor* parent, int64 index);
 }  // namespace batch_util
@@ -498,6 +499,10 @@ class Tensor {
                                    // taking the buffer.
 
   friend class remote::PagingHelper; // For access to buf_
+  friend class ZrpcTensorCoding;  // For access to the private constructor
+                                  // taking the buffer.
+  friend class BundleReader;      // For access to the private constructor
+                                  // taking the buffer.
 
   // Creates a tensor with the input datatype, shape and buf.
   //
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "tensorflow/core/grappler/costs/graph_memory.h"
 #include <list>
+#include <unordered_set>
 #include "tensorflow/core/framework/allocation_description.pb.h"
 #include "tensorflow/core/framework/node_def.pb.h"
 #include "tensorflow/core/framework/step_stats.pb.h"
@@ -23,6 +24,7 @@ limitations under the License.
 #include "tensorflow/core/framework/tensor_shape.pb.h"
 #include "tensorflow/core/grappler/clusters/virtual_cluster.h"
 #include "tensorflow/core/grappler/costs/graph_properties.h"
+#include "tensorflow/core/grappler/op_types.h"
 #include "tensorflow/core/grappler/utils.h"
 
 namespace tensorflow {
@@ -106,6 +108,21 @@ int64 GraphMemory::InferMemUsageForNeighbors(
   return neighbors_memory_usage;
 }
 
+// Bytes of the variable a VarHandleOp refers to, whose own output is only a
+// handle. Returns 0 if the shape isn't fully known.
+static int64 ResourceVariableSize(const NodeDef& node) {
+  if (node.op() != "VarHandleOp" || !node.attr().count("dtype") ||
+      !node.attr().count("shape")) {
+    return 0;
+  }
+  const TensorShapeProto& shape = node.attr().at("shape").shape();
+  if (!TensorShape::IsValid(shape)) {
+    return 0;
+  }
+  return TensorShape(shape).num_elements() *
+         DataTypeSize(node.attr().at("dtype").type());
+}
+
 static GraphMemory::LiveTensor* FindOrCreateLiveTensor(
     const string& node_name, int output_id,
     std::unordered_map<string, GraphMemory::LiveTensor*>* live_tensors,
@@ -152,6 +169,21 @@ void GraphMemory::InferFromTrace(const StepStats& timeline) {
   std::unordered_map<string, std::list<LiveTensor>> live_tensors_per_device;
 
   NodeMap node_map(&item_.graph);
+  // Variables stay allocated across steps.
+  std::unordered_set<string> persistent_nodes;
+  footprint_.clear();
+  for (const auto& dev_stats : timeline.dev_stats()) {
+    MemoryFootprint& footprint = footprint_[dev_stats.device()];
+    footprint = MemoryFootprint{0, 0, 0};
+    for (const auto& node_stats : dev_stats.node_stats()) {
+      const NodeDef* node = node_map.GetNode(node_stats.node_name());
+      if (node && IsVariable(*node)) {
+        persistent_nodes.insert(node->name());
+        footprint.persistent_memory += ResourceVariableSize(*node);
+      }
+    }
+  }
+
   for (const auto& dev_stats : timeline.dev_stats()) {
     std::list<LiveTensor>& device_tensors =
         live_tensors_per_device[dev_stats.device()];
@@ -215,9 +247,24 @@ void GraphMemory::InferFromTrace(const StepStats& timeline) {
     std::set<const LiveTensor*> live_at_peak;
     size_t current = 0;
     std::set<const LiveTensor*> currently_live;
+    MemoryFootprint& footprint = footprint_[live_per_device.first];
+    size_t current_temporary = 0;
     for (int i = 0; i < events.size(); ++i) {
       const auto& event = events[i];
 
+      if (persistent_nodes.count(event.tensor->node)) {
+        if (event.allocated) {
+          footprint.persistent_memory += event.tensor->memory_used;
+        }
+      } else if (event.allocated) {
+        current_temporary += event.tensor->memory_used;
+        if (event.tensor->memory_used > 0) {
+          ++footprint.num_temporary_allocations;
+        }
+      } else {
+        current_temporary -= event.tensor->memory_used;
+      }
+
       if (event.allocated) {
         VLOG(1) << "At time " << event.timestamp << " allocated "
                 << event.tensor->memory_used << " for tensor "
@@ -237,6 +284,8 @@ void GraphMemory::InferFromTrace(const StepStats& timeline) {
           peak = current;
           live_at_peak = currently_live;
         }
+        footprint.peak_temporary_memory = std::max<int64>(
+            footprint.peak_temporary_memory, current_temporary);
       }
     }
     MemoryUsage& peak_mem_usage = peak_usage_[live_per_device.first];
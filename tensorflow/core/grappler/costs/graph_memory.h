@@ -39,9 +39,20 @@ class GraphMemory {
     int64 used_memory;
     std::vector<LiveTensor> live_tensors;
   };
+  // Memory of a device split by lifetime. Persistent memory holds the
+  // variables placed on the device, and temporary memory everything else.
+  struct MemoryFootprint {
+    int64 persistent_memory;
+    // Peak usage, not counting persistent memory.
+    int64 peak_temporary_memory;
+    // Number of tensors allocated in temporary memory per step.
+    int64 num_temporary_allocations;
+  };
 
   explicit GraphMemory(const GrapplerItem& item)
-      : item_(item), unknown_usage_({-1, {}}) {}
+      : item_(item),
+        unknown_usage_({-1, {}}),
+        unknown_footprint_({-1, -1, -1}) {}
 
   Status InferStatically(
       const std::unordered_map<string, DeviceProperties>& devices);
@@ -60,6 +71,15 @@ class GraphMemory {
     return it->second;
   }
 
+  // Returns the memory footprint of the specified device.
+  const MemoryFootprint& GetMemoryFootprint(const string& device) const {
+    auto it = footprint_.find(device);
+    if (it == footprint_.end()) {
+      return unknown_footprint_;
+    }
+    return it->second;
+  }
+
  private:
   void InferMemUsageForNodes(const std::vector<const NodeDef*>& nodes,
                              GraphProperties* properties, int64* worst_case,
@@ -72,7 +92,9 @@ class GraphMemory {
   GrapplerItem item_;
   std::unordered_map<string, int64> worst_case_memory_usage_;
   std::unordered_map<string, MemoryUsage> peak_usage_;
+  std::unordered_map<string, MemoryFootprint> footprint_;
   const MemoryUsage unknown_usage_;
+  const MemoryFootprint unknown_footprint_;
 };
 
 }  // end namespace grappler
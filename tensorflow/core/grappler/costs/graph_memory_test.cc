@@ -167,6 +167,37 @@ TEST_F(GraphMemoryTest, CtrlDependencies) {
   EXPECT_EQ(expected, tensors);
 }
 
+TEST_F(GraphMemoryTest, Footprint) {
+  Scope s = Scope::NewRootScope();
+  Output a = ops::Const(s.WithOpName("a").WithDevice("/CPU:0"), 10.0f, {3});
+  Output v =
+      ops::Variable(s.WithOpName("v").WithDevice("/CPU:0"), {3}, DT_FLOAT);
+  Output assign =
+      ops::Assign(s.WithOpName("assign").WithDevice("/CPU:0"), v, a);
+  Output h = ops::VarHandleOp(s.WithOpName("h").WithDevice("/CPU:0"),
+                              DT_FLOAT, {4, 4});
+  ops::NoOp init(
+      s.WithOpName("init").WithDevice("/CPU:0").WithControlDependencies(
+          {assign.op(), h.op()}));
+
+  GrapplerItem item;
+  item.fetch.push_back("init");
+  TF_CHECK_OK(s.ToGraphDef(&item.graph));
+
+  GraphMemory memory(item);
+  TF_CHECK_OK(memory.InferStatically(devices_));
+
+  const GraphMemory::MemoryFootprint& footprint =
+      memory.GetMemoryFootprint("/CPU:0");
+  // v and the 4x4 floats behind h.
+  EXPECT_EQ(12 + 64, footprint.persistent_memory);
+  // a and assign.
+  EXPECT_EQ(24, footprint.peak_temporary_memory);
+  EXPECT_EQ(2, footprint.num_temporary_allocations);
+
+  EXPECT_EQ(-1, memory.GetMemoryFootprint("/GPU:0").persistent_memory);
+}
+
 }  // namespace
 }  // namespace grappler
 }  // namespace tensorflow
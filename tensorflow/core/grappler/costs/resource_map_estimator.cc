@@ -0,0 +1,144 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/grappler/costs/resource_map_estimator.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "tensorflow/core/grappler/clusters/utils.h"
+#include "tensorflow/core/grappler/costs/graph_memory.h"
+#include "tensorflow/core/grappler/grappler_item.h"
+#include "tensorflow/core/grappler/op_types.h"
+#include "tensorflow/core/grappler/utils.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/util/device_name_utils.h"
+
+namespace tensorflow {
+namespace grappler {
+
+namespace {
+
+const char* const kDevicePrefix = "/job:localhost/replica:0/task:0/device:";
+
+// Only the memory estimate matters, so any GPU will do.
+DeviceProperties NominalGPUInfo() {
+  DeviceProperties device;
+  device.set_type("GPU");
+  device.set_vendor("NVidia");
+  device.set_frequency(1000);
+  device.set_num_cores(16);
+  device.set_bandwidth(256 * 1024 * 1024);
+  (*device.mutable_environment())["architecture"] = "6";
+  return device;
+}
+
+void SetBatchSize(int64 batch_size, TensorShapeProto* shape) {
+  if (!shape->unknown_rank() && shape->dim_size() > 0 &&
+      shape->dim(0).size() < 0) {
+    shape->mutable_dim(0)->set_size(batch_size);
+  }
+}
+
+// Makes the unknown leading dimension of placeholders `batch_size`.
+void SetBatchSize(int64 batch_size, GraphDef* graph) {
+  for (NodeDef& node : *graph->mutable_node()) {
+    if (!IsPlaceholder(node)) {
+      continue;
+    }
+    auto attr = node.mutable_attr();
+    if (attr->count("shape")) {
+      SetBatchSize(batch_size, (*attr)["shape"].mutable_shape());
+    }
+    if (attr->count("_output_shapes") &&
+        (*attr)["_output_shapes"].list().shape_size() > 0) {
+      SetBatchSize(batch_size,
+                   (*attr)["_output_shapes"].mutable_list()->mutable_shape(0));
+    }
+  }
+}
+
+}  // namespace
+
+Status EstimateResourceMap(const GraphDef& graph, int64 batch_size,
+                           SalusOptions::ResourceMapDef* resource_map) {
+  GrapplerItem item;
+  item.id = "resource_map";
+  item.graph = graph;
+  SetBatchSize(std::max<int64>(batch_size, 1), &item.graph);
+
+  std::unordered_set<string> consumed;
+  for (const NodeDef& node : item.graph.node()) {
+    for (const string& input : node.input()) {
+      consumed.insert(NodeName(input));
+    }
+  }
+  for (const NodeDef& node : item.graph.node()) {
+    if (!consumed.count(node.name())) {
+      item.fetch.push_back(node.name());
+    }
+  }
+
+  // Device name to resource tag.
+  std::unordered_map<string, DeviceProperties> devices;
+  std::unordered_map<string, string> tags;
+  auto add_device = [&](const string& type, int id) {
+    const string name = strings::StrCat(kDevicePrefix, type, ":", id);
+    if (devices.count(name)) {
+      return;
+    }
+    devices[name] = type == "GPU" ? NominalGPUInfo() : GetLocalCPUInfo();
+    tags[name] = strings::StrCat("MEMORY:", type, id);
+  };
+  add_device("CPU", 0);
+  add_device("GPU", 0);
+  for (const NodeDef& node : item.graph.node()) {
+    DeviceNameUtils::ParsedName parsed;
+    if (node.device().empty() ||
+        !DeviceNameUtils::ParseFullName(node.device(), &parsed) ||
+        !parsed.has_type || !parsed.has_id) {
+      continue;
+    }
+    const string type = str_util::Uppercase(parsed.type);
+    if (type == "CPU" || type == "GPU") {
+      add_device(type, parsed.id);
+    }
+  }
+
+  GraphMemory memory(item);
+  TF_RETURN_IF_ERROR(memory.InferStatically(devices));
+
+  resource_map->Clear();
+  int64 alloc_count = 0;
+  for (const auto& tag : tags) {
+    const auto& footprint = memory.GetMemoryFootprint(tag.first);
+    if (footprint.persistent_memory < 0) {
+      // Nothing ran on the device.
+      continue;
+    }
+    (*resource_map->mutable_persistant())[tag.second] =
+        footprint.persistent_memory;
+    (*resource_map->mutable_temporary())[tag.second] =
+        footprint.peak_temporary_memory;
+    alloc_count += footprint.num_temporary_allocations;
+  }
+  resource_map->set_alloc_count(alloc_count);
+  return Status::OK();
+}
+
+}  // end namespace grappler
+}  // end namespace tensorflow
@@ -0,0 +1,46 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_GRAPPLER_COSTS_RESOURCE_MAP_ESTIMATOR_H_
+#define TENSORFLOW_GRAPPLER_COSTS_RESOURCE_MAP_ESTIMATOR_H_
+
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/protobuf/config.pb.h"
+
+namespace tensorflow {
+namespace grappler {
+
+// Statically estimates the memory a session running `graph` needs, in the
+// form of SalusOptions.resource_map, so that the scheduler can admit the job
+// without profiling it first.
+//
+// The graph is simulated by the virtual scheduler on CPU:0 and GPU:0, plus
+// any other CPU or GPU named by node devices. Unplaced nodes go to GPU:0.
+// Unknown leading dimensions of placeholders are taken to be `batch_size`,
+// and other unknown dimensions to be 1. All nodes without consumers are
+// fetched, so the estimate covers running the whole graph in one step.
+//
+// For each device, `persistant` gets the bytes of its variables, and
+// `temporary` the peak bytes of all other tensors. `alloc_count` gets the
+// number of temporary allocations per step on all devices. Keys are Salus
+// resource tags, e.g. "MEMORY:GPU0".
+Status EstimateResourceMap(const GraphDef& graph, int64 batch_size,
+                           SalusOptions::ResourceMapDef* resource_map);
+
+}  // end namespace grappler
+}  // end namespace tensorflow
+
+#endif  // TENSORFLOW_GRAPPLER_COSTS_RESOURCE_MAP_ESTIMATOR_H_
@@ -0,0 +1,79 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/grappler/costs/resource_map_estimator.h"
+
+#include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace grappler {
+namespace {
+
+// x: [batch, 4] -> MatMul with v: [4, 4] -> Square
+GraphDef MatMulGraph(const string& variable_device) {
+  Scope s = Scope::NewRootScope();
+  auto x = ops::Placeholder(s.WithOpName("x"), DT_FLOAT,
+                            ops::Placeholder::Shape({-1, 4}));
+  auto v = ops::Variable(s.WithOpName("v").WithDevice(variable_device), {4, 4},
+                         DT_FLOAT);
+  auto y = ops::MatMul(s.WithOpName("y"), x, v);
+  ops::Square(s.WithOpName("z"), y);
+  GraphDef graph;
+  TF_CHECK_OK(s.ToGraphDef(&graph));
+  return graph;
+}
+
+TEST(ResourceMapEstimatorTest, SingleDevice) {
+  SalusOptions::ResourceMapDef resource_map;
+  TF_ASSERT_OK(EstimateResourceMap(MatMulGraph(""), 8, &resource_map));
+
+  EXPECT_EQ(1, resource_map.persistant_size());
+  EXPECT_EQ(64, resource_map.persistant().at("MEMORY:GPU0"));
+  // x, y and z of 8x4 floats each. In the worst case, x is only freed once z
+  // is allocated.
+  EXPECT_EQ(384, resource_map.temporary().at("MEMORY:GPU0"));
+  EXPECT_EQ(3, resource_map.alloc_count());
+}
+
+TEST(ResourceMapEstimatorTest, BatchSize) {
+  SalusOptions::ResourceMapDef small;
+  TF_ASSERT_OK(EstimateResourceMap(MatMulGraph(""), 8, &small));
+  SalusOptions::ResourceMapDef large;
+  TF_ASSERT_OK(EstimateResourceMap(MatMulGraph(""), 32, &large));
+
+  EXPECT_EQ(small.persistant().at("MEMORY:GPU0"),
+            large.persistant().at("MEMORY:GPU0"));
+  EXPECT_EQ(4 * small.temporary().at("MEMORY:GPU0"),
+            large.temporary().at("MEMORY:GPU0"));
+}
+
+TEST(ResourceMapEstimatorTest, VariableOnCPU) {
+  SalusOptions::ResourceMapDef resource_map;
+  TF_ASSERT_OK(
+      EstimateResourceMap(MatMulGraph("/device:CPU:0"), 8, &resource_map));
+
+  EXPECT_EQ(64, resource_map.persistant().at("MEMORY:CPU0"));
+  EXPECT_EQ(0, resource_map.temporary().at("MEMORY:CPU0"));
+  EXPECT_EQ(0, resource_map.persistant().at("MEMORY:GPU0"));
+  // The copy of v is temporary on the GPU.
+  EXPECT_EQ(384 + 64, resource_map.temporary().at("MEMORY:GPU0"));
+  EXPECT_EQ(4, resource_map.alloc_count());
+}
+
+}  // namespace
+}  // namespace grappler
+}  // namespace tensorflow
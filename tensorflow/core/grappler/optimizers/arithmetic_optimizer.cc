@@ -30,6 +30,7 @@ limitations under the License.
 #include "tensorflow/core/grappler/grappler_item.h"
 #include "tensorflow/core/grappler/op_types.h"
 #include "tensorflow/core/grappler/optimizers/constant_folding.h"
+#include "tensorflow/core/grappler/optimizers/shared_graph_analysis.h"
 #include "tensorflow/core/grappler/utils.h"
 #include "tensorflow/core/grappler/utils/frame.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -1111,8 +1112,9 @@ Status ArithmeticOptimizer::Optimize(Cluster* /*cluster*/,
                                                &frame_map_, &num_frames));
   // Shapes are only needed in aggressive mode.
   if (opt_level_ == RewriterConfig::AGGRESSIVE) {
-    graph_properties_.reset(new GraphProperties(item));
-    TF_RETURN_IF_ERROR(graph_properties_->InferStatically(false));
+    TF_RETURN_IF_ERROR(GetGraphProperties(shared_analysis_, item, false,
+                                          &owned_graph_properties_,
+                                          &graph_properties_));
     TF_RETURN_IF_ERROR(
         graph_properties_->AnnotateOutputShapes(optimized_graph_));
   }
@@ -96,7 +96,8 @@ class ArithmeticOptimizer : public GraphOptimizer {
   std::unordered_set<string> nodes_to_preserve_;
   std::unique_ptr<NodeMap> node_map_;
   FrameMap frame_map_;
-  std::unique_ptr<GraphProperties> graph_properties_;
+  std::unique_ptr<GraphProperties> owned_graph_properties_;
+  const GraphProperties* graph_properties_ = nullptr;
   GraphDef* optimized_graph_;  // Not owned.
 };
 
@@ -30,6 +30,7 @@ limitations under the License.
 #include "tensorflow/core/grappler/costs/graph_properties.h"
 #include "tensorflow/core/grappler/grappler_item.h"
 #include "tensorflow/core/grappler/op_types.h"
+#include "tensorflow/core/grappler/optimizers/shared_graph_analysis.h"
 #include "tensorflow/core/grappler/utils.h"
 #include "tensorflow/core/lib/gtl/cleanup.h"
 #include "tensorflow/core/lib/gtl/inlined_vector.h"
@@ -1536,6 +1537,7 @@ Status ConstantFolding::SimplifyGraph(GraphDef* output,
 
 Status ConstantFolding::RunOptimizationPass(Cluster* cluster,
                                             const GrapplerItem& item,
+                                            SharedGraphAnalysis* analysis,
                                             GraphDef* output) {
   node_map_.reset(new NodeMap(graph_));
   nodes_whitelist_.clear();
@@ -1553,22 +1555,24 @@ Status ConstantFolding::RunOptimizationPass(Cluster* cluster,
     }
   }
 
-  GraphProperties properties(item);
+  std::unique_ptr<GraphProperties> owned_properties;
+  const GraphProperties* properties;
   // It's possible to feed a placeholder with a tensor of any shape: make sure
   // that the shape inference deals with this conservatively unless we're in
   // aggressive mode.
   const bool assume_valid_feeds = opt_level_ == RewriterConfig::AGGRESSIVE;
-  Status s = properties.InferStatically(assume_valid_feeds);
+  Status s = GetGraphProperties(analysis, item, assume_valid_feeds,
+                                &owned_properties, &properties);
   const bool can_use_shape_info = s.ok();
 
   if (can_use_shape_info) {
-    TF_RETURN_IF_ERROR(MaterializeShapes(properties));
-    TF_RETURN_IF_ERROR(MaterializeConstants(properties));
+    TF_RETURN_IF_ERROR(MaterializeShapes(*properties));
+    TF_RETURN_IF_ERROR(MaterializeConstants(*properties));
   }
 
   TF_RETURN_IF_ERROR(FoldGraph(output));
   node_map_.reset(new NodeMap(output));
-  TF_RETURN_IF_ERROR(SimplifyGraph(output, properties, can_use_shape_info));
+  TF_RETURN_IF_ERROR(SimplifyGraph(output, *properties, can_use_shape_info));
   return Status::OK();
 }
 
@@ -1589,13 +1593,17 @@ Status ConstantFolding::Optimize(Cluster* cluster, const GrapplerItem& item,
   GrapplerItem item_to_optimize = item;
   *output = item.graph;
   int64 node_count;
+  // Only the first iteration works on the graph the shared analysis is for.
+  SharedGraphAnalysis* analysis = shared_analysis_;
   do {
     graph_modified_ = false;
     item_to_optimize.graph.Swap(output);
     graph_ = &item_to_optimize.graph;
     *output = GraphDef();
     node_count = graph_->node_size();
-    TF_RETURN_IF_ERROR(RunOptimizationPass(cluster, item_to_optimize, output));
+    TF_RETURN_IF_ERROR(
+        RunOptimizationPass(cluster, item_to_optimize, analysis, output));
+    analysis = nullptr;
   } while (graph_modified_ || output->node_size() != node_count);
   *output->mutable_library() = item.graph.library();
   *output->mutable_versions() = item.graph.versions();
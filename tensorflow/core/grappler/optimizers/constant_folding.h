@@ -91,8 +91,9 @@ class ConstantFolding : public GraphOptimizer {
   Status SimplifyGraph(GraphDef* output, const GraphProperties& properties,
                        bool use_shape_info);
 
+  // analysis, if not null, describes item.graph.
   Status RunOptimizationPass(Cluster* cluster, const GrapplerItem& item,
-                             GraphDef* output);
+                             SharedGraphAnalysis* analysis, GraphDef* output);
 
   // Points to an externally provided device or to owned_device_;
   RewriterConfig::Toggle opt_level_;
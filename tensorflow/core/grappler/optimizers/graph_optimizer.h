@@ -24,6 +24,7 @@ namespace grappler {
 
 class Cluster;
 struct GrapplerItem;
+class SharedGraphAnalysis;
 
 // An abstract interface for an algorithm for generating a candidate
 // optimization of a GrapplerItem for running on a cluster.
@@ -45,6 +46,15 @@ class GraphOptimizer {
   // call to Optimize) performed.  Lower "result" scores are better.
   virtual void Feedback(Cluster* cluster, const GrapplerItem& item,
                         const GraphDef& optimized_graph, double result) = 0;
+
+  // Analyses of the graph of the item passed to Optimize(), shared with the
+  // other optimizers run on the same graph. Not owned, may be null.
+  void set_shared_analysis(SharedGraphAnalysis* analysis) {
+    shared_analysis_ = analysis;
+  }
+
+ protected:
+  SharedGraphAnalysis* shared_analysis_ = nullptr;
 };
 
 }  // end namespace grappler
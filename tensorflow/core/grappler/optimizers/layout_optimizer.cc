@@ -25,6 +25,7 @@ limitations under the License.
 #include "tensorflow/core/grappler/grappler_item.h"
 #include "tensorflow/core/grappler/op_types.h"
 #include "tensorflow/core/grappler/optimizers/layout_optimizer.h"
+#include "tensorflow/core/grappler/optimizers/shared_graph_analysis.h"
 #include "tensorflow/core/grappler/utils.h"
 #include "tensorflow/core/grappler/utils/frame.h"
 #include "tensorflow/core/lib/strings/numbers.h"
@@ -1575,8 +1576,10 @@ Status LayoutOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
 
   virtual_placer_.reset(new VirtualPlacer(cluster));
   nodes_to_preserve_ = item.NodesToPreserve();
-  GraphProperties graph_properties(item);
-  auto status = graph_properties.InferStatically(false);
+  std::unique_ptr<GraphProperties> owned_properties;
+  const GraphProperties* graph_properties;
+  auto status = GetGraphProperties(shared_analysis_, item, false,
+                                   &owned_properties, &graph_properties);
   if (!status.ok()) {
     *output = item.graph;
     return status;
@@ -1586,7 +1589,7 @@ Status LayoutOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
   config.no_gemm = true;
   // TODO(yaozhang): Enable tuning with various TuningConfig choices wtih
   // the measurement-based estimator.
-  status = Tune(item, graph_properties, config, output);
+  status = Tune(item, *graph_properties, config, output);
   if (!status.ok()) {
     *output = item.graph;
   }
@@ -30,6 +30,7 @@ limitations under the License.
 #include "tensorflow/core/grappler/grappler_item.h"
 #include "tensorflow/core/grappler/op_types.h"
 #include "tensorflow/core/grappler/optimizers/graph_rewriter.h"
+#include "tensorflow/core/grappler/optimizers/shared_graph_analysis.h"
 #include "tensorflow/core/grappler/optimizers/static_schedule.h"
 #include "tensorflow/core/grappler/utils.h"
 #include "tensorflow/core/grappler/utils/topological_sort.h"
@@ -481,6 +482,7 @@ void RecomputationRewritingPass(RewriterConfig::MemOptType optimization_level,
 }
 
 std::pair<NodeDef*, NodeDef*> BuildSwapPair(NodeDef* node, int input_to_swap,
+                                            DataType input_type,
                                             GraphDef* graph) {
   string tensor_to_swap = strings::StrCat(node->name(), "_", input_to_swap);
 
@@ -501,7 +503,6 @@ std::pair<NodeDef*, NodeDef*> BuildSwapPair(NodeDef* node, int input_to_swap,
   (*swap_in_node->mutable_attr())["_class"].mutable_list()->add_s(coloc_group);
   (*node->mutable_attr())["_class"].mutable_list()->add_s(coloc_group);
 
-  const DataType input_type = node->attr().at("T").type();
   (*swap_in_node->mutable_attr())["T"].set_type(input_type);
   (*swap_out_node->mutable_attr())["T"].set_type(input_type);
   return std::make_pair(swap_out_node, swap_in_node);
@@ -528,6 +529,7 @@ static int64 EstimateSize(const OpInfo::TensorProperties& t) {
 
 struct SwapInfo {
   std::vector<int> inputs_to_swap;
+  std::vector<DataType> input_types;
   Costs::NanoSeconds time_to_swap = 0;
 };
 
@@ -605,8 +607,23 @@ static const NodeDef* FindSwapTrigger(
   return nullptr;
 }
 
+// A tensor that can be swapped out to the host while it isn't used.
+struct SwapCandidate {
+  // The last consumer of the tensor, which reads the copy swapped back in.
+  GraphView::InputPort fanout;
+  int64 bytes;
+  // Time between the previous use of the tensor and the moment the last
+  // consumer could start.
+  Costs::NanoSeconds idle_time;
+};
+
+// Marks tensors live at the peak memory usage of devices over their budget
+// with _swap_to_host, until enough memory is saved. Candidates must be idle
+// long enough to be swapped out and back in without delaying their last
+// consumer. The largest are picked first, so that few swaps are needed.
 static void IdentifySwappingCandidates(Cluster* cluster,
                                        const GrapplerItem& item,
+                                       int64 device_memory_budget,
                                        GraphDef* optimized_graph) {
   GraphMemory memory(item);
   const std::unordered_map<string, DeviceProperties>& devices =
@@ -615,52 +632,117 @@ static void IdentifySwappingCandidates(Cluster* cluster,
     return;
   }
 
+  std::unordered_map<const NodeDef*, Costs::NanoSeconds> execution_times;
+  if (!EstimateEarliestExecutionTimes(item, cluster, &execution_times).ok()) {
+    return;
+  }
+  // The optimized graph has its own copy of the nodes.
+  std::unordered_map<string, Costs::NanoSeconds> completion_times;
+  for (const auto& execution_time : execution_times) {
+    completion_times[execution_time.first->name()] = execution_time.second;
+  }
+
+  GraphView graph(optimized_graph);
   for (const auto& device : devices) {
     const string& name = device.first;
     const DeviceProperties& prop = device.second;
     if (prop.type() != "GPU") {
       continue;
     }
-    if (prop.memory_size() <= 0) {
+    const int64 budget =
+        device_memory_budget > 0 ? device_memory_budget : prop.memory_size();
+    if (budget <= 0) {
       continue;
     }
     const GraphMemory::MemoryUsage& mem_usage = memory.GetPeakMemoryUsage(name);
-    if (mem_usage.used_memory <= prop.memory_size()) {
+    if (mem_usage.used_memory <= budget) {
       continue;
     }
-    int64 required_savings = mem_usage.used_memory - prop.memory_size();
-    // TODO(bsteiner): sort the tensors by how long they're live.
+    int64 required_savings = mem_usage.used_memory - budget;
 
-    std::unordered_map<const NodeDef*, Costs::NanoSeconds> execution_times;
-    if (!EstimateEarliestExecutionTimes(item, cluster, &execution_times).ok()) {
-      return;
-    }
-    GraphView graph(optimized_graph);
+    std::vector<SwapCandidate> candidates;
     for (const auto& live_tensor : mem_usage.live_tensors) {
-      if (live_tensor.deallocation_time - live_tensor.allocation_time <=
-          Costs::Duration(1e6)) {
-        // Not enough time to swap.
-        continue;
-      }
       if (live_tensor.memory_used <= 1024) {
         // Don't bother with small tensors.
         continue;
       }
-      Costs::NanoSeconds execution_time(-1);
-      GraphView::InputPort fanout_to_swap;
+      const NodeDef* producer = graph.GetNode(live_tensor.node);
+      if (!producer || IsVariable(*producer)) {
+        // Variables stay in memory anyway.
+        continue;
+      }
+      auto produced = completion_times.find(producer->name());
+      if (produced == completion_times.end()) {
+        continue;
+      }
+
+      Costs::NanoSeconds last_use = produced->second;
+      Costs::NanoSeconds previous_use = produced->second;
+      GraphView::InputPort last_fanout;
       GraphView::OutputPort port =
           graph.GetOutputPort(live_tensor.node, live_tensor.output_id);
-      for (GraphView::InputPort input : graph.GetFanout(port)) {
-        auto it = execution_times.find(input.node);
-        if (it != execution_times.end()) {
-          if (it->second > execution_time) {
-            fanout_to_swap = input;
-            execution_time = it->second;
-          }
+      for (const GraphView::InputPort& fanout : graph.GetFanout(port)) {
+        auto used = completion_times.find(fanout.node->name());
+        if (used == completion_times.end()) {
+          last_fanout.node = nullptr;
+          break;
         }
+        const bool later =
+            used->second > last_use ||
+            (used->second == last_use && last_fanout.node &&
+             fanout.node->name() > last_fanout.node->name());
+        if (later) {
+          previous_use = std::max(previous_use, last_use);
+          last_use = used->second;
+          last_fanout = fanout;
+        } else {
+          previous_use = std::max(previous_use, used->second);
+        }
+      }
+      if (!last_fanout.node || IsNextIteration(*last_fanout.node) ||
+          IsSwitch(*last_fanout.node) || IsMerge(*last_fanout.node)) {
+        continue;
       }
+
+      // The last consumer can't start before its other inputs are ready.
+      Costs::NanoSeconds ready_time = previous_use;
+      for (const string& input : last_fanout.node->input()) {
+        const string input_name = NodeName(input);
+        auto ready = completion_times.find(input_name);
+        if (ready != completion_times.end() &&
+            input_name != producer->name()) {
+          ready_time = std::max(ready_time, ready->second);
+        }
+      }
+      // Let's assume we're going to swap over PCIe running at 16 GBps, both
+      // ways.
+      const Costs::NanoSeconds time_to_swap(2 * live_tensor.memory_used / 16);
+      const Costs::NanoSeconds idle_time = ready_time - previous_use;
+      if (idle_time <= time_to_swap) {
+        continue;
+      }
+      candidates.push_back(
+          SwapCandidate{last_fanout, live_tensor.memory_used, idle_time});
+    }
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const SwapCandidate& a, const SwapCandidate& b) {
+                if (a.bytes != b.bytes) {
+                  return a.bytes > b.bytes;
+                }
+                if (a.idle_time != b.idle_time) {
+                  return a.idle_time > b.idle_time;
+                }
+                if (a.fanout.node != b.fanout.node) {
+                  return a.fanout.node->name() < b.fanout.node->name();
+                }
+                return a.fanout.port_id < b.fanout.port_id;
+              });
+
+    for (const SwapCandidate& candidate : candidates) {
       // Annotate the fanout to request the tensor to be swapped if it's not
       // already been done.
+      const GraphView::InputPort& fanout_to_swap = candidate.fanout;
       AttrValue& val = (*fanout_to_swap.node->mutable_attr())["_swap_to_host"];
       bool found = false;
       for (int port_id : val.list().i()) {
@@ -670,9 +752,12 @@ static void IdentifySwappingCandidates(Cluster* cluster,
         }
       }
       if (!found) {
+        VLOG(1) << "Swapping input " << fanout_to_swap.port_id << " of "
+                << fanout_to_swap.node->name() << " (" << candidate.bytes
+                << " bytes) to the host";
         val.mutable_list()->add_i(fanout_to_swap.port_id);
-        required_savings -= live_tensor.memory_used;
-        if (required_savings < 0) {
+        required_savings -= candidate.bytes;
+        if (required_savings <= 0) {
           break;
         }
       }
@@ -688,8 +773,10 @@ Status MemoryOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
                              recomputation_targets_name_prefix_,
                              optimized_graph, item);
 
-  if (optimization_level_ == RewriterConfig::SWAPPING_HEURISTICS) {
-    IdentifySwappingCandidates(cluster, item, optimized_graph);
+  if (optimization_level_ == RewriterConfig::SWAPPING_HEURISTICS ||
+      optimization_level_ == RewriterConfig::HEURISTICS) {
+    IdentifySwappingCandidates(cluster, item, device_memory_budget_,
+                               optimized_graph);
   }
 
   // Figure out what needs to be swapped;
@@ -715,17 +802,24 @@ Status MemoryOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
 
   {
     // Estimate the size of the data to swap for each node.
-    GraphProperties properties(item);
-    TF_RETURN_IF_ERROR(properties.InferStatically(true));
+    std::unique_ptr<GraphProperties> owned_properties;
+    const GraphProperties* properties;
+    TF_RETURN_IF_ERROR(GetGraphProperties(shared_analysis_, item, true,
+                                          &owned_properties, &properties));
     for (auto& swap : nodes_to_swap) {
       const NodeDef* node = swap.first;
       std::vector<OpInfo::TensorProperties> props =
-          properties.GetInputProperties(node->name());
+          properties->GetInputProperties(node->name());
       SwapInfo& swap_info = swap.second;
       int64 bytes_to_swap = 0;
       for (int64 input_id : swap_info.inputs_to_swap) {
+        if (input_id < 0 || input_id >= static_cast<int64>(props.size())) {
+          return errors::InvalidArgument("Can't swap input ", input_id,
+                                         " of node ", node->name());
+        }
         const OpInfo::TensorProperties& t = props[input_id];
         bytes_to_swap += EstimateSize(t);
+        swap_info.input_types.push_back(t.dtype());
       }
       // Let's assume we're going to swap over PCIe running at 16 GBps.
       swap_info.time_to_swap = bytes_to_swap / 16;
@@ -754,9 +848,10 @@ Status MemoryOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
       continue;
     }
     // Swap all the tensors that are marked with the 'swap_to_host' attribute.
-    for (int input_id : swap_info.inputs_to_swap) {
-      std::pair<NodeDef*, NodeDef*> swap_nodes =
-          BuildSwapPair(node, input_id, optimized_graph);
+    for (int i = 0; i < swap_info.inputs_to_swap.size(); ++i) {
+      const int input_id = swap_info.inputs_to_swap[i];
+      std::pair<NodeDef*, NodeDef*> swap_nodes = BuildSwapPair(
+          node, input_id, swap_info.input_types[i], optimized_graph);
       *swap_nodes.first->add_input() = node->input(input_id);
       *node->mutable_input(input_id) = swap_nodes.second->name();
 
@@ -30,11 +30,16 @@ class MemoryOptimizer : public GraphOptimizer {
   // recomputation_targets_name_prefix: Name prefix for potential outputs of
   //   recomputations. See
   //   RewriterConfig::memory_optimizer_target_node_name_prefix.
+  // device_memory_budget: Bytes each GPU may use before the swapping
+  //   heuristics move tensors to the host. 0 means the memory size of the
+  //   device. See RewriterConfig::memory_optimizer_device_budget_bytes.
   explicit MemoryOptimizer(
       RewriterConfig::MemOptType optimization_level,
-      const string& recomputation_targets_name_prefix = "gradients/")
+      const string& recomputation_targets_name_prefix = "gradients/",
+      int64 device_memory_budget = 0)
       : optimization_level_(optimization_level),
-        recomputation_targets_name_prefix_(recomputation_targets_name_prefix) {}
+        recomputation_targets_name_prefix_(recomputation_targets_name_prefix),
+        device_memory_budget_(device_memory_budget) {}
   ~MemoryOptimizer() override {}
 
   string name() const override { return "memory_optimizer"; };
@@ -48,6 +53,7 @@ class MemoryOptimizer : public GraphOptimizer {
  private:
   RewriterConfig::MemOptType optimization_level_;
   string recomputation_targets_name_prefix_;
+  int64 device_memory_budget_;
 };
 
 }  // end namespace grappler
@@ -205,6 +205,26 @@ class MemoryOptimizerTest : public ::testing::Test {
     devices["/job:localhost/replica:0/task:0/cpu:0"] = cpu_device;
     return std::unique_ptr<VirtualCluster>(new VirtualCluster(devices));
   }
+
+  static std::unique_ptr<VirtualCluster> CreateVirtualClusterWithGpu(
+      int64 gpu_memory_size) {
+    DeviceProperties cpu_device;
+    cpu_device.set_type("CPU");
+    cpu_device.set_frequency(1000);
+    cpu_device.set_num_cores(4);
+    cpu_device.set_bandwidth(32);
+    DeviceProperties gpu_device;
+    gpu_device.set_type("GPU");
+    gpu_device.set_frequency(1000);
+    gpu_device.set_num_cores(24);
+    gpu_device.set_bandwidth(128);
+    gpu_device.set_memory_size(gpu_memory_size);
+    (*gpu_device.mutable_environment())["architecture"] = "6";
+    std::unordered_map<string, DeviceProperties> devices;
+    devices["/job:localhost/replica:0/task:0/cpu:0"] = cpu_device;
+    devices["/job:localhost/replica:0/task:0/gpu:0"] = gpu_device;
+    return std::unique_ptr<VirtualCluster>(new VirtualCluster(devices));
+  }
 };
 
 TEST_F(MemoryOptimizerTest, SimpleSwapping) {
@@ -252,6 +272,57 @@ TEST_F(MemoryOptimizerTest, SimpleSwapping) {
   EXPECT_EQ("^c", swap_in.input(1));
 }
 
+TEST_F(MemoryOptimizerTest, SwappingHeuristics) {
+  // b is idle on the gpu while c, d and e are computed, and is the only
+  // tensor large enough to be worth swapping.
+  tensorflow::Scope s = tensorflow::Scope::NewRootScope().WithDevice(
+      "/job:localhost/replica:0/task:0/gpu:0");
+
+  Output a = ops::Variable(s.WithOpName("a"), {128, 128}, DT_FLOAT);
+  Output b = ops::MatMul(s.WithOpName("b"), a, a);
+  Output c = ops::MatMul(s.WithOpName("c"), b, a);
+  Output d = ops::MatMul(s.WithOpName("d"), c, a);
+  Output e = ops::MatMul(s.WithOpName("e"), d, a);
+  Output f = ops::AddN(s.WithOpName("f"), {b, e});
+
+  GrapplerItem item;
+  TF_CHECK_OK(s.ToGraphDef(&item.graph));
+  item.fetch = {"f"};
+
+  std::unique_ptr<VirtualCluster> cluster(
+      CreateVirtualClusterWithGpu(1024 * 1024));
+  TF_CHECK_OK(cluster->Provision());
+
+  // Plenty of memory, nothing to swap.
+  {
+    MemoryOptimizer optimizer(RewriterConfig::SWAPPING_HEURISTICS);
+    GraphDef output;
+    TF_EXPECT_OK(optimizer.Optimize(cluster.get(), item, &output));
+    EXPECT_EQ(6, output.node_size());
+  }
+
+  // Only room for about two of the 64KB matrices.
+  MemoryOptimizer optimizer(RewriterConfig::SWAPPING_HEURISTICS, "gradients/",
+                            128 * 1024);
+  GraphDef output;
+  TF_EXPECT_OK(optimizer.Optimize(cluster.get(), item, &output));
+
+  EXPECT_EQ(8, output.node_size());
+  const NodeDef& new_f = output.node(5);
+  EXPECT_EQ("f", new_f.name());
+  EXPECT_EQ("swap_in_f_0", new_f.input(0));
+  EXPECT_EQ("e", new_f.input(1));
+
+  const NodeDef& swap_out = output.node(6);
+  EXPECT_EQ("swap_out_f_0", swap_out.name());
+  EXPECT_EQ("b", swap_out.input(0));
+
+  const NodeDef& swap_in = output.node(7);
+  EXPECT_EQ("swap_in_f_0", swap_in.name());
+  EXPECT_EQ("swap_out_f_0", swap_in.input(0));
+  EXPECT_EQ("^d", swap_in.input(1));
+}
+
 }  // namespace
 }  // namespace grappler
 }  // namespace tensorflow
@@ -14,6 +14,12 @@ limitations under the License.
 ==============================================================================*/
 
 #include "tensorflow/core/grappler/optimizers/meta_optimizer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "tensorflow/core/framework/function.pb.h"
 #include "tensorflow/core/framework/versions.pb.h"
 #include "tensorflow/core/grappler/optimizers/arithmetic_optimizer.h"
@@ -24,14 +30,231 @@ limitations under the License.
 #include "tensorflow/core/grappler/optimizers/layout_optimizer.h"
 #include "tensorflow/core/grappler/optimizers/memory_optimizer.h"
 #include "tensorflow/core/grappler/optimizers/model_pruner.h"
+#include "tensorflow/core/grappler/optimizers/shared_graph_analysis.h"
+#include "tensorflow/core/grappler/utils.h"
 #include "tensorflow/core/grappler/utils/topological_sort.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/util/equal_graph_def.h"
 
 namespace tensorflow {
 namespace grappler {
 
+namespace {
+
+// Optimizers which neither use the cluster nor look beyond the connected
+// component of the nodes they rewrite, so disconnected subgraphs can be
+// optimized separately and concurrently. The arithmetic optimizer is not one
+// of them: it dedups identical nodes across the whole graph.
+bool IsComponentLocal(const GraphOptimizer& optimizer) {
+  static const std::set<string>* const kComponentLocal = new std::set<string>(
+      {"model_pruner", "constant folding", "dependency_optimizer"});
+  return kComponentLocal->count(optimizer.name()) > 0;
+}
+
+int FindRoot(std::vector<int>* parents, int node) {
+  while ((*parents)[node] != node) {
+    (*parents)[node] = (*parents)[(*parents)[node]];
+    node = (*parents)[node];
+  }
+  return node;
+}
+
+void Union(std::vector<int>* parents, int a, int b) {
+  a = FindRoot(parents, a);
+  b = FindRoot(parents, b);
+  if (a != b) {
+    (*parents)[std::max(a, b)] = std::min(a, b);
+  }
+}
+
+// Splits the nodes of item.graph into at most max_groups groups of weakly
+// connected components of similar sizes. Returns no group if the graph is
+// connected, or can't be split without changing what the optimizers do with
+// it: all the nodes to preserve must exist, and every group gets some so
+// that the model pruner still removes the components which don't lead to any
+// of them.
+std::vector<std::vector<int>> GroupComponents(const GrapplerItem& item,
+                                              int max_groups) {
+  const GraphDef& graph = item.graph;
+  std::unordered_map<string, int> indices;
+  indices.reserve(graph.node_size());
+  for (int i = 0; i < graph.node_size(); ++i) {
+    indices.emplace(graph.node(i).name(), i);
+  }
+  auto find_node = [&indices](const string& name) {
+    auto it = indices.find(NodeName(name));
+    return it == indices.end() ? -1 : it->second;
+  };
+
+  std::vector<int> parents(graph.node_size());
+  std::iota(parents.begin(), parents.end(), 0);
+  for (int i = 0; i < graph.node_size(); ++i) {
+    for (const string& input : graph.node(i).input()) {
+      const int j = find_node(input);
+      if (j < 0) {
+        return {};
+      }
+      Union(&parents, i, j);
+    }
+  }
+  // A queue runner goes to a single group.
+  for (const auto& queue_runner : item.queue_runners) {
+    std::vector<string> ops(queue_runner.enqueue_op_name().begin(),
+                            queue_runner.enqueue_op_name().end());
+    ops.push_back(queue_runner.close_op_name());
+    ops.push_back(queue_runner.cancel_op_name());
+    int first = -1;
+    for (const string& op : ops) {
+      const int j = op.empty() ? -1 : find_node(op);
+      if (j >= 0 && first >= 0) {
+        Union(&parents, first, j);
+      } else if (j >= 0) {
+        first = j;
+      }
+    }
+  }
+
+  std::vector<char> preserved(graph.node_size(), false);
+  for (const string& name : item.NodesToPreserve()) {
+    const int j = find_node(name);
+    if (j < 0) {
+      return {};
+    }
+    preserved[j] = true;
+  }
+  const bool has_preserved =
+      std::find(preserved.begin(), preserved.end(), true) != preserved.end();
+
+  std::unordered_map<int, std::vector<int>> components;
+  for (int i = 0; i < graph.node_size(); ++i) {
+    components[FindRoot(&parents, i)].push_back(i);
+  }
+  std::vector<std::vector<int>> kept;
+  std::vector<std::vector<int>> others;
+  for (auto& component : components) {
+    const auto& nodes = component.second;
+    const bool keep =
+        !has_preserved ||
+        std::any_of(nodes.begin(), nodes.end(),
+                    [&preserved](int node) { return preserved[node]; });
+    (keep ? kept : others).push_back(std::move(component.second));
+  }
+  if (kept.size() < 2) {
+    return {};
+  }
+
+  // Largest first, each to the smallest group so far.
+  auto by_size = [](const std::vector<int>& a, const std::vector<int>& b) {
+    return a.size() != b.size() ? a.size() > b.size() : a[0] < b[0];
+  };
+  std::sort(kept.begin(), kept.end(), by_size);
+  std::sort(others.begin(), others.end(), by_size);
+  std::vector<std::vector<int>> groups(
+      std::min<size_t>(max_groups, kept.size()));
+  auto assign = [&groups](const std::vector<int>& component) {
+    auto smallest = std::min_element(
+        groups.begin(), groups.end(),
+        [](const std::vector<int>& a, const std::vector<int>& b) {
+          return a.size() < b.size();
+        });
+    smallest->insert(smallest->end(), component.begin(), component.end());
+  };
+  for (const auto& component : kept) {
+    assign(component);
+  }
+  for (const auto& component : others) {
+    assign(component);
+  }
+  for (auto& group : groups) {
+    // Keep the original order of the nodes.
+    std::sort(group.begin(), group.end());
+  }
+  return groups;
+}
+
+// The item made of the given nodes of item.graph, with the feeds, fetches and
+// other nodes to preserve which are among them.
+GrapplerItem GroupItem(const GrapplerItem& item, const std::vector<int>& group) {
+  GrapplerItem result;
+  result.id = item.id;
+  std::unordered_set<string> names;
+  for (int i : group) {
+    *result.graph.add_node() = item.graph.node(i);
+    names.insert(item.graph.node(i).name());
+  }
+  *result.graph.mutable_library() = item.graph.library();
+  *result.graph.mutable_versions() = item.graph.versions();
+
+  auto in_group = [&names](const string& name) {
+    return !name.empty() && names.count(NodeName(name)) > 0;
+  };
+  for (const auto& feed : item.feed) {
+    if (in_group(feed.first)) {
+      result.feed.push_back(feed);
+    }
+  }
+  for (const string& fetch : item.fetch) {
+    if (in_group(fetch)) {
+      result.fetch.push_back(fetch);
+    }
+  }
+  for (const string& init_op : item.init_ops) {
+    if (in_group(init_op)) {
+      result.init_ops.push_back(init_op);
+    }
+  }
+  result.expected_init_time = item.expected_init_time;
+  if (in_group(item.save_op)) {
+    result.save_op = item.save_op;
+  }
+  if (in_group(item.restore_op)) {
+    result.restore_op = item.restore_op;
+  }
+  if (in_group(item.save_restore_loc_tensor)) {
+    result.save_restore_loc_tensor = item.save_restore_loc_tensor;
+  }
+  for (const auto& queue_runner : item.queue_runners) {
+    if (queue_runner.enqueue_op_name_size() > 0 &&
+        in_group(queue_runner.enqueue_op_name(0))) {
+      result.queue_runners.push_back(queue_runner);
+    }
+  }
+  return result;
+}
+
+string ResultString(const MetaOptimizer::PassResult& result) {
+  if (!result.status.ok()) {
+    return result.status.ToString();
+  }
+  const int64 delta = result.nodes_after - result.nodes_before;
+  return strings::StrCat(
+      "OK. Graph size before: ", result.nodes_before,
+      ". Graph size after: ", result.nodes_after, " (", delta > 0 ? "+" : "",
+      delta, "). Time: ",
+      strings::HumanReadableElapsedTime(result.time_us / 1e6),
+      ". Shapes inferred: ", result.shapes_inferred,
+      ", reused: ", result.shapes_reused);
+}
+
+// Whether an optimizer changed the graph, including attributes such as the
+// annotated output shapes.
+bool GraphChanged(const GraphDef& before, const GraphDef& after) {
+  if (before.node_size() != after.node_size()) {
+    return true;
+  }
+  EqualGraphDefOptions options;
+  options.ignore_internal_attrs = false;
+  return !EqualGraphDef(after, before, nullptr, options);
+}
+
+}  // namespace
+
 std::unique_ptr<GraphOptimizer> MetaOptimizer::NewOptimizer(
-    const string& optimizer) {
+    const string& optimizer) const {
   VLOG(1) << "Adding graph optimization pass: " << optimizer;
   std::unique_ptr<GraphOptimizer> graph_optimizer;
   if (optimizer == "pruning") {
@@ -61,8 +284,8 @@ std::unique_ptr<GraphOptimizer> MetaOptimizer::NewOptimizer(
   return graph_optimizer;
 }
 
-Status MetaOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
-                               GraphDef* optimized_graph) {
+std::vector<std::unique_ptr<GraphOptimizer>>
+MetaOptimizer::InitializeOptimizers() const {
   std::vector<std::unique_ptr<GraphOptimizer>> optimizers;
   if (cfg_.optimizers().empty()) {
     if (!cfg_.disable_model_pruning()) {
@@ -88,12 +311,14 @@ Status MetaOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
       if (cfg_.memory_optimizer_target_node_name_prefix().empty()) {
         optimizers.push_back(std::unique_ptr<GraphOptimizer>(
             // Use the default target node name prefix "gradients/"
-            new MemoryOptimizer(cfg_.memory_optimization())));
+            new MemoryOptimizer(cfg_.memory_optimization(), "gradients/",
+                                cfg_.memory_optimizer_device_budget_bytes())));
       } else {
         optimizers.push_back(
             std::unique_ptr<GraphOptimizer>(new MemoryOptimizer(
                 cfg_.memory_optimization(),
-                cfg_.memory_optimizer_target_node_name_prefix())));
+                cfg_.memory_optimizer_target_node_name_prefix(),
+                cfg_.memory_optimizer_device_budget_bytes())));
       }
     }
     if (cfg_.auto_parallel().enable()) {
@@ -110,53 +335,170 @@ Status MetaOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
       }
     }
   }
+  return optimizers;
+}
+
+bool MetaOptimizer::RunOptimizers(
+    Cluster* cluster, const GrapplerItem& item,
+    const std::vector<std::unique_ptr<GraphOptimizer>>& optimizers,
+    GraphDef* optimized_graph, std::vector<PassResult>* results) const {
+  SharedGraphAnalysis analysis;
+  // Holds the graph optimized so far, once an optimizer succeeded.
+  std::unique_ptr<GrapplerItem> optimized_item;
+  for (const auto& optimizer : optimizers) {
+    const GrapplerItem& input = optimized_item ? *optimized_item : item;
+    PassResult result;
+    result.name = optimizer->name();
+    result.nodes_before = input.graph.node_size();
+
+    GraphDef output;
+    optimizer->set_shared_analysis(&analysis);
+    const int inferred_before = analysis.num_inferred();
+    const int reused_before = analysis.num_reused();
+    const uint64 start_us = Env::Default()->NowMicros();
+    result.status = optimizer->Optimize(cluster, input, &output);
+    result.time_us = Env::Default()->NowMicros() - start_us;
+    result.shapes_inferred = analysis.num_inferred() - inferred_before;
+    result.shapes_reused = analysis.num_reused() - reused_before;
+    optimizer->set_shared_analysis(nullptr);
+
+    if (!result.status.ok()) {
+      VLOG(1) << "Not able to apply optimizer " << optimizer->name()
+              << ". Return status: " << result.status.ToString();
+      result.nodes_after = result.nodes_before;
+    } else {
+      result.nodes_after = output.node_size();
+      // Only worth comparing the graphs when there are analyses to keep.
+      if (analysis.HasAnalyses() && GraphChanged(input.graph, output)) {
+        analysis.GraphChanged();
+      }
+      if (optimized_item) {
+        optimized_item->graph.Swap(&output);
+      } else {
+        optimized_item.reset(new GrapplerItem(item, std::move(output)));
+      }
+    }
+    VLOG(1) << "Optimizer " << optimizer->name()
+            << " return status: " << ResultString(result);
+    results->push_back(result);
+  }
+  VLOG(1) << "Inferred shapes " << analysis.num_inferred()
+          << " times, reused them " << analysis.num_reused() << " times";
+
+  if (!optimized_item) {
+    *optimized_graph = item.graph;
+    return false;
+  }
+  optimized_graph->Swap(&optimized_item->graph);
+  return true;
+}
+
+bool MetaOptimizer::RunOptimizersOnGroups(
+    Cluster* cluster, const GrapplerItem& item,
+    const std::vector<std::vector<int>>& groups, size_t num_optimizers,
+    GraphDef* optimized_graph, bool* optimized) {
+  const int num_groups = groups.size();
+  std::vector<GrapplerItem> items;
+  std::vector<std::vector<std::unique_ptr<GraphOptimizer>>> optimizers;
+  for (const auto& group : groups) {
+    items.push_back(GroupItem(item, group));
+    optimizers.push_back(InitializeOptimizers());
+    optimizers.back().resize(num_optimizers);
+  }
+
+  std::vector<GraphDef> outputs(num_groups);
+  std::vector<std::vector<PassResult>> results(num_groups);
+  std::vector<char> group_optimized(num_groups, false);
+  const uint64 start_us = Env::Default()->NowMicros();
+  {
+    thread::ThreadPool pool(
+        Env::Default(), "meta_optimizer",
+        std::min(num_groups, cfg_.meta_optimizer_threads()));
+    for (int i = 0; i < num_groups; ++i) {
+      pool.Schedule([this, cluster, i, &items, &optimizers, &outputs,
+                     &results, &group_optimized]() {
+        group_optimized[i] = RunOptimizers(cluster, items[i], optimizers[i],
+                                           &outputs[i], &results[i]);
+      });
+    }
+  }
+  VLOG(1) << "Optimized " << item.graph.node_size() << " nodes in "
+          << num_groups << " groups of subgraphs in "
+          << strings::HumanReadableElapsedTime(
+                 (Env::Default()->NowMicros() - start_us) / 1e6);
+
+  // Nodes created by different groups may clash.
+  GraphDef merged;
+  std::unordered_set<string> names;
+  for (auto& output : outputs) {
+    for (auto& node : *output.mutable_node()) {
+      if (!names.insert(node.name()).second) {
+        VLOG(1) << "Node " << node.name() << " was created by several groups"
+                << ", optimizing the whole graph at once instead";
+        return false;
+      }
+      merged.add_node()->Swap(&node);
+    }
+  }
+  *merged.mutable_library() = outputs[0].library();
+  *merged.mutable_versions() = outputs[0].versions();
+  optimized_graph->Swap(&merged);
+
+  for (size_t pass = 0; pass < num_optimizers; ++pass) {
+    PassResult result = results[0][pass];
+    for (int i = 1; i < num_groups; ++i) {
+      const PassResult& other = results[i][pass];
+      if (result.status.ok()) {
+        result.status = other.status;
+      }
+      result.nodes_before += other.nodes_before;
+      result.nodes_after += other.nodes_after;
+      result.time_us += other.time_us;
+      result.shapes_inferred += other.shapes_inferred;
+      result.shapes_reused += other.shapes_reused;
+    }
+    result_.push_back(result);
+  }
+  *optimized = std::find(group_optimized.begin(), group_optimized.end(),
+                         true) != group_optimized.end();
+  return true;
+}
+
+Status MetaOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
+                               GraphDef* optimized_graph) {
+  result_.clear();
+  std::vector<std::unique_ptr<GraphOptimizer>> optimizers =
+      InitializeOptimizers();
 
   if (optimizers.empty()) {
     *optimized_graph = item.graph;
     return Status::OK();
   }
 
+  // The leading optimizers may run on disconnected subgraphs concurrently.
+  size_t num_local = 0;
+  while (num_local < optimizers.size() &&
+         IsComponentLocal(*optimizers[num_local])) {
+    ++num_local;
+  }
+  std::vector<std::vector<int>> groups;
+  if (cfg_.meta_optimizer_threads() > 1 && num_local > 0) {
+    groups = GroupComponents(item, cfg_.meta_optimizer_threads());
+  }
+
   bool already_optimized = false;
-  for (const auto& optimizer : optimizers) {
-    if (!already_optimized) {
-      auto status = optimizer->Optimize(cluster, item, optimized_graph);
-      string result;
-      if (!status.ok()) {
-        VLOG(1) << "Not able to apply optimizer " << optimizer->name()
-                << ". Return status: " << status.ToString();
-        result = status.ToString();
-      } else {
-        already_optimized = true;
-        result = strings::StrCat(
-            "OK. "
-            "Graph size before: ",
-            item.graph.node_size(),
-            ". Graph size after: ", optimized_graph->node_size());
-      }
-      result_.push_back(std::make_pair(optimizer->name(), result));
-      VLOG(1) << "Optimizer " << optimizer->name()
-              << " return status: " << result;
-    } else {
+  if (groups.size() > 1 &&
+      RunOptimizersOnGroups(cluster, item, groups, num_local, optimized_graph,
+                            &already_optimized)) {
+    optimizers.erase(optimizers.begin(), optimizers.begin() + num_local);
+    if (!optimizers.empty()) {
       GrapplerItem optimized_item(item, std::move(*optimized_graph));
-      auto status =
-          optimizer->Optimize(cluster, optimized_item, optimized_graph);
-      string result;
-      if (!status.ok()) {
-        VLOG(1) << "Not able to apply optimizer " << optimizer->name()
-                << ". Return status: " << status.ToString();
-        optimized_graph->Swap(&optimized_item.graph);
-        result = status.ToString();
-      } else {
-        result = strings::StrCat(
-            "OK. "
-            "Graph size before: ",
-            optimized_item.graph.node_size(),
-            ". Graph size after: ", optimized_graph->node_size());
-      }
-      result_.push_back(std::make_pair(optimizer->name(), result));
-      VLOG(1) << "Optimizer " << optimizer->name()
-              << " return status: " << result;
+      already_optimized |= RunOptimizers(cluster, optimized_item, optimizers,
+                                         optimized_graph, &result_);
     }
+  } else {
+    already_optimized =
+        RunOptimizers(cluster, item, optimizers, optimized_graph, &result_);
   }
 
   if (already_optimized) {
@@ -177,8 +519,8 @@ Status MetaOptimizer::Optimize(Cluster* cluster, const GrapplerItem& item,
 
 void MetaOptimizer::PrintResult() {
   for (const auto& result : result_) {
-    LOG(INFO) << "Return status of optimizer " << result.first << ": "
-              << result.second;
+    LOG(INFO) << "Return status of optimizer " << result.name << ": "
+              << ResultString(result);
   }
 }
 
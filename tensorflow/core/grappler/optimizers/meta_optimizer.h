@@ -37,16 +37,52 @@ class MetaOptimizer : public GraphOptimizer {
   Status Optimize(Cluster* cluster, const GrapplerItem& item,
                   GraphDef* optimized_graph) override;
 
+  // What one optimizer did to the graph in the last call to Optimize(). If
+  // disconnected subgraphs were optimized concurrently, the sizes and times
+  // are summed over all of them.
+  struct PassResult {
+    string name;
+    Status status;
+    int64 nodes_before;
+    int64 nodes_after;
+    int64 time_us;
+    // Times the pass inferred the shapes of the graph, and reused the shapes
+    // inferred for the same graph by an earlier pass.
+    int shapes_inferred;
+    int shapes_reused;
+  };
+  const std::vector<PassResult>& results() const { return result_; }
+
   void PrintResult();
 
   void Feedback(Cluster* cluster, const GrapplerItem& item,
                 const GraphDef& optimized_graph, double result) override;
 
  private:
-  std::unique_ptr<GraphOptimizer> NewOptimizer(const string& optimizer);
+  std::unique_ptr<GraphOptimizer> NewOptimizer(const string& optimizer) const;
+  // The optimizers to run, in order.
+  std::vector<std::unique_ptr<GraphOptimizer>> InitializeOptimizers() const;
+
+  // Runs the optimizers one after another, sharing the analysis of the graph
+  // between them. Sets *optimized_graph to the result even if all of them
+  // failed, and returns whether any of them succeeded.
+  bool RunOptimizers(Cluster* cluster, const GrapplerItem& item,
+                     const std::vector<std::unique_ptr<GraphOptimizer>>&
+                         optimizers,
+                     GraphDef* optimized_graph,
+                     std::vector<PassResult>* results) const;
+
+  // Runs the first num_optimizers optimizers on each group of nodes of
+  // item.graph concurrently. Returns false without touching optimized_graph
+  // if the results can't be merged back.
+  bool RunOptimizersOnGroups(Cluster* cluster, const GrapplerItem& item,
+                             const std::vector<std::vector<int>>& groups,
+                             size_t num_optimizers, GraphDef* optimized_graph,
+                             bool* optimized);
+
   DeviceBase* const cpu_device_;  // may be NULL
   RewriterConfig cfg_;
-  std::vector<std::pair<string, string>> result_;
+  std::vector<PassResult> result_;
 };
 
 bool MetaOptimizerEnabled(const RewriterConfig& cfg);
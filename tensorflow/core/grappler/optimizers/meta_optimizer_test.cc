@@ -0,0 +1,211 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/grappler/optimizers/meta_optimizer.h"
+
+#include <set>
+
+#include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/core/framework/node_def.pb.h"
+#include "tensorflow/core/grappler/grappler_item.h"
+#include "tensorflow/core/grappler/utils.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace grappler {
+namespace {
+
+class MetaOptimizerTest : public ::testing::Test {
+ protected:
+  // Two fetched subgraphs and an unused one.
+  static GrapplerItem DisconnectedItem() {
+    tensorflow::Scope s = tensorflow::Scope::NewRootScope();
+    Output x = ops::Placeholder(s.WithOpName("x"), DT_FLOAT,
+                                ops::Placeholder::Shape({2}));
+    Output a = ops::Const(s.WithOpName("a"), {1.0f, 2.0f}, {2});
+    Output b = ops::Identity(s.WithOpName("b"), x);
+    Output c = ops::Add(s.WithOpName("c"), b, a);
+
+    Output y = ops::Placeholder(s.WithOpName("y"), DT_FLOAT,
+                                ops::Placeholder::Shape({2}));
+    Output d = ops::Identity(s.WithOpName("d"), y);
+    Output e = ops::Mul(s.WithOpName("e"), d, d);
+
+    Output z = ops::Placeholder(s.WithOpName("z"), DT_FLOAT,
+                                ops::Placeholder::Shape({2}));
+    Output f = ops::Neg(s.WithOpName("f"), z);
+
+    GrapplerItem item;
+    TF_CHECK_OK(s.ToGraphDef(&item.graph));
+    item.fetch = {"c", "e"};
+    return item;
+  }
+
+  static std::set<string> NodeNames(const GraphDef& graph) {
+    std::set<string> names;
+    for (const NodeDef& node : graph.node()) {
+      names.insert(node.name());
+    }
+    return names;
+  }
+};
+
+TEST_F(MetaOptimizerTest, ReportsEveryPass) {
+  GrapplerItem item = DisconnectedItem();
+
+  RewriterConfig cfg;
+  cfg.add_optimizers("pruning");
+  cfg.add_optimizers("memory");
+  MetaOptimizer optimizer(nullptr, cfg);
+  GraphDef output;
+  TF_EXPECT_OK(optimizer.Optimize(nullptr, item, &output));
+
+  ASSERT_EQ(2, optimizer.results().size());
+  const auto& pruning = optimizer.results()[0];
+  EXPECT_EQ("model_pruner", pruning.name);
+  TF_EXPECT_OK(pruning.status);
+  EXPECT_EQ(9, pruning.nodes_before);
+  // f and z are not needed.
+  EXPECT_EQ(7, pruning.nodes_after);
+  EXPECT_LE(0, pruning.time_us);
+
+  const auto& memory = optimizer.results()[1];
+  EXPECT_EQ("memory_optimizer", memory.name);
+  EXPECT_EQ(7, memory.nodes_before);
+  EXPECT_EQ(7, memory.nodes_after);
+  EXPECT_EQ(7, output.node_size());
+}
+
+TEST_F(MetaOptimizerTest, ReusesShapesOfUnchangedGraph) {
+  tensorflow::Scope s = tensorflow::Scope::NewRootScope();
+  Output x = ops::Placeholder(s.WithOpName("x"), DT_FLOAT,
+                              ops::Placeholder::Shape({2}));
+  Output y = ops::Neg(s.WithOpName("y"), x);
+  GrapplerItem item;
+  TF_CHECK_OK(s.ToGraphDef(&item.graph));
+  item.fetch = {"y"};
+
+  // Nothing to fold, so the second pass gets the shapes of the first.
+  RewriterConfig cfg;
+  cfg.add_optimizers("constfold");
+  cfg.add_optimizers("constfold");
+  MetaOptimizer optimizer(nullptr, cfg);
+  GraphDef output;
+  TF_EXPECT_OK(optimizer.Optimize(nullptr, item, &output));
+
+  ASSERT_EQ(2, optimizer.results().size());
+  EXPECT_EQ(1, optimizer.results()[0].shapes_inferred);
+  EXPECT_EQ(0, optimizer.results()[0].shapes_reused);
+  EXPECT_EQ(0, optimizer.results()[1].shapes_inferred);
+  EXPECT_EQ(1, optimizer.results()[1].shapes_reused);
+}
+
+TEST_F(MetaOptimizerTest, InfersShapesAgainAfterTheGraphChanged) {
+  tensorflow::Scope s = tensorflow::Scope::NewRootScope();
+  Output a = ops::Const(s.WithOpName("a"), {1.0f, 2.0f}, {2});
+  Output b = ops::Neg(s.WithOpName("b"), a);
+  Output x = ops::Placeholder(s.WithOpName("x"), DT_FLOAT,
+                              ops::Placeholder::Shape({2}));
+  Output y = ops::Add(s.WithOpName("y"), x, b);
+  GrapplerItem item;
+  TF_CHECK_OK(s.ToGraphDef(&item.graph));
+  item.fetch = {"y"};
+
+  // The first pass folds b, so the second one cannot use its shapes.
+  RewriterConfig cfg;
+  cfg.add_optimizers("constfold");
+  cfg.add_optimizers("constfold");
+  MetaOptimizer optimizer(nullptr, cfg);
+  GraphDef output;
+  TF_EXPECT_OK(optimizer.Optimize(nullptr, item, &output));
+
+  ASSERT_EQ(2, optimizer.results().size());
+  EXPECT_EQ(1, optimizer.results()[0].shapes_inferred);
+  EXPECT_EQ(1, optimizer.results()[1].shapes_inferred);
+  EXPECT_EQ(0, optimizer.results()[1].shapes_reused);
+}
+
+TEST_F(MetaOptimizerTest, DisconnectedSubgraphsInParallel) {
+  GrapplerItem item = DisconnectedItem();
+
+  MetaOptimizer sequential(nullptr, RewriterConfig());
+  GraphDef expected;
+  TF_EXPECT_OK(sequential.Optimize(nullptr, item, &expected));
+
+  RewriterConfig cfg;
+  cfg.set_meta_optimizer_threads(4);
+  MetaOptimizer parallel(nullptr, cfg);
+  GraphDef output;
+  TF_EXPECT_OK(parallel.Optimize(nullptr, item, &output));
+
+  EXPECT_EQ(NodeNames(expected), NodeNames(output));
+  ASSERT_EQ(sequential.results().size(), parallel.results().size());
+  for (size_t i = 0; i < parallel.results().size(); ++i) {
+    EXPECT_EQ(sequential.results()[i].name, parallel.results()[i].name);
+    EXPECT_EQ(sequential.results()[i].nodes_before,
+              parallel.results()[i].nodes_before);
+    EXPECT_EQ(sequential.results()[i].nodes_after,
+              parallel.results()[i].nodes_after);
+  }
+}
+
+TEST_F(MetaOptimizerTest, DedupsAcrossDisconnectedSubgraphs) {
+  tensorflow::Scope s = tensorflow::Scope::NewRootScope();
+  Output x = ops::Placeholder(s.WithOpName("x"), DT_FLOAT,
+                              ops::Placeholder::Shape({2}));
+  Output a = ops::Const(s.WithOpName("a"), {1.0f, 2.0f}, {2});
+  Output b = ops::Add(s.WithOpName("b"), x, a);
+
+  // Same constant as a, in another subgraph.
+  Output y = ops::Placeholder(s.WithOpName("y"), DT_FLOAT,
+                              ops::Placeholder::Shape({2}));
+  Output c = ops::Const(s.WithOpName("c"), {1.0f, 2.0f}, {2});
+  Output d = ops::Add(s.WithOpName("d"), y, c);
+
+  GrapplerItem item;
+  TF_CHECK_OK(s.ToGraphDef(&item.graph));
+  item.fetch = {"b", "d"};
+
+  MetaOptimizer sequential(nullptr, RewriterConfig());
+  GraphDef expected;
+  TF_EXPECT_OK(sequential.Optimize(nullptr, item, &expected));
+
+  RewriterConfig cfg;
+  cfg.set_meta_optimizer_threads(4);
+  MetaOptimizer parallel(nullptr, cfg);
+  GraphDef output;
+  TF_EXPECT_OK(parallel.Optimize(nullptr, item, &output));
+
+  // Which of a and c is kept depends on the order of the nodes.
+  EXPECT_EQ(5, expected.node_size());
+  EXPECT_EQ(5, output.node_size());
+  std::set<string> constants;
+  for (const NodeDef& node : output.node()) {
+    if (node.op() == "Const") {
+      constants.insert(node.name());
+    }
+  }
+  ASSERT_EQ(1, constants.size());
+  for (const NodeDef& node : output.node()) {
+    if (node.op() == "Add") {
+      EXPECT_EQ(*constants.begin(), node.input(1));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace grappler
+}  // namespace tensorflow
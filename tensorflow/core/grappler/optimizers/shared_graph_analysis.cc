@@ -0,0 +1,59 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/grappler/optimizers/shared_graph_analysis.h"
+
+namespace tensorflow {
+namespace grappler {
+
+Status SharedGraphAnalysis::GetGraphProperties(
+    const GrapplerItem& item, bool assume_valid_feeds,
+    const GraphProperties** properties) {
+  Properties& cached = properties_[assume_valid_feeds ? 1 : 0];
+  if (cached.generation == generation_) {
+    ++num_reused_;
+  } else {
+    cached.generation = generation_;
+    cached.properties.reset(new GraphProperties(item));
+    cached.status = cached.properties->InferStatically(assume_valid_feeds);
+    ++num_inferred_;
+  }
+  *properties = cached.properties.get();
+  return cached.status;
+}
+
+bool SharedGraphAnalysis::HasAnalyses() const {
+  for (const auto& cached : properties_) {
+    if (cached.generation == generation_) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Status GetGraphProperties(SharedGraphAnalysis* analysis,
+                          const GrapplerItem& item, bool assume_valid_feeds,
+                          std::unique_ptr<GraphProperties>* owned,
+                          const GraphProperties** properties) {
+  if (analysis) {
+    return analysis->GetGraphProperties(item, assume_valid_feeds, properties);
+  }
+  owned->reset(new GraphProperties(item));
+  *properties = owned->get();
+  return (*owned)->InferStatically(assume_valid_feeds);
+}
+
+}  // end namespace grappler
+}  // end namespace tensorflow
@@ -0,0 +1,84 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_GRAPPLER_OPTIMIZERS_SHARED_GRAPH_ANALYSIS_H_
+#define TENSORFLOW_GRAPPLER_OPTIMIZERS_SHARED_GRAPH_ANALYSIS_H_
+
+#include <memory>
+
+#include "tensorflow/core/grappler/costs/graph_properties.h"
+#include "tensorflow/core/grappler/grappler_item.h"
+#include "tensorflow/core/lib/core/status.h"
+
+namespace tensorflow {
+namespace grappler {
+
+// Analyses of a graph computed by one optimizer and reused by the following
+// ones until the graph changes.
+//
+// The analyses hold for the current generation of the graph. Whoever hands
+// the optimizers a changed graph calls GraphChanged(), as MetaOptimizer does
+// after each pass that changed it, and the next optimizer needing an analysis
+// computes it again for the whole graph. Not thread-safe: every graph
+// optimized concurrently has its own.
+class SharedGraphAnalysis {
+ public:
+  SharedGraphAnalysis() {}
+
+  // Sets *properties to the shapes and types statically inferred for
+  // item.graph, which must be the current generation of the graph. They are
+  // inferred unless they already were for this generation. *properties is set
+  // even if the inference fails, and then holds whatever could be inferred.
+  // It stays valid until the next call.
+  Status GetGraphProperties(const GrapplerItem& item, bool assume_valid_feeds,
+                            const GraphProperties** properties);
+
+  // Whether some analysis of the current generation of the graph is kept.
+  bool HasAnalyses() const;
+
+  // Starts a new generation of the graph.
+  void GraphChanged() { ++generation_; }
+
+  // Number of times the shapes were inferred, and reused.
+  int num_inferred() const { return num_inferred_; }
+  int num_reused() const { return num_reused_; }
+
+ private:
+  struct Properties {
+    int64 generation = -1;
+    std::unique_ptr<GraphProperties> properties;
+    Status status;
+  };
+  // Indexed by assume_valid_feeds.
+  Properties properties_[2];
+
+  int64 generation_ = 0;
+  int num_inferred_ = 0;
+  int num_reused_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(SharedGraphAnalysis);
+};
+
+// Helper for optimizers: gets the properties of item.graph from analysis if
+// there is one, or infers them into *owned otherwise.
+Status GetGraphProperties(SharedGraphAnalysis* analysis,
+                          const GrapplerItem& item, bool assume_valid_feeds,
+                          std::unique_ptr<GraphProperties>* owned,
+                          const GraphProperties** properties);
+
+}  // end namespace grappler
+}  // end namespace tensorflow
+
+#endif  // TENSORFLOW_GRAPPLER_OPTIMIZERS_SHARED_GRAPH_ANALYSIS_H_
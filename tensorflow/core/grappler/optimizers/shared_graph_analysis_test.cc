@@ -0,0 +1,93 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/grappler/optimizers/shared_graph_analysis.h"
+
+#include "tensorflow/cc/ops/standard_ops.h"
+#include "tensorflow/core/grappler/grappler_item.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace grappler {
+namespace {
+
+GrapplerItem NegItem() {
+  tensorflow::Scope s = tensorflow::Scope::NewRootScope();
+  Output x = ops::Placeholder(s.WithOpName("x"), DT_FLOAT,
+                              ops::Placeholder::Shape({2, 3}));
+  Output y = ops::Neg(s.WithOpName("y"), x);
+  Output z = ops::Neg(s.WithOpName("z"), x);
+  GrapplerItem item;
+  TF_CHECK_OK(s.ToGraphDef(&item.graph));
+  item.fetch = {"y"};
+  return item;
+}
+
+TEST(SharedGraphAnalysisTest, ReusesPropertiesOfTheSameGeneration) {
+  SharedGraphAnalysis analysis;
+  EXPECT_FALSE(analysis.HasAnalyses());
+  const GraphProperties* first;
+  const GraphProperties* second;
+  GrapplerItem item = NegItem();
+  TF_EXPECT_OK(analysis.GetGraphProperties(item, false, &first));
+  EXPECT_TRUE(analysis.HasAnalyses());
+  // A copy of the item, as each optimizer outputs a new graph.
+  GrapplerItem copy(item, GraphDef(item.graph));
+  TF_EXPECT_OK(analysis.GetGraphProperties(copy, false, &second));
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(1, analysis.num_inferred());
+  EXPECT_EQ(1, analysis.num_reused());
+
+  const auto& props = second->GetOutputProperties("y");
+  ASSERT_EQ(1, props.size());
+  EXPECT_EQ(3, props[0].shape().dim(1).size());
+
+  // Inferred separately when feeds are assumed to be valid.
+  TF_EXPECT_OK(analysis.GetGraphProperties(item, true, &second));
+  EXPECT_EQ(2, analysis.num_inferred());
+}
+
+TEST(SharedGraphAnalysisTest, InfersAgainAfterTheGraphChanged) {
+  SharedGraphAnalysis analysis;
+  const GraphProperties* properties;
+  GrapplerItem item = NegItem();
+  TF_EXPECT_OK(analysis.GetGraphProperties(item, false, &properties));
+  EXPECT_TRUE(properties->HasOutputProperties("z"));
+
+  // Removes z, as the model pruner does.
+  GraphDef pruned;
+  for (const NodeDef& node : item.graph.node()) {
+    if (node.name() != "z") {
+      *pruned.add_node() = node;
+    }
+  }
+  GrapplerItem pruned_item(item, std::move(pruned));
+  analysis.GraphChanged();
+  EXPECT_FALSE(analysis.HasAnalyses());
+  TF_EXPECT_OK(analysis.GetGraphProperties(pruned_item, false, &properties));
+  EXPECT_EQ(2, analysis.num_inferred());
+  EXPECT_EQ(0, analysis.num_reused());
+  EXPECT_FALSE(properties->HasOutputProperties("z"));
+
+  // Annotating the pruned graph does not bring z back.
+  GraphDef annotated;
+  TF_EXPECT_OK(properties->AnnotateOutputShapes(&annotated));
+  EXPECT_EQ(2, annotated.node_size());
+}
+
+}  // namespace
+}  // namespace grappler
+}  // namespace tensorflow
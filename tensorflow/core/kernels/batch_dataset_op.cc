@@ -22,6 +22,10 @@ namespace tensorflow {
 
 namespace {
 
+// The most input elements reserved up front per call; larger batches grow
+// their buffer as the elements arrive.
+const int64 kMaxReservedElements = 1 << 14;
+
 // See documentation in ../ops/dataset_ops.cc for a high-level
 // description of the following op.
 
@@ -93,7 +97,6 @@ class BatchDatasetOp : public UnaryDatasetOpKernel {
     }
 
    private:
-
     class Iterator : public DatasetIterator<Dataset> {
      public:
       explicit Iterator(const Params& params)
@@ -108,66 +111,50 @@ class BatchDatasetOp : public UnaryDatasetOpKernel {
         std::vector<std::vector<Tensor>> batch_elements;
         {
           mutex_lock l(mu_);
-          if (!input_impl_) {
-            *end_of_sequence = true;
-            return Status::OK();
-          }
-          batch_elements.reserve(dataset()->batch_size_);
-          *end_of_sequence = false;
-          for (int i = 0; i < dataset()->batch_size_ && !*end_of_sequence;
-               ++i) {
-            std::vector<Tensor> batch_element_tuple;
-            TF_RETURN_IF_ERROR(input_impl_->GetNext(ctx, &batch_element_tuple,
-                                                    end_of_sequence));
-            if (!*end_of_sequence) {
-              batch_elements.emplace_back(std::move(batch_element_tuple));
-            } else {
-              input_impl_.reset();
-            }
-          }
+          TF_RETURN_IF_ERROR(GetInputElementsLocked(
+              ctx, dataset()->batch_size_, &batch_elements));
         }
 
         if (batch_elements.empty()) {
-          DCHECK(*end_of_sequence);
+          *end_of_sequence = true;
           return Status::OK();
         }
+        *end_of_sequence = false;
+        return CopyBatch(&batch_elements, 0, batch_elements.size(),
+                         out_tensors);
+      }
 
-        // Copy the retrieved batch elements into one output tensor
-        // per tuple component.
-        // NOTE(mrry): If the input or output sizes are statically
-        // known, we could potentially read the input values in-place
-        // into their respective slice locations. This would require a
-        // different GetNext() overload that supports zero-copy, and might
-        // make sense in an optimization pass.
-        const size_t num_tuple_components = batch_elements[0].size();
-        const int64 num_batch_elements = batch_elements.size();
-        for (size_t component_index = 0; component_index < num_tuple_components;
-             ++component_index) {
-          const Tensor& first_element = batch_elements[0][component_index];
-          TensorShape batch_component_shape({num_batch_elements});
-          batch_component_shape.AppendShape(first_element.shape());
-          Tensor batch_component(cpu_allocator(), first_element.dtype(),
-                                 batch_component_shape);
-          // Build the output tuple component by copying one slice
-          // from each input element in the batch.
-          for (size_t i = 0; i < num_batch_elements; ++i) {
-            if (batch_elements[i][component_index].shape() !=
-                first_element.shape()) {
-              return errors::InvalidArgument(
-                  "Cannot batch tensors with different shapes in component ",
-                  component_index, ". First element had shape ",
-                  first_element.shape().DebugString(), " and element ", i,
-                  " had shape ",
-                  batch_elements[i][component_index].shape().DebugString(),
-                  ".");
-            }
-            TF_RETURN_IF_ERROR(batch_util::CopyElementToSlice(
-                std::move(batch_elements[i][component_index]), &batch_component,
-                i));
-          }
-          out_tensors->emplace_back(std::move(batch_component));
+      Status GetNextBatchInternal(
+          IteratorContext* ctx, int64 max_elements,
+          std::vector<std::vector<Tensor>>* out_elements,
+          bool* end_of_sequence) override {
+        // Pull the input elements of all batches at once, and split them
+        // outside the lock.
+        std::vector<std::vector<Tensor>> batch_elements;
+        {
+          mutex_lock l(mu_);
+          // Both factors come from the caller, so the product may
+          // overflow.
+          const int64 batch_size = dataset()->batch_size_;
+          const int64 num_elements =
+              max_elements > kint64max / batch_size ? kint64max
+                                                    : max_elements * batch_size;
+          TF_RETURN_IF_ERROR(
+              GetInputElementsLocked(ctx, num_elements, &batch_elements));
         }
-        *end_of_sequence = false;
+
+        const int64 num_input_elements = batch_elements.size();
+        int64 num_batches = 0;
+        for (int64 begin = 0; begin < num_input_elements;
+             begin += dataset()->batch_size_) {
+          out_elements->emplace_back();
+          TF_RETURN_IF_ERROR(CopyBatch(
+              &batch_elements, begin,
+              std::min(dataset()->batch_size_, num_input_elements - begin),
+              &out_elements->back()));
+          ++num_batches;
+        }
+        *end_of_sequence = num_batches < max_elements;
         return Status::OK();
       }
 
@@ -195,6 +182,67 @@ class BatchDatasetOp : public UnaryDatasetOpKernel {
       }
 
      private:
+      // Appends up to `num_elements` elements of the input to
+      // `*batch_elements`, fewer only at the end of the input.
+      Status GetInputElementsLocked(
+          IteratorContext* ctx, int64 num_elements,
+          std::vector<std::vector<Tensor>>* batch_elements)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        if (!input_impl_) {
+          return Status::OK();
+        }
+        // `num_elements` is only an upper bound, which may be far larger
+        // than the input.
+        batch_elements->reserve(std::min(num_elements, kMaxReservedElements));
+        bool end_of_input = false;
+        TF_RETURN_IF_ERROR(input_impl_->GetNextBatch(
+            ctx, num_elements, batch_elements, &end_of_input));
+        if (end_of_input) {
+          input_impl_.reset();
+        }
+        return Status::OK();
+      }
+
+      // Copies `num_batch_elements` elements, starting at `begin`, into one
+      // output tensor per tuple component.
+      static Status CopyBatch(std::vector<std::vector<Tensor>>* batch_elements,
+                              int64 begin, int64 num_batch_elements,
+                              std::vector<Tensor>* out_tensors) {
+        // NOTE(mrry): If the input or output sizes are statically
+        // known, we could potentially read the input values in-place
+        // into their respective slice locations. This would require a
+        // different GetNext() overload that supports zero-copy, and might
+        // make sense in an optimization pass.
+        const size_t num_tuple_components = (*batch_elements)[begin].size();
+        for (size_t component_index = 0; component_index < num_tuple_components;
+             ++component_index) {
+          const Tensor& first_element =
+              (*batch_elements)[begin][component_index];
+          // A copy, since the first element is moved into the batch below.
+          const TensorShape first_shape = first_element.shape();
+          TensorShape batch_component_shape({num_batch_elements});
+          batch_component_shape.AppendShape(first_shape);
+          Tensor batch_component(cpu_allocator(), first_element.dtype(),
+                                 batch_component_shape);
+          // Build the output tuple component by copying one slice
+          // from each input element in the batch.
+          for (int64 i = 0; i < num_batch_elements; ++i) {
+            Tensor& element = (*batch_elements)[begin + i][component_index];
+            if (element.shape() != first_shape) {
+              return errors::InvalidArgument(
+                  "Cannot batch tensors with different shapes in component ",
+                  component_index, ". First element had shape ",
+                  first_shape.DebugString(), " and element ", i,
+                  " had shape ", element.shape().DebugString(), ".");
+            }
+            TF_RETURN_IF_ERROR(batch_util::CopyElementToSlice(
+                std::move(element), &batch_component, i));
+          }
+          out_tensors->emplace_back(std::move(batch_component));
+        }
+        return Status::OK();
+      }
+
       mutex mu_;
       std::unique_ptr<IteratorBase> input_impl_ GUARDED_BY(mu_);
     };
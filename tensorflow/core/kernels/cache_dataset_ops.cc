@@ -14,10 +14,17 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow/core/kernels/dataset.h"
 
+#include <algorithm>
+#include <deque>
+
 #include "tensorflow/core/framework/partial_tensor_shape.h"
 #include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/strings/numbers.h"
+#include "tensorflow/core/lib/strings/str_util.h"
 #include "tensorflow/core/lib/strings/stringprintf.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/util/env_var.h"
 #include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
 
 namespace tensorflow {
@@ -39,41 +46,122 @@ class CacheDatasetOp : public UnaryDatasetOpKernel {
     OP_REQUIRES_OK(ctx,
                    ParseScalarArgument<string>(ctx, "filename", &filename));
 
-    if (filename.empty()) {
-      *output = new MemoryDataset(input);
+    // By default a memory cache keeps everything in memory and a file cache
+    // nothing, as they always did.
+    int64 budget_mb;
+    OP_REQUIRES_OK(ctx, ReadInt64FromEnvVar("TF_DATA_CACHE_MEMORY_BUDGET_MB",
+                                            -1, &budget_mb));
+    int64 memory_budget;
+    if (budget_mb >= 0) {
+      memory_budget = budget_mb << 20;
     } else {
-      *output = new FileDataset(input, filename, ctx->env());
+      memory_budget = filename.empty() ? kint64max : 0;
     }
+
+    // How long a reader that caught up with the writer waits for its next
+    // element before giving up, in case the writer is only advanced by the
+    // same thread.
+    int64 reader_timeout_ms;
+    OP_REQUIRES_OK(ctx, ReadInt64FromEnvVar("TF_DATA_CACHE_READER_TIMEOUT_MS",
+                                            60 * 1000, &reader_timeout_ms));
+
+    *output = new Dataset(input, filename, memory_budget, reader_timeout_ms,
+                          ctx->env());
   }
 
  private:
-  class FileDataset : public DatasetBase {
+  // Elements that do not stay in memory are written to shards of about this
+  // many bytes, each of which can be read as soon as it is complete.
+  static constexpr int64 kShardBytes = 64 << 20;
+  // Number of shards a reader loads in parallel, ahead of the element it is
+  // returning.
+  static constexpr int kReadAheadShards = 4;
+  static const size_t kMaxItems = 10000000;  // 10 million
+
+  // A complete shard on disk, holding elements [begin, end).
+  struct Shard {
+    int64 index;
+    int64 begin;
+    int64 end;
+  };
+
+  // The elements cached so far, shared between the iterator writing them and
+  // the iterators reading them. Readers of the same dataset follow the writer
+  // during the first epoch.
+  struct CacheState {
+    mutex mu;
+    condition_variable cond_var;
+    // The first elements, as long as they fit in the memory budget.
+    std::vector<std::vector<Tensor>> memory GUARDED_BY(mu);
+    int64 memory_bytes GUARDED_BY(mu) = 0;
+    // Complete shards, in order. For a file cache they hold all elements,
+    // for a memory cache the ones after those in `memory`.
+    std::vector<Shard> shards GUARDED_BY(mu);
+    bool writer_created GUARDED_BY(mu) = false;
+    // Number of elements the writer has added, in memory or to a shard that
+    // may not be complete yet.
+    int64 num_added GUARDED_BY(mu) = 0;
+    // Whether all elements of the input are in the cache.
+    bool complete GUARDED_BY(mu) = false;
+    // Set if the writer went away before the cache was complete.
+    Status status GUARDED_BY(mu);
+  };
+
+  class Dataset : public DatasetBase {
    public:
-    explicit FileDataset(const DatasetBase* input, string filename, Env* env)
+    Dataset(const DatasetBase* input, string filename, int64 memory_budget,
+            int64 reader_timeout_ms, Env* env)
         : input_(input),
           filename_(std::move(filename)),
+          memory_budget_(memory_budget),
+          reader_timeout_ms_(reader_timeout_ms),
           env_(env),
           num_tensors_(input->output_dtypes().size()),
           tensor_index_padding_size_(StringPaddingSize(num_tensors_)),
           item_index_padding_size_(StringPaddingSize(kMaxItems)),
           tensor_format_string_(strings::Printf("%%%zuzu_%%%zuzu",
                                                 item_index_padding_size_,
-                                                tensor_index_padding_size_)) {
+                                                tensor_index_padding_size_)),
+          prefix_(filename_),
+          state_(std::make_shared<CacheState>()) {
       input_->Ref();
       DCHECK_EQ(item_index_padding_size_, 7);
     }
 
-    ~FileDataset() override { input_->Unref(); }
+    ~Dataset() override {
+      input_->Unref();
+      if (filename_.empty()) {
+        // Spilled shards of a memory cache only live as long as the dataset.
+        mutex_lock l(state_->mu);
+        DeleteShards(state_->shards.size());
+      }
+    }
 
     std::unique_ptr<IteratorBase> MakeIterator(
         const string& prefix) const override {
-      if (env_->FileExists(strings::StrCat(filename_, ".index")).ok()) {
-        return std::unique_ptr<IteratorBase>(new FileReaderIterator(
-            {this, strings::StrCat(prefix, "::FileReader")}));
-      } else {
-        return std::unique_ptr<IteratorBase>(new FileWriterIterator(
-            {this, strings::StrCat(prefix, "::FileWriter")}));
+      mutex_lock l(mu_);
+      {
+        mutex_lock sl(state_->mu);
+        if (!state_->writer_created && !state_->complete) {
+          if (!filename_.empty() &&
+              env_->FileExists(ManifestFilename()).ok()) {
+            // Written by another dataset, possibly in another process.
+            state_->status = ReadManifest(&state_->shards);
+            state_->complete = state_->status.ok();
+          } else if (!filename_.empty() &&
+                     env_->FileExists(MetaFilename(filename_)).ok()) {
+            // Written as a single bundle by an earlier version.
+            return std::unique_ptr<IteratorBase>(new LegacyReaderIterator(
+                {this, strings::StrCat(prefix, "::LegacyCacheReader")}));
+          } else {
+            state_->writer_created = true;
+            return std::unique_ptr<IteratorBase>(new WriterIterator(
+                {this, strings::StrCat(prefix, "::CacheWriter")}, state_));
+          }
+        }
       }
+      return std::unique_ptr<IteratorBase>(new ReaderIterator(
+          {this, strings::StrCat(prefix, "::CacheReader")}, state_));
     }
 
     const DataTypeVector& output_dtypes() const override {
@@ -84,7 +172,10 @@ class CacheDatasetOp : public UnaryDatasetOpKernel {
       return input_->output_shapes();
     }
 
-    string DebugString() override { return "CacheDatasetOp::FileDataset"; }
+    string DebugString() override {
+      return filename_.empty() ? "CacheDatasetOp::MemoryDataset"
+                               : "CacheDatasetOp::FileDataset";
+    }
 
    private:
     static size_t StringPaddingSize(size_t num_tensors) {
@@ -96,72 +187,257 @@ class CacheDatasetOp : public UnaryDatasetOpKernel {
                              tensor_index);
     }
 
-    // FileWriterIterator passes through and caches items from the input
-    // FileDataset.
+    string ShardPrefix(int64 index) const {
+      mutex_lock l(prefix_mu_);
+      return strings::Printf("%s_shard-%05lld", prefix_.c_str(),
+                             static_cast<long long>(index));
+    }
+
+    // Picks the temporary file a memory cache spills to, the first time it
+    // has to.
+    Status EnsureShardPrefix() const {
+      mutex_lock l(prefix_mu_);
+      if (prefix_.empty() && !env_->LocalTempFilename(&prefix_)) {
+        return errors::Unavailable(
+            "No temporary directory to spill the cache to.");
+      }
+      return Status::OK();
+    }
+
+    // Lists the shards of a complete file cache, one "begin end" line each.
+    string ManifestFilename() const {
+      return strings::StrCat(filename_, ".manifest");
+    }
+
+    Status WriteManifest(const std::vector<Shard>& shards) const {
+      string contents;
+      for (const Shard& shard : shards) {
+        strings::StrAppend(&contents, shard.begin, " ", shard.end, "\n");
+      }
+      // Other processes take the cache as complete once the manifest exists.
+      const string tmp = strings::StrCat(ManifestFilename(), ".tmp");
+      TF_RETURN_IF_ERROR(WriteStringToFile(env_, tmp, contents));
+      return env_->RenameFile(tmp, ManifestFilename());
+    }
+
+    Status ReadManifest(std::vector<Shard>* shards) const {
+      string contents;
+      TF_RETURN_IF_ERROR(ReadFileToString(env_, ManifestFilename(), &contents));
+      shards->clear();
+      for (StringPiece line :
+           str_util::Split(contents, '\n', str_util::SkipEmpty())) {
+        std::vector<string> fields = str_util::Split(line, ' ');
+        Shard shard;
+        shard.index = shards->size();
+        if (fields.size() != 2 ||
+            !strings::safe_strto64(fields[0], &shard.begin) ||
+            !strings::safe_strto64(fields[1], &shard.end)) {
+          return errors::DataLoss("Corrupted cache manifest ",
+                                  ManifestFilename(), ": ", line);
+        }
+        shards->push_back(shard);
+      }
+      return Status::OK();
+    }
+
+    void DeleteShards(int64 num_shards) const {
+      for (int64 i = 0; i < num_shards; ++i) {
+        const string shard_prefix = ShardPrefix(i);
+        env_->DeleteFile(MetaFilename(shard_prefix)).IgnoreError();
+        env_->DeleteFile(DataFilename(shard_prefix, 0, 1)).IgnoreError();
+      }
+    }
+
+    Status LoadShard(const Shard& shard,
+                     std::vector<std::vector<Tensor>>* elements) const {
+      // The elements alias the mapped data file where they can, instead of
+      // being copied out of it.
+      BundleReader::Options options;
+      options.use_mmap = true;
+      BundleReader reader(env_, ShardPrefix(shard.index), options);
+      TF_RETURN_IF_ERROR(reader.status());
+      elements->reserve(shard.end - shard.begin);
+      reader.Seek(FormatName(shard.begin, 0));
+      for (int64 i = shard.begin; i < shard.end; ++i) {
+        elements->emplace_back(num_tensors_);
+        for (size_t j = 0; j < num_tensors_; ++j) {
+          if (!reader.Valid()) {
+            return errors::DataLoss("Cache shard ", ShardPrefix(shard.index),
+                                    " ends before element ", i);
+          }
+          DCHECK_EQ(reader.key(), FormatName(i, j));
+          TF_RETURN_IF_ERROR(reader.ReadCurrent(&elements->back()[j]));
+          reader.Next();
+        }
+      }
+      return reader.status();
+    }
+
+    // Makes the next iterator start over, after a writer did not finish.
+    void ResetState(const std::shared_ptr<CacheState>& state) const {
+      mutex_lock l(mu_);
+      if (state_ == state) {
+        state_ = std::make_shared<CacheState>();
+      }
+    }
+
+    // WriterIterator passes through and caches items from the input dataset.
     //
-    // This iterator is used when the cache directory is not found on disk. It
-    // creates the cache directory, and passes on the underlying iterator's
-    // elements.
-    class FileWriterIterator : public DatasetIterator<FileDataset> {
+    // This iterator is used when there is no cache yet. Elements are kept in
+    // memory up to the memory budget; a file cache writes all of them to
+    // disk as well, a memory cache only those over the budget. Finished
+    // shards are published to readers right away.
+    class WriterIterator : public DatasetIterator<Dataset> {
      public:
-      explicit FileWriterIterator(const Params& params)
-          : DatasetIterator<FileDataset>(params),
-            cur_index_(0),
+      explicit WriterIterator(const Params& params,
+                              std::shared_ptr<CacheState> state)
+          : DatasetIterator<Dataset>(params),
+            state_(std::move(state)),
             input_impl_(params.dataset->input_->MakeIterator(params.prefix)),
-            writer_(params.dataset->env_, params.dataset->filename_),
-            lockfile_(strings::StrCat(params.dataset->filename_, ".lockfile")),
-            lockfile_created_(false),
-            iteration_completed_(false) {}
+            lockfile_(strings::StrCat(params.dataset->filename_, ".lockfile")) {
+      }
+
+      ~WriterIterator() override {
+        if (iteration_completed_) {
+          return;
+        }
+        {
+          mutex_lock l(state_->mu);
+          state_->status = errors::Aborted(
+              "The iterator writing the cache was destroyed before reaching "
+              "the end of its input.");
+          state_->cond_var.notify_all();
+        }
+        if (lockfile_created_ || dataset()->filename_.empty()) {
+          if (shard_writer_) {
+            // Finished only to have its temporary files in place to delete.
+            shard_writer_->Finish().IgnoreError();
+            shard_writer_.reset();
+            ++num_shards_;
+          }
+          dataset()->DeleteShards(num_shards_);
+          if (lockfile_created_) {
+            dataset()->env_->DeleteFile(lockfile_).IgnoreError();
+          }
+        }
+        dataset()->ResetState(state_);
+      }
 
       Status GetNextInternal(IteratorContext* ctx,
                              std::vector<Tensor>* out_tensors,
                              bool* end_of_sequence) override {
         mutex_lock l(mu_);
-        TF_RETURN_IF_ERROR(EnsureLockFileExists());
-        TF_RETURN_IF_ERROR(writer_.status());
-        if (cur_index_ >= kMaxItems) {
-          // As a courtesy, close the [truncated] cache file.
-          Status s = Finish();
-          if (!s.ok()) {
-            LOG(ERROR) << s;
-          }
-          return errors::InvalidArgument(
-              "Upstream iterator is producing more than ", kMaxItems,
-              " items, which is more than the cache limit.");
+        if (iteration_completed_) {
+          *end_of_sequence = true;
+          return Status::OK();
+        }
+        TF_RETURN_IF_ERROR(status_);
+        if (!dataset()->filename_.empty()) {
+          TF_RETURN_IF_ERROR(EnsureLockFileExists());
         }
-
         TF_RETURN_IF_ERROR(
             input_impl_->GetNext(ctx, out_tensors, end_of_sequence));
-        if (*end_of_sequence && out_tensors->empty()) {
-          TF_RETURN_IF_ERROR(Finish());
-          cur_index_++;
-          return Status::OK();
+        if (*end_of_sequence) {
+          status_ = Finish();
+          return status_;
         }
         if (out_tensors->size() != dataset()->num_tensors_) {
           return errors::Internal(
               "Upstream iterator returned invalid number of tensors. Expected ",
               dataset()->num_tensors_, " got: ", out_tensors->size());
         }
-        size_t tensor_index = 0;
-        for (const Tensor& t : *out_tensors) {
-          DCHECK_LT(tensor_index, dataset()->num_tensors_);
-          string key = dataset()->FormatName(cur_index_, tensor_index++);
-          TF_RETURN_IF_ERROR(writer_.Add(key, t));
+        if (cur_index_ >= kMaxItems) {
+          return errors::InvalidArgument(
+              "Upstream iterator is producing more than ", kMaxItems,
+              " items, which is more than the cache limit.");
+        }
+        status_ = Add(*out_tensors);
+        return status_;
+      }
+
+     private:
+      Status Add(const std::vector<Tensor>& element)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        int64 bytes = 0;
+        for (const Tensor& t : element) {
+          bytes += t.TotalBytes();
         }
-        if (*end_of_sequence) {
-          TF_RETURN_IF_ERROR(Finish());
+        bool to_disk = !dataset()->filename_.empty();
+        {
+          mutex_lock l(state_->mu);
+          // Once an element is over the budget, keep the rest out of memory
+          // too, so that readers find each element in one place.
+          if (!over_budget_ &&
+              state_->memory_bytes + bytes <= dataset()->memory_budget_) {
+            state_->memory.push_back(element);
+            state_->memory_bytes += bytes;
+          } else {
+            over_budget_ = true;
+            to_disk = true;
+          }
+          // Readers waiting for a shard take this as progress too.
+          ++state_->num_added;
+          state_->cond_var.notify_all();
+        }
+        if (to_disk) {
+          if (!shard_writer_) {
+            TF_RETURN_IF_ERROR(dataset()->EnsureShardPrefix());
+            // Aligned, so that LoadShard() can alias the tensors.
+            BundleWriter::Options options;
+            options.data_alignment = EIGEN_MAX_ALIGN_BYTES;
+            shard_writer_.reset(new BundleWriter(
+                dataset()->env_, dataset()->ShardPrefix(num_shards_),
+                options));
+            shard_begin_ = cur_index_;
+            shard_bytes_ = 0;
+          }
+          for (size_t i = 0; i < element.size(); ++i) {
+            TF_RETURN_IF_ERROR(shard_writer_->Add(
+                dataset()->FormatName(cur_index_, i), element[i]));
+          }
+          shard_bytes_ += bytes;
+        }
+        ++cur_index_;
+        if (shard_writer_ && shard_bytes_ >= kShardBytes) {
+          TF_RETURN_IF_ERROR(FinishShard());
         }
-        cur_index_++;
         return Status::OK();
       }
 
-     private:
+      Status FinishShard() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        Status s = shard_writer_->Finish();
+        shard_writer_.reset();
+        ++num_shards_;
+        TF_RETURN_IF_ERROR(s);
+        mutex_lock l(state_->mu);
+        state_->shards.push_back(Shard{num_shards_ - 1, shard_begin_,
+                                       static_cast<int64>(cur_index_)});
+        state_->cond_var.notify_all();
+        return Status::OK();
+      }
+
+      Status Finish() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        if (shard_writer_) {
+          TF_RETURN_IF_ERROR(FinishShard());
+        }
+        if (!dataset()->filename_.empty()) {
+          std::vector<Shard> shards;
+          {
+            mutex_lock l(state_->mu);
+            shards = state_->shards;
+          }
+          TF_RETURN_IF_ERROR(dataset()->WriteManifest(shards));
+          TF_RETURN_IF_ERROR(dataset()->env_->DeleteFile(lockfile_));
+        }
+        iteration_completed_ = true;
+        mutex_lock l(state_->mu);
+        state_->complete = true;
+        state_->cond_var.notify_all();
+        return Status::OK();
+      }
+
       Status EnsureLockFileExists() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-        if (iteration_completed_)
-          return errors::OutOfRange(
-              "Attempting to call get_next after iteration should have "
-              "finished.");
-        if (lockfile_created_ && !iteration_completed_) return Status::OK();
+        if (lockfile_created_) return Status::OK();
         // Perform rudimentary locking to help catch concurrent writes to the
         // same cache files.
         if (dataset()->env_->FileExists(lockfile_).ok()) {
@@ -192,27 +468,146 @@ class CacheDatasetOp : public UnaryDatasetOpKernel {
         }
       }
 
-      Status Finish() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-        iteration_completed_ = true;
-        TF_RETURN_IF_ERROR(writer_.Finish());
-        TF_RETURN_IF_ERROR(dataset()->env_->DeleteFile(lockfile_));
+      const std::shared_ptr<CacheState> state_;
+      mutex mu_;
+      size_t cur_index_ GUARDED_BY(mu_) = 0;
+      std::unique_ptr<IteratorBase> input_impl_ GUARDED_BY(mu_);
+      bool over_budget_ GUARDED_BY(mu_) = false;
+      // The shard being written, holding elements from shard_begin_ on.
+      std::unique_ptr<BundleWriter> shard_writer_ GUARDED_BY(mu_);
+      int64 shard_begin_ GUARDED_BY(mu_) = 0;
+      int64 shard_bytes_ GUARDED_BY(mu_) = 0;
+      int64 num_shards_ GUARDED_BY(mu_) = 0;
+      const string lockfile_;
+      bool lockfile_created_ GUARDED_BY(mu_) = false;
+      bool iteration_completed_ GUARDED_BY(mu_) = false;
+      // Set once writing the cache failed.
+      Status status_ GUARDED_BY(mu_);
+    };  // WriterIterator
+
+    // ReaderIterator returns the elements in memory, then those on disk,
+    // loading up to kReadAheadShards shards at a time on the runner. If the
+    // cache is still being written, it waits for the elements to come in, but
+    // fails with AlreadyExists if the writer adds nothing for
+    // `reader_timeout_ms_`.
+    class ReaderIterator : public DatasetIterator<Dataset> {
+     public:
+      explicit ReaderIterator(const Params& params,
+                              std::shared_ptr<CacheState> state)
+          : DatasetIterator<Dataset>(params), state_(std::move(state)) {}
+
+      ~ReaderIterator() override {
+        for (const auto& load : loads_) {
+          load->done.WaitForNotification();
+        }
+      }
+
+      Status GetNextInternal(IteratorContext* ctx,
+                             std::vector<Tensor>* out_tensors,
+                             bool* end_of_sequence) override {
+        mutex_lock l(mu_);
+        std::vector<std::shared_ptr<ShardLoad>> new_loads;
+        {
+          mutex_lock l2(state_->mu);
+          // The writer must add an element within the timeout, however often
+          // the wait below wakes up.
+          int64 num_added = state_->num_added;
+          uint64 deadline_micros =
+              ctx->env()->NowMicros() + dataset()->reader_timeout_ms_ * 1000;
+          for (;;) {
+            // Stay on disk until the loaded shards are used up, as a file
+            // cache has the first elements in both places.
+            if (loads_.empty() &&
+                index_ < static_cast<int64>(state_->memory.size())) {
+              *out_tensors = state_->memory[index_++];
+              *end_of_sequence = false;
+              return Status::OK();
+            }
+            if (!state_->shards.empty() &&
+                index_ < state_->shards.back().end) {
+              break;
+            }
+            if (state_->complete) {
+              *end_of_sequence = true;
+              return Status::OK();
+            }
+            TF_RETURN_IF_ERROR(state_->status);
+            const uint64 now_micros = ctx->env()->NowMicros();
+            if (state_->num_added != num_added) {
+              num_added = state_->num_added;
+              deadline_micros =
+                  now_micros + dataset()->reader_timeout_ms_ * 1000;
+            } else if (now_micros >= deadline_micros) {
+              return errors::AlreadyExists(
+                  "There appears to be a concurrent caching iterator running, "
+                  "which has not added element ", index_, " to the cache "
+                  "within ", dataset()->reader_timeout_ms_, " ms. An iterator "
+                  "can only read a cache while it is being written if the "
+                  "writing iterator advances on another thread.");
+            }
+            WaitForMilliseconds(
+                &l2, &state_->cond_var,
+                std::max<int64>((deadline_micros - now_micros + 999) / 1000,
+                                1));
+          }
+          ScheduleLoadsLocked(&new_loads);
+        }
+        for (const auto& load : new_loads) {
+          (*ctx->runner())([this, load]() {
+            load->status = dataset()->LoadShard(load->shard, &load->elements);
+            load->done.Notify();
+          });
+        }
+
+        ShardLoad* load = loads_.front().get();
+        load->done.WaitForNotification();
+        TF_RETURN_IF_ERROR(load->status);
+        *out_tensors = std::move(load->elements[index_ - load->shard.begin]);
+        *end_of_sequence = false;
+        if (++index_ >= load->shard.end) {
+          loads_.pop_front();
+        }
         return Status::OK();
       }
 
+     private:
+      struct ShardLoad {
+        Shard shard;
+        std::vector<std::vector<Tensor>> elements;
+        Status status;
+        Notification done;
+      };
+
+      // Adds loads for the complete shards from the one holding index_ on,
+      // up to kReadAheadShards in total.
+      void ScheduleLoadsLocked(std::vector<std::shared_ptr<ShardLoad>>* added)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_, state_->mu) {
+        int64 next = loads_.empty() ? index_ : loads_.back()->shard.end;
+        const std::vector<Shard>& shards = state_->shards;
+        auto it = std::upper_bound(
+            shards.begin(), shards.end(), next,
+            [](int64 i, const Shard& shard) { return i < shard.end; });
+        for (; it != shards.end() &&
+             loads_.size() < static_cast<size_t>(kReadAheadShards); ++it) {
+          std::shared_ptr<ShardLoad> load = std::make_shared<ShardLoad>();
+          load->shard = *it;
+          loads_.push_back(load);
+          added->push_back(std::move(load));
+        }
+      }
+
+      const std::shared_ptr<CacheState> state_;
       mutex mu_;
-      size_t cur_index_ GUARDED_BY(mu_);
-      std::unique_ptr<IteratorBase> input_impl_ GUARDED_BY(mu_);
-      BundleWriter writer_ GUARDED_BY(mu_);
-      const string lockfile_;
-      bool lockfile_created_ GUARDED_BY(mu_);
-      bool iteration_completed_ GUARDED_BY(mu_);
-    };  // FileWriterIterator
+      int64 index_ GUARDED_BY(mu_) = 0;
+      std::deque<std::shared_ptr<ShardLoad>> loads_ GUARDED_BY(mu_);
+    };  // ReaderIterator
 
-    class FileReaderIterator : public DatasetIterator<FileDataset> {
+    // LegacyReaderIterator reads a file cache written as a single bundle,
+    // without a manifest, by earlier versions.
+    class LegacyReaderIterator : public DatasetIterator<Dataset> {
      public:
-      explicit FileReaderIterator(const Params& params)
-          : DatasetIterator<FileDataset>(params),
-            cur_index_(0),
+      explicit LegacyReaderIterator(const Params& params)
+          : DatasetIterator<Dataset>(params),
             reader_(dataset()->env_, dataset()->filename_) {}
 
       Status GetNextInternal(IteratorContext* ctx,
@@ -247,145 +642,28 @@ class CacheDatasetOp : public UnaryDatasetOpKernel {
 
      private:
       mutex mu_;
-      size_t cur_index_ GUARDED_BY(mu_);
+      size_t cur_index_ GUARDED_BY(mu_) = 0;
       BundleReader reader_ GUARDED_BY(mu_);
-    };  // FileReaderIterator
+    };  // LegacyReaderIterator
 
     const DatasetBase* const input_;
     const string filename_;
+    const int64 memory_budget_;
+    const int64 reader_timeout_ms_;
     Env* const env_;
     const size_t num_tensors_;
     const size_t tensor_index_padding_size_;
-    static const size_t kMaxItems = 10000000;  // 10 million
     const size_t item_index_padding_size_;
     const string tensor_format_string_;
-  };  // FileDataset
-
-  class MemoryDataset : public DatasetBase {
-   public:
-    explicit MemoryDataset(const DatasetBase* input) : input_(input) {
-      input->Ref();
-    }
-
-    ~MemoryDataset() override { input_->Unref(); }
-
-    std::unique_ptr<IteratorBase> MakeIterator(
-        const string& prefix) const override {
-      mutex_lock l(mu_);
-      if (cache_) {
-        return std::unique_ptr<IteratorBase>(new MemoryReaderIterator(
-            {this, strings::StrCat(prefix, "::MemoryReader")}, cache_.get()));
-      }
-      if (!writer_iterator_created_) {
-        writer_iterator_created_ = true;
-        return std::unique_ptr<IteratorBase>(new MemoryWriterIterator(
-            {this, strings::StrCat(prefix, "::MemoryWriter")}));
-      }
-      return std::unique_ptr<IteratorBase>(new DuplicateWriterIterator(
-          {this, strings::StrCat(prefix, "::DuplicateWriter")}));
-    }
-
-    const DataTypeVector& output_dtypes() const override {
-      return input_->output_dtypes();
-    }
-
-    const std::vector<PartialTensorShape>& output_shapes() const override {
-      return input_->output_shapes();
-    }
-
-    string DebugString() override { return "CacheDatasetOp::MemoryDataset"; }
-
-   private:
-    // MemoryWriterIterator passes through and appends items from the input
-    // dataset to its vector.
-    //
-    // This iterator is used when dataset->cache_ is null. After buffering
-    // the tensors in memory, upon exhausing the underlying iterator, they are
-    // updated into the parent dataset's cache_ pointer.
-    class MemoryWriterIterator : public DatasetIterator<MemoryDataset> {
-     public:
-      explicit MemoryWriterIterator(const Params& params)
-          : DatasetIterator<MemoryDataset>(params),
-            input_impl_(params.dataset->input_->MakeIterator(params.prefix)),
-            cache_(new std::vector<std::vector<Tensor>>) {}
-
-      Status GetNextInternal(IteratorContext* ctx,
-                             std::vector<Tensor>* out_tensors,
-                             bool* end_of_sequence) override {
-        mutex_lock l(mu_);
-        TF_RETURN_IF_ERROR(
-            input_impl_->GetNext(ctx, out_tensors, end_of_sequence));
-        if (*end_of_sequence) {
-          // Guard on cache_ to not crash if GetNext is called a second time
-          // after *end_of_sequence == true
-          if (cache_) {
-            mutex_lock l2(dataset()->mu_);
-            DCHECK(dataset()->writer_iterator_created_);
-            DCHECK(!dataset()->cache_);
-            cache_.swap(dataset()->cache_);
-          }
-          return Status::OK();
-        }
-        cache_->emplace_back(*out_tensors);
-        return Status::OK();
-      }
 
-     private:
-      mutex mu_;
-      std::unique_ptr<IteratorBase> input_impl_ GUARDED_BY(mu_);
-      std::unique_ptr<std::vector<std::vector<Tensor>>> cache_ GUARDED_BY(mu_);
-    };  // MemoryWriterIterator
+    mutable mutex prefix_mu_;
+    // Names the shards on disk; the filename for a file cache, a temporary
+    // file for a memory cache once it spills.
+    mutable string prefix_ GUARDED_BY(prefix_mu_);
 
-    class MemoryReaderIterator : public DatasetIterator<MemoryDataset> {
-     public:
-      explicit MemoryReaderIterator(
-          const Params& params, const std::vector<std::vector<Tensor>>* cache)
-          : DatasetIterator<MemoryDataset>(params), cache_(cache), index_(0) {
-        CHECK(cache);
-      }
-
-      Status GetNextInternal(IteratorContext* ctx,
-                             std::vector<Tensor>* out_tensors,
-                             bool* end_of_sequence) override {
-        mutex_lock l(mu_);
-        if (index_ < cache_->size()) {
-          const std::vector<Tensor>& cache_tensors = (*cache_)[index_];
-          out_tensors->insert(out_tensors->begin(), cache_tensors.begin(),
-                              cache_tensors.end());
-          index_++;
-          *end_of_sequence = false;
-          return Status::OK();
-        } else {
-          *end_of_sequence = true;
-          return Status::OK();
-        }
-      }
-
-     private:
-      mutex mu_;
-      const std::vector<std::vector<Tensor>>* const cache_;
-      size_t index_ GUARDED_BY(mu_);
-    };  // MemoryReaderIterator
-
-    class DuplicateWriterIterator : public DatasetIterator<MemoryDataset> {
-     public:
-      explicit DuplicateWriterIterator(const Params& params)
-          : DatasetIterator<MemoryDataset>(params) {}
-
-      Status GetNextInternal(IteratorContext* ctx,
-                             std::vector<Tensor>* out_tensors,
-                             bool* end_of_sequence) override {
-        return errors::AlreadyExists(
-            "There appears to be a concurrent caching iterator running.");
-      }
-    };  // DuplicateWriterIterator
-
-    const DatasetBase* const input_;
     mutable mutex mu_;
-    mutable std::unique_ptr<std::vector<std::vector<Tensor>>> cache_
-        GUARDED_BY(mu_);
-    mutable bool writer_iterator_created_ GUARDED_BY(mu_) = false;
-  };  // MemoryDataset
+    mutable std::shared_ptr<CacheState> state_ GUARDED_BY(mu_);
+  };  // Dataset
 };    // CacheDatasetOp
 
 REGISTER_KERNEL_BUILDER(Name("CacheDataset").Device(DEVICE_CPU),
@@ -0,0 +1,397 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <stdlib.h>
+
+#include "tensorflow/core/common_runtime/device.h"
+#include "tensorflow/core/common_runtime/device_factory.h"
+#include "tensorflow/core/framework/fake_input.h"
+#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/kernels/dataset.h"
+#include "tensorflow/core/lib/core/notification.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/lib/random/random.h"
+#include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/public/session_options.h"
+#include "tensorflow/core/public/version.h"
+#include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
+
+namespace tensorflow {
+namespace {
+
+class CacheDatasetOpTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    device_.reset(DeviceFactory::NewDevice("CPU", {},
+                                           "/job:localhost/replica:0/task:0"));
+    ASSERT_NE(device_, nullptr);
+    IteratorContext::Params params;
+    params.env = Env::Default();
+    params.runner = [](std::function<void()> fn) { fn(); };
+    iterator_ctx_.reset(new IteratorContext(std::move(params)));
+
+    // Memory caches spill to the temporary directory, so give each test its
+    // own.
+    const string base = testing::TmpDir();
+    test_dir_ = io::JoinPath(
+        base, strings::StrCat("cache_dataset_ops_test_", random::New64()));
+    TF_ASSERT_OK(Env::Default()->RecursivelyCreateDir(test_dir_));
+    spill_dir_ = io::JoinPath(test_dir_, "spill");
+    TF_ASSERT_OK(Env::Default()->CreateDir(spill_dir_));
+    const char* test_tmpdir = getenv("TEST_TMPDIR");
+    if (test_tmpdir != nullptr) {
+      saved_test_tmpdir_.reset(new string(test_tmpdir));
+    }
+    setenv("TEST_TMPDIR", spill_dir_.c_str(), 1);
+  }
+
+  void TearDown() override {
+    if (saved_test_tmpdir_) {
+      setenv("TEST_TMPDIR", saved_test_tmpdir_->c_str(), 1);
+    } else {
+      unsetenv("TEST_TMPDIR");
+    }
+    unsetenv("TF_DATA_CACHE_MEMORY_BUDGET_MB");
+    unsetenv("TF_DATA_CACHE_READER_TIMEOUT_MS");
+    int64 undeleted_files, undeleted_dirs;
+    Env::Default()
+        ->DeleteRecursively(test_dir_, &undeleted_files, &undeleted_dirs)
+        .IgnoreError();
+  }
+
+  // Runs the dataset kernel `def` on `inputs` and returns its dataset
+  // in `*dataset`.
+  Status MakeDataset(const NodeDef& def, std::vector<Tensor> inputs,
+                     Tensor* dataset) {
+    OpKernel* raw_kernel = nullptr;
+    TF_RETURN_IF_ERROR(CreateOpKernel(
+        DEVICE_CPU, device_.get(), device_->GetAllocator({}), nullptr, def,
+        TF_GRAPH_DEF_VERSION, &raw_kernel));
+    std::unique_ptr<OpKernel> kernel(raw_kernel);
+    gtl::InlinedVector<TensorValue, 4> input_values;
+    for (Tensor& input : inputs) {
+      input_values.emplace_back(&input);
+    }
+    OpKernelContext::Params params;
+    params.device = device_.get();
+    params.op_kernel = kernel.get();
+    params.inputs = &input_values;
+    AllocatorAttributes output_attr;
+    params.output_attr_array = &output_attr;
+    OpKernelContext ctx(&params);
+    kernel->Compute(&ctx);
+    TF_RETURN_IF_ERROR(ctx.status());
+    *dataset = *ctx.mutable_output(0);
+    return Status::OK();
+  }
+
+  Tensor Range(int64 start, int64 stop) {
+    NodeDef def;
+    TF_CHECK_OK(NodeDefBuilder("range", "RangeDataset")
+                    .Input(FakeInput(DT_INT64))
+                    .Input(FakeInput(DT_INT64))
+                    .Input(FakeInput(DT_INT64))
+                    .Attr("output_types", {DT_INT64})
+                    .Attr("output_shapes", {PartialTensorShape({})})
+                    .Finalize(&def));
+    Tensor dataset;
+    TF_CHECK_OK(MakeDataset(def,
+                            {test::AsScalar<int64>(start),
+                             test::AsScalar<int64>(stop),
+                             test::AsScalar<int64>(1)},
+                            &dataset));
+    return dataset;
+  }
+
+  // `count` times the same `component`.
+  Tensor Repeated(const Tensor& component, int64 count) {
+    NodeDef tensor_def;
+    TF_CHECK_OK(NodeDefBuilder("tensor", "TensorDataset")
+                    .Input(FakeInput({component.dtype()}))
+                    .Attr("Toutput_types", {component.dtype()})
+                    .Attr("output_shapes", {PartialTensorShape({-1})})
+                    .Finalize(&tensor_def));
+    Tensor tensor_dataset;
+    TF_CHECK_OK(MakeDataset(tensor_def, {component}, &tensor_dataset));
+    NodeDef repeat_def;
+    TF_CHECK_OK(NodeDefBuilder("repeat", "RepeatDataset")
+                    .Input(FakeInput(DT_VARIANT))
+                    .Input(FakeInput(DT_INT64))
+                    .Attr("output_types", {component.dtype()})
+                    .Attr("output_shapes", {PartialTensorShape({-1})})
+                    .Finalize(&repeat_def));
+    Tensor dataset;
+    TF_CHECK_OK(MakeDataset(
+        repeat_def, {tensor_dataset, test::AsScalar<int64>(count)}, &dataset));
+    return dataset;
+  }
+
+  Tensor Cache(const Tensor& input, const string& filename) {
+    DatasetBase* input_dataset = nullptr;
+    TF_CHECK_OK(GetDatasetFromVariantTensor(input, &input_dataset));
+    NodeDef def;
+    TF_CHECK_OK(NodeDefBuilder("cache", "CacheDataset")
+                    .Input(FakeInput(DT_VARIANT))
+                    .Input(FakeInput(DT_STRING))
+                    .Attr("output_types", input_dataset->output_dtypes())
+                    .Attr("output_shapes", input_dataset->output_shapes())
+                    .Finalize(&def));
+    Tensor dataset;
+    TF_CHECK_OK(MakeDataset(def, {input, test::AsScalar<string>(filename)},
+                            &dataset));
+    return dataset;
+  }
+
+  std::unique_ptr<IteratorBase> MakeIterator(const Tensor& dataset_tensor) {
+    DatasetBase* dataset = nullptr;
+    TF_CHECK_OK(GetDatasetFromVariantTensor(dataset_tensor, &dataset));
+    return dataset->MakeIterator("Iterator");
+  }
+
+  // Reads the next `n` elements, which must be scalars.
+  std::vector<int64> Read(IteratorBase* iterator, int n) {
+    std::vector<int64> values;
+    for (int i = 0; i < n; ++i) {
+      std::vector<Tensor> element;
+      bool end_of_sequence = false;
+      TF_CHECK_OK(
+          iterator->GetNext(iterator_ctx_.get(), &element, &end_of_sequence));
+      CHECK(!end_of_sequence);
+      values.push_back(element[0].scalar<int64>()());
+    }
+    return values;
+  }
+
+  // Reads scalars up to the end of the sequence.
+  std::vector<int64> ReadAll(IteratorBase* iterator) {
+    std::vector<int64> values;
+    for (;;) {
+      std::vector<Tensor> element;
+      bool end_of_sequence = false;
+      TF_CHECK_OK(
+          iterator->GetNext(iterator_ctx_.get(), &element, &end_of_sequence));
+      if (end_of_sequence) {
+        return values;
+      }
+      values.push_back(element[0].scalar<int64>()());
+    }
+  }
+
+  std::vector<string> SpilledFiles() {
+    std::vector<string> children;
+    TF_CHECK_OK(Env::Default()->GetChildren(spill_dir_, &children));
+    return children;
+  }
+
+  string CacheFilename() { return io::JoinPath(test_dir_, "cache"); }
+
+  std::unique_ptr<Device> device_;
+  std::unique_ptr<IteratorContext> iterator_ctx_;
+  string test_dir_;
+  string spill_dir_;
+  std::unique_ptr<string> saved_test_tmpdir_;
+};
+
+TEST_F(CacheDatasetOpTest, MemoryCacheWithoutBudgetDoesNotSpill) {
+  Tensor cache = Cache(Range(0, 5), "");
+  EXPECT_EQ(std::vector<int64>({0, 1, 2, 3, 4}),
+            ReadAll(MakeIterator(cache).get()));
+  EXPECT_EQ(std::vector<int64>({0, 1, 2, 3, 4}),
+            ReadAll(MakeIterator(cache).get()));
+  EXPECT_TRUE(SpilledFiles().empty());
+}
+
+TEST_F(CacheDatasetOpTest, MemoryCacheSpillsOverBudget) {
+  setenv("TF_DATA_CACHE_MEMORY_BUDGET_MB", "0", 1);
+  {
+    Tensor cache = Cache(Range(0, 5), "");
+    EXPECT_EQ(std::vector<int64>({0, 1, 2, 3, 4}),
+              ReadAll(MakeIterator(cache).get()));
+    EXPECT_FALSE(SpilledFiles().empty());
+    EXPECT_EQ(std::vector<int64>({0, 1, 2, 3, 4}),
+              ReadAll(MakeIterator(cache).get()));
+  }
+  // The spilled shards go away with the dataset.
+  EXPECT_TRUE(SpilledFiles().empty());
+}
+
+TEST_F(CacheDatasetOpTest, FileCacheWritesManifest) {
+  const string filename = CacheFilename();
+  EXPECT_EQ(std::vector<int64>({0, 1, 2}),
+            ReadAll(MakeIterator(Cache(Range(0, 3), filename)).get()));
+  string manifest;
+  TF_ASSERT_OK(ReadFileToString(Env::Default(),
+                                strings::StrCat(filename, ".manifest"),
+                                &manifest));
+  EXPECT_EQ("0 3\n", manifest);
+  EXPECT_FALSE(
+      Env::Default()->FileExists(strings::StrCat(filename, ".lockfile")).ok());
+
+  // Another dataset over the same files reads the cache, not its input.
+  EXPECT_EQ(std::vector<int64>({0, 1, 2}),
+            ReadAll(MakeIterator(Cache(Range(10, 20), filename)).get()));
+}
+
+TEST_F(CacheDatasetOpTest, FileCacheRejectsCorruptedManifest) {
+  const string filename = CacheFilename();
+  TF_ASSERT_OK(WriteStringToFile(Env::Default(),
+                                 strings::StrCat(filename, ".manifest"),
+                                 "0 three\n"));
+  auto iterator = MakeIterator(Cache(Range(0, 3), filename));
+  std::vector<Tensor> element;
+  bool end_of_sequence = false;
+  Status s =
+      iterator->GetNext(iterator_ctx_.get(), &element, &end_of_sequence);
+  EXPECT_TRUE(errors::IsDataLoss(s)) << s;
+}
+
+TEST_F(CacheDatasetOpTest, FileCacheRollsOverShards) {
+  const string filename = CacheFilename();
+  // Shards end once they hold 64MB, so the first two elements of 40MB share
+  // one and the third starts the next.
+  Tensor component(DT_FLOAT, TensorShape({10 << 20}));
+  component.flat<float>().setConstant(1.5f);
+  {
+    auto iterator = MakeIterator(Cache(Repeated(component, 3), filename));
+    std::vector<Tensor> element;
+    bool end_of_sequence = false;
+    for (int i = 0; i < 3; ++i) {
+      TF_ASSERT_OK(
+          iterator->GetNext(iterator_ctx_.get(), &element, &end_of_sequence));
+      ASSERT_FALSE(end_of_sequence);
+    }
+    TF_ASSERT_OK(
+        iterator->GetNext(iterator_ctx_.get(), &element, &end_of_sequence));
+    EXPECT_TRUE(end_of_sequence);
+  }
+  string manifest;
+  TF_ASSERT_OK(ReadFileToString(Env::Default(),
+                                strings::StrCat(filename, ".manifest"),
+                                &manifest));
+  EXPECT_EQ("0 2\n2 3\n", manifest);
+
+  Tensor other(DT_FLOAT, TensorShape({1}));
+  other.flat<float>().setConstant(0.0f);
+  auto iterator = MakeIterator(Cache(Repeated(other, 1), filename));
+  int num_elements = 0;
+  for (;;) {
+    std::vector<Tensor> element;
+    bool end_of_sequence = false;
+    TF_ASSERT_OK(
+        iterator->GetNext(iterator_ctx_.get(), &element, &end_of_sequence));
+    if (end_of_sequence) break;
+    test::ExpectTensorEqual<float>(component, element[0]);
+    ++num_elements;
+  }
+  EXPECT_EQ(3, num_elements);
+}
+
+TEST_F(CacheDatasetOpTest, FileCacheReadsLegacyLayout) {
+  // A single bundle named after the cache, as earlier versions wrote it.
+  const string filename = CacheFilename();
+  {
+    BundleWriter writer(Env::Default(), filename);
+    for (int64 i = 0; i < 3; ++i) {
+      const string key =
+          strings::Printf("%7zu_%1zu", static_cast<size_t>(i), size_t{0});
+      TF_ASSERT_OK(writer.Add(key, test::AsScalar<int64>(100 + i)));
+    }
+    TF_ASSERT_OK(writer.Finish());
+  }
+  EXPECT_EQ(std::vector<int64>({100, 101, 102}),
+            ReadAll(MakeIterator(Cache(Range(0, 3), filename)).get()));
+}
+
+TEST_F(CacheDatasetOpTest, ReaderFollowsWriter) {
+  Tensor cache = Cache(Range(0, 6), "");
+  auto writer = MakeIterator(cache);
+  auto reader = MakeIterator(cache);
+  EXPECT_EQ(std::vector<int64>({0, 1, 2}), Read(writer.get(), 3));
+  EXPECT_EQ(std::vector<int64>({0, 1, 2}), Read(reader.get(), 3));
+
+  // The reader waits for the writer's next element.
+  std::vector<int64> followed;
+  Notification read;
+  std::unique_ptr<Thread> thread(Env::Default()->StartThread(
+      {}, "reader", [this, &reader, &followed, &read]() {
+        followed = Read(reader.get(), 1);
+        read.Notify();
+      }));
+  Env::Default()->SleepForMicroseconds(10 * 1000);
+  EXPECT_FALSE(read.HasBeenNotified());
+  EXPECT_EQ(std::vector<int64>({3}), Read(writer.get(), 1));
+  read.WaitForNotification();
+  thread.reset();
+  EXPECT_EQ(std::vector<int64>({3}), followed);
+
+  EXPECT_EQ(std::vector<int64>({4, 5}), ReadAll(writer.get()));
+  EXPECT_EQ(std::vector<int64>({4, 5}), ReadAll(reader.get()));
+}
+
+TEST_F(CacheDatasetOpTest, ReaderGivesUpOnIdleWriter) {
+  setenv("TF_DATA_CACHE_READER_TIMEOUT_MS", "10", 1);
+  Tensor cache = Cache(Range(0, 6), "");
+  auto writer = MakeIterator(cache);
+  auto reader = MakeIterator(cache);
+  EXPECT_EQ(std::vector<int64>({0}), Read(writer.get(), 1));
+  EXPECT_EQ(std::vector<int64>({0}), Read(reader.get(), 1));
+
+  // Advancing the writer on the same thread would never happen.
+  std::vector<Tensor> element;
+  bool end_of_sequence = false;
+  Status s = reader->GetNext(iterator_ctx_.get(), &element, &end_of_sequence);
+  EXPECT_TRUE(errors::IsAlreadyExists(s)) << s;
+}
+
+TEST_F(CacheDatasetOpTest, ResetsAfterIncompleteFileWriter) {
+  const string filename = CacheFilename();
+  Tensor cache = Cache(Range(0, 5), filename);
+  {
+    auto writer = MakeIterator(cache);
+    EXPECT_EQ(std::vector<int64>({0, 1}), Read(writer.get(), 2));
+  }
+  EXPECT_FALSE(
+      Env::Default()->FileExists(strings::StrCat(filename, ".lockfile")).ok());
+  EXPECT_FALSE(
+      Env::Default()->FileExists(strings::StrCat(filename, ".manifest")).ok());
+
+  // The next iterator writes the cache from the start.
+  EXPECT_EQ(std::vector<int64>({0, 1, 2, 3, 4}),
+            ReadAll(MakeIterator(cache).get()));
+  TF_EXPECT_OK(
+      Env::Default()->FileExists(strings::StrCat(filename, ".manifest")));
+  EXPECT_EQ(std::vector<int64>({0, 1, 2, 3, 4}),
+            ReadAll(MakeIterator(cache).get()));
+}
+
+TEST_F(CacheDatasetOpTest, ResetsAfterIncompleteMemoryWriter) {
+  setenv("TF_DATA_CACHE_MEMORY_BUDGET_MB", "0", 1);
+  Tensor cache = Cache(Range(0, 5), "");
+  {
+    auto writer = MakeIterator(cache);
+    EXPECT_EQ(std::vector<int64>({0, 1}), Read(writer.get(), 2));
+  }
+  EXPECT_TRUE(SpilledFiles().empty());
+  EXPECT_EQ(std::vector<int64>({0, 1, 2, 3, 4}),
+            ReadAll(MakeIterator(cache).get()));
+}
+
+}  // namespace
+}  // namespace tensorflow
@@ -304,6 +304,33 @@ class IteratorBase {
   virtual Status GetNext(IteratorContext* ctx, std::vector<Tensor>* out_tensors,
                          bool* end_of_sequence) = 0;
 
+  // Gets up to `max_elements` next outputs from the range that this
+  // iterator is traversing, appending each to `*out_elements`.
+  //
+  // Fewer than `max_elements` outputs are appended only if the range
+  // ends, in which case `true` will be stored in `*end_of_sequence`,
+  // or on error, in which case the appended outputs are undefined.
+  //
+  // The default calls `GetNext()` repeatedly. Iterators that can
+  // produce several outputs for the price of one should override it.
+  //
+  // This method is thread-safe, but outputs of concurrent calls may
+  // interleave.
+  virtual Status GetNextBatch(IteratorContext* ctx, int64 max_elements,
+                              std::vector<std::vector<Tensor>>* out_elements,
+                              bool* end_of_sequence) {
+    *end_of_sequence = false;
+    for (int64 i = 0; i < max_elements && !*end_of_sequence; ++i) {
+      out_elements->emplace_back();
+      TF_RETURN_IF_ERROR(
+          GetNext(ctx, &out_elements->back(), end_of_sequence));
+      if (*end_of_sequence) {
+        out_elements->pop_back();
+      }
+    }
+    return Status::OK();
+  }
+
   // Returns a vector of DataType values, representing the respective
   // element types of each tuple component in the outputs of this
   // iterator.
@@ -488,6 +515,14 @@ class DatasetIterator : public IteratorBase {
     return GetNextInternal(ctx, out_tensors, end_of_sequence);
   }
 
+  Status GetNextBatch(IteratorContext* ctx, int64 max_elements,
+                      std::vector<std::vector<Tensor>>* out_elements,
+                      bool* end_of_sequence) final {
+    port::Tracing::TraceMe activity(params_.prefix);
+    return GetNextBatchInternal(ctx, max_elements, out_elements,
+                                end_of_sequence);
+  }
+
   Status Save(OpKernelContext* ctx, IteratorStateWriter* writer) final {
     TF_RETURN_IF_ERROR(dataset()->Save(ctx, writer));
     return IteratorBase::Save(ctx, writer);
@@ -499,6 +534,23 @@ class DatasetIterator : public IteratorBase {
                                  std::vector<Tensor>* out_tensors,
                                  bool* end_of_sequence) = 0;
 
+  // Internal implementation of GetNextBatch that is wrapped in tracing
+  // logic. The default calls `GetNextInternal()` repeatedly.
+  virtual Status GetNextBatchInternal(
+      IteratorContext* ctx, int64 max_elements,
+      std::vector<std::vector<Tensor>>* out_elements, bool* end_of_sequence) {
+    *end_of_sequence = false;
+    for (int64 i = 0; i < max_elements && !*end_of_sequence; ++i) {
+      out_elements->emplace_back();
+      TF_RETURN_IF_ERROR(
+          GetNextInternal(ctx, &out_elements->back(), end_of_sequence));
+      if (*end_of_sequence) {
+        out_elements->pop_back();
+      }
+    }
+    return Status::OK();
+  }
+
   string full_name(const string& name) const {
     return strings::StrCat(prefix(), ":", name);
   }
@@ -0,0 +1,196 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/kernels/dataset_autotuner.h"
+
+#include <algorithm>
+
+#include "tensorflow/core/kernels/stats_aggregator.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/util/env_var.h"
+
+namespace tensorflow {
+
+namespace dataset {
+
+constexpr int64 Autotuner::kWindow;
+constexpr int Autotuner::kIdleWindowsToShrink;
+
+int64 AutotuneCpuBudget() {
+  static const int64 budget = [] {
+    int64 value;
+    Status s = ReadInt64FromEnvVar("TF_DATA_AUTOTUNE_CPU_BUDGET",
+                                   port::NumSchedulableCPUs(), &value);
+    if (!s.ok()) {
+      LOG(ERROR) << s;
+      value = port::NumSchedulableCPUs();
+    }
+    return std::max<int64>(value, 1);
+  }();
+  return budget;
+}
+
+int64 AutotuneRamBudget() {
+  static const int64 budget = [] {
+    int64 value;
+    Status s =
+        ReadInt64FromEnvVar("TF_DATA_AUTOTUNE_RAM_BUDGET_MB", 1024, &value);
+    if (!s.ok()) {
+      LOG(ERROR) << s;
+      value = 1024;
+    }
+    return std::max<int64>(value, 1) * 1024 * 1024;
+  }();
+  return budget;
+}
+
+AutotuneBudget::AutotuneBudget(int64 cpu, int64 ram_bytes) {
+  available_[static_cast<int>(AutotuneResource::kCpu)] = cpu;
+  available_[static_cast<int>(AutotuneResource::kRam)] = ram_bytes;
+}
+
+/* static */
+AutotuneBudget* AutotuneBudget::Global() {
+  static AutotuneBudget* budget =
+      new AutotuneBudget(AutotuneCpuBudget(), AutotuneRamBudget());
+  return budget;
+}
+
+int64 AutotuneBudget::Acquire(AutotuneResource resource, int64 amount) {
+  mutex_lock l(mu_);
+  int64& available = available_[static_cast<int>(resource)];
+  const int64 acquired = std::max<int64>(std::min(amount, available), 0);
+  available -= acquired;
+  return acquired;
+}
+
+void AutotuneBudget::Release(AutotuneResource resource, int64 amount) {
+  mutex_lock l(mu_);
+  available_[static_cast<int>(resource)] += amount;
+}
+
+int64 AutotuneBudget::Available(AutotuneResource resource) {
+  mutex_lock l(mu_);
+  return available_[static_cast<int>(resource)];
+}
+
+Autotuner::Autotuner(const string& name, AutotuneResource resource,
+                     int64 max_value, AutotuneBudget* budget)
+    : name_(name),
+      resource_(resource),
+      budget_(budget),
+      max_value_(std::max<int64>(max_value, 1)) {}
+
+Autotuner::~Autotuner() { budget_->Release(resource_, held_); }
+
+void Autotuner::SetMaxValue(int64 max_value) {
+  max_value_ = std::max<int64>(max_value, 1);
+  SetValue(value_);
+}
+
+void Autotuner::RecordConsumer(IteratorContext* ctx, int64 wait_micros) {
+  const uint64 now = ctx->env()->NowMicros();
+  if (last_consumer_micros_ != 0) {
+    // The time the consumer spent on its own since the last element.
+    consumer_micros_ += std::max<int64>(
+        static_cast<int64>(now - last_consumer_micros_) - wait_micros, 0);
+  }
+  last_consumer_micros_ = now;
+  ++num_calls_;
+  if (wait_micros > 0) {
+    ++num_waits_;
+  }
+  if (num_calls_ < kWindow) {
+    return;
+  }
+
+  const int64 old_value = value_;
+  const int64 target = TargetValue();
+  int64 new_value = value_;
+  if (num_waits_ * 10 > num_calls_) {
+    if (target == 0) {
+      new_value = value_ * 2;
+    } else {
+      // Towards the target, but at least by one in case the estimate is
+      // low.
+      new_value = std::max(std::min(value_ * 2, target), value_ + 1);
+    }
+    num_idle_windows_ = 0;
+  } else if (num_waits_ == 0 && ++num_idle_windows_ >= kIdleWindowsToShrink) {
+    if (value_ > target) {
+      new_value = value_ - 1;
+    }
+    num_idle_windows_ = 0;
+  }
+  // Also settles the budget for a changed element size.
+  SetValue(new_value);
+  num_calls_ = 0;
+  num_waits_ = 0;
+  consumer_micros_ = 0;
+  num_produced_ = 0;
+  producer_micros_ = 0;
+
+  if (value_ != old_value) {
+    VLOG(2) << "Autotuned " << name_ << " from " << old_value << " to "
+            << value_;
+    auto stats_aggregator = ctx->stats_aggregator();
+    if (stats_aggregator) {
+      stats_aggregator->AddToHistogram(name_, {static_cast<double>(value_)});
+    }
+  }
+}
+
+void Autotuner::RecordProducer(int64 busy_micros, int64 bytes) {
+  ++num_produced_;
+  producer_micros_ += std::max<int64>(busy_micros, 0);
+  ++total_produced_;
+  total_bytes_ += bytes;
+}
+
+void Autotuner::SetValue(int64 value) {
+  value = std::max<int64>(std::min(value, max_value_), 1);
+  const int64 cost = UnitCost();
+  const int64 needed = (value - 1) * cost;
+  if (needed > held_) {
+    held_ += budget_->Acquire(resource_, needed - held_);
+  }
+  value_ = std::min(value, 1 + held_ / cost);
+  const int64 used = (value_ - 1) * cost;
+  budget_->Release(resource_, held_ - used);
+  held_ = used;
+}
+
+int64 Autotuner::UnitCost() const {
+  if (resource_ == AutotuneResource::kCpu || total_produced_ == 0) {
+    return 1;
+  }
+  return std::max<int64>(total_bytes_ / total_produced_, 1);
+}
+
+int64 Autotuner::TargetValue() const {
+  if (num_produced_ == 0 || consumer_micros_ == 0) {
+    return 0;
+  }
+  // Little's law: as many producers as elements the consumer gets while
+  // one element is produced.
+  const int64 producer_micros = producer_micros_ / num_produced_;
+  const int64 consumer_micros = std::max<int64>(consumer_micros_ / kWindow, 1);
+  return (producer_micros + consumer_micros - 1) / consumer_micros;
+}
+
+}  // namespace dataset
+
+}  // namespace tensorflow
@@ -0,0 +1,156 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_KERNELS_DATASET_AUTOTUNER_H_
+#define TENSORFLOW_KERNELS_DATASET_AUTOTUNER_H_
+
+#include "tensorflow/core/kernels/dataset.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+
+namespace dataset {
+
+// Passed instead of a parallelism or buffer size to have it tuned at runtime.
+constexpr int64 kAutotune = -1;
+
+// Threads all autotuned iterators may keep busy together, from
+// TF_DATA_AUTOTUNE_CPU_BUDGET, by default the number of schedulable CPUs.
+int64 AutotuneCpuBudget();
+
+// Bytes all autotuned iterators may buffer together, from
+// TF_DATA_AUTOTUNE_RAM_BUDGET_MB, by default 1GB.
+int64 AutotuneRamBudget();
+
+// What each unit of an autotuned value costs.
+enum class AutotuneResource {
+  // One thread.
+  kCpu,
+  // The memory of one buffered element.
+  kRam,
+};
+
+// Threads and bytes shared by autotuned iterators. Each Autotuner takes what
+// its value needs beyond 1 from here, and gives it back when it shrinks or
+// goes away, so that all the tuned stages of all pipelines together stay
+// within the budget.
+//
+// Thread-safe.
+class AutotuneBudget {
+ public:
+  AutotuneBudget(int64 cpu, int64 ram_bytes);
+
+  // The budget of the process, of AutotuneCpuBudget() threads and
+  // AutotuneRamBudget() bytes.
+  static AutotuneBudget* Global();
+
+  // Takes up to `amount` of `resource`, and returns how much was taken.
+  int64 Acquire(AutotuneResource resource, int64 amount);
+
+  // Gives back `amount` of `resource` taken with Acquire().
+  void Release(AutotuneResource resource, int64 amount);
+
+  int64 Available(AutotuneResource resource);
+
+ private:
+  mutex mu_;
+  int64 available_[2] GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AutotuneBudget);
+};
+
+// Tunes the parallelism or buffer depth of an iterator, so that its consumer
+// is rarely left waiting.
+//
+// The consumer reports every element it gets and how long it waited for it.
+// The producers report how long each element took to produce. After every
+// window of elements, if more than a tenth of them had to be waited for, the
+// value grows towards the number of producers needed to keep up with the
+// consumer, at most doubling. It shrinks by one after several windows in a
+// row without any wait, but not below that number.
+//
+// Each unit of the value above 1 is paid for from the shared budget, and the
+// value grows only as far as the budget allows.
+//
+// Not thread-safe, the iterator calls it under its own lock.
+class Autotuner {
+ public:
+  // `name` is used to report the value to the stats aggregator.
+  Autotuner(const string& name, AutotuneResource resource, int64 max_value,
+            AutotuneBudget* budget = AutotuneBudget::Global());
+  ~Autotuner();
+
+  int64 value() const { return value_; }
+  int64 max_value() const { return max_value_; }
+
+  // Changes the maximum. The value is clamped to it, and neither goes
+  // below 1.
+  void SetMaxValue(int64 max_value);
+
+  // Records that the consumer got an element after waiting `wait_micros`
+  // for it, 0 if it was ready.
+  void RecordConsumer(IteratorContext* ctx, int64 wait_micros);
+
+  // Records that a producer took `busy_micros` to produce an element, and
+  // that buffering one more such element would hold `bytes` bytes. The
+  // bytes only matter for kRam.
+  void RecordProducer(int64 busy_micros, int64 bytes);
+
+ private:
+  static constexpr int64 kWindow = 32;
+  static constexpr int kIdleWindowsToShrink = 8;
+
+  // Moves the value to `value`, or as close as the budget allows.
+  void SetValue(int64 value);
+
+  // The budget one unit of the value takes.
+  int64 UnitCost() const;
+
+  // How many producers keep up with the consumer, from the current window.
+  // 0 if unknown.
+  int64 TargetValue() const;
+
+  const string name_;
+  const AutotuneResource resource_;
+  AutotuneBudget* const budget_;
+  int64 max_value_;
+  int64 value_ = 1;
+  // Taken from `budget_`.
+  int64 held_ = 0;
+
+  // Over the current window.
+  int64 num_calls_ = 0;
+  int64 num_waits_ = 0;
+  int64 consumer_micros_ = 0;
+  int64 num_produced_ = 0;
+  int64 producer_micros_ = 0;
+  int num_idle_windows_ = 0;
+  // When the consumer last got an element, 0 before the first.
+  uint64 last_consumer_micros_ = 0;
+
+  // Over the lifetime of the iterator.
+  int64 total_bytes_ = 0;
+  int64 total_produced_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(Autotuner);
+};
+
+}  // namespace dataset
+
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_KERNELS_DATASET_AUTOTUNER_H_
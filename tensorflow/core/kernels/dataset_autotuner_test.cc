@@ -0,0 +1,235 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/kernels/dataset_autotuner.h"
+
+#include <vector>
+
+#include "tensorflow/core/kernels/stats_aggregator.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace tensorflow {
+namespace dataset {
+namespace {
+
+class RecordingStatsAggregator : public StatsAggregator {
+ public:
+  void AddToHistogram(const string& name,
+                      gtl::ArraySlice<double> values) override {
+    names.push_back(name);
+    samples.insert(samples.end(), values.begin(), values.end());
+  }
+  void EncodeToProto(Summary* out_summary) override {}
+
+  std::vector<string> names;
+  std::vector<double> samples;
+};
+
+// An Env whose clock only moves when told to.
+class FakeClockEnv : public EnvWrapper {
+ public:
+  FakeClockEnv() : EnvWrapper(Env::Default()) {}
+
+  uint64 NowMicros() override { return now_micros; }
+
+  uint64 now_micros = 1;
+};
+
+IteratorContext MakeContext(std::shared_ptr<StatsAggregator> stats,
+                            Env* env = Env::Default()) {
+  IteratorContext::Params params;
+  params.env = env;
+  params.stats_aggregator_getter = [stats]() { return stats; };
+  return IteratorContext(std::move(params));
+}
+
+void RecordWindow(Autotuner* autotuner, IteratorContext* ctx, int num_waits) {
+  for (int i = 0; i < 32; ++i) {
+    autotuner->RecordConsumer(ctx, i < num_waits ? 100 : 0);
+  }
+}
+
+// Records a window in which every element takes `producer_micros` to
+// produce, and the consumer spends `consumer_micros` on each one and waits
+// for all of them.
+void RecordTimedWindow(Autotuner* autotuner, IteratorContext* ctx,
+                       FakeClockEnv* env, int64 producer_micros,
+                       int64 consumer_micros) {
+  for (int i = 0; i < 32; ++i) {
+    autotuner->RecordProducer(producer_micros, 0);
+    env->now_micros += consumer_micros + 1;
+    autotuner->RecordConsumer(ctx, 1);
+  }
+}
+
+TEST(AutotunerTest, GrowsWhileConsumerWaits) {
+  auto stats = std::make_shared<RecordingStatsAggregator>();
+  IteratorContext ctx = MakeContext(stats);
+  AutotuneBudget budget(100, 0);
+  Autotuner autotuner("test", AutotuneResource::kCpu, 6, &budget);
+  EXPECT_EQ(1, autotuner.value());
+
+  RecordWindow(&autotuner, &ctx, 32);
+  EXPECT_EQ(2, autotuner.value());
+  RecordWindow(&autotuner, &ctx, 8);
+  EXPECT_EQ(4, autotuner.value());
+  // Rare waits are fine.
+  RecordWindow(&autotuner, &ctx, 2);
+  EXPECT_EQ(4, autotuner.value());
+  RecordWindow(&autotuner, &ctx, 32);
+  EXPECT_EQ(6, autotuner.value());
+  RecordWindow(&autotuner, &ctx, 32);
+  EXPECT_EQ(6, autotuner.value());
+
+  EXPECT_EQ(std::vector<double>({2, 4, 6}), stats->samples);
+  EXPECT_EQ("test", stats->names[0]);
+}
+
+TEST(AutotunerTest, ShrinksWhenIdle) {
+  IteratorContext ctx = MakeContext(nullptr);
+  AutotuneBudget budget(100, 0);
+  Autotuner autotuner("test", AutotuneResource::kCpu, 8, &budget);
+  RecordWindow(&autotuner, &ctx, 32);
+  RecordWindow(&autotuner, &ctx, 32);
+  EXPECT_EQ(4, autotuner.value());
+
+  for (int i = 0; i < 7; ++i) {
+    RecordWindow(&autotuner, &ctx, 0);
+  }
+  EXPECT_EQ(4, autotuner.value());
+  RecordWindow(&autotuner, &ctx, 0);
+  EXPECT_EQ(3, autotuner.value());
+}
+
+TEST(AutotunerTest, ClampsToMaxValue) {
+  IteratorContext ctx = MakeContext(nullptr);
+  AutotuneBudget budget(100, 0);
+  Autotuner autotuner("test", AutotuneResource::kCpu, 100, &budget);
+  for (int i = 0; i < 4; ++i) {
+    RecordWindow(&autotuner, &ctx, 32);
+  }
+  EXPECT_EQ(16, autotuner.value());
+
+  autotuner.SetMaxValue(5);
+  EXPECT_EQ(5, autotuner.value());
+  autotuner.SetMaxValue(0);
+  EXPECT_EQ(1, autotuner.max_value());
+  EXPECT_EQ(1, autotuner.value());
+  EXPECT_EQ(100, budget.Available(AutotuneResource::kCpu));
+}
+
+TEST(AutotunerTest, SharesCpuBudget) {
+  IteratorContext ctx = MakeContext(nullptr);
+  // Each autotuner gets its first thread for free, and 4 more to share.
+  AutotuneBudget budget(4, 0);
+  Autotuner first("first", AutotuneResource::kCpu, 100, &budget);
+  Autotuner second("second", AutotuneResource::kCpu, 100, &budget);
+
+  RecordWindow(&first, &ctx, 32);
+  RecordWindow(&first, &ctx, 32);
+  EXPECT_EQ(4, first.value());
+  EXPECT_EQ(1, budget.Available(AutotuneResource::kCpu));
+
+  RecordWindow(&second, &ctx, 32);
+  EXPECT_EQ(2, second.value());
+  RecordWindow(&second, &ctx, 32);
+  EXPECT_EQ(2, second.value());
+  RecordWindow(&first, &ctx, 32);
+  EXPECT_EQ(4, first.value());
+  EXPECT_EQ(0, budget.Available(AutotuneResource::kCpu));
+
+  // What the first gives back goes to the second.
+  for (int i = 0; i < 8; ++i) {
+    RecordWindow(&first, &ctx, 0);
+  }
+  EXPECT_EQ(3, first.value());
+  RecordWindow(&second, &ctx, 32);
+  EXPECT_EQ(3, second.value());
+}
+
+TEST(AutotunerTest, ReleasesBudgetWhenDestroyed) {
+  IteratorContext ctx = MakeContext(nullptr);
+  AutotuneBudget budget(8, 0);
+  {
+    Autotuner autotuner("test", AutotuneResource::kCpu, 100, &budget);
+    RecordWindow(&autotuner, &ctx, 32);
+    RecordWindow(&autotuner, &ctx, 32);
+    EXPECT_EQ(5, budget.Available(AutotuneResource::kCpu));
+  }
+  EXPECT_EQ(8, budget.Available(AutotuneResource::kCpu));
+}
+
+TEST(AutotunerTest, RamBudgetCountsElementBytes) {
+  IteratorContext ctx = MakeContext(nullptr);
+  AutotuneBudget budget(0, 1000);
+  Autotuner autotuner("test", AutotuneResource::kRam, 100, &budget);
+  autotuner.RecordProducer(0, 300);
+  for (int i = 0; i < 4; ++i) {
+    RecordWindow(&autotuner, &ctx, 32);
+  }
+  // 1 element for free, and 3 more of 300 bytes.
+  EXPECT_EQ(4, autotuner.value());
+  EXPECT_EQ(100, budget.Available(AutotuneResource::kRam));
+
+  // Larger elements, 600 bytes on average, shrink the buffer at the end of
+  // the next window.
+  autotuner.RecordProducer(0, 900);
+  RecordWindow(&autotuner, &ctx, 32);
+  EXPECT_EQ(2, autotuner.value());
+  EXPECT_EQ(400, budget.Available(AutotuneResource::kRam));
+}
+
+TEST(AutotunerTest, GrowsTowardsProducerRate) {
+  FakeClockEnv env;
+  IteratorContext ctx = MakeContext(nullptr, &env);
+  AutotuneBudget budget(100, 0);
+  Autotuner autotuner("test", AutotuneResource::kCpu, 100, &budget);
+
+  // An element takes 3 times as long to produce as to consume, so 3
+  // producers keep up.
+  RecordTimedWindow(&autotuner, &ctx, &env, 300, 100);
+  EXPECT_EQ(2, autotuner.value());
+  RecordTimedWindow(&autotuner, &ctx, &env, 300, 100);
+  EXPECT_EQ(3, autotuner.value());
+  // Past the estimate, it grows by one at a time while the consumer still
+  // waits.
+  RecordTimedWindow(&autotuner, &ctx, &env, 300, 100);
+  EXPECT_EQ(4, autotuner.value());
+}
+
+TEST(AutotunerTest, DoesNotShrinkBelowProducerRate) {
+  FakeClockEnv env;
+  IteratorContext ctx = MakeContext(nullptr, &env);
+  AutotuneBudget budget(100, 0);
+  Autotuner autotuner("test", AutotuneResource::kCpu, 100, &budget);
+  RecordWindow(&autotuner, &ctx, 32);
+  RecordWindow(&autotuner, &ctx, 32);
+  EXPECT_EQ(4, autotuner.value());
+
+  // Idle windows in which 4 producers are needed.
+  for (int i = 0; i < 16; ++i) {
+    for (int j = 0; j < 32; ++j) {
+      autotuner.RecordProducer(400, 0);
+      env.now_micros += 100;
+      autotuner.RecordConsumer(&ctx, 0);
+    }
+  }
+  EXPECT_EQ(4, autotuner.value());
+}
+
+}  // namespace
+}  // namespace dataset
+}  // namespace tensorflow
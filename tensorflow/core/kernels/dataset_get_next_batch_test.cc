@@ -0,0 +1,331 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/common_runtime/device_factory.h"
+#include "tensorflow/core/common_runtime/device_mgr.h"
+#include "tensorflow/core/common_runtime/process_function_library_runtime.h"
+#include "tensorflow/core/framework/fake_input.h"
+#include "tensorflow/core/framework/function_testlib.h"
+#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/shape_inference.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/kernels/dataset.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/public/session_options.h"
+#include "tensorflow/core/public/version.h"
+
+namespace tensorflow {
+namespace {
+
+// Multiplies its input by ten. Raises OutOfRange for `end_at` and
+// InvalidArgument for `fail_at`.
+REGISTER_OP("GetNextBatchTestTimesTen")
+    .Input("x: int64")
+    .Output("y: int64")
+    .Attr("end_at: int")
+    .Attr("fail_at: int")
+    .SetShapeFn(shape_inference::UnchangedShape);
+
+class TimesTenOp : public OpKernel {
+ public:
+  explicit TimesTenOp(OpKernelConstruction* ctx) : OpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("end_at", &end_at_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("fail_at", &fail_at_));
+  }
+
+  void Compute(OpKernelContext* ctx) override {
+    const int64 x = ctx->input(0).scalar<int64>()();
+    OP_REQUIRES(ctx, x != end_at_, errors::OutOfRange("End at ", x));
+    OP_REQUIRES(ctx, x != fail_at_, errors::InvalidArgument("Fail at ", x));
+    Tensor* y = nullptr;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0, TensorShape({}), &y));
+    y->scalar<int64>()() = 10 * x;
+  }
+
+ private:
+  int end_at_;
+  int fail_at_;
+};
+
+REGISTER_KERNEL_BUILDER(Name("GetNextBatchTestTimesTen").Device(DEVICE_CPU),
+                        TimesTenOp);
+
+FunctionDef TimesTen(const string& name, int end_at, int fail_at) {
+  return FunctionDefHelper::Define(
+      // Name
+      name,
+      // Args
+      {"x: int64"},
+      // Return values
+      {"y: int64"},
+      // Attr def
+      {},
+      // Nodes
+      {
+          {{"y"},
+           "GetNextBatchTestTimesTen",
+           {"x"},
+           {{"end_at", end_at}, {"fail_at", fail_at}}},
+      });
+}
+
+class DatasetGetNextBatchTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    device_ = DeviceFactory::NewDevice("CPU", {},
+                                       "/job:localhost/replica:0/task:0");
+    ASSERT_NE(device_, nullptr);
+    device_mgr_.reset(new DeviceMgr({device_}));
+    FunctionDefLibrary proto;
+    *proto.add_function() = TimesTen("EndAtThree", 3, -1);
+    *proto.add_function() = TimesTen("FailAtThree", -1, 3);
+    flib_def_.reset(new FunctionLibraryDefinition(OpRegistry::Global(), proto));
+    pflr_.reset(new ProcessFunctionLibraryRuntime(
+        device_mgr_.get(), Env::Default(), TF_GRAPH_DEF_VERSION,
+        flib_def_.get(), OptimizerOptions(), nullptr));
+    flr_ = pflr_->GetFLR(device_->name());
+
+    IteratorContext::Params params;
+    params.env = Env::Default();
+    params.runner = [](std::function<void()> fn) { fn(); };
+    iterator_ctx_.reset(new IteratorContext(std::move(params)));
+  }
+
+  // Runs the dataset kernel `def` on `inputs` and returns its dataset
+  // in `*dataset`.
+  Status MakeDataset(const NodeDef& def, std::vector<Tensor> inputs,
+                     Tensor* dataset) {
+    OpKernel* raw_kernel = nullptr;
+    TF_RETURN_IF_ERROR(CreateOpKernel(DEVICE_CPU, device_,
+                                      device_->GetAllocator({}), flr_, def,
+                                      TF_GRAPH_DEF_VERSION, &raw_kernel));
+    std::unique_ptr<OpKernel> kernel(raw_kernel);
+    gtl::InlinedVector<TensorValue, 4> input_values;
+    for (Tensor& input : inputs) {
+      input_values.emplace_back(&input);
+    }
+    OpKernelContext::Params params;
+    params.device = device_;
+    params.op_kernel = kernel.get();
+    params.inputs = &input_values;
+    params.function_library = flr_;
+    params.resource_manager = device_->resource_manager();
+    AllocatorAttributes output_attr;
+    params.output_attr_array = &output_attr;
+    OpKernelContext ctx(&params);
+    kernel->Compute(&ctx);
+    TF_RETURN_IF_ERROR(ctx.status());
+    *dataset = *ctx.mutable_output(0);
+    return Status::OK();
+  }
+
+  Tensor Range(int64 start, int64 stop) {
+    NodeDef def;
+    TF_CHECK_OK(NodeDefBuilder("range", "RangeDataset")
+                    .Input(FakeInput(DT_INT64))
+                    .Input(FakeInput(DT_INT64))
+                    .Input(FakeInput(DT_INT64))
+                    .Attr("output_types", {DT_INT64})
+                    .Attr("output_shapes", {PartialTensorShape({})})
+                    .Finalize(&def));
+    Tensor dataset;
+    TF_CHECK_OK(MakeDataset(def,
+                            {test::AsScalar<int64>(start),
+                             test::AsScalar<int64>(stop),
+                             test::AsScalar<int64>(1)},
+                            &dataset));
+    return dataset;
+  }
+
+  Tensor Map(const Tensor& input, const string& func) {
+    NameAttrList f;
+    f.set_name(func);
+    NodeDef def;
+    TF_CHECK_OK(NodeDefBuilder("map", "MapDataset")
+                    .Input(FakeInput(DT_VARIANT))
+                    .Input(FakeInput(DataTypeSlice()))
+                    .Attr("f", f)
+                    .Attr("Targuments", DataTypeVector())
+                    .Attr("output_types", {DT_INT64})
+                    .Attr("output_shapes", {PartialTensorShape({})})
+                    .Finalize(&def));
+    Tensor dataset;
+    TF_CHECK_OK(MakeDataset(def, {input}, &dataset));
+    return dataset;
+  }
+
+  Tensor Batch(const Tensor& input, int64 batch_size) {
+    NodeDef def;
+    TF_CHECK_OK(NodeDefBuilder("batch", "BatchDataset")
+                    .Input(FakeInput(DT_VARIANT))
+                    .Input(FakeInput(DT_INT64))
+                    .Attr("output_types", {DT_INT64})
+                    .Attr("output_shapes", {PartialTensorShape({-1})})
+                    .Finalize(&def));
+    Tensor dataset;
+    TF_CHECK_OK(
+        MakeDataset(def, {input, test::AsScalar<int64>(batch_size)}, &dataset));
+    return dataset;
+  }
+
+  std::unique_ptr<IteratorBase> MakeIterator(const Tensor& dataset_tensor) {
+    DatasetBase* dataset = nullptr;
+    TF_CHECK_OK(GetDatasetFromVariantTensor(dataset_tensor, &dataset));
+    return dataset->MakeIterator("Iterator");
+  }
+
+  // Calls GetNextBatch() and returns the single component of each element.
+  Status GetNextBatch(IteratorBase* iterator, int64 max_elements,
+                      std::vector<Tensor>* elements, bool* end_of_sequence) {
+    std::vector<std::vector<Tensor>> out_elements;
+    Status s = iterator->GetNextBatch(iterator_ctx_.get(), max_elements,
+                                      &out_elements, end_of_sequence);
+    elements->clear();
+    for (auto& element : out_elements) {
+      EXPECT_EQ(1, element.size());
+      elements->push_back(std::move(element[0]));
+    }
+    return s;
+  }
+
+  // Checks that `elements` are scalars with the given values.
+  static void ExpectScalars(const std::vector<Tensor>& elements,
+                            const std::vector<int64>& expected) {
+    ASSERT_EQ(expected.size(), elements.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      test::ExpectTensorEqual<int64>(test::AsScalar<int64>(expected[i]),
+                                     elements[i]);
+    }
+  }
+
+  Device* device_ = nullptr;  // Owned by device_mgr_.
+  std::unique_ptr<DeviceMgr> device_mgr_;
+  std::unique_ptr<FunctionLibraryDefinition> flib_def_;
+  std::unique_ptr<ProcessFunctionLibraryRuntime> pflr_;
+  FunctionLibraryRuntime* flr_ = nullptr;
+  std::unique_ptr<IteratorContext> iterator_ctx_;
+};
+
+TEST_F(DatasetGetNextBatchTest, BatchSplitsInputIntoBatches) {
+  auto iterator = MakeIterator(Batch(Range(0, 10), 3));
+  std::vector<Tensor> batches;
+  bool end_of_sequence = true;
+
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 2, &batches, &end_of_sequence));
+  EXPECT_FALSE(end_of_sequence);
+  ASSERT_EQ(2, batches.size());
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({0, 1, 2}),
+                                 batches[0]);
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({3, 4, 5}),
+                                 batches[1]);
+
+  // The last batch is partial.
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 5, &batches, &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+  ASSERT_EQ(2, batches.size());
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({6, 7, 8}),
+                                 batches[0]);
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({9}), batches[1]);
+
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 1, &batches, &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+  EXPECT_TRUE(batches.empty());
+}
+
+TEST_F(DatasetGetNextBatchTest, BatchWithHugeSizes) {
+  // Neither the batch size nor the number of batches is reserved up front,
+  // and their product does not overflow.
+  auto iterator = MakeIterator(Batch(Range(0, 5), int64{1} << 40));
+  std::vector<Tensor> batches;
+  bool end_of_sequence = false;
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), kint64max, &batches,
+                            &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+  ASSERT_EQ(1, batches.size());
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({0, 1, 2, 3, 4}),
+                                 batches[0]);
+}
+
+TEST_F(DatasetGetNextBatchTest, MapKeepsElementsPulledAfterEnd) {
+  auto iterator = MakeIterator(Map(Range(0, 10), "EndAtThree"));
+  std::vector<Tensor> elements;
+  bool end_of_sequence = false;
+
+  // `f` ends the iteration at 3, after 4 and 5 were pulled from the input.
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 6, &elements, &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+  ExpectScalars(elements, {0, 10, 20});
+
+  // As with GetNext(), the iteration continues after 3.
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 6, &elements, &end_of_sequence));
+  EXPECT_FALSE(end_of_sequence);
+  ExpectScalars(elements, {40, 50, 60, 70, 80, 90});
+
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 6, &elements, &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+  EXPECT_TRUE(elements.empty());
+}
+
+TEST_F(DatasetGetNextBatchTest, MapServesKeptElementsToGetNext) {
+  auto iterator = MakeIterator(Map(Range(0, 6), "EndAtThree"));
+  std::vector<Tensor> elements;
+  bool end_of_sequence = false;
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 6, &elements, &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+  ExpectScalars(elements, {0, 10, 20});
+
+  for (int64 expected : {40, 50}) {
+    std::vector<Tensor> element;
+    TF_ASSERT_OK(
+        iterator->GetNext(iterator_ctx_.get(), &element, &end_of_sequence));
+    ASSERT_FALSE(end_of_sequence);
+    ExpectScalars(element, {expected});
+  }
+  std::vector<Tensor> element;
+  TF_ASSERT_OK(
+      iterator->GetNext(iterator_ctx_.get(), &element, &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+}
+
+TEST_F(DatasetGetNextBatchTest, MapKeepsElementsPulledAfterError) {
+  auto iterator = MakeIterator(Map(Range(0, 6), "FailAtThree"));
+  std::vector<Tensor> elements;
+  bool end_of_sequence = false;
+
+  Status s = GetNextBatch(iterator.get(), 6, &elements, &end_of_sequence);
+  EXPECT_TRUE(errors::IsInvalidArgument(s)) << s;
+
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 6, &elements, &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+  ExpectScalars(elements, {40, 50});
+}
+
+TEST_F(DatasetGetNextBatchTest, BatchOfMapStopsAtEnd) {
+  // BatchDataset pulls its input with GetNextBatch(), and ends with the
+  // elements mapped before `f` ended the iteration.
+  auto iterator = MakeIterator(Batch(Map(Range(0, 10), "EndAtThree"), 2));
+  std::vector<Tensor> batches;
+  bool end_of_sequence = false;
+  TF_ASSERT_OK(GetNextBatch(iterator.get(), 4, &batches, &end_of_sequence));
+  EXPECT_TRUE(end_of_sequence);
+  ASSERT_EQ(2, batches.size());
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({0, 10}), batches[0]);
+  test::ExpectTensorEqual<int64>(test::AsTensor<int64>({20}), batches[1]);
+}
+
+}  // namespace
+}  // namespace tensorflow
@@ -0,0 +1,188 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_KERNELS_LOOKUP_FLAT_MAP_H_
+#define TENSORFLOW_KERNELS_LOOKUP_FLAT_MAP_H_
+
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/prefetch.h"
+#include "tensorflow/core/platform/types.h"
+
+#include <utility>
+#include <vector>
+
+namespace tensorflow {
+namespace lookup {
+
+// Hash of lookup table keys. Integer keys are mixed rather than being their
+// own hash, as FlatLookupMap picks slots by the low bits.
+template <typename K>
+struct LookupKeyHash {
+  uint64 operator()(K key) const
+  {
+      uint64 h = static_cast<uint64>(key);
+      h *= 0x9e3779b97f4a7c15ULL;
+      h ^= h >> 32;
+      return h;
+  }
+};
+
+template <>
+struct LookupKeyHash<string> {
+  uint64 operator()(const string& key) const { return Hash64(key); }
+};
+
+// Open addressing hash map for the lookup tables, which never erase keys.
+//
+// A slot holds the key, the value and one byte of the key's hash next to each
+// other, so looking up a scalar key usually touches one cache line, and string
+// keys are only compared when that byte matches. Collisions are resolved by
+// linear probing, keeping the table at most 3/4 full.
+//
+// Callers pass in the hash of each key, computed with Hash(), so that a batch
+// of keys can be hashed and prefetched before looking up any of them. Hashes
+// are 64 bits wide whatever the size of size_t, as the tag and the shards of
+// the lookup tables come from their top bits.
+template <typename K, typename V>
+class FlatLookupMap {
+ public:
+  FlatLookupMap() { Rehash(kMinCapacity); }
+
+  static uint64 Hash(const K& key) { return LookupKeyHash<K>()(key); }
+
+  size_t size() const { return size_; }
+
+  // Bytes taken by the slots, not counting what keys and values point to.
+  size_t bytes() const { return slots_.size() * sizeof(Slot); }
+
+  // Makes room for n keys in total.
+  void reserve(size_t n)
+  {
+      size_t capacity = slots_.size();
+      while (n > MaxSize(capacity)) {
+          capacity *= 2;
+      }
+      if (capacity != slots_.size()) {
+          Rehash(capacity);
+      }
+  }
+
+  void clear()
+  {
+      std::vector<Slot>(kMinCapacity).swap(slots_);
+      mask_ = kMinCapacity - 1;
+      size_ = 0;
+  }
+
+  // Hints that the key with hash h is going to be looked up.
+  void Prefetch(uint64 h) const { port::prefetch<port::PREFETCH_HINT_T0>(&slots_[h & mask_]); }
+
+  // Returns the value of key, whose hash is h, or nullptr if it is missing.
+  const V* Find(const K& key, uint64 h) const
+  {
+      const uint8 tag = Tag(h);
+      for (size_t i = h & mask_;; i = (i + 1) & mask_) {
+          const Slot& slot = slots_[i];
+          if (slot.tag == tag && slot.key == key) {
+              return &slot.value;
+          }
+          if (slot.tag == kEmpty) {
+              return nullptr;
+          }
+      }
+  }
+
+  // Returns the value of key, whose hash is h, inserting it with value if it
+  // is missing. inserted tells which one happened.
+  V* Insert(const K& key, uint64 h, const V& value, bool* inserted)
+  {
+      if (size_ + 1 > MaxSize(slots_.size())) {
+          Rehash(slots_.size() * 2);
+      }
+      const uint8 tag = Tag(h);
+      for (size_t i = h & mask_;; i = (i + 1) & mask_) {
+          Slot& slot = slots_[i];
+          if (slot.tag == tag && slot.key == key) {
+              *inserted = false;
+              return &slot.value;
+          }
+          if (slot.tag == kEmpty) {
+              slot.tag = tag;
+              slot.key = key;
+              slot.value = value;
+              ++size_;
+              *inserted = true;
+              return &slot.value;
+          }
+      }
+  }
+
+  // Calls f(key, value) for each key.
+  template <typename F>
+  void ForEach(F f) const
+  {
+      for (const Slot& slot : slots_) {
+          if (slot.tag != kEmpty) {
+              f(slot.key, slot.value);
+          }
+      }
+  }
+
+ private:
+  static const size_t kMinCapacity = 8;
+  static const uint8 kEmpty = 0;
+
+  struct Slot {
+    K key = K();
+    V value = V();
+    uint8 tag = kEmpty;
+  };
+
+  static size_t MaxSize(size_t capacity) { return capacity - capacity / 4; }
+
+  // The byte of the hash kept in the slot, from bits well above those picking
+  // the slot. Never kEmpty.
+  static uint8 Tag(uint64 h) { return static_cast<uint8>(h >> 48) | 1; }
+
+  void Rehash(size_t capacity)
+  {
+      DCHECK_EQ(capacity & (capacity - 1), 0);
+      std::vector<Slot> old(capacity);
+      old.swap(slots_);
+      mask_ = capacity - 1;
+      for (Slot& from : old) {
+          if (from.tag == kEmpty) {
+              continue;
+          }
+          size_t i = Hash(from.key) & mask_;
+          while (slots_[i].tag != kEmpty) {
+              i = (i + 1) & mask_;
+          }
+          slots_[i].tag = from.tag;
+          slots_[i].key = std::move(from.key);
+          slots_[i].value = std::move(from.value);
+      }
+  }
+
+  std::vector<Slot> slots_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace lookup
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_KERNELS_LOOKUP_FLAT_MAP_H_
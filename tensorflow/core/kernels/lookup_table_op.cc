@@ -16,6 +16,7 @@ limitations under the License.
 #include "tensorflow/core/kernels/lookup_table_op.h"
 #define EIGEN_USE_THREADS
 
+#include <algorithm>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -29,11 +30,15 @@ limitations under the License.
 namespace tensorflow {
 namespace lookup {
 
-// Lookup table that wraps an unordered_map, where the key and value data type
+// Lookup table that wraps FlatLookupMaps, where the key and value data type
 // is specified. Each individual value must be a scalar. If vector values are
 // required, use MutableHashTableOfTensors.
 //
 // This table is mutable and thread safe - Insert can be called at any time.
+// Keys are spread over shards with reader/writer locks, so that lookups don't
+// block each other and an Insert only blocks the lookups of the shards it
+// writes to. A concurrent Find may see part of an Insert; ImportValues
+// replaces the contents of all shards at once.
 //
 // Sample use case:
 //
@@ -49,8 +54,12 @@ class MutableHashTableOfScalars final : public LookupInterface {
   MutableHashTableOfScalars(OpKernelContext* ctx, OpKernel* kernel) {}
 
   size_t size() const override {
-    mutex_lock l(mu_);
-    return table_.size();
+    size_t size = 0;
+    for (const Shard& shard : shards_) {
+      tf_shared_lock l(shard.mu);
+      size += shard.table.size();
+    }
+    return size;
   }
 
   Status Find(OpKernelContext* ctx, const Tensor& key, Tensor* value,
@@ -59,28 +68,62 @@ class MutableHashTableOfScalars final : public LookupInterface {
     const auto key_values = key.flat<K>();
     auto value_values = value->flat<V>();
 
-    mutex_lock l(mu_);
-    for (int64 i = 0; i < key_values.size(); ++i) {
-      value_values(i) = gtl::FindWithDefault(
-          table_, SubtleMustCopyUnlessStringOrFloat(key_values(i)),
-          default_val);
+    std::vector<uint64> hashes;
+    std::vector<int64> order;
+    int64 starts[kNumShards + 1];
+    GroupByShard(key_values, &hashes, &order, starts);
+    for (int s = 0; s < kNumShards; ++s) {
+      const Shard& shard = shards_[s];
+      if (starts[s] == starts[s + 1]) {
+        continue;
+      }
+      tf_shared_lock l(shard.mu);
+      FindBatch(shard.table, key_values, hashes.data(),
+                order.data() + starts[s], starts[s + 1] - starts[s],
+                default_val, &value_values);
     }
 
     return Status::OK();
   }
 
-  Status DoInsert(bool clear, const Tensor& keys, const Tensor& values) {
+  Status DoInsert(bool clear, const Tensor& keys, const Tensor& values)
+      NO_THREAD_SAFETY_ANALYSIS {
     const auto key_values = keys.flat<K>();
     const auto value_values = values.flat<V>();
 
-    mutex_lock l(mu_);
+    std::vector<uint64> hashes;
+    std::vector<int64> order;
+    int64 starts[kNumShards + 1];
+    GroupByShard(key_values, &hashes, &order, starts);
     if (clear) {
-      table_.clear();
+      LockAll();
     }
-    for (int64 i = 0; i < key_values.size(); ++i) {
-      gtl::InsertOrUpdate(&table_,
-                          SubtleMustCopyUnlessStringOrFloat(key_values(i)),
-                          SubtleMustCopyUnlessStringOrFloat(value_values(i)));
+    for (int s = 0; s < kNumShards; ++s) {
+      Shard& shard = shards_[s];
+      if (clear) {
+        shard.table.clear();
+      } else if (starts[s] == starts[s + 1]) {
+        continue;
+      } else {
+        shard.mu.lock();
+      }
+      for (int64 j = starts[s]; j < starts[s + 1]; ++j) {
+        const int64 i = order[j];
+        const V value = SubtleMustCopyUnlessStringOrFloat(value_values(i));
+        bool inserted;
+        V* previous = shard.table.Insert(
+            SubtleMustCopyUnlessStringOrFloat(key_values(i)), hashes[i], value,
+            &inserted);
+        if (!inserted) {
+          *previous = value;
+        }
+      }
+      if (!clear) {
+        shard.mu.unlock();
+      }
+    }
+    if (clear) {
+      UnlockAll();
     }
     return Status::OK();
   }
@@ -95,25 +138,34 @@ class MutableHashTableOfScalars final : public LookupInterface {
     return DoInsert(true, keys, values);
   }
 
-  Status ExportValues(OpKernelContext* ctx) override {
-    mutex_lock l(mu_);
-    int64 size = table_.size();
+  Status ExportValues(OpKernelContext* ctx) override
+      NO_THREAD_SAFETY_ANALYSIS {
+    LockAll();
+    int64 size = 0;
+    for (const Shard& shard : shards_) {
+      size += shard.table.size();
+    }
 
     Tensor* keys;
     Tensor* values;
-    TF_RETURN_IF_ERROR(
-        ctx->allocate_output("keys", TensorShape({size}), &keys));
-    TF_RETURN_IF_ERROR(
-        ctx->allocate_output("values", TensorShape({size}), &values));
-
-    auto keys_data = keys->flat<K>();
-    auto values_data = values->flat<V>();
-    int64 i = 0;
-    for (auto it = table_.begin(); it != table_.end(); ++it, ++i) {
-      keys_data(i) = it->first;
-      values_data(i) = it->second;
+    Status s = ctx->allocate_output("keys", TensorShape({size}), &keys);
+    if (s.ok()) {
+      s = ctx->allocate_output("values", TensorShape({size}), &values);
     }
-    return Status::OK();
+    if (s.ok()) {
+      auto keys_data = keys->flat<K>();
+      auto values_data = values->flat<V>();
+      int64 i = 0;
+      for (const Shard& shard : shards_) {
+        shard.table.ForEach([&](const K& key, const V& value) {
+          keys_data(i) = key;
+          values_data(i) = value;
+          ++i;
+        });
+      }
+    }
+    UnlockAll();
+    return s;
   }
 
   DataType key_dtype() const override { return DataTypeToEnum<K>::v(); }
@@ -126,22 +178,67 @@ class MutableHashTableOfScalars final : public LookupInterface {
 
   int64 MemoryUsed() const override {
     int64 ret = 0;
-    mutex_lock l(mu_);
-    for (unsigned i = 0; i < table_.bucket_count(); ++i) {
-      size_t bucket_size = table_.bucket_size(i);
-      if (bucket_size == 0) {
-        ret++;
-      } else {
-        ret += bucket_size;
-      }
+    for (const Shard& shard : shards_) {
+      tf_shared_lock l(shard.mu);
+      ret += shard.table.bytes();
     }
     return sizeof(MutableHashTableOfScalars) + ret;
   }
 
  private:
-  // TODO(andreasst): consider using a read/write lock or a concurrent map
-  mutable mutex mu_;
-  std::unordered_map<K, V> table_ GUARDED_BY(mu_);
+  static const int kNumShardBits = 4;
+  static const int kNumShards = 1 << kNumShardBits;
+
+  struct Shard {
+    mutable mutex mu;
+    FlatLookupMap<K, V> table GUARDED_BY(mu);
+  };
+
+  // The top bits of the hash pick the shard; FlatLookupMap uses the lower
+  // ones.
+  static int ShardOf(uint64 hash) {
+    return hash >> (64 - kNumShardBits);
+  }
+
+  // Hashes every key once and orders the keys by shard, so that each shard
+  // is locked once per call. The keys of shard s are
+  // order[starts[s], starts[s + 1]).
+  template <class KeyFlat>
+  static void GroupByShard(const KeyFlat& keys, std::vector<uint64>* hashes,
+                           std::vector<int64>* order, int64* starts) {
+    const int64 num_keys = keys.size();
+    hashes->resize(num_keys);
+    order->resize(num_keys);
+    std::fill(starts, starts + kNumShards + 1, 0);
+    for (int64 i = 0; i < num_keys; ++i) {
+      (*hashes)[i] = FlatLookupMap<K, V>::Hash(
+          SubtleMustCopyUnlessStringOrFloat(keys(i)));
+      ++starts[ShardOf((*hashes)[i]) + 1];
+    }
+    for (int s = 0; s < kNumShards; ++s) {
+      starts[s + 1] += starts[s];
+    }
+    int64 next[kNumShards];
+    std::copy(starts, starts + kNumShards, next);
+    for (int64 i = 0; i < num_keys; ++i) {
+      (*order)[next[ShardOf((*hashes)[i])]++] = i;
+    }
+  }
+
+  // Locks all shards in order, for the operations on the whole table.
+  void LockAll() NO_THREAD_SAFETY_ANALYSIS {
+    for (Shard& shard : shards_) {
+      shard.mu.lock();
+    }
+  }
+
+  void UnlockAll() NO_THREAD_SAFETY_ANALYSIS {
+    for (Shard& shard : shards_) {
+      shard.mu.unlock();
+    }
+  }
+
+  Shard shards_[kNumShards];
 };
 
 // Lookup table that wraps an unordered_map. Behaves identical to
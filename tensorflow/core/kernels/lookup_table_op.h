@@ -16,12 +16,16 @@ limitations under the License.
 #ifndef TENSORFLOW_KERNELS_LOOKUP_TABLE_OP_H_
 #define TENSORFLOW_KERNELS_LOOKUP_TABLE_OP_H_
 
+#include <algorithm>
+#include <vector>
+
 #include "tensorflow/core/framework/lookup_interface.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/resource_mgr.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/kernels/bounds_check.h"
+#include "tensorflow/core/kernels/lookup_flat_map.h"
 #include "tensorflow/core/kernels/lookup_util.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
@@ -141,7 +145,32 @@ inline const double SubtleMustCopyUnlessStringOrFloat(const double value) {
   return value;
 }
 
-// Lookup table that wraps an unordered_map, where the key and value data type
+// Number of keys FindBatch prefetches before looking any of them up, so that
+// their cache misses overlap.
+const int64 kLookupPrefetchBatch = 16;
+
+// Looks up keys(i) in `map` for each i in indices[0, n), or in [0, n) if
+// indices is null, writing the value or `default_val` to values(i).
+// hashes[i] is the hash of keys(i).
+template <class K, class V, class KeyFlat, class ValueFlat>
+void FindBatch(const FlatLookupMap<K, V>& map, const KeyFlat& keys,
+               const uint64* hashes, const int64* indices, int64 n,
+               const V& default_val, ValueFlat* values) {
+  for (int64 first = 0; first < n; first += kLookupPrefetchBatch) {
+    const int64 last = std::min(first + kLookupPrefetchBatch, n);
+    for (int64 j = first; j < last; ++j) {
+      map.Prefetch(hashes[indices ? indices[j] : j]);
+    }
+    for (int64 j = first; j < last; ++j) {
+      const int64 i = indices ? indices[j] : j;
+      const V* value =
+          map.Find(SubtleMustCopyUnlessStringOrFloat(keys(i)), hashes[i]);
+      (*values)(i) = value ? *value : default_val;
+    }
+  }
+}
+
+// Lookup table that wraps a FlatLookupMap, where the key and value data type
 // is specified.
 //
 // This table is recommended for any variations to key values.
@@ -152,8 +181,8 @@ inline const double SubtleMustCopyUnlessStringOrFloat(const double value) {
 // Sample use case:
 //
 // HashTable<int64, int64> table;  // int64 -> int64.
-// table.Prepare(10); // Prepare the underlying data structure, the number of
-//                    // elements is required by interface, but not used.
+// table.Prepare(10); // Prepare the underlying data structure, reserving
+//                    // room for the expected number of elements.
 // // Populate the table, elements could be added in one or multiple calls.
 // table.Insert(key_tensor, value_tensor); // Populate the table.
 // ...
@@ -180,13 +209,17 @@ class HashTable : public InitializableLookupTable {
   DataType value_dtype() const override { return DataTypeToEnum<V>::v(); }
 
  protected:
-  Status DoPrepare(size_t unused) override {
+  Status DoPrepare(size_t expected_num_elements) override {
     if (is_initialized_) {
       return errors::Aborted("HashTable already initialized.");
     }
     if (!table_) {
-      table_ = std::unique_ptr<std::unordered_map<K, V>>(
-          new std::unordered_map<K, V>());
+      table_ = std::unique_ptr<Map>(new Map());
+    }
+    // Initializers which don't know their size pass -1.
+    const int64 expected = static_cast<int64>(expected_num_elements);
+    if (expected > 0) {
+      table_->reserve(table_->size() + expected);
     }
     return Status::OK();
   };
@@ -201,7 +234,9 @@ class HashTable : public InitializableLookupTable {
     for (int64 i = 0; i < key_values.size(); ++i) {
       const K key = SubtleMustCopyUnlessStringOrFloat(key_values(i));
       const V value = SubtleMustCopyUnlessStringOrFloat(value_values(i));
-      const V& previous_value = gtl::LookupOrInsert(table_.get(), key, value);
+      bool inserted;
+      const V& previous_value =
+          *table_->Insert(key, Map::Hash(key), value, &inserted);
       if (previous_value != value) {
         return errors::FailedPrecondition(
             "HashTable has different value for same key. Key ", key, " has ",
@@ -217,25 +252,27 @@ class HashTable : public InitializableLookupTable {
     const auto key_values = key.flat<K>();
     auto value_values = value->flat<V>();
 
+    std::vector<uint64> hashes(key_values.size());
     for (int64 i = 0; i < key_values.size(); ++i) {
-      value_values(i) = gtl::FindWithDefault(
-          *table_, SubtleMustCopyUnlessStringOrFloat(key_values(i)),
-          default_val);
+      hashes[i] = Map::Hash(SubtleMustCopyUnlessStringOrFloat(key_values(i)));
     }
+    FindBatch(*table_, key_values, hashes.data(), nullptr, key_values.size(),
+              default_val, &value_values);
     return Status::OK();
   }
 
   int64 MemoryUsed() const override {
     if (table_) {
-      const int64 num_elements = table_->size();
-      return num_elements * (sizeof(K) + sizeof(V));
+      return table_->bytes();
     } else {
       return 0;
     }
   }
 
  private:
-  std::unique_ptr<std::unordered_map<K, V>> table_;
+  typedef FlatLookupMap<K, V> Map;
+
+  std::unique_ptr<Map> table_;
 };
 
 }  // namespace lookup
@@ -0,0 +1,186 @@
+/* Copyright 2018 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/kernels/lookup_table_op.h"
+
+#include <vector>
+
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace lookup {
+namespace {
+
+template <class K, class V>
+HashTable<K, V>* MakeTable(const Tensor& keys, const Tensor& values) {
+  auto table = new HashTable<K, V>(nullptr, nullptr);
+  KeyValueTensorIterator iter(&keys, &values);
+  TF_CHECK_OK(table->Initialize(iter));
+  return table;
+}
+
+string Word(int64 i) { return strings::StrCat("word_", i * 7919); }
+
+TEST(FlatLookupMapTest, InsertGrowsAndFinds) {
+  FlatLookupMap<string, int64> map;
+  const int64 n = 10000;
+  bool inserted;
+  for (int64 i = 0; i < n; ++i) {
+    const string key = Word(i);
+    EXPECT_EQ(i, *map.Insert(key, map.Hash(key), i, &inserted));
+    EXPECT_TRUE(inserted);
+  }
+  EXPECT_EQ(n, map.size());
+
+  // Existing keys keep their value.
+  const string key = Word(5);
+  EXPECT_EQ(5, *map.Insert(key, map.Hash(key), 0, &inserted));
+  EXPECT_FALSE(inserted);
+
+  for (int64 i = 0; i < 2 * n; ++i) {
+    const string key = Word(i);
+    const int64* value = map.Find(key, map.Hash(key));
+    if (i < n) {
+      ASSERT_NE(nullptr, value);
+      EXPECT_EQ(i, *value);
+    } else {
+      EXPECT_EQ(nullptr, value);
+    }
+  }
+
+  int64 sum = 0;
+  map.ForEach([&sum](const string& key, int64 value) { sum += value; });
+  EXPECT_EQ(n * (n - 1) / 2, sum);
+
+  map.clear();
+  EXPECT_EQ(0, map.size());
+  EXPECT_EQ(nullptr, map.Find(key, map.Hash(key)));
+}
+
+TEST(FlatLookupMapTest, ReserveKeepsKeys) {
+  FlatLookupMap<int64, int64> map;
+  bool inserted;
+  map.Insert(-1, map.Hash(-1), 1, &inserted);
+  map.reserve(1000);
+  const size_t bytes = map.bytes();
+  for (int64 i = 0; i < 999; ++i) {
+    map.Insert(i, map.Hash(i), i, &inserted);
+  }
+  // No rehash was needed.
+  EXPECT_EQ(bytes, map.bytes());
+  EXPECT_EQ(1, *map.Find(-1, map.Hash(-1)));
+}
+
+TEST(HashTableTest, FindInt64) {
+  const int64 n = 1000;
+  Tensor keys(DT_INT64, TensorShape({n}));
+  Tensor values(DT_INT64, TensorShape({n}));
+  for (int64 i = 0; i < n; ++i) {
+    keys.flat<int64>()(i) = i * 3;
+    values.flat<int64>()(i) = i;
+  }
+  auto table = MakeTable<int64, int64>(keys, values);
+  core::ScopedUnref unref(table);
+  EXPECT_EQ(n, table->size());
+
+  Tensor lookup = test::AsTensor<int64>({0, 1, 2997, -3, 3000, 300});
+  Tensor found(DT_INT64, lookup.shape());
+  TF_ASSERT_OK(
+      table->Find(nullptr, lookup, &found, test::AsScalar<int64>(-1)));
+  test::ExpectTensorEqual<int64>(
+      test::AsTensor<int64>({0, -1, 999, -1, -1, 100}), found);
+}
+
+TEST(HashTableTest, FindStringBatches) {
+  // More keys than a prefetch batch, with misses in between.
+  const int64 n = 100;
+  Tensor keys(DT_STRING, TensorShape({n}));
+  Tensor values(DT_INT32, TensorShape({n}));
+  for (int64 i = 0; i < n; ++i) {
+    keys.flat<string>()(i) = Word(i);
+    values.flat<int32>()(i) = i;
+  }
+  auto table = MakeTable<string, int32>(keys, values);
+  core::ScopedUnref unref(table);
+
+  Tensor lookup(DT_STRING, TensorShape({2 * n}));
+  for (int64 i = 0; i < 2 * n; ++i) {
+    lookup.flat<string>()(i) = Word(i);
+  }
+  Tensor found(DT_INT32, lookup.shape());
+  TF_ASSERT_OK(
+      table->Find(nullptr, lookup, &found, test::AsScalar<int32>(-1)));
+  for (int64 i = 0; i < 2 * n; ++i) {
+    EXPECT_EQ(i < n ? i : -1, found.flat<int32>()(i));
+  }
+}
+
+TEST(HashTableTest, DifferentValueForSameKey) {
+  Tensor keys = test::AsTensor<int64>({1, 2, 1});
+  Tensor values = test::AsTensor<int64>({1, 2, 3});
+  auto table = new HashTable<int64, int64>(nullptr, nullptr);
+  core::ScopedUnref unref(table);
+  KeyValueTensorIterator iter(&keys, &values);
+  EXPECT_TRUE(errors::IsFailedPrecondition(table->Initialize(iter)));
+}
+
+// Looks up batches of 4096 keys, a tenth of which are missing, in a table of
+// num_keys keys.
+template <class K>
+void BM_Find(int iters, int num_keys, const std::function<K(int64)>& key) {
+  testing::StopTiming();
+  Tensor keys(DataTypeToEnum<K>::v(), TensorShape({num_keys}));
+  Tensor values(DT_INT64, TensorShape({num_keys}));
+  for (int64 i = 0; i < num_keys; ++i) {
+    keys.flat<K>()(i) = key(i);
+    values.flat<int64>()(i) = i;
+  }
+  auto table = MakeTable<K, int64>(keys, values);
+  core::ScopedUnref unref(table);
+
+  const int64 kBatch = 4096;
+  random::PhiloxRandom philox(301, 17);
+  random::SimplePhilox rnd(&philox);
+  Tensor lookup(DataTypeToEnum<K>::v(), TensorShape({kBatch}));
+  for (int64 i = 0; i < kBatch; ++i) {
+    lookup.flat<K>()(i) = key(rnd.Uniform64(num_keys + num_keys / 10));
+  }
+  Tensor found(DT_INT64, lookup.shape());
+  const Tensor default_value = test::AsScalar<int64>(-1);
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    TF_CHECK_OK(table->Find(nullptr, lookup, &found, default_value));
+  }
+  testing::ItemsProcessed(static_cast<int64>(iters) * kBatch);
+}
+
+static void BM_FindInt64(int iters, int num_keys) {
+  BM_Find<int64>(iters, num_keys, [](int64 i) { return i * 7919; });
+}
+BENCHMARK(BM_FindInt64)->Arg(1 << 10)->Arg(1 << 20)->Arg(10 << 20);
+
+static void BM_FindString(int iters, int num_keys) {
+  BM_Find<string>(iters, num_keys, Word);
+}
+BENCHMARK(BM_FindString)->Arg(1 << 10)->Arg(1 << 20)->Arg(10 << 20);
+
+}  // namespace
+}  // namespace lookup
+}  // namespace tensorflow
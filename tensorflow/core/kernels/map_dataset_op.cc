@@ -14,6 +14,9 @@ limitations under the License.
 ==============================================================================*/
 #include "tensorflow/core/kernels/dataset.h"
 
+#include <atomic>
+#include <deque>
+
 #include "tensorflow/core/common_runtime/function.h"
 #include "tensorflow/core/framework/partial_tensor_shape.h"
 #include "tensorflow/core/framework/tensor.h"
@@ -138,11 +141,139 @@ class MapDatasetOp : public UnaryDatasetOpKernel {
         // non-deterministic order.
 
         std::vector<Tensor> args;
-        TF_RETURN_IF_ERROR(input_impl_->GetNext(ctx, &args, end_of_sequence));
-        if (*end_of_sequence) {
-          return Status::OK();
+        bool have_args = false;
+        // Elements are only left over after a failed batch, so GetNext
+        // usually skips the lock.
+        if (has_pending_.load(std::memory_order_acquire)) {
+          mutex_lock l(mu_);
+          if (!pending_.empty()) {
+            args = std::move(pending_.front());
+            pending_.pop_front();
+            have_args = true;
+          }
+          has_pending_.store(!pending_.empty(), std::memory_order_release);
+        }
+        if (!have_args) {
+          TF_RETURN_IF_ERROR(
+              input_impl_->GetNext(ctx, &args, end_of_sequence));
+          if (*end_of_sequence) {
+            return Status::OK();
+          }
+        }
+        *end_of_sequence = false;
+        return Apply(ctx, std::move(args), out_tensors, end_of_sequence);
+      }
+
+      Status GetNextBatchInternal(
+          IteratorContext* ctx, int64 max_elements,
+          std::vector<std::vector<Tensor>>* out_elements,
+          bool* end_of_sequence) override {
+        // The input elements are mapped in place. Elements left over from
+        // an earlier call come first.
+        const size_t first = out_elements->size();
+        if (has_pending_.load(std::memory_order_acquire)) {
+          mutex_lock l(mu_);
+          while (!pending_.empty() &&
+                 static_cast<int64>(out_elements->size() - first) <
+                     max_elements) {
+            out_elements->push_back(std::move(pending_.front()));
+            pending_.pop_front();
+          }
+          has_pending_.store(!pending_.empty(), std::memory_order_release);
+        }
+        *end_of_sequence = false;
+        const int64 num_pending = out_elements->size() - first;
+        if (num_pending < max_elements) {
+          Status s = input_impl_->GetNextBatch(
+              ctx, max_elements - num_pending, out_elements, end_of_sequence);
+          if (!s.ok()) {
+            KeepPending(first, out_elements);
+            return s;
+          }
+        }
+        for (size_t i = first; i < out_elements->size(); ++i) {
+          std::vector<Tensor> args = std::move((*out_elements)[i]);
+          (*out_elements)[i].clear();
+          bool end_of_mapping = false;
+          Status s = Apply(ctx, std::move(args), &(*out_elements)[i],
+                           &end_of_mapping);
+          if (!s.ok() || end_of_mapping) {
+            // The input elements after `i` are mapped by the next call, as a
+            // sequence of GetNext() calls would have.
+            KeepPending(i + 1, out_elements);
+            out_elements->resize(i);
+            TF_RETURN_IF_ERROR(s);
+            *end_of_sequence = true;
+            break;
+          }
+        }
+        return Status::OK();
+      }
+
+     protected:
+      Status SaveInternal(IteratorStateWriter* writer) override {
+        mutex_lock l(mu_);
+        TF_RETURN_IF_ERROR(
+            writer->WriteScalar(full_name("pending_size"), pending_.size()));
+        for (size_t i = 0; i < pending_.size(); ++i) {
+          TF_RETURN_IF_ERROR(writer->WriteScalar(
+              full_name(strings::StrCat("pending_", i, "_size")),
+              pending_[i].size()));
+          for (size_t j = 0; j < pending_[i].size(); ++j) {
+            TF_RETURN_IF_ERROR(writer->WriteTensor(
+                full_name(strings::StrCat("pending_", i, "_", j)),
+                pending_[i][j]));
+          }
+        }
+        TF_RETURN_IF_ERROR(SaveParent(writer, input_impl_));
+        return Status::OK();
+      }
+
+      Status RestoreInternal(OpKernelContext* ctx,
+                             IteratorStateReader* reader) override {
+        mutex_lock l(mu_);
+        pending_.clear();
+        // Checkpoints written before elements could be left over have no
+        // "pending_size".
+        if (reader->Contains(full_name("pending_size"))) {
+          int64 pending_size;
+          TF_RETURN_IF_ERROR(
+              reader->ReadScalar(full_name("pending_size"), &pending_size));
+          for (int64 i = 0; i < pending_size; ++i) {
+            int64 element_size;
+            TF_RETURN_IF_ERROR(reader->ReadScalar(
+                full_name(strings::StrCat("pending_", i, "_size")),
+                &element_size));
+            pending_.emplace_back(element_size);
+            for (int64 j = 0; j < element_size; ++j) {
+              TF_RETURN_IF_ERROR(reader->ReadTensor(
+                  full_name(strings::StrCat("pending_", i, "_", j)),
+                  &pending_.back()[j]));
+            }
+          }
         }
+        has_pending_.store(!pending_.empty(), std::memory_order_release);
+        TF_RETURN_IF_ERROR(RestoreParent(ctx, reader, input_impl_));
+        return Status::OK();
+      }
+
+     private:
+      // Moves the input elements from `begin` on out of `*elements` and
+      // ahead of the other pending elements.
+      void KeepPending(size_t begin,
+                       std::vector<std::vector<Tensor>>* elements)
+          LOCKS_EXCLUDED(mu_) {
+        mutex_lock l(mu_);
+        pending_.insert(pending_.begin(),
+                        std::make_move_iterator(elements->begin() + begin),
+                        std::make_move_iterator(elements->end()));
+        elements->resize(begin);
+        has_pending_.store(!pending_.empty(), std::memory_order_release);
+      }
 
+      // Calls `f` on `args`.
+      Status Apply(IteratorContext* ctx, std::vector<Tensor> args,
+                   std::vector<Tensor>* out_tensors, bool* end_of_sequence) {
         FunctionLibraryRuntime::Options opts;
         opts.step_id = CapturedFunction::generate_step_id();
         ScopedStepContainer step_container(
@@ -168,20 +299,13 @@ class MapDatasetOp : public UnaryDatasetOpKernel {
         }
       }
 
-     protected:
-      Status SaveInternal(IteratorStateWriter* writer) override {
-        TF_RETURN_IF_ERROR(SaveParent(writer, input_impl_));
-        return Status::OK();
-      }
-
-      Status RestoreInternal(OpKernelContext* ctx,
-                             IteratorStateReader* reader) override {
-        TF_RETURN_IF_ERROR(RestoreParent(ctx, reader, input_impl_));
-        return Status::OK();
-      }
-
-     private:
       const std::unique_ptr<IteratorBase> input_impl_;
+      mutex mu_;
+      // Input elements pulled by GetNextBatch() but not mapped yet, because
+      // `f` ended the iteration or failed on an earlier element.
+      std::deque<std::vector<Tensor>> pending_ GUARDED_BY(mu_);
+      // Whether `pending_` may be non-empty, checked without `mu_`.
+      std::atomic<bool> has_pending_{false};
     };
 
     const DatasetBase* const input_;
@@ -19,6 +19,7 @@ limitations under the License.
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/kernels/captured_function.h"
 #include "tensorflow/core/kernels/dataset.h"
+#include "tensorflow/core/kernels/dataset_autotuner.h"
 #include "tensorflow/core/kernels/dataset_utils.h"
 #include "tensorflow/core/lib/gtl/cleanup.h"
 #include "tensorflow/core/lib/random/random.h"
@@ -68,9 +69,12 @@ class ParallelInterleaveDatasetOp : public UnaryDatasetOpKernel {
     int64 buffer_output_elements = 0;
     OP_REQUIRES_OK(ctx, ParseScalarArgument(ctx, "buffer_output_elements",
                                             &buffer_output_elements));
-    OP_REQUIRES(
-        ctx, buffer_output_elements > 0,
-        errors::InvalidArgument("`buffer_output_elements` must be > 0"));
+    OP_REQUIRES(ctx,
+                buffer_output_elements > 0 ||
+                    buffer_output_elements == dataset::kAutotune,
+                errors::InvalidArgument(
+                    "`buffer_output_elements` must be > 0, or ",
+                    dataset::kAutotune, " to tune it at runtime"));
 
     int64 prefetch_input_elements = 0;
     OP_REQUIRES_OK(ctx, ParseScalarArgument(ctx, "prefetch_input_elements",
@@ -187,7 +191,16 @@ class ParallelInterleaveDatasetOp : public UnaryDatasetOpKernel {
       explicit Iterator(const Params& params)
           : DatasetIterator<Dataset>(params),
             input_impl_(params.dataset->input_->MakeIterator(params.prefix)),
-            workers_(dataset()->num_threads()) {}
+            workers_(dataset()->num_threads()) {
+        if (dataset()->buffer_output_elements_ == dataset::kAutotune) {
+          // Bounded by the RAM budget once the size of elements is known.
+          // The cycle length is not tuned, since it determines the order of
+          // the outputs.
+          autotuner_.reset(new dataset::Autotuner(
+              strings::StrCat(prefix(), "::buffer_output_elements"),
+              dataset::AutotuneResource::kRam, dataset::AutotuneRamBudget()));
+        }
+      }
 
       ~Iterator() override {
         mutex_lock l(mu_);
@@ -206,6 +219,8 @@ class ParallelInterleaveDatasetOp : public UnaryDatasetOpKernel {
                              bool* end_of_sequence) override {
         mutex_lock l(mu_);
         TF_RETURN_IF_ERROR(EnsureWorkerThreadsStarted(ctx));
+        // When this call started waiting for an element, if it did.
+        uint64 wait_start = 0;
         while (!cancelled_) {
           // Wait for an item to become available, blocking if necessary. If we
           // are allowed to be sloppy, we can skip over input datasets that do
@@ -230,6 +245,11 @@ class ParallelInterleaveDatasetOp : public UnaryDatasetOpKernel {
                 block_count_ = 0;
               }
               *end_of_sequence = false;
+              if (autotuner_) {
+                const uint64 now =
+                    wait_start == 0 ? 0 : ctx->env()->NowMicros();
+                autotuner_->RecordConsumer(ctx, now - wait_start);
+              }
               Status s = current_worker->outputs.front().status;
               current_worker->outputs.front().output.swap(*out_tensors);
               current_worker->outputs.pop_front();
@@ -282,6 +302,9 @@ class ParallelInterleaveDatasetOp : public UnaryDatasetOpKernel {
           }
 
           if (must_wait_for_input) {
+            if (autotuner_ && wait_start == 0) {
+              wait_start = ctx->env()->NowMicros();
+            }
             // Wait for elements to become available.
             if (dataset()->sloppy_) {
               sloppy_cond_var_.wait(l);
@@ -415,19 +438,34 @@ class ParallelInterleaveDatasetOp : public UnaryDatasetOpKernel {
             while (!end_of_sequence) {
               // 3.a Produce an element!
               std::vector<Tensor> output_elem;
+              const bool autotune =
+                  dataset()->buffer_output_elements_ == dataset::kAutotune;
+              const uint64 start = autotune ? ctx->env()->NowMicros() : 0;
               s = iterator->GetNext(ctx.get(), &output_elem, &end_of_sequence);
+              const uint64 busy_micros =
+                  autotune ? ctx->env()->NowMicros() - start : 0;
 
               // 3.b Make it available to the client.
               {
                 mutex_lock l(mu_);
 
                 // Wait for space in the prefetch queue.
-                while (!cancelled_ && workers_[thread_index].outputs.size() ==
-                                          dataset()->buffer_output_elements_) {
+                while (!cancelled_ && workers_[thread_index].outputs.size() >=
+                                          BufferOutputElementsLocked()) {
                   workers_[thread_index].cond_var.wait(l);
                 }
                 if (cancelled_) return;
 
+                if (autotuner_ && !end_of_sequence) {
+                  int64 bytes = 0;
+                  for (const Tensor& t : output_elem) {
+                    bytes += t.TotalBytes();
+                  }
+                  // Every worker may buffer as many elements.
+                  autotuner_->RecordProducer(busy_micros,
+                                             bytes * dataset()->num_threads());
+                }
+
                 // Output the element.
                 workers_[thread_index].is_producing = !end_of_sequence;
                 if (!end_of_sequence) {
@@ -446,6 +484,11 @@ class ParallelInterleaveDatasetOp : public UnaryDatasetOpKernel {
         }
       }
 
+      size_t BufferOutputElementsLocked() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        return autotuner_ ? autotuner_->value()
+                          : dataset()->buffer_output_elements_;
+      }
+
       // Mutex & condition variable to guard mutable iterator internals and
       // coordinate among worker threads and client thread[s].
       mutex mu_;
@@ -473,6 +516,8 @@ class ParallelInterleaveDatasetOp : public UnaryDatasetOpKernel {
       size_t block_count_ GUARDED_BY(mu_) = 0;
       // Flag to instruct the worker threads to exit.
       bool cancelled_ GUARDED_BY(mu_) = false;
+      // Set if the output buffer of each worker is tuned at runtime.
+      std::unique_ptr<dataset::Autotuner> autotuner_ GUARDED_BY(mu_);
       // The worker threads. This must be last to ensure the
       // threads have exited before any other members are deallocated.
       // TODO(b/65178177): Avoid allocating additional threads.
@@ -22,6 +22,7 @@ limitations under the License.
 #include "tensorflow/core/lib/random/random.h"
 
 #include "tensorflow/core/kernels/captured_function.h"
+#include "tensorflow/core/kernels/dataset_autotuner.h"
 
 namespace tensorflow {
 
@@ -54,9 +55,12 @@ class ParallelMapDatasetOp : public UnaryDatasetOpKernel {
     int32 num_parallel_calls;
     OP_REQUIRES_OK(ctx, ParseScalarArgument(ctx, "num_parallel_calls",
                                             &num_parallel_calls));
-    OP_REQUIRES(ctx, num_parallel_calls > 0,
+    OP_REQUIRES(ctx,
+                num_parallel_calls > 0 ||
+                    num_parallel_calls == dataset::kAutotune,
                 errors::InvalidArgument(
-                    "num_parallel_calls must be greater than zero."));
+                    "num_parallel_calls must be greater than zero, or ",
+                    dataset::kAutotune, " to tune it at runtime."));
 
     std::unique_ptr<CapturedFunction> captured_func;
     OP_REQUIRES_OK(ctx, CapturedFunction::Create(ctx, func_, graph_def_version_,
@@ -105,8 +109,16 @@ class ParallelMapDatasetOp : public UnaryDatasetOpKernel {
      public:
       explicit Iterator(const Params& params)
           : DatasetIterator<Dataset>(params),
-            input_impl_(params.dataset->input_->MakeIterator(params.prefix)),
-            invocation_results_(params.dataset->num_parallel_calls_) {}
+            input_impl_(params.dataset->input_->MakeIterator(params.prefix)) {
+        if (dataset()->num_parallel_calls_ == dataset::kAutotune) {
+          autotuner_.reset(new dataset::Autotuner(
+              strings::StrCat(prefix(), "::num_parallel_calls"),
+              dataset::AutotuneResource::kCpu, dataset::AutotuneCpuBudget()));
+          invocation_results_.resize(autotuner_->max_value());
+        } else {
+          invocation_results_.resize(dataset()->num_parallel_calls_);
+        }
+      }
 
       ~Iterator() override {
         // TODO(mrry): Replace this cancellation logic with a
@@ -116,9 +128,9 @@ class ParallelMapDatasetOp : public UnaryDatasetOpKernel {
         // potentially-blocking iterators, when we add these.
         {
           mutex_lock l(mu_);
-          for (size_t i = 0; i < dataset()->num_parallel_calls_; ++i) {
-            if (invocation_results_[i].notification) {
-              invocation_results_[i].notification->WaitForNotification();
+          for (auto& result : invocation_results_) {
+            if (result.notification) {
+              result.notification->WaitForNotification();
             }
           }
         }
@@ -128,11 +140,44 @@ class ParallelMapDatasetOp : public UnaryDatasetOpKernel {
                              std::vector<Tensor>* out_tensors,
                              bool* end_of_sequence) override {
         mutex_lock l(mu_);
+        return GetNextLocked(ctx, out_tensors, end_of_sequence);
+      }
+
+      Status GetNextBatchInternal(
+          IteratorContext* ctx, int64 max_elements,
+          std::vector<std::vector<Tensor>>* out_elements,
+          bool* end_of_sequence) override {
+        mutex_lock l(mu_);
+        *end_of_sequence = false;
+        for (int64 i = 0; i < max_elements && !*end_of_sequence; ++i) {
+          out_elements->emplace_back();
+          TF_RETURN_IF_ERROR(
+              GetNextLocked(ctx, &out_elements->back(), end_of_sequence));
+          if (*end_of_sequence) {
+            out_elements->pop_back();
+          }
+        }
+        return Status::OK();
+      }
+
+     private:
+      struct InvocationResult {
+        Status status;
+        std::unique_ptr<Notification> notification;
+        std::vector<Tensor> return_values;
+        // When `func_` was called and returned, if autotuned.
+        uint64 start_micros = 0;
+        uint64 end_micros = 0;
+      };
 
-        // Ensure that there are `dataset()->num_parallel_calls_`
-        // invocations of `func_` outstanding at once.
+      Status GetNextLocked(IteratorContext* ctx,
+                           std::vector<Tensor>* out_tensors,
+                           bool* end_of_sequence)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        // Ensure that there are `NumParallelCallsLocked()` invocations
+        // of `func_` outstanding at once.
         while (!end_of_input_ && (num_inputs_consumed_ - num_outputs_consumed_ <
-                                  dataset()->num_parallel_calls_)) {
+                                  NumParallelCallsLocked())) {
           InvokeFunctionLocked(ctx);
         }
 
@@ -144,10 +189,21 @@ class ParallelMapDatasetOp : public UnaryDatasetOpKernel {
         // Read the next result out of `invocation_results_`, which
         // acts as a circular buffer.
         const size_t result_index =
-            num_outputs_consumed_ % dataset()->num_parallel_calls_;
+            num_outputs_consumed_ % invocation_results_.size();
         InvocationResult* result = &invocation_results_[result_index];
         *end_of_sequence = false;
         if (result->notification) {
+          if (autotuner_) {
+            int64 wait_micros = 0;
+            if (!result->notification->HasBeenNotified()) {
+              const uint64 start = ctx->env()->NowMicros();
+              result->notification->WaitForNotification();
+              wait_micros = ctx->env()->NowMicros() - start;
+            }
+            autotuner_->RecordConsumer(ctx, wait_micros);
+            autotuner_->RecordProducer(
+                result->end_micros - result->start_micros, 0);
+          }
           result->notification->WaitForNotification();
           if (result->status.ok()) {
             std::swap(*out_tensors, result->return_values);
@@ -157,23 +213,16 @@ class ParallelMapDatasetOp : public UnaryDatasetOpKernel {
         return result->status;
       }
 
-     private:
-      struct InvocationResult {
-        Status status;
-        std::unique_ptr<Notification> notification;
-        std::vector<Tensor> return_values;
-      };
-
       void InvokeFunctionLocked(IteratorContext* ctx)
           EXCLUSIVE_LOCKS_REQUIRED(mu_) {
         DCHECK(!end_of_input_);
         DCHECK(num_inputs_consumed_ - num_outputs_consumed_ <
-               dataset()->num_parallel_calls_);
+               NumParallelCallsLocked());
 
         // The result of invoking the function will be written into the next
         // slot in `invocation_results_`, which acts as a circular buffer.
         const size_t result_index =
-            num_inputs_consumed_ % dataset()->num_parallel_calls_;
+            num_inputs_consumed_ % invocation_results_.size();
         InvocationResult* result = &invocation_results_[result_index];
         *result = InvocationResult();
 
@@ -204,19 +253,34 @@ class ParallelMapDatasetOp : public UnaryDatasetOpKernel {
               });
           opts.step_container = step_container;
           opts.runner = ctx->runner();
+          Env* env = autotuner_ ? ctx->env() : nullptr;
+          if (env) {
+            result->start_micros = env->NowMicros();
+          }
           dataset()->captured_func_->RunAsync(
               opts, std::move(input_element), &result->return_values,
-              [result, step_container, result_index](Status ret_status) {
+              [result, step_container, result_index, env](Status ret_status) {
                 delete step_container;
+                if (env) {
+                  result->end_micros = env->NowMicros();
+                }
                 result->status.Update(ret_status);
                 result->notification->Notify();
               });
         }
       }
 
+      int64 NumParallelCallsLocked() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        return autotuner_ ? autotuner_->value()
+                          : dataset()->num_parallel_calls_;
+      }
+
       mutex mu_;
       const std::unique_ptr<IteratorBase> input_impl_ GUARDED_BY(mu_);
+      // Sized for the most parallel calls, which may be fewer at a time if
+      // autotuned.
       std::vector<InvocationResult> invocation_results_ GUARDED_BY(mu_);
+      std::unique_ptr<dataset::Autotuner> autotuner_ GUARDED_BY(mu_);
       bool end_of_input_ GUARDED_BY(mu_) = false;
       int64 num_inputs_consumed_ GUARDED_BY(mu_) = 0;
       int64 num_outputs_consumed_ GUARDED_BY(mu_) = 0;
@@ -17,6 +17,7 @@ limitations under the License.
 #include "tensorflow/core/framework/partial_tensor_shape.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/kernels/dataset.h"
+#include "tensorflow/core/kernels/dataset_autotuner.h"
 #include "tensorflow/core/lib/core/error_codes.pb.h"
 
 namespace tensorflow {
@@ -37,8 +38,10 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
     int64 buffer_size;
     OP_REQUIRES_OK(
         ctx, ParseScalarArgument<int64>(ctx, "buffer_size", &buffer_size));
-    OP_REQUIRES(ctx, buffer_size > 0,
-                errors::InvalidArgument("buffer_size must be > 0"));
+    OP_REQUIRES(
+        ctx, buffer_size > 0 || buffer_size == dataset::kAutotune,
+        errors::InvalidArgument("buffer_size must be > 0, or ",
+                                dataset::kAutotune, " to tune it at runtime"));
 
     *output = new Dataset(ctx, input, buffer_size);
   }
@@ -85,7 +88,15 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
      public:
       explicit Iterator(const Params& params)
           : DatasetIterator<Dataset>(params),
-            input_impl_(params.dataset->input_->MakeIterator(params.prefix)) {}
+            input_impl_(params.dataset->input_->MakeIterator(params.prefix)) {
+        if (dataset()->buffer_size_ == dataset::kAutotune) {
+          // Bounded by the shared RAM budget once the size of elements is
+          // known.
+          autotuner_.reset(new dataset::Autotuner(
+              strings::StrCat(prefix(), "::buffer_size"),
+              dataset::AutotuneResource::kRam, dataset::AutotuneRamBudget()));
+        }
+      }
 
       ~Iterator() override {
         // Signal the prefetch thread to terminate it. We will then
@@ -112,6 +123,7 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
         while (true) {
           // Wait until the next element in the buffer has been
           // produced, or we are shutting down.
+          const uint64 wait_start = WaitStartLocked(ctx);
           while (!cancelled_ && !prefetch_thread_finished_ && buffer_.empty()) {
             cond_var_.wait(l);
           }
@@ -122,6 +134,7 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
           }
 
           if (!buffer_.empty()) {
+            RecordConsumerLocked(ctx, wait_start);
             // A new element is available. Forward the status from
             // computing it, and (if we successfully got an element)
             // the output values.
@@ -146,6 +159,53 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
         }
       }
 
+      Status GetNextBatchInternal(
+          IteratorContext* ctx, int64 max_elements,
+          std::vector<std::vector<Tensor>>* out_elements,
+          bool* end_of_sequence) override {
+        mutex_lock l(mu_);
+        TF_RETURN_IF_ERROR(EnsurePrefetchThreadStarted(ctx));
+
+        *end_of_sequence = false;
+        int64 num_elements = 0;
+        while (num_elements < max_elements) {
+          uint64 wait_start = WaitStartLocked(ctx);
+          while (!cancelled_ && !prefetch_thread_finished_ && buffer_.empty()) {
+            cond_var_.wait(l);
+          }
+
+          if (cancelled_) {
+            return errors::Cancelled(
+                "PrefetchDatasetOp::Dataset::Iterator::GetNextBatch");
+          }
+
+          if (buffer_.empty()) {
+            DCHECK(prefetch_thread_finished_);
+            *end_of_sequence = true;
+            return Status::OK();
+          }
+
+          // Take everything available with one wakeup of the prefetch
+          // thread.
+          while (!buffer_.empty() && num_elements < max_elements) {
+            RecordConsumerLocked(ctx, wait_start);
+            wait_start = 0;
+            Status s = buffer_.front().status;
+            if (s.ok()) {
+              out_elements->emplace_back(std::move(buffer_.front().value));
+            }
+            buffer_.pop_front();
+            ++num_elements;
+            if (!s.ok()) {
+              cond_var_.notify_all();
+              return s;
+            }
+          }
+          cond_var_.notify_all();
+        }
+        return Status::OK();
+      }
+
      protected:
       Status SaveInternal(IteratorStateWriter* writer) override {
         // Acquire both locks to ensure that the prefetch thread and
@@ -242,7 +302,7 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
           // 1. Wait for a slot in the buffer.
           {
             mutex_lock l(mu_);
-            while (!cancelled_ && buffer_.size() == dataset()->buffer_size_) {
+            while (!cancelled_ && buffer_.size() >= BufferSizeLocked()) {
               cond_var_.wait(l);
             }
 
@@ -260,8 +320,12 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
           mutex_lock parent_l(parent_mu_);
           bool end_of_sequence;
           BufferElement buffer_element;
+          const bool autotune = dataset()->buffer_size_ == dataset::kAutotune;
+          const uint64 start = autotune ? ctx->env()->NowMicros() : 0;
           buffer_element.status = input_impl_->GetNext(
               ctx, &buffer_element.value, &end_of_sequence);
+          const uint64 busy_micros =
+              autotune ? ctx->env()->NowMicros() - start : 0;
           if (buffer_element.status.ok() && end_of_sequence) {
             mutex_lock l(mu_);
             prefetch_thread_finished_ = true;
@@ -272,12 +336,41 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
           // 3. Signal that the element has been produced.
           {
             mutex_lock l(mu_);
+            if (autotuner_) {
+              int64 bytes = 0;
+              for (const Tensor& t : buffer_element.value) {
+                bytes += t.TotalBytes();
+              }
+              autotuner_->RecordProducer(busy_micros, bytes);
+            }
             buffer_.push_back(std::move(buffer_element));
             cond_var_.notify_all();
           }
         }
       }
 
+      size_t BufferSizeLocked() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        return autotuner_ ? autotuner_->value() : dataset()->buffer_size_;
+      }
+
+      // When the consumer starts waiting for the buffer, 0 if it does not
+      // have to or the buffer size is fixed.
+      uint64 WaitStartLocked(IteratorContext* ctx)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        if (autotuner_ && buffer_.empty() && !prefetch_thread_finished_) {
+          return ctx->env()->NowMicros();
+        }
+        return 0;
+      }
+
+      void RecordConsumerLocked(IteratorContext* ctx, uint64 wait_start)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        if (autotuner_) {
+          autotuner_->RecordConsumer(
+              ctx, wait_start == 0 ? 0 : ctx->env()->NowMicros() - wait_start);
+        }
+      }
+
       Status WriteStatus(IteratorStateWriter* writer, size_t index,
                          const Status& status) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
         TF_RETURN_IF_ERROR(writer->WriteScalar(
@@ -327,6 +420,8 @@ class PrefetchDatasetOp : public UnaryDatasetOpKernel {
       std::unique_ptr<Thread> prefetch_thread_ GUARDED_BY(mu_);
       bool cancelled_ GUARDED_BY(mu_) = false;
       bool prefetch_thread_finished_ GUARDED_BY(mu_) = false;
+      // Set if the buffer size is tuned at runtime.
+      std::unique_ptr<dataset::Autotuner> autotuner_ GUARDED_BY(mu_);
     };
 
     const DatasetBase* const input_;
@@ -110,6 +110,26 @@ class RangeDatasetOp : public DatasetOpKernel {
         return Status::OK();
       }
 
+      Status GetNextBatchInternal(
+          IteratorContext* ctx, int64 max_elements,
+          std::vector<std::vector<Tensor>>* out_elements,
+          bool* end_of_sequence) override {
+        mutex_lock l(mu_);
+        *end_of_sequence = false;
+        for (int64 i = 0; i < max_elements; ++i) {
+          if ((dataset()->step_ > 0 && next_ >= dataset()->stop_) ||
+              (dataset()->step_ < 0 && next_ <= dataset()->stop_)) {
+            *end_of_sequence = true;
+            break;
+          }
+          Tensor value_tensor(cpu_allocator(), DT_INT64, {});
+          value_tensor.scalar<int64>()() = next_;
+          out_elements->emplace_back(1, std::move(value_tensor));
+          next_ += dataset()->step_;
+        }
+        return Status::OK();
+      }
+
      protected:
       Status SaveInternal(IteratorStateWriter* writer) override {
         mutex_lock l(mu_);
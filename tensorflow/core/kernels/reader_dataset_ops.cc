@@ -573,33 +573,24 @@ class TFRecordDatasetOp : public DatasetOpKernel {
                              std::vector<Tensor>* out_tensors,
                              bool* end_of_sequence) override {
         mutex_lock l(mu_);
-        do {
-          // We are currently processing a file, so try to read the next record.
-          if (reader_) {
-            Tensor result_tensor(cpu_allocator(), DT_STRING, {});
-            Status s = reader_->ReadRecord(&result_tensor.scalar<string>()());
-            if (s.ok()) {
-              out_tensors->emplace_back(std::move(result_tensor));
-              *end_of_sequence = false;
-              return Status::OK();
-            } else if (!errors::IsOutOfRange(s)) {
-              return s;
-            }
-
-            // We have reached the end of the current file, so maybe
-            // move on to next file.
-            ResetStreamsLocked();
-            ++current_file_index_;
-          }
+        return NextRecordLocked(ctx->env(), out_tensors, end_of_sequence);
+      }
 
-          // Iteration ends when there are no more files to process.
-          if (current_file_index_ == dataset()->filenames_.size()) {
-            *end_of_sequence = true;
-            return Status::OK();
+      Status GetNextBatchInternal(
+          IteratorContext* ctx, int64 max_elements,
+          std::vector<std::vector<Tensor>>* out_elements,
+          bool* end_of_sequence) override {
+        mutex_lock l(mu_);
+        *end_of_sequence = false;
+        for (int64 i = 0; i < max_elements && !*end_of_sequence; ++i) {
+          out_elements->emplace_back();
+          TF_RETURN_IF_ERROR(NextRecordLocked(
+              ctx->env(), &out_elements->back(), end_of_sequence));
+          if (*end_of_sequence) {
+            out_elements->pop_back();
           }
-
-          TF_RETURN_IF_ERROR(SetupStreamsLocked(ctx->env()));
-        } while (true);
+        }
+        return Status::OK();
       }
 
      protected:
@@ -609,8 +600,12 @@ class TFRecordDatasetOp : public DatasetOpKernel {
                                                current_file_index_));
 
         if (reader_) {
-          TF_RETURN_IF_ERROR(
-              writer->WriteScalar(full_name("offset"), reader_->TellOffset()));
+          // Records read ahead but not returned yet are read again after a
+          // restore.
+          const int64 offset = next_record_ < records_.size()
+                                   ? record_offset_
+                                   : reader_->TellOffset();
+          TF_RETURN_IF_ERROR(writer->WriteScalar(full_name("offset"), offset));
         }
         return Status::OK();
       }
@@ -633,6 +628,52 @@ class TFRecordDatasetOp : public DatasetOpKernel {
       }
 
      private:
+      // Number of records read from the file at once. They alias the
+      // reader's buffer until they are all returned.
+      static const int64 kRecordsPerRead = 64;
+
+      Status NextRecordLocked(Env* env, std::vector<Tensor>* out_tensors,
+                              bool* end_of_sequence)
+          EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        do {
+          // We are currently processing a file, so try to read the next record.
+          if (reader_) {
+            if (next_record_ == records_.size()) {
+              next_record_ = 0;
+              record_offset_ = reader_->TellOffset();
+              Status s = reader_->ReadRecords(kRecordsPerRead, &records_);
+              if (!s.ok() && !errors::IsOutOfRange(s)) {
+                return s;
+              }
+            }
+            if (next_record_ < records_.size()) {
+              const StringPiece record = records_[next_record_++];
+              record_offset_ += io::RecordReader::kHeaderSize + record.size() +
+                                io::RecordReader::kFooterSize;
+              Tensor result_tensor(cpu_allocator(), DT_STRING, {});
+              result_tensor.scalar<string>()().assign(record.data(),
+                                                      record.size());
+              out_tensors->emplace_back(std::move(result_tensor));
+              *end_of_sequence = false;
+              return Status::OK();
+            }
+
+            // We have reached the end of the current file, so maybe
+            // move on to next file.
+            ResetStreamsLocked();
+            ++current_file_index_;
+          }
+
+          // Iteration ends when there are no more files to process.
+          if (current_file_index_ == dataset()->filenames_.size()) {
+            *end_of_sequence = true;
+            return Status::OK();
+          }
+
+          TF_RETURN_IF_ERROR(SetupStreamsLocked(env));
+        } while (true);
+      }
+
       // Sets up reader streams to read from the file at `current_file_index_`.
       Status SetupStreamsLocked(Env* env) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
         if (current_file_index_ >= dataset()->filenames_.size()) {
@@ -652,6 +693,8 @@ class TFRecordDatasetOp : public DatasetOpKernel {
 
       // Resets all reader streams.
       void ResetStreamsLocked() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+        records_.clear();
+        next_record_ = 0;
         reader_.reset();
         file_.reset();
       }
@@ -663,6 +706,12 @@ class TFRecordDatasetOp : public DatasetOpKernel {
       // we must destroy `reader_` before `file_`.
       std::unique_ptr<RandomAccessFile> file_ GUARDED_BY(mu_);
       std::unique_ptr<io::SequentialRecordReader> reader_ GUARDED_BY(mu_);
+
+      // Records from the last ReadRecords() call, pointing into `reader_`.
+      std::vector<StringPiece> records_ GUARDED_BY(mu_);
+      size_t next_record_ GUARDED_BY(mu_) = 0;
+      // Offset of `records_[next_record_]` in the file.
+      uint64 record_offset_ GUARDED_BY(mu_) = 0;
     };
 
     const std::vector<string> filenames_;
@@ -13,6 +13,7 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <map>
 #include <unordered_map>
 
 #include <utility>
@@ -23,11 +24,14 @@ limitations under the License.
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/kernels/bounds_check.h"
+#include "tensorflow/core/lib/core/blocking_counter.h"
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/gtl/array_slice.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/lib/strings/stringprintf.h"
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/util/env_var.h"
 #include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
 #include "tensorflow/core/util/tensor_slice_reader.h"
 #include "tensorflow/core/util/tensor_slice_reader_cache.h"
@@ -240,34 +244,57 @@ Status RestoreTensorsV2(OpKernelContext* context, const Tensor& prefix,
   const auto& tensor_names_flat = tensor_names.flat<string>();
   const auto& shape_and_slices_flat = shape_and_slices.flat<string>();
 
-  BundleReader reader(Env::Default(), prefix_string);
+  // Restoring from mapped data files skips a copy of every tensor, and
+  // without checksums the restored tensors are only paged in when used.
+  BundleReader::Options options;
+  TF_RETURN_IF_ERROR(
+      ReadBoolFromEnvVar("TF_RESTORE_USE_MMAP", false, &options.use_mmap));
+  TF_RETURN_IF_ERROR(ReadBoolFromEnvVar("TF_RESTORE_VERIFY_CHECKSUMS", true,
+                                        &options.verify_checksums));
+
+  BundleReader reader(Env::Default(), prefix_string, options);
   TF_RETURN_IF_ERROR(reader.status());
 
-  // TODO(zongheng): potential optimization: one Seek() in first lookup.
-  // TODO(zongheng): consider measuring speed and issuing concurrent lookups
-  // within a fixed memory budget.
-  TensorShape restored_full_shape;
-  Tensor* restored_tensor = nullptr;
-  for (size_t i = 0; i < tensor_names_flat.size(); ++i) {
+  // Validates all the requests up front and groups them by the data file they
+  // read from, so that different data files are read in parallel.  Outputs
+  // that may alias a mapped data file are produced by the lookup, all others
+  // are allocated here.
+  const int num_tensors = static_cast<int>(tensor_names_flat.size());
+  std::vector<Tensor*> outputs(num_tensors, nullptr);
+  std::vector<Tensor> mapped(num_tensors);
+  std::vector<TensorSlice> slices(num_tensors);
+  std::map<int32, std::vector<int>> by_shard;
+  for (int i = 0; i < num_tensors; ++i) {
     const string& tensor_name = tensor_names_flat(i);
     const string& shape_and_slice = shape_and_slices_flat(i);
-    TF_RETURN_IF_ERROR(
-        reader.LookupTensorShape(tensor_name, &restored_full_shape));
+    DataType restored_dtype;
+    TensorShape restored_full_shape;
+    TF_RETURN_IF_ERROR(reader.LookupDtypeAndShape(tensor_name, &restored_dtype,
+                                                  &restored_full_shape));
+    if (dtypes[i] != restored_dtype) {
+      return errors::InvalidArgument(
+          "tensor_name = ", tensor_name, "; expected dtype ",
+          DataTypeString(dtypes[i]), " does not equal restored dtype ",
+          DataTypeString(restored_dtype));
+    }
+    int32 shard_id;
+    TF_RETURN_IF_ERROR(reader.LookupShardId(tensor_name, &shard_id));
 
     if (shape_and_slice.empty()) {
       // Lookup the full tensor.
-      TF_RETURN_IF_ERROR(
-          context->allocate_output(i, restored_full_shape, &restored_tensor));
-      TF_RETURN_IF_ERROR(reader.Lookup(tensor_name, restored_tensor));
+      if (!options.use_mmap || shard_id < 0 ||
+          !DataTypeCanUseMemcpy(restored_dtype)) {
+        TF_RETURN_IF_ERROR(
+            context->allocate_output(i, restored_full_shape, &outputs[i]));
+      }
     } else {
       // Lookup the slice.
       TensorShape parsed_full_shape;
-      TensorSlice parsed_slice;
       TensorShape parsed_slice_shape;
 
       TF_RETURN_IF_ERROR(
           checkpoint::ParseShapeAndSlice(shape_and_slice, &parsed_full_shape,
-                                         &parsed_slice, &parsed_slice_shape));
+                                         &slices[i], &parsed_slice_shape));
       if (!restored_full_shape.IsSameSize(parsed_full_shape)) {
         return errors::InvalidArgument(
             "tensor_name = ", tensor_name, "; shape in shape_and_slice spec ",
@@ -277,15 +304,55 @@ Status RestoreTensorsV2(OpKernelContext* context, const Tensor& prefix,
       }
 
       TF_RETURN_IF_ERROR(
-          context->allocate_output(i, parsed_slice_shape, &restored_tensor));
-      TF_RETURN_IF_ERROR(
-          reader.LookupSlice(tensor_name, parsed_slice, restored_tensor));
+          context->allocate_output(i, parsed_slice_shape, &outputs[i]));
     }
-    if (dtypes[i] != restored_tensor->dtype()) {
-      return errors::InvalidArgument(
-          "tensor_name = ", tensor_name, "; expected dtype ",
-          DataTypeString(dtypes[i]), " does not equal restored dtype ",
-          DataTypeString(restored_tensor->dtype()));
+    by_shard[shard_id].push_back(i);
+  }
+  if (by_shard.empty()) return Status::OK();
+
+  auto restore = [&](BundleReader* shard_reader,
+                     const std::vector<int>& indices) -> Status {
+    for (int i : indices) {
+      const string& tensor_name = tensor_names_flat(i);
+      if (!shape_and_slices_flat(i).empty()) {
+        TF_RETURN_IF_ERROR(
+            shard_reader->LookupSlice(tensor_name, slices[i], outputs[i]));
+      } else if (outputs[i] != nullptr) {
+        TF_RETURN_IF_ERROR(shard_reader->Lookup(tensor_name, outputs[i]));
+      } else {
+        TF_RETURN_IF_ERROR(shard_reader->Lookup(tensor_name, &mapped[i]));
+      }
+    }
+    return Status::OK();
+  };
+
+  // A BundleReader is not thread-safe, so every other group gets its own.
+  std::vector<Status> statuses(by_shard.size());
+  BlockingCounter counter(static_cast<int>(by_shard.size()) - 1);
+  thread::ThreadPool* workers =
+      context->device()->tensorflow_cpu_worker_threads()->workers;
+  auto group = by_shard.begin();
+  for (size_t g = 1; g < by_shard.size(); ++g) {
+    Status* status = &statuses[g];
+    const std::vector<int>* indices = &(++group)->second;
+    workers->Schedule([&, status, indices]() {
+      BundleReader shard_reader(Env::Default(), prefix_string, options);
+      *status = shard_reader.status();
+      if (status->ok()) {
+        *status = restore(&shard_reader, *indices);
+      }
+      counter.DecrementCount();
+    });
+  }
+  statuses[0] = restore(&reader, by_shard.begin()->second);
+  counter.Wait();
+  for (const Status& status : statuses) {
+    TF_RETURN_IF_ERROR(status);
+  }
+
+  for (int i = 0; i < num_tensors; ++i) {
+    if (outputs[i] == nullptr) {
+      context->set_output(i, mapped[i]);
     }
   }
   return Status::OK();
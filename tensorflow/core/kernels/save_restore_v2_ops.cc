@@ -15,6 +15,7 @@ limitations under the License.
 
 // See docs in ../ops/io_ops.cc.
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -37,6 +38,11 @@ namespace tensorflow {
 
 namespace {
 
+// SaveV2 starts another data file for every this many bytes, up to
+// kMaxDataShards.
+const int64 kBytesPerDataShard = 256LL << 20;
+const int64 kMaxDataShards = 8;
+
 // Shared validations of the inputs to the SaveV2 and RestoreV2 ops.
 void ValidateInputs(bool is_save_op, OpKernelContext* context,
                     const Tensor& prefix, const Tensor& tensor_names,
@@ -105,7 +111,18 @@ class SaveV2 : public OpKernel {
     const auto& tensor_names_flat = tensor_names.flat<string>();
     const auto& shape_and_slices_flat = shape_and_slices.flat<string>();
 
-    BundleWriter writer(Env::Default(), prefix_string);
+    // Aligned entries can be restored from a mapped data file without a copy.
+    // Large checkpoints are written as several data files in parallel; their
+    // number only depends on the tensors, so the bundle is deterministic.
+    int64 total_bytes = 0;
+    for (int i = 0; i < num_tensors; ++i) {
+      total_bytes += context->input(i + kFixedInputs).TotalBytes();
+    }
+    BundleWriter::Options options;
+    options.data_alignment = EIGEN_MAX_ALIGN_BYTES;
+    options.num_data_shards = static_cast<int>(std::min(
+        kMaxDataShards, 1 + total_bytes / kBytesPerDataShard));
+    BundleWriter writer(Env::Default(), prefix_string, options);
     OP_REQUIRES_OK(context, writer.status());
     VLOG(1) << "BundleWriter, prefix_string: " << prefix_string;
 
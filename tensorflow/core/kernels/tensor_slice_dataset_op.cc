@@ -131,6 +131,29 @@ class TensorSliceDatasetOp : public DatasetOpKernel {
         return Status::OK();
       }
 
+      Status GetNextBatchInternal(
+          IteratorContext* ctx, int64 max_elements,
+          std::vector<std::vector<Tensor>>* out_elements,
+          bool* end_of_sequence) override {
+        mutex_lock l(mu_);
+        const int64 num_elements = std::min(max_elements, n_ - i_);
+        out_elements->reserve(out_elements->size() + num_elements);
+        for (int64 j = 0; j < num_elements; ++j, ++i_) {
+          out_elements->emplace_back();
+          std::vector<Tensor>* out_tensors = &out_elements->back();
+          out_tensors->reserve(dataset()->tensors_.size());
+          for (int i = 0; i < dataset()->tensors_.size(); ++i) {
+            const Tensor& t = dataset()->tensors_[i];
+            Tensor t_slice(cpu_allocator(), t.dtype(),
+                           TensorShape(dataset()->shapes_[i].dim_sizes()));
+            TF_RETURN_IF_ERROR(batch_util::CopySliceToElement(t, &t_slice, i_));
+            out_tensors->emplace_back(std::move(t_slice));
+          }
+        }
+        *end_of_sequence = num_elements < max_elements;
+        return Status::OK();
+      }
+
      protected:
       Status SaveInternal(IteratorStateWriter* writer) override {
         mutex_lock l(mu_);
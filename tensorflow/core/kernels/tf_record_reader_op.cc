@@ -16,6 +16,7 @@ limitations under the License.
 // See docs in ../ops/io_ops.cc.
 
 #include <memory>
+#include <vector>
 #include "tensorflow/core/framework/reader_base.h"
 #include "tensorflow/core/framework/reader_op_kernel.h"
 #include "tensorflow/core/lib/core/errors.h"
@@ -36,6 +37,8 @@ class TFRecordReader : public ReaderBase {
 
   Status OnWorkStartedLocked() override {
     offset_ = 0;
+    records_.clear();
+    next_record_ = 0;
     TF_RETURN_IF_ERROR(env_->NewRandomAccessFile(current_work(), &file_));
 
     io::RecordReaderOptions options =
@@ -45,6 +48,8 @@ class TFRecordReader : public ReaderBase {
   }
 
   Status OnWorkFinishedLocked() override {
+    records_.clear();
+    next_record_ = 0;
     reader_.reset(nullptr);
     file_.reset(nullptr);
     return Status::OK();
@@ -52,19 +57,29 @@ class TFRecordReader : public ReaderBase {
 
   Status ReadLocked(string* key, string* value, bool* produced,
                     bool* at_end) override {
-    *key = strings::StrCat(current_work(), ":", offset_);
-    Status status = reader_->ReadRecord(&offset_, value);
-    if (errors::IsOutOfRange(status)) {
-      *at_end = true;
-      return Status::OK();
+    if (next_record_ == records_.size()) {
+      next_record_ = 0;
+      uint64 end = offset_;
+      Status status = reader_->ReadRecords(&end, kRecordsPerRead, &records_);
+      if (errors::IsOutOfRange(status)) {
+        *at_end = true;
+        return Status::OK();
+      }
+      if (!status.ok()) return status;
     }
-    if (!status.ok()) return status;
+    const StringPiece record = records_[next_record_++];
+    *key = strings::StrCat(current_work(), ":", offset_);
+    value->assign(record.data(), record.size());
+    offset_ += io::RecordReader::kHeaderSize + record.size() +
+               io::RecordReader::kFooterSize;
     *produced = true;
     return Status::OK();
   }
 
   Status ResetLocked() override {
     offset_ = 0;
+    records_.clear();
+    next_record_ = 0;
     reader_.reset(nullptr);
     file_.reset(nullptr);
     return ReaderBase::ResetLocked();
@@ -73,10 +88,17 @@ class TFRecordReader : public ReaderBase {
   // TODO(josh11b): Implement serializing and restoring the state.
 
  private:
+  // Number of records read from the file at once.
+  static const int64 kRecordsPerRead = 64;
+
   Env* const env_;
+  // Offset of the next record to return.
   uint64 offset_;
   std::unique_ptr<RandomAccessFile> file_;
   std::unique_ptr<io::RecordReader> reader_;
+  // Records from the last ReadRecords() call, pointing into `reader_`.
+  std::vector<StringPiece> records_;
+  size_t next_record_ = 0;
   string compression_type_ = "";
 };
 
@@ -18,18 +18,21 @@ limitations under the License.
 
 // SSE4.2 accelerated CRC32c.
 
-// See if the SSE4.2 crc32c instruction is available.
+// See if the SSE4.2 crc32c instruction is available. Unless the whole build
+// targets SSE4.2, only AcceleratedExtend is compiled for it, and it is only
+// called after CanAccelerate checked the cpu at runtime.
 #undef USE_SSE_CRC32C
-#ifdef __SSE4_2__
-#if defined(__x86_64__) && defined(__GNUC__) && \
-    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
-#define USE_SSE_CRC32C 1
-#elif defined(__x86_64__) && defined(__clang__)
+#if defined(__x86_64__) && defined(__clang__)
 #if __has_builtin(__builtin_cpu_supports)
 #define USE_SSE_CRC32C 1
 #endif
+#elif defined(__x86_64__) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_SSE_CRC32C 1
+#elif defined(__SSE4_2__) && defined(__x86_64__) && defined(__GNUC__) && \
+    (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)
+#define USE_SSE_CRC32C 1
 #endif
-#endif /* __SSE4_2__ */
 
 // This version of Apple clang has a bug:
 // https://llvm.org/bugs/show_bug.cgi?id=25510
@@ -57,6 +60,9 @@ uint32_t AcceleratedExtend(uint32_t crc, const char *buf, size_t size) {
 // SSE4.2 optimized crc32c computation.
 bool CanAccelerate() { return __builtin_cpu_supports("sse4.2"); }
 
+#ifndef __SSE4_2__
+__attribute__((target("sse4.2")))
+#endif
 uint32_t AcceleratedExtend(uint32_t crc, const char *buf, size_t size) {
   const uint8_t *p = reinterpret_cast<const uint8_t *>(buf);
   const uint8_t *e = p + size;
@@ -17,6 +17,8 @@ limitations under the License.
 
 #include <limits.h>
 
+#include <algorithm>
+
 #include "tensorflow/core/lib/core/coding.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/hash/crc32c.h"
@@ -28,6 +30,16 @@ limitations under the License.
 namespace tensorflow {
 namespace io {
 
+namespace {
+
+// Minimum number of bytes ReadRecords() reads at once.
+const size_t kReadaheadSize = 256 << 10;
+
+}  // namespace
+
+const size_t RecordReader::kHeaderSize;
+const size_t RecordReader::kFooterSize;
+
 RecordReaderOptions RecordReaderOptions::CreateRecordReaderOptions(
     const string& compression_type) {
   RecordReaderOptions options;
@@ -57,22 +69,23 @@ RecordReaderOptions RecordReaderOptions::CreateRecordReaderOptions(
 RecordReader::RecordReader(RandomAccessFile* file,
                            const RecordReaderOptions& options)
     : src_(file), options_(options) {
-  if (options.buffer_size > 0) {
-    input_stream_.reset(new BufferedInputStream(file, options.buffer_size));
-  } else {
-    input_stream_.reset(new RandomAccessInputStream(file));
-  }
   if (options.compression_type == RecordReaderOptions::ZLIB_COMPRESSION) {
 // We don't have zlib available on all embedded platforms, so fail.
 #if defined(IS_SLIM_BUILD)
     LOG(FATAL) << "Zlib compression is unsupported on mobile platforms.";
 #else   // IS_SLIM_BUILD
+    if (options.buffer_size > 0) {
+      input_stream_.reset(new BufferedInputStream(file, options.buffer_size));
+    } else {
+      input_stream_.reset(new RandomAccessInputStream(file));
+    }
     zlib_input_stream_.reset(new ZlibInputStream(
         input_stream_.get(), options.zlib_options.input_buffer_size,
         options.zlib_options.output_buffer_size, options.zlib_options));
 #endif  // IS_SLIM_BUILD
   } else if (options.compression_type == RecordReaderOptions::NONE) {
-    // Nothing to do.
+    // Nothing to do.  Uncompressed records are read straight from the file,
+    // through the readahead buffer if buffer_size is set.
   } else {
     LOG(FATAL) << "Unspecified compression type :" << options.compression_type;
   }
@@ -99,7 +112,7 @@ Status RecordReader::ReadChecksummed(uint64 offset, size_t n,
     // No checks are done to validate that the file is being read
     // sequentially.  At some point the zlib input buffer may support
     // seeking, possibly inefficiently.
-    TF_RETURN_IF_ERROR(zlib_input_stream_->ReadNBytes(expected, storage));
+    TF_RETURN_IF_ERROR(ReadFromStream(expected, storage));
 
     if (storage->size() != expected) {
       if (storage->empty()) {
@@ -117,27 +130,24 @@ Status RecordReader::ReadChecksummed(uint64 offset, size_t n,
   } else {
 #endif  // IS_SLIM_BUILD
     if (options_.buffer_size > 0) {
-      // If we have a buffer, we assume that the file is being read
-      // sequentially, and we use the underlying implementation to read the
-      // data.
-      //
-      // No checks are done to validate that the file is being read
-      // sequentially.
-      TF_RETURN_IF_ERROR(input_stream_->ReadNBytes(expected, storage));
-
-      if (storage->size() != expected) {
-        if (storage->empty()) {
-          return errors::OutOfRange("eof");
-        } else {
+      // Reads through the readahead buffer, which is filled straight from the
+      // file, so that consecutive records take one file read.
+      SeekReadahead(offset);
+      Status s = Readahead(expected);
+      if (!s.ok()) {
+        if (errors::IsOutOfRange(s) && readahead_end_ > readahead_pos_) {
           return errors::DataLoss("truncated record at ", offset);
         }
+        return errors::IsOutOfRange(s) ? errors::OutOfRange("eof") : s;
       }
 
-      const uint32 masked_crc = core::DecodeFixed32(storage->data() + n);
-      if (crc32c::Unmask(masked_crc) != crc32c::Value(storage->data(), n)) {
+      const char* data = readahead_.data() + readahead_pos_;
+      const uint32 masked_crc = core::DecodeFixed32(data + n);
+      if (crc32c::Unmask(masked_crc) != crc32c::Value(data, n)) {
         return errors::DataLoss("corrupted record at ", offset);
       }
-      *result = StringPiece(storage->data(), n);
+      readahead_pos_ += expected;
+      *result = StringPiece(data, n);
     } else {
       // This version supports reading from arbitrary offsets
       // since we are accessing the random access file directly.
@@ -164,9 +174,6 @@ Status RecordReader::ReadChecksummed(uint64 offset, size_t n,
 }
 
 Status RecordReader::ReadRecord(uint64* offset, string* record) {
-  static const size_t kHeaderSize = sizeof(uint64) + sizeof(uint32);
-  static const size_t kFooterSize = sizeof(uint32);
-
   // Read header data.
   StringPiece lbuf;
   Status s = ReadChecksummed(*offset, sizeof(uint64), &lbuf, record);
@@ -196,16 +203,159 @@ Status RecordReader::ReadRecord(uint64* offset, string* record) {
   return Status::OK();
 }
 
-Status RecordReader::SkipNBytes(uint64 offset) {
+InputStreamInterface* RecordReader::stream() {
 #if !defined(IS_SLIM_BUILD)
-  if (zlib_input_stream_) {
-    TF_RETURN_IF_ERROR(zlib_input_stream_->SkipNBytes(offset));
+  return zlib_input_stream_.get();
+#else
+  return nullptr;
+#endif  // IS_SLIM_BUILD
+}
+
+void RecordReader::SeekReadahead(uint64 offset) {
+  if (offset >= readahead_offset_ &&
+      offset <= readahead_offset_ + readahead_end_) {
+    readahead_pos_ = offset - readahead_offset_;
   } else {
-#endif
-    if (options_.buffer_size > 0) {
-      TF_RETURN_IF_ERROR(input_stream_->SkipNBytes(offset));
+    readahead_offset_ = offset;
+    readahead_pos_ = readahead_end_ = 0;
+  }
+}
+
+Status RecordReader::ReadFromStream(size_t n, string* result) {
+  const size_t buffered = std::min(n, readahead_end_ - readahead_pos_);
+  if (buffered == 0) {
+    return stream()->ReadNBytes(n, result);
+  }
+  result->assign(readahead_.data() + readahead_pos_, buffered);
+  readahead_pos_ += buffered;
+  if (buffered == n) {
+    return Status::OK();
+  }
+  Status s = stream()->ReadNBytes(n - buffered, &stream_chunk_);
+  result->append(stream_chunk_);
+  return s;
+}
+
+Status RecordReader::Readahead(size_t n) {
+  if (readahead_end_ - readahead_pos_ >= n) {
+    return Status::OK();
+  }
+  if (readahead_pos_ + n > readahead_.size()) {
+    memmove(&readahead_[0], readahead_.data() + readahead_pos_,
+            readahead_end_ - readahead_pos_);
+    readahead_offset_ += readahead_pos_;
+    readahead_end_ -= readahead_pos_;
+    readahead_pos_ = 0;
+    const size_t capacity = std::max<size_t>(
+        n, std::max<int64>(options_.buffer_size, kReadaheadSize));
+    if (readahead_.size() < capacity) {
+      readahead_.resize(capacity);
+    }
+  }
+
+  InputStreamInterface* const input = stream();
+  while (readahead_end_ - readahead_pos_ < n) {
+    const size_t desired = readahead_.size() - readahead_end_;
+    char* const dst = &readahead_[readahead_end_];
+    size_t read = 0;
+    Status s;
+    if (input != nullptr) {
+      s = input->ReadNBytes(desired, &stream_chunk_);
+      read = stream_chunk_.size();
+      memcpy(dst, stream_chunk_.data(), read);
+    } else {
+      StringPiece data;
+      s = src_->Read(readahead_offset_ + readahead_end_, desired, &data, dst);
+      read = data.size();
+      if (data.data() != dst) {
+        memmove(dst, data.data(), read);
+      }
+    }
+    readahead_end_ += read;
+    if (!s.ok()) {
+      if (errors::IsOutOfRange(s) && readahead_end_ - readahead_pos_ >= n) {
+        break;
+      }
+      return s;
+    }
+    if (read == 0) {
+      return errors::OutOfRange("eof");
+    }
+  }
+  return Status::OK();
+}
+
+Status RecordReader::ReadRecords(uint64* offset, int64 n,
+                                 std::vector<StringPiece>* records) {
+  records->clear();
+  if (stream() == nullptr) {
+    SeekReadahead(*offset);
+  }
+
+  Status s;
+  while (records->size() < n) {
+    // Stops before the buffer would have to move under the records so far.
+    if (!records->empty() && readahead_pos_ + kHeaderSize > readahead_.size()) {
+      break;
+    }
+    s = Readahead(kHeaderSize);
+    if (!s.ok()) {
+      if (errors::IsOutOfRange(s) && readahead_end_ > readahead_pos_) {
+        s = errors::DataLoss("truncated record at ", *offset);
+      }
+      break;
     }
+    const char* header = readahead_.data() + readahead_pos_;
+    const uint32 masked_length_crc =
+        core::DecodeFixed32(header + sizeof(uint64));
+    if (crc32c::Unmask(masked_length_crc) !=
+        crc32c::Value(header, sizeof(uint64))) {
+      s = errors::DataLoss("corrupted record at ", *offset);
+      break;
+    }
+    const uint64 length = core::DecodeFixed64(header);
+    if (length >= SIZE_MAX - kHeaderSize - kFooterSize) {
+      s = errors::DataLoss("record size too large");
+      break;
+    }
+
+    const size_t record_size = kHeaderSize + length + kFooterSize;
+    if (!records->empty() && readahead_pos_ + record_size > readahead_.size()) {
+      break;
+    }
+    s = Readahead(record_size);
+    if (!s.ok()) {
+      if (errors::IsOutOfRange(s)) {
+        s = errors::DataLoss("truncated record at ", *offset);
+      }
+      break;
+    }
+    const char* data = readahead_.data() + readahead_pos_ + kHeaderSize;
+    const uint32 masked_data_crc = core::DecodeFixed32(data + length);
+    if (crc32c::Unmask(masked_data_crc) != crc32c::Value(data, length)) {
+      s = errors::DataLoss("corrupted record at ", *offset);
+      break;
+    }
+
+    records->emplace_back(data, length);
+    readahead_pos_ += record_size;
+    *offset += record_size;
   }
+  // The failed record is read again by the next call.
+  return records->empty() ? s : Status::OK();
+}
+
+Status RecordReader::SkipNBytes(uint64 offset) {
+#if !defined(IS_SLIM_BUILD)
+  if (zlib_input_stream_) {
+    // Skips what was read ahead first.
+    const size_t buffered =
+        std::min<uint64>(offset, readahead_end_ - readahead_pos_);
+    readahead_pos_ += buffered;
+    TF_RETURN_IF_ERROR(zlib_input_stream_->SkipNBytes(offset - buffered));
+  }
+#endif  // IS_SLIM_BUILD
+  // Uncompressed records are read from the offset they are asked for.
   return Status::OK();
 }
 
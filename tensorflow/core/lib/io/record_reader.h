@@ -16,6 +16,8 @@ limitations under the License.
 #ifndef TENSORFLOW_LIB_IO_RECORD_READER_H_
 #define TENSORFLOW_LIB_IO_RECORD_READER_H_
 
+#include <vector>
+
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
 #if !defined(IS_SLIM_BUILD)
@@ -58,6 +60,14 @@ class RecordReaderOptions {
 // Note: this class is not thread safe; external synchronization required.
 class RecordReader {
  public:
+  // Format of a single record:
+  //  uint64    length
+  //  uint32    masked crc of length
+  //  byte      data[length]
+  //  uint32    masked crc of data
+  static const size_t kHeaderSize = sizeof(uint64) + sizeof(uint32);
+  static const size_t kFooterSize = sizeof(uint32);
+
   // Create a reader that will return log records from "*file".
   // "*file" must remain live while this Reader is in use.
   explicit RecordReader(
@@ -74,6 +84,21 @@ class RecordReader {
   // sequential.
   Status ReadRecord(uint64* offset, string* record);
 
+  // Reads up to "n" records starting at "*offset" into "*records", and
+  // updates "*offset" to point past the last of them.  The records alias a
+  // readahead buffer, which is filled in chunks of at least 256KB or
+  // buffer_size, and stay valid until the next call on this reader.
+  //
+  // Fewer than "n" records are returned at the end of the readahead buffer or
+  // of the file, or before a record that fails to read, whose error is then
+  // returned by the next call.  Returns OUT_OF_RANGE if there are no more
+  // records, or something else for an error.
+  //
+  // Note: if buffering is used (with or without compression), access must be
+  // sequential, but may mix ReadRecord() and ReadRecords().
+  Status ReadRecords(uint64* offset, int64 n,
+                     std::vector<StringPiece>* records);
+
   // Skip the records till "offset". Returns OK on success,
   // OUT_OF_RANGE for end of file, or something else for an error.
   Status SkipNBytes(uint64 offset);
@@ -82,13 +107,39 @@ class RecordReader {
   Status ReadChecksummed(uint64 offset, size_t n, StringPiece* result,
                          string* storage);
 
+  // The stream to read from if compression is used, otherwise nullptr.
+  InputStreamInterface* stream();
+
+  // Without a stream(), moves the readahead buffer to file offset "offset",
+  // keeping what was read ahead if "offset" is in it.
+  void SeekReadahead(uint64 offset);
+
+  // Reads "n" bytes from stream(), starting with those read ahead.
+  Status ReadFromStream(size_t n, string* result);
+
+  // Makes at least "n" bytes available in the readahead buffer from
+  // readahead_pos_ on, moving the unconsumed bytes to its front first if
+  // they do not fit.  Returns OUT_OF_RANGE if the file ends before.
+  Status Readahead(size_t n);
+
   RandomAccessFile* src_;
   RecordReaderOptions options_;
+  // The compressed input, only used with compression.
   std::unique_ptr<InputStreamInterface> input_stream_;
 #if !defined(IS_SLIM_BUILD)
   std::unique_ptr<ZlibInputStream> zlib_input_stream_;
 #endif  // IS_SLIM_BUILD
 
+  // Bytes read ahead, of which [readahead_pos_, readahead_end_) are not
+  // consumed yet.  Without a stream(), they are read straight from src_ and
+  // readahead_[0] is at readahead_offset_ in the file.
+  string readahead_;
+  size_t readahead_pos_ = 0;
+  size_t readahead_end_ = 0;
+  uint64 readahead_offset_ = 0;
+  // What the last read from stream() returned.
+  string stream_chunk_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(RecordReader);
 };
 
@@ -111,6 +162,11 @@ class SequentialRecordReader {
     return underlying_.ReadRecord(&offset_, record);
   }
 
+  // Reads up to "n" next records, see RecordReader::ReadRecords().
+  Status ReadRecords(int64 n, std::vector<StringPiece>* records) {
+    return underlying_.ReadRecords(&offset_, n, records);
+  }
+
   // Returns the current offset in the file.
   uint64 TellOffset() { return offset_; }
 
@@ -25,6 +25,7 @@ limitations under the License.
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
 
 namespace tensorflow {
 
@@ -105,4 +106,188 @@ TEST(RecordReaderWriterTest, TestZlib) {
   }
 }
 
+// Writes `n` records of increasing sizes, the last ones larger than the
+// readahead buffer.
+static std::vector<string> WriteRecords(const string& fname, int n,
+                                        io::RecordWriterOptions options) {
+  std::vector<string> records;
+  std::unique_ptr<WritableFile> file;
+  TF_CHECK_OK(Env::Default()->NewWritableFile(fname, &file));
+  {
+    io::RecordWriter writer(file.get(), options);
+    for (int i = 0; i < n; ++i) {
+      records.emplace_back(i * i * 1000, 'a' + i % 26);
+      TF_CHECK_OK(writer.WriteRecord(records.back()));
+    }
+  }
+  TF_CHECK_OK(file->Close());
+  return records;
+}
+
+TEST(RecordReaderWriterTest, TestReadRecords) {
+  Env* env = Env::Default();
+  string fname = testing::TmpDir() + "/record_reader_writer_batch_test";
+
+  for (auto compression : {io::RecordWriterOptions::NONE,
+                           io::RecordWriterOptions::ZLIB_COMPRESSION}) {
+    io::RecordWriterOptions write_options;
+    write_options.compression_type = compression;
+    const std::vector<string> expected = WriteRecords(fname, 30, write_options);
+
+    for (int64 buffer_size : {0, 7, 65536}) {
+      if (compression != io::RecordWriterOptions::NONE && buffer_size == 0) {
+        continue;
+      }
+      std::unique_ptr<RandomAccessFile> read_file;
+      TF_CHECK_OK(env->NewRandomAccessFile(fname, &read_file));
+      io::RecordReaderOptions options;
+      options.compression_type =
+          compression == io::RecordWriterOptions::NONE
+              ? io::RecordReaderOptions::NONE
+              : io::RecordReaderOptions::ZLIB_COMPRESSION;
+      options.buffer_size = buffer_size;
+      io::RecordReader reader(read_file.get(), options);
+
+      uint64 offset = 0;
+      std::vector<StringPiece> records;
+      size_t next = 0;
+      while (next < expected.size()) {
+        // Mixes single and batched reads.
+        if (next % 5 == 4) {
+          string record;
+          TF_ASSERT_OK(reader.ReadRecord(&offset, &record));
+          EXPECT_EQ(expected[next++], record);
+          continue;
+        }
+        TF_ASSERT_OK(reader.ReadRecords(&offset, 3, &records));
+        ASSERT_LE(1, records.size());
+        ASSERT_GE(3, records.size());
+        for (StringPiece record : records) {
+          ASSERT_LT(next, expected.size());
+          EXPECT_EQ(expected[next++], record);
+        }
+      }
+      EXPECT_TRUE(
+          errors::IsOutOfRange(reader.ReadRecords(&offset, 3, &records)));
+      EXPECT_TRUE(records.empty());
+    }
+  }
+}
+
+TEST(RecordReaderWriterTest, TestReadRecordsSeek) {
+  Env* env = Env::Default();
+  string fname = testing::TmpDir() + "/record_reader_writer_seek_test";
+  const std::vector<string> expected =
+      WriteRecords(fname, 10, io::RecordWriterOptions());
+
+  std::unique_ptr<RandomAccessFile> read_file;
+  TF_CHECK_OK(env->NewRandomAccessFile(fname, &read_file));
+  io::SequentialRecordReader reader(read_file.get());
+  std::vector<StringPiece> records;
+  // The batch ends where the readahead buffer does.
+  TF_ASSERT_OK(reader.ReadRecords(100, &records));
+  ASSERT_LT(4, records.size());
+  ASSERT_GT(expected.size(), records.size());
+
+  // Skips the first two records.
+  io::SequentialRecordReader seek_reader(read_file.get());
+  uint64 offset = 0;
+  for (int i = 0; i < 2; ++i) {
+    offset += io::RecordReader::kHeaderSize + expected[i].size() +
+              io::RecordReader::kFooterSize;
+  }
+  TF_ASSERT_OK(seek_reader.SeekOffset(offset));
+  TF_ASSERT_OK(seek_reader.ReadRecords(2, &records));
+  ASSERT_EQ(2, records.size());
+  EXPECT_EQ(expected[2], records[0]);
+  EXPECT_EQ(expected[3], records[1]);
+  EXPECT_EQ(offset + 2 * io::RecordReader::kHeaderSize + expected[2].size() +
+                expected[3].size() + 2 * io::RecordReader::kFooterSize,
+            seek_reader.TellOffset());
+}
+
+TEST(RecordReaderWriterTest, TestReadRecordsCorrupted) {
+  Env* env = Env::Default();
+  string fname = testing::TmpDir() + "/record_reader_writer_corrupt_test";
+  const std::vector<string> expected =
+      WriteRecords(fname, 4, io::RecordWriterOptions());
+
+  // Flips a byte in the data of the third record.
+  string contents;
+  TF_CHECK_OK(ReadFileToString(env, fname, &contents));
+  uint64 offset = 0;
+  for (int i = 0; i < 2; ++i) {
+    offset += io::RecordReader::kHeaderSize + expected[i].size() +
+              io::RecordReader::kFooterSize;
+  }
+  contents[offset + io::RecordReader::kHeaderSize] ^= 1;
+  TF_CHECK_OK(WriteStringToFile(env, fname, contents));
+
+  std::unique_ptr<RandomAccessFile> read_file;
+  TF_CHECK_OK(env->NewRandomAccessFile(fname, &read_file));
+  io::RecordReader reader(read_file.get());
+  uint64 read_offset = 0;
+  std::vector<StringPiece> records;
+  // The records before the corrupted one come first, then the error.
+  TF_ASSERT_OK(reader.ReadRecords(&read_offset, 10, &records));
+  EXPECT_EQ(2, records.size());
+  EXPECT_EQ(offset, read_offset);
+  EXPECT_TRUE(
+      errors::IsDataLoss(reader.ReadRecords(&read_offset, 10, &records)));
+  EXPECT_TRUE(records.empty());
+  EXPECT_EQ(offset, read_offset);
+}
+
+// Reads 10000 uncompressed records of 1000 bytes, one at a time with
+// ReadRecord() if "batch_size" is 0, otherwise with ReadRecords().
+static void BM_ReadRecords(int iters, int batch_size, int buffer_size) {
+  testing::StopTiming();
+  Env* env = Env::Default();
+  const string fname = testing::TmpDir() + "/record_reader_benchmark";
+  const int kNumRecords = 10000;
+  const int kRecordSize = 1000;
+  {
+    std::unique_ptr<WritableFile> file;
+    TF_CHECK_OK(env->NewWritableFile(fname, &file));
+    io::RecordWriter writer(file.get());
+    const string record(kRecordSize, 'x');
+    for (int i = 0; i < kNumRecords; ++i) {
+      TF_CHECK_OK(writer.WriteRecord(record));
+    }
+    TF_CHECK_OK(writer.Close());
+    TF_CHECK_OK(file->Close());
+  }
+  std::unique_ptr<RandomAccessFile> read_file;
+  TF_CHECK_OK(env->NewRandomAccessFile(fname, &read_file));
+  io::RecordReaderOptions options;
+  options.buffer_size = buffer_size;
+  testing::BytesProcessed(static_cast<int64>(iters) * kNumRecords *
+                          kRecordSize);
+  testing::StartTiming();
+
+  string record;
+  std::vector<StringPiece> records;
+  for (int i = 0; i < iters; ++i) {
+    io::RecordReader reader(read_file.get(), options);
+    uint64 offset = 0;
+    int num_read = 0;
+    while (num_read < kNumRecords) {
+      if (batch_size == 0) {
+        TF_CHECK_OK(reader.ReadRecord(&offset, &record));
+        ++num_read;
+      } else {
+        TF_CHECK_OK(reader.ReadRecords(&offset, batch_size, &records));
+        num_read += records.size();
+      }
+    }
+  }
+}
+BENCHMARK(BM_ReadRecords)
+    ->ArgPair(0, 0)
+    ->ArgPair(0, 256 << 10)
+    ->ArgPair(1, 0)
+    ->ArgPair(64, 0)
+    ->ArgPair(64, 256 << 10)
+    ->ArgPair(1024, 1 << 20);
+
 }  // namespace tensorflow
@@ -203,7 +203,8 @@ Unlike a "MapDataset", which applies `f` sequentially, this dataset invokes up
 to `num_parallel_calls` copies of `f` in parallel.
 
 num_parallel_calls: The number of concurrent invocations of `f` that process
-  elements from `input_dataset` in parallel.
+  elements from `input_dataset` in parallel. If -1, it is tuned at runtime so
+  that the consumer rarely waits, up to the number of CPUs.
 )doc");
 
 REGISTER_OP("MapAndBatchDataset")
@@ -243,7 +244,8 @@ REGISTER_OP("PrefetchDataset")
 Creates a dataset that asynchronously prefetches elements from `input_dataset`.
 
 buffer_size: The maximum number of elements to buffer in an iterator over
-  this dataset.
+  this dataset. If -1, it is tuned at runtime so that the consumer rarely
+  waits, within a memory budget.
 )doc");
 
 REGISTER_OP("ScanDataset")
@@ -335,6 +337,9 @@ allows the training step to proceed so long as some data is available.
 f: A function mapping elements of `input_dataset`, concatenated with
    `other_arguments`, to a Dataset variant that contains elements matching
    `output_types` and `output_shapes`.
+buffer_output_elements: The number of elements each iterator being interleaved
+   should buffer. If -1, it is tuned at runtime so that the consumer rarely
+   waits, within a memory budget.
 )doc");
 
 REGISTER_OP("GroupByWindowDataset")
@@ -531,8 +536,17 @@ cache already exists, the cache will be used. If the cache is inappropriate
 (e.g. cannot be opened, contains tensors of the wrong shape / size), an error
 will the returned when used.
 
+The elements are written to disk in shards, which can be read as soon as they
+are complete, so iterators over the same dataset can follow the one writing the
+cache during the first epoch. One that catches up with the writer fails with
+AlreadyExists if no element is added for TF_DATA_CACHE_READER_TIMEOUT_MS
+milliseconds (default 60000). Up to TF_DATA_CACHE_MEMORY_BUDGET_MB megabytes of
+the first elements are also kept in memory. If `filename` is empty, elements
+are only cached in memory; those over the budget, if one is set, are spilled to
+temporary files that are deleted with the dataset.
+
 filename: A path on the filesystem where we should cache the dataset. Note: this
-  will be a directory.
+  is used as the prefix of the shard files.
 )doc");
 
 REGISTER_OP("TextLineDataset")
@@ -18,9 +18,11 @@ limitations under the License.
 #include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <memory>
 #include <utility>
 
+#include "tensorflow/core/framework/allocation_description.pb.h"
 #include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/tensor.pb.h"
 #include "tensorflow/core/framework/tensor_shape.pb_text.h"
@@ -34,6 +36,8 @@ limitations under the License.
 #include "tensorflow/core/framework/versions.pb.h"
 #include "tensorflow/core/lib/core/coding.h"
 #include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/refcount.h"
+#include "tensorflow/core/lib/core/threadpool.h"
 #include "tensorflow/core/lib/gtl/map_util.h"
 #include "tensorflow/core/lib/gtl/stl_util.h"
 #include "tensorflow/core/lib/hash/crc32c.h"
@@ -299,6 +303,41 @@ Status WriteVariantTensor(const Tensor& val, FileOutputBuffer* out,
   return Status::OK();
 }
 
+// Appends "val" to "out", whose data file holds "*size" bytes so far, after
+// padding memcpy-able tensors to "alignment".  On OK, advances "*size" and
+// stores the offset, size and checksum of the tensor into "entry".
+Status AppendTensor(const Tensor& val, int64 alignment, FileOutputBuffer* out,
+                    int64* size, BundleEntryProto* entry) {
+  // Pads the data file, outside of the checksummed bytes of any entry.
+  if (alignment > 1 && DataTypeCanUseMemcpy(val.dtype()) &&
+      *size % alignment != 0) {
+    const string padding(alignment - *size % alignment, '\0');
+    TF_RETURN_IF_ERROR(out->Append(padding));
+    *size += padding.size();
+  }
+  entry->set_offset(*size);
+
+  // Updates the data file.
+  size_t data_bytes_written = 0;
+  uint32 crc32c = 0;
+  out->clear_crc32c();
+  if (val.dtype() == DT_STRING) {
+    TF_RETURN_IF_ERROR(
+        WriteStringTensor(val, out, &data_bytes_written, &crc32c));
+  } else if (val.dtype() == DT_VARIANT) {
+    TF_RETURN_IF_ERROR(
+        WriteVariantTensor(val, out, &data_bytes_written, &crc32c));
+  } else {
+    TF_RETURN_IF_ERROR(WriteTensor(val, out, &data_bytes_written));
+    crc32c = out->crc32c();
+  }
+
+  entry->set_size(data_bytes_written);
+  entry->set_crc32c(crc32c::Mask(crc32c));
+  *size += data_bytes_written;
+  return Status::OK();
+}
+
 // Reads file[offset:offset+size) into destination[0:size).  Each Read() copies
 // at most "buffer_size" bytes.
 //
@@ -381,8 +420,146 @@ table::Options TableBuilderOptions() {
 
 }  // namespace
 
+// One of the data files of a bundle written with several, filled by its own
+// thread in the order the tensors were added.
+class BundleWriter::DataShard {
+ public:
+  DataShard(Env* env, const string& filename, int data_alignment)
+      : env_(env),
+        filename_(filename),
+        tmp_filename_(
+            strings::StrCat(filename, ".tempstate", random::New64())),
+        data_alignment_(data_alignment) {}
+
+  // Deletes the data file unless it was moved in place by Commit().
+  ~DataShard() {
+    Stop();
+    out_.reset();
+    if (!committed_) {
+      env_->DeleteFile(tmp_filename_).IgnoreError();
+    }
+  }
+
+  Status Open() {
+    std::unique_ptr<WritableFile> file;
+    TF_RETURN_IF_ERROR(env_->NewWritableFile(tmp_filename_, &file));
+    flush_pool_.reset(new thread::ThreadPool(env_, "bundle_flush", 1));
+    out_.reset(new FileOutputBuffer(file.release(), 8 << 20 /* 8MB */,
+                                    flush_pool_.get()));
+    thread_.reset(env_->StartThread(ThreadOptions(), "bundle_writer",
+                                    [this]() { Run(); }));
+    VLOG(1) << "Writing to file " << tmp_filename_;
+    return Status::OK();
+  }
+
+  // Bytes of all the tensors added so far.
+  int64 added_bytes() const { return added_bytes_; }
+
+  // Queues "val" to be appended.  Its offset, size and checksum are stored
+  // into "entry" by Finish().
+  void Add(const Tensor& val, BundleEntryProto* entry) {
+    added_bytes_ += val.TotalBytes();
+    jobs_.emplace_back(new Job{val, entry, BundleEntryProto()});
+    Job* job = jobs_.back().get();
+    mutex_lock l(mu_);
+    queue_.push_back(job);
+    cond_.notify_one();
+  }
+
+  // Waits for all the queued tensors and closes the data file, still under
+  // its temporary name.  On success, stores where each tensor went into its
+  // entry.
+  Status Close() {
+    Stop();
+    Status status = status_;
+    if (out_) {
+      status.Update(out_->Close());
+      out_.reset();
+    }
+    if (!status.ok()) return status;
+    for (const auto& job : jobs_) {
+      job->entry->set_offset(job->result.offset());
+      job->entry->set_size(job->result.size());
+      job->entry->set_crc32c(job->result.crc32c());
+    }
+    jobs_.clear();
+    return Status::OK();
+  }
+
+  // Moves the data file closed by Close() in place.
+  Status Commit() {
+    TF_RETURN_IF_ERROR(env_->RenameFile(tmp_filename_, filename_));
+    committed_ = true;
+    return Status::OK();
+  }
+
+ private:
+  struct Job {
+    Tensor val;
+    BundleEntryProto* entry;  // Not owned.
+    BundleEntryProto result;
+  };
+
+  void Stop() {
+    {
+      mutex_lock l(mu_);
+      stopping_ = true;
+      cond_.notify_one();
+    }
+    // Joins the thread.
+    thread_.reset();
+  }
+
+  void Run() {
+    while (true) {
+      Job* job;
+      {
+        mutex_lock l(mu_);
+        while (queue_.empty() && !stopping_) {
+          cond_.wait(l);
+        }
+        if (queue_.empty()) return;
+        job = queue_.front();
+        queue_.pop_front();
+      }
+      if (status_.ok()) {
+        status_ = AppendTensor(job->val, data_alignment_, out_.get(), &size_,
+                               &job->result);
+      }
+      job->val = Tensor();
+    }
+  }
+
+  Env* const env_;  // Not owned.
+  const string filename_;
+  const string tmp_filename_;
+  const int data_alignment_;
+
+  int64 added_bytes_ = 0;
+  std::vector<std::unique_ptr<Job>> jobs_;
+
+  mutex mu_;
+  condition_variable cond_;
+  std::deque<Job*> queue_ GUARDED_BY(mu_);
+  bool stopping_ GUARDED_BY(mu_) = false;
+
+  // Only used by thread_ until it is joined.
+  std::unique_ptr<thread::ThreadPool> flush_pool_;
+  std::unique_ptr<FileOutputBuffer> out_;
+  int64 size_ = 0;
+  Status status_;
+
+  std::unique_ptr<Thread> thread_;
+  bool committed_ = false;
+};
+
 BundleWriter::BundleWriter(Env* env, StringPiece prefix)
+    : BundleWriter(env, prefix, Options()) {}
+
+BundleWriter::BundleWriter(Env* env, StringPiece prefix,
+                           const Options& options)
     : env_(env),
+      options_(options),
       prefix_(prefix.ToString()),
       tmp_metadata_path_(strings::StrCat(MetaFilename(prefix_), ".tempstate",
                                          random::New64())),
@@ -394,7 +571,16 @@ BundleWriter::BundleWriter(Env* env, StringPiece prefix)
   if (!status_.ok() && !errors::IsAlreadyExists(status_)) {
     return;
   }
-  const string filename = DataFilename(prefix_, 0, 1);
+  if (options_.num_data_shards > 1) {
+    for (int i = 0; i < options_.num_data_shards; ++i) {
+      shards_.emplace_back(new DataShard(
+          env_, DataFilename(prefix_, i, options_.num_data_shards),
+          options_.data_alignment));
+      status_ = shards_.back()->Open();
+      if (!status_.ok()) return;
+    }
+    return;
+  }
   std::unique_ptr<WritableFile> wrapper;
   status_ = env_->NewWritableFile(tmp_data_path_, &wrapper);
   if (!status_.ok()) return;
@@ -416,27 +602,23 @@ Status BundleWriter::Add(StringPiece key, const Tensor& val) {
   BundleEntryProto* entry = &entries_[key_string];
   entry->set_dtype(val.dtype());
   val.shape().AsProto(entry->mutable_shape());
-  entry->set_shard_id(0);
-  entry->set_offset(size_);
 
-  // Updates the data file.
-  size_t data_bytes_written = 0;
-  uint32 crc32c = 0;
-  out_->clear_crc32c();
-  if (val.dtype() == DT_STRING) {
-    status_ = WriteStringTensor(val, out_.get(), &data_bytes_written, &crc32c);
-  } else if (val.dtype() == DT_VARIANT) {
-    status_ = WriteVariantTensor(val, out_.get(), &data_bytes_written, &crc32c);
-  } else {
-    status_ = WriteTensor(val, out_.get(), &data_bytes_written);
-    crc32c = out_->crc32c();
+  if (!shards_.empty()) {
+    // The data file with the fewest bytes so far, the first one on ties.
+    int shard_id = 0;
+    for (int i = 1; i < shards_.size(); ++i) {
+      if (shards_[i]->added_bytes() < shards_[shard_id]->added_bytes()) {
+        shard_id = i;
+      }
+    }
+    entry->set_shard_id(shard_id);
+    shards_[shard_id]->Add(val, entry);
+    return status_;
   }
 
-  if (status_.ok()) {
-    entry->set_size(data_bytes_written);
-    entry->set_crc32c(crc32c::Mask(crc32c));
-    size_ += data_bytes_written;
-  }
+  entry->set_shard_id(0);
+  status_ =
+      AppendTensor(val, options_.data_alignment, out_.get(), &size_, entry);
   return status_;
 }
 
@@ -481,24 +663,58 @@ Status BundleWriter::AddSlice(StringPiece full_tensor_key,
   return status_;
 }
 
-// TODO(zongheng): on metadata write failure or !status_.ok(), consider removing
-// the orphaned data file.
+BundleWriter::~BundleWriter() {
+  // Abandoned without Finish().  The data shards delete their own files.
+  if (out_) {
+    out_->Close().IgnoreError();
+    out_ = nullptr;
+    env_->DeleteFile(tmp_data_path_).IgnoreError();
+  }
+}
+
 Status BundleWriter::Finish() {
+  // Closes every data file even after an error, which also joins the threads
+  // of the data shards.
+  for (auto& shard : shards_) {
+    status_.Update(shard->Close());
+  }
   if (out_) {
     status_.Update(out_->Close());
     out_ = nullptr;
-    if (status_.ok()) {
-      status_ = Env::Default()->RenameFile(tmp_data_path_,
-                                           DataFilename(prefix_, 0, 1));
-    } else {
-      Env::Default()->DeleteFile(tmp_data_path_).IgnoreError();
+  }
+  if (status_.ok()) {
+    status_ = WriteMetadata();
+  }
+  // Nothing is moved in place unless every data file and the metadata file
+  // were written, so a failed Finish() never leaves a partial bundle behind.
+  if (status_.ok()) {
+    for (auto& shard : shards_) {
+      status_ = shard->Commit();
+      if (!status_.ok()) break;
     }
   }
-  if (!status_.ok()) return status_;
+  if (status_.ok() && shards_.empty()) {
+    status_ = env_->RenameFile(tmp_data_path_, DataFilename(prefix_, 0, 1));
+  }
+  if (status_.ok()) {
+    status_ = env_->RenameFile(tmp_metadata_path_, MetaFilename(prefix_));
+  }
+  // Deletes the data files of the shards not committed.
+  shards_.clear();
+  if (!status_.ok()) {
+    env_->DeleteFile(tmp_data_path_).IgnoreError();
+    env_->DeleteFile(tmp_metadata_path_).IgnoreError();
+    return status_;
+  }
+  status_ = errors::Internal("BundleWriter is closed");
+  return Status::OK();
+}
+
+Status BundleWriter::WriteMetadata() {
   // Build key -> BundleEntryProto table.
   std::unique_ptr<WritableFile> file;
-  status_ = env_->NewWritableFile(tmp_metadata_path_, &file);
-  if (!status_.ok()) return status_;
+  TF_RETURN_IF_ERROR(env_->NewWritableFile(tmp_metadata_path_, &file));
+  Status status;
   {
     // N.B.: the default use of Snappy compression may not be supported on all
     // platforms (e.g. Android).  The metadata file is small, so this is fine.
@@ -507,7 +723,7 @@ Status BundleWriter::Finish() {
     table::TableBuilder builder(options, file.get());
     // Header entry.
     BundleHeaderProto header;
-    header.set_num_shards(1);
+    header.set_num_shards(std::max(options_.num_data_shards, 1));
     header.set_endianness(BundleHeaderProto::LITTLE);
     if (!port::kLittleEndian) header.set_endianness(BundleHeaderProto::BIG);
     VersionDef* version = header.mutable_version();
@@ -520,19 +736,10 @@ Status BundleWriter::Finish() {
     for (const auto& p : entries_) {
       builder.Add(p.first, p.second.SerializeAsString());
     }
-    status_ = builder.Finish();
-  }
-  status_.Update(file->Close());
-  if (!status_.ok()) {
-    Env::Default()->DeleteFile(tmp_metadata_path_).IgnoreError();
-    return status_;
-  } else {
-    status_ =
-        Env::Default()->RenameFile(tmp_metadata_path_, MetaFilename(prefix_));
-    if (!status_.ok()) return status_;
+    status = builder.Finish();
   }
-  status_ = errors::Internal("BundleWriter is closed");
-  return Status::OK();
+  status.Update(file->Close());
+  return status;
 }
 
 // Merging tensor bundles.
@@ -714,9 +921,55 @@ bool GetLenientNames() {
 
 // Interface for reading a tensor bundle.
 
+// A data file mapped into memory.  Shared by the reader and the tensors
+// aliasing it.
+class BundleReader::MappedFile : public core::RefCounted {
+ public:
+  explicit MappedFile(std::unique_ptr<ReadOnlyMemoryRegion> region)
+      : region_(std::move(region)) {}
+
+  const char* data() const {
+    return static_cast<const char*>(region_->data());
+  }
+  uint64 length() const { return region_->length(); }
+
+ private:
+  std::unique_ptr<ReadOnlyMemoryRegion> region_;
+};
+
+// Aliases the bytes of one tensor in a mapped data file.
+class BundleReader::MappedTensorBuffer : public TensorBuffer {
+ public:
+  MappedTensorBuffer(MappedFile* file, const char* data, size_t size)
+      : file_(file), data_(data), size_(size) {
+    file_->Ref();
+  }
+  ~MappedTensorBuffer() override { file_->Unref(); }
+
+  void* data() const override { return const_cast<char*>(data_); }
+  size_t size() const override { return size_; }
+  TensorBuffer* root_buffer() override { return this; }
+  void FillAllocationDescription(AllocationDescription* proto) const override {
+    proto->set_requested_bytes(size_);
+    proto->set_allocator_name("mmap");
+  }
+  // The mapping is read-only, so kernels must not forward it as an output.
+  bool OwnsMemory() const override { return false; }
+
+ private:
+  MappedFile* const file_;
+  const char* const data_;
+  const size_t size_;
+};
+
 BundleReader::BundleReader(Env* env, StringPiece prefix)
+    : BundleReader(env, prefix, Options()) {}
+
+BundleReader::BundleReader(Env* env, StringPiece prefix,
+                           const Options& options)
     : env_(env),
       prefix_(prefix.ToString()),
+      options_(options),
       metadata_(nullptr),
       table_(nullptr),
       iter_(nullptr) {
@@ -771,6 +1024,9 @@ BundleReader::~BundleReader() {
     }
   }
   gtl::STLDeleteValues(&data_);
+  for (auto pair : mapped_) {
+    if (pair.second != nullptr) pair.second->Unref();
+  }
   gtl::STLDeleteValues(&tensor_slices_);
 }
 
@@ -812,7 +1068,82 @@ Status BundleReader::GetBundleEntryProto(StringPiece key,
   return Status::OK();
 }
 
+Status BundleReader::GetMappedFile(int32 shard_id, MappedFile** file) {
+  auto it = mapped_.find(shard_id);
+  if (it != mapped_.end()) {
+    *file = it->second;
+    return Status::OK();
+  }
+  const string filename = DataFilename(prefix_, shard_id, num_shards_);
+  std::unique_ptr<ReadOnlyMemoryRegion> region;
+  Status s = env_->NewReadOnlyMemoryRegionFromFile(filename, &region);
+  if (errors::IsUnimplemented(s)) {
+    VLOG(1) << "Cannot map " << filename << ", reading it instead: " << s;
+    *file = mapped_[shard_id] = nullptr;
+    return Status::OK();
+  }
+  TF_RETURN_IF_ERROR(s);
+  *file = mapped_[shard_id] = new MappedFile(std::move(region));
+  return Status::OK();
+}
+
+Status BundleReader::GetMappedValue(const BundleEntryProto& entry,
+                                    MappedFile* file, Tensor* val) {
+  const TensorShape stored_shape(TensorShape(entry.shape()));
+  const bool alias = val->NumElements() == 0;
+  const size_t expected_size =
+      alias ? stored_shape.num_elements() * DataTypeSize(entry.dtype())
+            : val->TotalBytes();
+  if (entry.size() != expected_size) {
+    return errors::DataLoss("Invalid size in bundle entry: key ", key(),
+                            "; stored size ", entry.size(), "; expected size ",
+                            expected_size);
+  }
+  if (entry.offset() + entry.size() > file->length()) {
+    return errors::DataLoss("Bundle entry for key ", key(), " at offset ",
+                            entry.offset(), " with size ", entry.size(),
+                            " is beyond the end of its data file of ",
+                            file->length(), " bytes");
+  }
+
+  const char* data = file->data() + entry.offset();
+  if (options_.verify_checksums) {
+    const uint32 actual_crc32c = crc32c::Value(data, entry.size());
+    if (crc32c::Unmask(entry.crc32c()) != actual_crc32c) {
+      return errors::DataLoss(
+          "Checksum does not match: stored ",
+          strings::Printf("%08u", crc32c::Unmask(entry.crc32c())),
+          " vs. calculated on the restored bytes ", actual_crc32c);
+    }
+  }
+
+  if (alias && reinterpret_cast<uintptr_t>(data) % EIGEN_MAX_ALIGN_BYTES == 0) {
+    MappedTensorBuffer* buf = new MappedTensorBuffer(file, data, entry.size());
+    *val = Tensor(entry.dtype(), stored_shape, buf);
+    buf->Unref();
+    return Status::OK();
+  }
+  if (alias) {
+    *val = Tensor(entry.dtype(), stored_shape);
+  }
+  if (entry.size() > 0) {
+    memcpy(GetBackingBuffer(*val), data, entry.size());
+  }
+  return Status::OK();
+}
+
 Status BundleReader::GetValue(const BundleEntryProto& entry, Tensor* val) {
+  // Zero-length tensors need no data file at all, which may be empty and
+  // hence cannot be mapped.
+  if (options_.use_mmap && DataTypeCanUseMemcpy(entry.dtype()) &&
+      entry.size() > 0) {
+    MappedFile* file = nullptr;
+    TF_RETURN_IF_ERROR(GetMappedFile(entry.shard_id(), &file));
+    if (file != nullptr) {
+      return GetMappedValue(entry, file, val);
+    }
+  }
+
   Tensor* ret = val;
   const TensorShape stored_shape(TensorShape(entry.shape()));
   if (val->NumElements() == 0) {
@@ -864,7 +1195,9 @@ Status BundleReader::GetValue(const BundleEntryProto& entry, Tensor* val) {
     TF_RETURN_IF_ERROR(ReadInputByChunk(buffered_file->file(), entry.offset(),
                                         entry.size(), 8 << 20 /* 8MB buffer */,
                                         backing_buffer));
-    actual_crc32c = crc32c::Value(backing_buffer, entry.size());
+    if (options_.verify_checksums) {
+      actual_crc32c = crc32c::Value(backing_buffer, entry.size());
+    }
   } else if (entry.dtype() == DT_VARIANT) {
     // Relies on io::InputBuffer's buffering, because we issue many neighboring
     // reads for a single string tensor.
@@ -877,7 +1210,8 @@ Status BundleReader::GetValue(const BundleEntryProto& entry, Tensor* val) {
         buffered_file, ret->NumElements(), entry.offset(), entry.size(),
         GetStringBackingBuffer(*ret), &actual_crc32c));
   }
-  if (crc32c::Unmask(entry.crc32c()) != actual_crc32c) {
+  if (options_.verify_checksums &&
+      crc32c::Unmask(entry.crc32c()) != actual_crc32c) {
     return errors::DataLoss(
         "Checksum does not match: stored ",
         strings::Printf("%08u", crc32c::Unmask(entry.crc32c())),
@@ -933,6 +1267,13 @@ Status BundleReader::LookupTensorSlices(StringPiece key,
   return Status::OK();
 }
 
+Status BundleReader::LookupShardId(StringPiece key, int32* shard_id) {
+  BundleEntryProto entry;
+  TF_RETURN_IF_ERROR(GetBundleEntryProto(key, &entry));
+  *shard_id = entry.slices().empty() ? entry.shard_id() : -1;
+  return Status::OK();
+}
+
 Status BundleReader::LookupSlice(StringPiece full_tensor_key,
                                  const TensorSlice& slice_spec, Tensor* val) {
   CHECK(val != nullptr);
@@ -1091,7 +1432,10 @@ string BundleReader::DebugString() {
   return shape_str;
 }
 
-FileOutputBuffer::~FileOutputBuffer() { delete file_; }
+FileOutputBuffer::~FileOutputBuffer() {
+  WaitForFlush().IgnoreError();
+  delete file_;
+}
 
 Status FileOutputBuffer::Append(StringPiece data) {
   // In the below, it is critical to calculate the checksum on the actually
@@ -1125,15 +1469,44 @@ Status FileOutputBuffer::Append(StringPiece data) {
 
 Status FileOutputBuffer::Close() {
   TF_RETURN_IF_ERROR(FlushBuffer());
+  TF_RETURN_IF_ERROR(WaitForFlush());
   return file_->Close();
 }
 
 Status FileOutputBuffer::FlushBuffer() {
-  if (position_ > 0) {
+  if (position_ == 0) return Status::OK();
+  if (flush_pool_ == nullptr) {
     TF_RETURN_IF_ERROR(file_->Append(StringPiece(&buffer_[0], position_)));
     position_ = 0;
+    return Status::OK();
   }
+
+  // Hands the full buffer to flush_pool_ and continues with the other one.
+  TF_RETURN_IF_ERROR(WaitForFlush());
+  flushing_.resize(buffer_size_);
+  buffer_.swap(flushing_);
+  const size_t size = position_;
+  position_ = 0;
+  {
+    mutex_lock l(mu_);
+    flushing_busy_ = true;
+  }
+  flush_pool_->Schedule([this, size]() {
+    Status s = file_->Append(StringPiece(&flushing_[0], size));
+    mutex_lock l(mu_);
+    flush_status_.Update(s);
+    flushing_busy_ = false;
+    flushed_.notify_all();
+  });
   return Status::OK();
 }
 
+Status FileOutputBuffer::WaitForFlush() {
+  mutex_lock l(mu_);
+  while (flushing_busy_) {
+    flushed_.wait(l);
+  }
+  return flush_status_;
+}
+
 }  // namespace tensorflow
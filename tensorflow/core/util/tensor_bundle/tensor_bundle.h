@@ -66,6 +66,7 @@ limitations under the License.
 #include <map>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
@@ -77,6 +78,8 @@ limitations under the License.
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/file_system.h"
 #include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/util/tensor_bundle/naming.h"
 #include "tensorflow/core/util/tensor_slice_set.h"
@@ -84,6 +87,9 @@ limitations under the License.
 namespace tensorflow {
 
 class FileOutputBuffer;
+namespace thread {
+class ThreadPool;
+}  // namespace thread
 
 // Versioning of the tensor bundle format.
 // Follows the same rules as 3p/tf/core/public/version.h.
@@ -107,10 +113,32 @@ extern const char* const kHeaderEntryKey;
 // All threads accessing the same BundleWriter must synchronize.
 class BundleWriter {
  public:
+  struct Options {
+    // Pads the data file so that the bytes of every memcpy-able tensor start
+    // at a multiple of this, which lets a BundleReader mapping the data file
+    // hand them out without copying.  Other entries are never padded.
+    int data_alignment = 1;
+
+    // Spreads the tensors over this many data files, each serialized,
+    // checksummed and written by its own thread while Add() returns right
+    // away.  A tensor goes to the data file with the fewest bytes so far, so
+    // the bundle only depends on the order and sizes of the added tensors.
+    //
+    // With more than one data file, errors writing a tensor are only
+    // reported by Finish().
+    int num_data_shards = 1;
+  };
+
   BundleWriter(Env* env, StringPiece prefix);
+  BundleWriter(Env* env, StringPiece prefix, const Options& options);
+  ~BundleWriter();
 
   // Adds the tensor "val" under key "key".
   // Across calls "key" must be unique but can be added in any order.
+  //
+  // With more than one data file, "val" is written after Add() returns and
+  // shares its buffer with the caller's tensor, so the caller must not
+  // modify that buffer until Finish() returns.
   Status Add(StringPiece key, const Tensor& val);
 
   // Partitioned variables support.
@@ -133,18 +161,28 @@ class BundleWriter {
                   const TensorShape& full_tensor_shape,
                   const TensorSlice& slice_spec, const Tensor& slice_tensor);
 
-  // Finishes the writer and flushes.
+  // Finishes the writer and flushes.  The data and metadata files only get
+  // their final names if all of them were written; otherwise they are
+  // deleted and the first error is returned.
   Status Finish() TF_MUST_USE_RESULT;
 
   Status status() const { return status_; }
 
  private:
+  class DataShard;
+
+  // Writes the metadata table to tmp_metadata_path_.
+  Status WriteMetadata();
+
   Env* const env_;  // Not owned.
+  const Options options_;
   const string prefix_;
   const string tmp_metadata_path_;
   const string tmp_data_path_;
   std::unique_ptr<FileOutputBuffer> out_;
   int64 size_;  // Number of bytes written into out_.
+  // Used instead of out_ if options_.num_data_shards > 1.
+  std::vector<std::unique_ptr<DataShard>> shards_;
   std::map<string, BundleEntryProto> entries_;
   Status status_;
 
@@ -173,7 +211,23 @@ Status MergeBundles(Env* env, gtl::ArraySlice<string> prefixes,
 // All threads accessing the same BundleReader must synchronize.
 class BundleReader {
  public:
+  struct Options {
+    // Maps the data files into memory instead of reading them through
+    // buffers.  Looking up a memcpy-able tensor into an empty "val" then
+    // returns a tensor aliasing the mapping, if its bytes are suitably
+    // aligned (see BundleWriter::Options::data_alignment).  Such tensors keep
+    // the mapping alive after the reader is destroyed, and are read-only.
+    //
+    // Falls back to buffered reads on file systems that cannot map files.
+    bool use_mmap = false;
+
+    // Validates the stored crc32c checksum against the restored bytes.  When
+    // off, aliased tensors are not even paged in until they are used.
+    bool verify_checksums = true;
+  };
+
   BundleReader(Env* const env, StringPiece prefix);
+  BundleReader(Env* const env, StringPiece prefix, const Options& options);
   ~BundleReader();
 
   // Is ok() iff the reader construction is successful (completed the read of
@@ -206,7 +260,8 @@ class BundleReader {
   // On error, "val" may contain nonsense data.  Returns a NotFound error if
   // tensor keyed by "key" does not exist in this bundle.
   //
-  // Validates the stored crc32c checksum against the restored bytes.
+  // Validates the stored crc32c checksum against the restored bytes, unless
+  // disabled in the options.
   // REQUIRES: status().ok()
   Status Lookup(StringPiece key, Tensor* val) TF_MUST_USE_RESULT;
 
@@ -214,7 +269,8 @@ class BundleReader {
   //
   // On error, "val" may contain nonsense data.
   //
-  // Validates the stored crc32c checksum against the restored bytes.
+  // Validates the stored crc32c checksum against the restored bytes, unless
+  // disabled in the options.
   // REQUIRES: status().ok() && Valid()
   Status ReadCurrent(Tensor* val) TF_MUST_USE_RESULT;
 
@@ -235,6 +291,16 @@ class BundleReader {
   Status LookupSlice(StringPiece full_tensor_key, const TensorSlice& slice_spec,
                      Tensor* val) TF_MUST_USE_RESULT;
 
+  // Looks up the index of the data file holding the tensor keyed by "key".
+  // Sets "shard_id" to -1 for a partitioned tensor, whose slices may be spread
+  // over several data files.
+  // REQUIRES: status().ok()
+  Status LookupShardId(StringPiece key, int32* shard_id) TF_MUST_USE_RESULT;
+
+  // Number of data files in the bundle.
+  // REQUIRES: status().ok()
+  int num_shards() const { return num_shards_; }
+
   // Seeks to the first position in the bundle whose key is no less than "key".
   // REQUIRES: status().ok()
   void Seek(StringPiece key) { return iter_->Seek(key); }
@@ -255,6 +321,9 @@ class BundleReader {
   string DebugString();
 
  private:
+  class MappedFile;
+  class MappedTensorBuffer;
+
   // Seeks for "key" and reads the metadata proto.
   // On non-OK return, clears "entry" for the caller.
   // REQUIRES: status().ok()
@@ -266,6 +335,14 @@ class BundleReader {
   Status GetValue(const BundleEntryProto& entry,
                   Tensor* val) TF_MUST_USE_RESULT;
 
+  // GetValue() for a memcpy-able tensor stored in the mapped data file "file".
+  Status GetMappedValue(const BundleEntryProto& entry, MappedFile* file,
+                        Tensor* val) TF_MUST_USE_RESULT;
+
+  // Maps data file "shard_id" into memory if it has not been mapped.  Sets
+  // "file" to nullptr if the file system cannot map files.
+  Status GetMappedFile(int32 shard_id, MappedFile** file) TF_MUST_USE_RESULT;
+
   // Reads the slice described by "slice_spec".  The corresponding full tensor
   // has key "ful_tensor_key" and metadata proto "full_tensor_entry".
   // REQUIRES: full_tensor_entry.slices_size() > 0
@@ -276,6 +353,7 @@ class BundleReader {
 
   Env* env_;  // Not owned.
   const string prefix_;
+  const Options options_;
 
   Status status_;
   RandomAccessFile* metadata_;  // Owned.
@@ -283,6 +361,9 @@ class BundleReader {
   table::Iterator* iter_;
   // Owned the InputBuffer objects and their underlying RandomAccessFile's.
   std::unordered_map<int32, io::InputBuffer*> data_;
+  // Data files mapped into memory if options_.use_mmap, or nullptr if mapping
+  // is not supported.  Holds a reference on each.
+  std::unordered_map<int32, MappedFile*> mapped_;
 
   // Maps each partitioned tensor's key to its stored slices (represented in a
   // TensorSliceSet).  Populated on-demand.
@@ -303,10 +384,18 @@ class BundleReader {
 // A buffering wrapper for a WritableFile.  Useful if the caller wishes to issue
 // small writes to a file (e.g. writing out a list of small varints).
 // External synchronization must be used in the presence of concurrent callers.
+//
+// If "flush_pool" is given, a full buffer is appended to the file on it while
+// the caller fills a second one.  Errors appending are then returned by a later
+// call.  The pool is not owned and must outlive this.
 class FileOutputBuffer {
  public:
-  FileOutputBuffer(WritableFile* file, size_t buffer_size)
-      : file_(file), position_(0), buffer_size_(buffer_size) {
+  FileOutputBuffer(WritableFile* file, size_t buffer_size,
+                   thread::ThreadPool* flush_pool = nullptr)
+      : file_(file),
+        position_(0),
+        buffer_size_(buffer_size),
+        flush_pool_(flush_pool) {
     DCHECK_GT(buffer_size, 0);
     buffer_.resize(buffer_size);
   }
@@ -327,6 +416,9 @@ class FileOutputBuffer {
   // Appends the buffered data to the underlying file. Does NOT flush the file.
   Status FlushBuffer();
 
+  // Waits for the buffer being appended on flush_pool_, if any.
+  Status WaitForFlush();
+
   WritableFile* file_;  // Owned.
 
   // buffer_[0, position_) holds the buffered data not yet appended to the
@@ -337,6 +429,14 @@ class FileOutputBuffer {
 
   // Checksum of all appended bytes since construction or last clear_crc32c().
   uint32 crc32c_ = 0;
+
+  // The second buffer, appended on flush_pool_.
+  thread::ThreadPool* const flush_pool_;  // Not owned.
+  std::vector<char> flushing_;
+  mutex mu_;
+  condition_variable flushed_;
+  bool flushing_busy_ GUARDED_BY(mu_) = false;
+  Status flush_status_ GUARDED_BY(mu_);
 };
 
 }  // namespace tensorflow
@@ -16,6 +16,7 @@ limitations under the License.
 #include "tensorflow/core/util/tensor_bundle/tensor_bundle.h"
 
 #include <random>
+#include <set>
 #include <vector>
 
 #include "tensorflow/core/framework/tensor_testutil.h"
@@ -24,8 +25,11 @@ limitations under the License.
 #include "tensorflow/core/framework/variant_op_registry.h"
 #include "tensorflow/core/framework/versions.pb.h"
 #include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/hash/crc32c.h"
 #include "tensorflow/core/lib/io/path.h"
 #include "tensorflow/core/lib/io/table_builder.h"
+#include "tensorflow/core/lib/strings/str_util.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/test.h"
 
@@ -703,6 +707,277 @@ TEST(TensorBundleTest, TruncatedTensorContents) {
   EXPECT_TRUE(errors::IsOutOfRange(reader.Lookup("key", &val)));
 }
 
+TEST(TensorBundleTest, MappedReads) {
+  Env* env = Env::Default();
+  {
+    BundleWriter::Options options;
+    options.data_alignment = EIGEN_MAX_ALIGN_BYTES;
+    BundleWriter writer(env, Prefix("mapped"), options);
+    TF_EXPECT_OK(writer.Add("a", Constant<int8>(1, TensorShape({3}))));
+    TF_EXPECT_OK(writer.Add("b", Constant_2x3<float>(2.0)));
+    TF_EXPECT_OK(writer.Add("c", test::AsTensor<string>({"x", "yz"})));
+    TF_EXPECT_OK(writer.Add("d", Constant_2x3<double>(3.0)));
+    TF_ASSERT_OK(writer.Finish());
+  }
+
+  BundleReader::Options options;
+  options.use_mmap = true;
+  Tensor b, d;
+  {
+    BundleReader reader(env, Prefix("mapped"), options);
+    TF_ASSERT_OK(reader.status());
+    TF_ASSERT_OK(reader.Lookup("b", &b));
+    TF_ASSERT_OK(reader.Lookup("d", &d));
+    // Both alias the same mapping, right after each other.
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(b.tensor_data().data()) %
+                     EIGEN_MAX_ALIGN_BYTES);
+    Tensor b_again;
+    TF_ASSERT_OK(reader.Lookup("b", &b_again));
+    EXPECT_EQ(b.tensor_data().data(), b_again.tensor_data().data());
+
+    // Preallocated tensors and strings are copied as before.
+    Expect<int8>(&reader, "a", Constant<int8>(1, TensorShape({3})));
+    Expect<float>(&reader, "b", Constant_2x3<float>(2.0));
+    Expect<string>(&reader, "c", test::AsTensor<string>({"x", "yz"}));
+  }
+  // The mapping outlives the reader.
+  test::ExpectTensorEqual<float>(b, Constant_2x3<float>(2.0));
+  test::ExpectTensorEqual<double>(d, Constant_2x3<double>(3.0));
+}
+
+TEST(TensorBundleTest, MappedReadsUnaligned) {
+  Env* env = Env::Default();
+  {
+    BundleWriter writer(env, Prefix("unaligned"));
+    TF_EXPECT_OK(writer.Add("a", Constant<int8>(1, TensorShape({3}))));
+    TF_EXPECT_OK(writer.Add("b", Constant_2x3<float>(2.0)));
+    TF_ASSERT_OK(writer.Finish());
+  }
+  BundleReader::Options options;
+  options.use_mmap = true;
+  BundleReader reader(env, Prefix("unaligned"), options);
+  TF_ASSERT_OK(reader.status());
+  Tensor b;
+  TF_ASSERT_OK(reader.Lookup("b", &b));
+  test::ExpectTensorEqual<float>(b, Constant_2x3<float>(2.0));
+  EXPECT_TRUE(b.IsAligned());
+}
+
+TEST(TensorBundleTest, MappedReadsChecksum) {
+  Env* env = Env::Default();
+  {
+    BundleWriter writer(env, Prefix("mapped_corrupt"));
+    TF_EXPECT_OK(writer.Add("foo", Constant_2x3<float>(1.0)));
+    TF_ASSERT_OK(writer.Finish());
+  }
+  const string datafile = DataFilename(Prefix("mapped_corrupt"), 0, 1);
+  string data;
+  TF_ASSERT_OK(ReadFileToString(env, datafile, &data));
+  data[0] = ~data[0];
+  TF_ASSERT_OK(WriteStringToFile(env, datafile, data));
+
+  BundleReader::Options options;
+  options.use_mmap = true;
+  {
+    BundleReader reader(env, Prefix("mapped_corrupt"), options);
+    Tensor val;
+    Status status = reader.Lookup("foo", &val);
+    EXPECT_TRUE(errors::IsDataLoss(status));
+    EXPECT_TRUE(
+        StringPiece(status.ToString()).contains("Checksum does not match"));
+  }
+  // Not verified, with or without the mapping.
+  options.verify_checksums = false;
+  for (bool use_mmap : {true, false}) {
+    options.use_mmap = use_mmap;
+    BundleReader reader(env, Prefix("mapped_corrupt"), options);
+    Tensor val(DT_FLOAT, TensorShape({2, 3}));
+    TF_EXPECT_OK(reader.Lookup("foo", &val));
+  }
+
+  // Truncated data files are caught regardless.
+  TF_ASSERT_OK(WriteStringToFile(env, datafile,
+                                 StringPiece(data.data(), data.size() - 1)));
+  options.use_mmap = true;
+  BundleReader reader(env, Prefix("mapped_corrupt"), options);
+  Tensor val;
+  EXPECT_TRUE(errors::IsDataLoss(reader.Lookup("foo", &val)));
+}
+
+TEST(TensorBundleTest, LookupShardId) {
+  {
+    BundleWriter writer(Env::Default(), Prefix("shards0"));
+    TF_EXPECT_OK(writer.Add("a", Constant_2x3<float>(1.0)));
+    TF_ASSERT_OK(writer.Finish());
+  }
+  {
+    BundleWriter writer(Env::Default(), Prefix("shards1"));
+    TF_EXPECT_OK(writer.Add("b", Constant_2x3<float>(2.0)));
+    TF_EXPECT_OK(writer.AddSlice("c", TensorShape({4}),
+                                 TensorSlice::ParseOrDie("0,2"),
+                                 Constant<float>(3.0, TensorShape({2}))));
+    TF_ASSERT_OK(writer.Finish());
+  }
+  TF_ASSERT_OK(MergeBundles(Env::Default(),
+                            {Prefix("shards0"), Prefix("shards1")},
+                            Prefix("shards")));
+
+  BundleReader reader(Env::Default(), Prefix("shards"));
+  TF_ASSERT_OK(reader.status());
+  EXPECT_EQ(2, reader.num_shards());
+  int32 a, b, c;
+  TF_ASSERT_OK(reader.LookupShardId("a", &a));
+  TF_ASSERT_OK(reader.LookupShardId("b", &b));
+  TF_ASSERT_OK(reader.LookupShardId("c", &c));
+  EXPECT_NE(a, b);
+  EXPECT_EQ(-1, c);
+  EXPECT_TRUE(errors::IsNotFound(reader.LookupShardId("d", &a)));
+}
+
+TEST(TensorBundleTest, ShardedWriter) {
+  Env* env = Env::Default();
+  auto Write = [env](const string& prefix) {
+    BundleWriter::Options options;
+    options.num_data_shards = 3;
+    options.data_alignment = EIGEN_MAX_ALIGN_BYTES;
+    BundleWriter writer(env, Prefix(prefix), options);
+    TF_ASSERT_OK(writer.status());
+    for (int i = 0; i < 10; ++i) {
+      TF_EXPECT_OK(writer.Add(strings::StrCat("float", i),
+                              Constant<float>(i, TensorShape({i + 1, 100}))));
+    }
+    TF_EXPECT_OK(writer.Add("strings", test::AsTensor<string>({"a", "bc"})));
+    TF_EXPECT_OK(writer.AddSlice("sliced", TensorShape({4}),
+                                 TensorSlice::ParseOrDie("2,2"),
+                                 Constant<int64>(7, TensorShape({2}))));
+    TF_ASSERT_OK(writer.Finish());
+  };
+  Write("sharded");
+
+  for (bool use_mmap : {false, true}) {
+    BundleReader::Options options;
+    options.use_mmap = use_mmap;
+    BundleReader reader(env, Prefix("sharded"), options);
+    TF_ASSERT_OK(reader.status());
+    EXPECT_EQ(3, reader.num_shards());
+    std::set<int32> shards;
+    for (int i = 0; i < 10; ++i) {
+      const string key = strings::StrCat("float", i);
+      Expect<float>(&reader, key,
+                    Constant<float>(i, TensorShape({i + 1, 100})));
+      int32 shard_id;
+      TF_ASSERT_OK(reader.LookupShardId(key, &shard_id));
+      shards.insert(shard_id);
+    }
+    EXPECT_EQ(3, shards.size());
+    Expect<string>(&reader, "strings", test::AsTensor<string>({"a", "bc"}));
+    Tensor sliced(DT_INT64, TensorShape({2}));
+    TF_ASSERT_OK(
+        reader.LookupSlice("sliced", TensorSlice::ParseOrDie("2,2"), &sliced));
+    test::ExpectTensorEqual<int64>(sliced,
+                                   Constant<int64>(7, TensorShape({2})));
+  }
+
+  // The same tensors give the same bundle.
+  Write("sharded_again");
+  for (int i = 0; i < 3; ++i) {
+    string data, data_again;
+    TF_ASSERT_OK(
+        ReadFileToString(env, DataFilename(Prefix("sharded"), i, 3), &data));
+    TF_ASSERT_OK(ReadFileToString(
+        env, DataFilename(Prefix("sharded_again"), i, 3), &data_again));
+    EXPECT_EQ(data, data_again);
+  }
+  string index, index_again;
+  TF_ASSERT_OK(ReadFileToString(env, MetaFilename(Prefix("sharded")), &index));
+  TF_ASSERT_OK(ReadFileToString(env, MetaFilename(Prefix("sharded_again")),
+                                &index_again));
+  EXPECT_EQ(index, index_again);
+}
+
+TEST(TensorBundleTest, ShardedWriterErrors) {
+  Env* env = Env::Default();
+  for (int num_data_shards : {1, 2}) {
+    BundleWriter::Options options;
+    options.num_data_shards = num_data_shards;
+    const string dup_prefix =
+        Prefix(strings::StrCat("dup_", num_data_shards, "_shards"));
+    {
+      BundleWriter writer(env, dup_prefix, options);
+      TF_EXPECT_OK(writer.Add("foo", Constant_2x3<float>(1.0)));
+      EXPECT_TRUE(errors::IsInvalidArgument(
+          writer.Add("foo", Constant_2x3<float>(1.0))));
+      EXPECT_TRUE(errors::IsInvalidArgument(writer.Finish()));
+    }
+    // Neither the data files nor the metadata file are left behind.
+    std::vector<string> files;
+    TF_ASSERT_OK(env->GetMatchingPaths(strings::StrCat(dup_prefix, "*"),
+                                       &files));
+    EXPECT_TRUE(files.empty()) << str_util::Join(files, ", ");
+
+    const string abandoned_prefix =
+        Prefix(strings::StrCat("abandoned_", num_data_shards, "_shards"));
+    {
+      // Abandoned without Finish().
+      BundleWriter writer(env, abandoned_prefix, options);
+      TF_EXPECT_OK(writer.Add("foo", Constant_2x3<float>(1.0)));
+    }
+    files.clear();
+    TF_ASSERT_OK(env->GetMatchingPaths(strings::StrCat(abandoned_prefix, "*"),
+                                       &files));
+    EXPECT_TRUE(files.empty()) << str_util::Join(files, ", ");
+  }
+}
+
+TEST(TensorBundleTest, MergeShardedBundles) {
+  Env* env = Env::Default();
+  {
+    BundleWriter::Options options;
+    options.num_data_shards = 2;
+    BundleWriter writer(env, Prefix("merge_sharded0"), options);
+    TF_EXPECT_OK(writer.Add("a", Constant_2x3<float>(1.0)));
+    TF_EXPECT_OK(writer.Add("b", Constant_2x3<float>(2.0)));
+    TF_ASSERT_OK(writer.Finish());
+  }
+  {
+    BundleWriter writer(env, Prefix("merge_sharded1"));
+    TF_EXPECT_OK(writer.Add("c", Constant_2x3<float>(3.0)));
+    TF_ASSERT_OK(writer.Finish());
+  }
+  TF_ASSERT_OK(MergeBundles(
+      env, {Prefix("merge_sharded0"), Prefix("merge_sharded1")},
+      Prefix("merge_sharded")));
+
+  BundleReader reader(env, Prefix("merge_sharded"));
+  TF_ASSERT_OK(reader.status());
+  EXPECT_EQ(3, reader.num_shards());
+  Expect<float>(&reader, "a", Constant_2x3<float>(1.0));
+  Expect<float>(&reader, "b", Constant_2x3<float>(2.0));
+  Expect<float>(&reader, "c", Constant_2x3<float>(3.0));
+}
+
+TEST(TensorBundleTest, FileOutputBufferFlushPool) {
+  Env* env = Env::Default();
+  thread::ThreadPool pool(env, "flush", 1);
+  const string filename = Prefix("flushed");
+  std::unique_ptr<WritableFile> file;
+  TF_ASSERT_OK(env->NewWritableFile(filename, &file));
+  FileOutputBuffer out(file.release(), 16, &pool);
+
+  string expected;
+  for (int i = 0; i < 50; ++i) {
+    const string data(i % 40, 'a' + i % 26);
+    TF_ASSERT_OK(out.Append(data));
+    expected += data;
+  }
+  EXPECT_EQ(crc32c::Value(expected.data(), expected.size()), out.crc32c());
+  TF_ASSERT_OK(out.Close());
+
+  string written;
+  TF_ASSERT_OK(ReadFileToString(env, filename, &written));
+  EXPECT_EQ(expected, written);
+}
+
 TEST(TensorBundleTest, HeaderEntry) {
   {
     BundleWriter writer(Env::Default(), Prefix("b"));